@@ -28,6 +28,7 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #endif
+#include <zlib.h>
 #include "config.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
@@ -44,6 +45,7 @@
 #include "exec/address-spaces.h"
 #include "hw/audio/pcspk.h"
 #include "migration/page_cache.h"
+#include "migration/postcopy-ram.h"
 #include "qemu/config-file.h"
 #include "qemu/error-report.h"
 #include "qmp-commands.h"
@@ -52,6 +54,8 @@
 #include "exec/ram_addr.h"
 #include "hw/acpi/acpi.h"
 #include "qemu/host-utils.h"
+#include "qemu/iov.h"
+#include "qemu/sockets.h"
 
 #ifdef DEBUG_ARCH_INIT
 #define DPRINTF(fmt, ...) \
@@ -124,6 +128,8 @@ static uint64_t bitmap_sync_count;
 #define RAM_SAVE_FLAG_CONTINUE 0x20
 #define RAM_SAVE_FLAG_XBZRLE   0x40
 /* 0x80 is reserved in migration.h start with 0x100 next */
+#define RAM_SAVE_FLAG_COMPRESS_PAGE 0x100
+#define RAM_SAVE_FLAG_MULTIFD_SYNC  0x200
 
 static struct defconfig_file {
     const char *filename;
@@ -160,6 +166,82 @@ static inline bool is_zero_range(uint8_t *p, uint64_t size)
     return buffer_find_nonzero_offset(p, size) == size;
 }
 
+/*
+ * A page of anonymous RAM that the guest never touched is zero, and can
+ * be sent as such without reading it, which would fault it in.  Those
+ * are the pages that /proc/self/pagemap shows neither present nor
+ * swapped out; the entries are read a batch at a time.  A page written
+ * after its entry was read must be caught by the dirty log.
+ */
+#define PAGEMAP_PRESENT (1ULL << 63)
+#define PAGEMAP_SWAPPED (1ULL << 62)
+#define PAGEMAP_BATCH   512
+
+static struct {
+    int fd;
+    uintptr_t start;        /* host address of entries[0] */
+    uintptr_t end;
+    uint64_t entries[PAGEMAP_BATCH];
+} pagemap = { .fd = -1 };
+
+/*
+ * Returns whether the pagemap was opened here, and must be closed.  The
+ * entries already read are dropped either way.  Called with the ramlist
+ * lock held, like ram_page_untouched().
+ */
+static bool ram_pagemap_open(void)
+{
+    pagemap.start = pagemap.end = 0;
+#ifdef __linux__
+    if (pagemap.fd < 0) {
+        pagemap.fd = qemu_open("/proc/self/pagemap", O_RDONLY);
+        return pagemap.fd >= 0;
+    }
+#endif
+    return false;
+}
+
+static void ram_pagemap_close(void)
+{
+    if (pagemap.fd >= 0) {
+        close(pagemap.fd);
+        pagemap.fd = -1;
+    }
+}
+
+static bool ram_page_untouched(RAMBlock *block, uint8_t *p)
+{
+#ifdef __linux__
+    uintptr_t page_size = getpagesize();
+    uintptr_t addr = (uintptr_t)p & ~(page_size - 1);
+    uintptr_t end = (uintptr_t)p + TARGET_PAGE_SIZE;
+    ssize_t len;
+
+    if (pagemap.fd < 0 || !(block->flags & RAM_ANON_MASK)) {
+        return false;
+    }
+    for (; addr < end; addr += page_size) {
+        if (addr < pagemap.start || addr >= pagemap.end) {
+            len = pread(pagemap.fd, pagemap.entries, sizeof(pagemap.entries),
+                        addr / page_size * sizeof(uint64_t));
+            if (len < (ssize_t)sizeof(uint64_t)) {
+                ram_pagemap_close();
+                return false;
+            }
+            pagemap.start = addr;
+            pagemap.end = addr + len / sizeof(uint64_t) * page_size;
+        }
+        if (pagemap.entries[(addr - pagemap.start) / page_size] &
+            (PAGEMAP_PRESENT | PAGEMAP_SWAPPED)) {
+            return false;
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 /* struct contains XBZRLE cache and a static page
    used by the compression */
 static struct {
@@ -167,64 +249,35 @@ static struct {
     uint8_t *encoded_buf;
     /* buffer for storing page content */
     uint8_t *current_buf;
-    /* Cache for XBZRLE, Protected by lock. */
+    /* Cache for XBZRLE, only used by the migration thread */
     PageCache *cache;
-    QemuMutex lock;
 } XBZRLE;
 
 /* buffer used for XBZRLE decoding */
 static uint8_t *xbzrle_decoded_buf;
 
-static void XBZRLE_cache_lock(void)
-{
-    if (migrate_use_xbzrle())
-        qemu_mutex_lock(&XBZRLE.lock);
-}
-
-static void XBZRLE_cache_unlock(void)
-{
-    if (migrate_use_xbzrle())
-        qemu_mutex_unlock(&XBZRLE.lock);
-}
-
 /*
  * called from qmp_migrate_set_cache_size in main thread, possibly while
  * a migration is in progress.
- * A running migration maybe using the cache and might finish during this
- * call, hence changes to the cache are protected by XBZRLE.lock().
+ * The cache belongs to the migration thread, which uses it without a
+ * lock and picks the new size up before its next round of pages.
  */
 int64_t xbzrle_cache_resize(int64_t new_size)
 {
-    PageCache *new_cache;
-    int64_t ret;
-
     if (new_size < TARGET_PAGE_SIZE) {
         return -1;
     }
 
-    XBZRLE_cache_lock();
+    return pow2floor(new_size);
+}
 
-    if (XBZRLE.cache != NULL) {
-        if (pow2floor(new_size) == migrate_xbzrle_cache_size()) {
-            goto out_new_size;
-        }
-        new_cache = cache_init(new_size / TARGET_PAGE_SIZE,
-                                        TARGET_PAGE_SIZE);
-        if (!new_cache) {
-            error_report("Error creating cache");
-            ret = -1;
-            goto out;
-        }
+static void xbzrle_cache_update_size(void)
+{
+    int64_t num_pages = migrate_xbzrle_cache_size() / TARGET_PAGE_SIZE;
 
-        cache_fini(XBZRLE.cache);
-        XBZRLE.cache = new_cache;
+    if (XBZRLE.cache && cache_resize(XBZRLE.cache, num_pages) < 0) {
+        error_report("Error resizing cache");
     }
-
-out_new_size:
-    ret = pow2floor(new_size);
-out:
-    XBZRLE_cache_unlock();
-    return ret;
 }
 
 /* accounting for migration statistics */
@@ -238,6 +291,10 @@ typedef struct AccountingInfo {
     uint64_t xbzrle_cache_miss;
     double xbzrle_cache_miss_rate;
     uint64_t xbzrle_overflows;
+    uint64_t compress_pages;
+    uint64_t compress_bytes;
+    uint64_t compress_busy;
+    uint64_t postcopy_requests;
 } AccountingInfo;
 
 static AccountingInfo acct_info;
@@ -302,9 +359,54 @@ uint64_t xbzrle_mig_pages_overflow(void)
     return acct_info.xbzrle_overflows;
 }
 
+/* This is the last block that we have visited serching for dirty pages
+ */
+static RAMBlock *last_seen_block;
+/* This is the last block from where we have sent data */
+static RAMBlock *last_sent_block;
+static ram_addr_t last_offset;
+static unsigned long *migration_bitmap;
+static uint64_t migration_dirty_pages;
+static uint32_t last_version;
+static bool ram_bulk_stage;
+
+static RAMBlock *ram_find_block(const char *idstr)
+{
+    RAMBlock *block;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (!strcmp(idstr, block->idstr)) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+/* Post-copy, source side: once the guest runs on the destination, the
+ * pages it faults on are requested on the return path and sent ahead of
+ * the others.  The pages are sent as they are, since the destination
+ * places each of them at once.
+ */
+typedef struct RAMPageRequest {
+    char idstr[256];
+    ram_addr_t offset;
+    QSIMPLEQ_ENTRY(RAMPageRequest) next;
+} RAMPageRequest;
+
+static bool ram_postcopy_active;
+static QemuMutex page_request_lock;
+static QSIMPLEQ_HEAD(, RAMPageRequest) page_requests =
+    QSIMPLEQ_HEAD_INITIALIZER(page_requests);
+
+/* The block id is only sent when it differs from that of the previous
+ * page header in the stream.  Compressed pages are written out of order
+ * with respect to the pages found dirty, so this is tracked here rather
+ * than by the callers.
+ */
 static size_t save_block_hdr(QEMUFile *f, RAMBlock *block, ram_addr_t offset,
-                             int cont, int flag)
+                             int flag)
 {
+    int cont = (block == last_sent_block) ? RAM_SAVE_FLAG_CONTINUE : 0;
     size_t size;
 
     qemu_put_be64(f, offset | cont | flag);
@@ -315,21 +417,11 @@ static size_t save_block_hdr(QEMUFile *f, RAMBlock *block, ram_addr_t offset,
         qemu_put_buffer(f, (uint8_t *)block->idstr,
                         strlen(block->idstr));
         size += 1 + strlen(block->idstr);
+        last_sent_block = block;
     }
     return size;
 }
 
-/* This is the last block that we have visited serching for dirty pages
- */
-static RAMBlock *last_seen_block;
-/* This is the last block from where we have sent data */
-static RAMBlock *last_sent_block;
-static ram_addr_t last_offset;
-static unsigned long *migration_bitmap;
-static uint64_t migration_dirty_pages;
-static uint32_t last_version;
-static bool ram_bulk_stage;
-
 /* Update the xbzrle cache to reflect a page that's been sent as all 0.
  * The important thing is that a stale (not-yet-0'd) page be replaced
  * by the new data.
@@ -351,7 +443,7 @@ static void xbzrle_cache_zero_page(ram_addr_t current_addr)
 
 static int save_xbzrle_page(QEMUFile *f, uint8_t **current_data,
                             ram_addr_t current_addr, RAMBlock *block,
-                            ram_addr_t offset, int cont, bool last_stage)
+                            ram_addr_t offset, bool last_stage)
 {
     int encoded_len = 0, bytes_sent = -1;
     uint8_t *prev_cached_page;
@@ -399,7 +491,7 @@ static int save_xbzrle_page(QEMUFile *f, uint8_t **current_data,
     }
 
     /* Send XBZRLE based compressed page */
-    bytes_sent = save_block_hdr(f, block, offset, cont, RAM_SAVE_FLAG_XBZRLE);
+    bytes_sent = save_block_hdr(f, block, offset, RAM_SAVE_FLAG_XBZRLE);
     qemu_put_byte(f, ENCODING_FLAG_XBZRLE);
     qemu_put_be16(f, encoded_len);
     qemu_put_buffer(f, XBZRLE.encoded_buf, encoded_len);
@@ -434,60 +526,244 @@ ram_addr_t migration_bitmap_find_and_reset_dirty(MemoryRegion *mr,
     return (next - base) << TARGET_PAGE_BITS;
 }
 
-static inline bool migration_bitmap_set_dirty(ram_addr_t addr)
+/*
+ * Synchronization of the dirty bitmap
+ *
+ * The dirty log of guest RAM is merged into migration_bitmap a word at a
+ * time, the words covered by each RAMBlock being cut into chunks.  On big
+ * guests, the migration thread and a few helper threads take the chunks
+ * in turn.  The global lock is only needed to fetch the log from KVM.
+ */
+#define SYNC_CHUNK_WORDS 8192   /* 512K pages, 2 GB with 4K pages */
+#define MAX_SYNC_THREADS 8
+
+typedef struct SyncChunk {
+    unsigned long first;    /* index of the first word */
+    unsigned long nr;
+} SyncChunk;
+
+static struct {
+    QemuThread threads[MAX_SYNC_THREADS];
+    int nr_threads;
+    QemuMutex lock;
+    QemuCond cond;
+    QemuCond done_cond;
+    /* protected by lock */
+    unsigned int round;
+    int busy;
+    bool quit;
+    /* for the current round */
+    SyncChunk *chunks;
+    int nr_chunks;
+    int next_chunk;
+    uint64_t new_dirty;
+} sync_pool;
+
+/* Returns the number of pages that were not dirty in migration_bitmap */
+static uint64_t migration_bitmap_sync_words(unsigned long first,
+                                            unsigned long nr)
 {
-    bool ret;
-    int nr = addr >> TARGET_PAGE_BITS;
+    unsigned long *src = ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION];
+    uint64_t new_dirty = 0;
+    unsigned long k;
 
-    ret = test_and_set_bit(nr, migration_bitmap);
+    for (k = first; k < first + nr; k++) {
+        if (atomic_read(&src[k])) {
+            unsigned long bits = atomic_xchg(&src[k], 0);
 
-    if (!ret) {
-        migration_dirty_pages++;
+            new_dirty += ctpopl(bits & ~migration_bitmap[k]);
+            migration_bitmap[k] |= bits;
+        }
     }
-    return ret;
+    return new_dirty;
 }
 
-static void migration_bitmap_sync_range(ram_addr_t start, ram_addr_t length)
+static void migration_bitmap_sync_chunks(void)
 {
-    ram_addr_t addr;
-    unsigned long page = BIT_WORD(start >> TARGET_PAGE_BITS);
-
-    /* start address is aligned at the start of a word? */
-    if (((page * BITS_PER_LONG) << TARGET_PAGE_BITS) == start) {
-        int k;
-        int nr = BITS_TO_LONGS(length >> TARGET_PAGE_BITS);
-        unsigned long *src = ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION];
-
-        for (k = page; k < page + nr; k++) {
-            if (src[k]) {
-                unsigned long new_dirty;
-                new_dirty = ~migration_bitmap[k];
-                migration_bitmap[k] |= src[k];
-                new_dirty &= src[k];
-                migration_dirty_pages += ctpopl(new_dirty);
-                src[k] = 0;
-            }
+    uint64_t new_dirty = 0;
+    int i;
+
+    while ((i = atomic_fetch_inc(&sync_pool.next_chunk)) <
+           sync_pool.nr_chunks) {
+        new_dirty += migration_bitmap_sync_words(sync_pool.chunks[i].first,
+                                                 sync_pool.chunks[i].nr);
+    }
+    atomic_add(&sync_pool.new_dirty, new_dirty);
+}
+
+static void *migration_bitmap_sync_thread(void *opaque)
+{
+    unsigned int round = 0;
+
+    qemu_mutex_lock(&sync_pool.lock);
+    for (;;) {
+        while (!sync_pool.quit && sync_pool.round == round) {
+            qemu_cond_wait(&sync_pool.cond, &sync_pool.lock);
         }
-    } else {
-        for (addr = 0; addr < length; addr += TARGET_PAGE_SIZE) {
-            if (cpu_physical_memory_get_dirty(start + addr,
-                                              TARGET_PAGE_SIZE,
-                                              DIRTY_MEMORY_MIGRATION)) {
-                cpu_physical_memory_reset_dirty(start + addr,
-                                                TARGET_PAGE_SIZE,
-                                                DIRTY_MEMORY_MIGRATION);
-                migration_bitmap_set_dirty(start + addr);
-            }
+        if (sync_pool.quit) {
+            break;
+        }
+        round = sync_pool.round;
+        qemu_mutex_unlock(&sync_pool.lock);
+
+        migration_bitmap_sync_chunks();
+
+        qemu_mutex_lock(&sync_pool.lock);
+        if (--sync_pool.busy == 0) {
+            qemu_cond_signal(&sync_pool.done_cond);
         }
     }
+    qemu_mutex_unlock(&sync_pool.lock);
+
+    return NULL;
 }
 
+/* Helpers only pay off when there are several chunks to share */
+static void migration_bitmap_sync_threads_start(void)
+{
+    int64_t chunks = BITS_TO_LONGS(ram_bytes_total() >> TARGET_PAGE_BITS) /
+                     SYNC_CHUNK_WORDS;
+    long cpus = 1;
+    int i;
+
+#ifndef _WIN32
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    sync_pool.nr_threads = MIN(MIN(cpus - 1, MAX_SYNC_THREADS), chunks - 1);
+    if (sync_pool.nr_threads <= 0) {
+        sync_pool.nr_threads = 0;
+        return;
+    }
 
-/* Needs iothread lock! */
+    sync_pool.round = 0;
+    sync_pool.quit = false;
+    for (i = 0; i < sync_pool.nr_threads; i++) {
+        qemu_thread_create(&sync_pool.threads[i], "mig/sync",
+                           migration_bitmap_sync_thread, NULL,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
 
-static void migration_bitmap_sync(void)
+static void migration_bitmap_sync_threads_stop(void)
+{
+    int i;
+
+    if (!sync_pool.nr_threads) {
+        return;
+    }
+
+    qemu_mutex_lock(&sync_pool.lock);
+    sync_pool.quit = true;
+    qemu_cond_broadcast(&sync_pool.cond);
+    qemu_mutex_unlock(&sync_pool.lock);
+
+    for (i = 0; i < sync_pool.nr_threads; i++) {
+        qemu_thread_join(&sync_pool.threads[i]);
+    }
+    sync_pool.nr_threads = 0;
+}
+
+static int sync_chunk_cmp(const void *a, const void *b)
+{
+    const SyncChunk *ca = a, *cb = b;
+
+    return ca->first < cb->first ? -1 : ca->first > cb->first;
+}
+
+/*
+ * Cut the words covered by the RAMBlocks into chunks.  Two blocks may
+ * share a word when they are not aligned on BITS_PER_LONG pages, so their
+ * ranges are merged first: no word may go to two threads.
+ */
+static void migration_bitmap_sync_prepare(void)
 {
     RAMBlock *block;
+    SyncChunk *ranges;
+    int nr_ranges = 0, i;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        nr_ranges++;
+    }
+    ranges = g_new(SyncChunk, nr_ranges);
+    i = 0;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        unsigned long first = block->mr->ram_addr >> TARGET_PAGE_BITS;
+        unsigned long last = first + (block->length >> TARGET_PAGE_BITS) - 1;
+
+        ranges[i].first = BIT_WORD(first);
+        ranges[i].nr = BIT_WORD(last) + 1 - ranges[i].first;
+        i++;
+    }
+    qsort(ranges, nr_ranges, sizeof(*ranges), sync_chunk_cmp);
+
+    g_free(sync_pool.chunks);
+    sync_pool.chunks = NULL;
+    sync_pool.nr_chunks = 0;
+    for (i = 0; i < nr_ranges; ) {
+        unsigned long first = ranges[i].first;
+        unsigned long end = first + ranges[i].nr;
+
+        for (i++; i < nr_ranges && ranges[i].first < end; i++) {
+            end = MAX(end, ranges[i].first + ranges[i].nr);
+        }
+        while (first < end) {
+            unsigned long nr = MIN(end - first, SYNC_CHUNK_WORDS);
+
+            sync_pool.chunks = g_renew(SyncChunk, sync_pool.chunks,
+                                       sync_pool.nr_chunks + 1);
+            sync_pool.chunks[sync_pool.nr_chunks].first = first;
+            sync_pool.chunks[sync_pool.nr_chunks].nr = nr;
+            sync_pool.nr_chunks++;
+            first += nr;
+        }
+    }
+    g_free(ranges);
+}
+
+/* Called with the ramlist lock held, and not the global lock */
+static void migration_bitmap_sync_merge(void)
+{
+    sync_pool.next_chunk = 0;
+    sync_pool.new_dirty = 0;
+    migration_bitmap_sync_prepare();
+
+    if (sync_pool.nr_threads) {
+        qemu_mutex_lock(&sync_pool.lock);
+        sync_pool.busy = sync_pool.nr_threads;
+        sync_pool.round++;
+        qemu_cond_broadcast(&sync_pool.cond);
+        qemu_mutex_unlock(&sync_pool.lock);
+    }
+
+    migration_bitmap_sync_chunks();
+
+    if (sync_pool.nr_threads) {
+        qemu_mutex_lock(&sync_pool.lock);
+        while (sync_pool.busy) {
+            qemu_cond_wait(&sync_pool.done_cond, &sync_pool.lock);
+        }
+        qemu_mutex_unlock(&sync_pool.lock);
+    }
+    migration_dirty_pages += sync_pool.new_dirty;
+}
+
+/* Called with the global lock held */
+static int64_t migration_bitmap_sync_log(void)
+{
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    trace_migration_bitmap_sync_start();
+    address_space_sync_dirty_bitmap(&address_space_memory);
+    return start;
+}
+
+/*
+ * Called with the ramlist lock held, once the log has been fetched at
+ * @sync_start.  Merges the log into migration_bitmap and updates the
+ * statistics.
+ */
+static void migration_bitmap_sync_end(int64_t sync_start)
+{
     uint64_t num_dirty_pages_init = migration_dirty_pages;
     MigrationState *s = migrate_get_current();
     static int64_t start_time;
@@ -497,6 +773,7 @@ static void migration_bitmap_sync(void)
     int64_t bytes_xfer_now;
     static uint64_t xbzrle_cache_miss_prev;
     static uint64_t iterations_prev;
+    int64_t merge_start;
 
     bitmap_sync_count++;
 
@@ -508,14 +785,17 @@ static void migration_bitmap_sync(void)
         start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
     }
 
-    trace_migration_bitmap_sync_start();
-    address_space_sync_dirty_bitmap(&address_space_memory);
+    merge_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    migration_bitmap_sync_merge();
+    s->dirty_sync_locked_time = (merge_start - sync_start) / 1000;
+    s->dirty_sync_time = (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                          sync_start) / 1000;
+    s->dirty_sync_time_max = MAX(s->dirty_sync_time_max, s->dirty_sync_time);
 
-    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
-        migration_bitmap_sync_range(block->mr->ram_addr, block->length);
-    }
     trace_migration_bitmap_sync_end(migration_dirty_pages
-                                    - num_dirty_pages_init);
+                                    - num_dirty_pages_init,
+                                    s->dirty_sync_time,
+                                    s->dirty_sync_locked_time);
     num_dirty_pages_period += migration_dirty_pages - num_dirty_pages_init;
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
@@ -559,100 +839,646 @@ static void migration_bitmap_sync(void)
     }
 }
 
-/*
- * ram_save_page: Send the given page to the stream
+/* Called with the global lock and the ramlist lock held */
+static void migration_bitmap_sync(void)
+{
+    migration_bitmap_sync_end(migration_bitmap_sync_log());
+}
+
+/* Multi-threaded compression of RAM pages
  *
- * Returns: Number of bytes written.
+ * With the compress capability, pages that would be sent as they are
+ * get handed to a pool of threads that deflate them with zlib.  The
+ * migration thread writes a result to the stream when it needs the thread
+ * again, and all of them at the end of each round, so the compressed
+ * pages of a round come after the pages that were sent directly but before
+ * its EOS.  A page is found dirty at most once per round, so the order in
+ * which the pages of a round are written does not matter.
  */
-static int ram_save_page(QEMUFile *f, RAMBlock* block, ram_addr_t offset,
-                         bool last_stage)
+
+typedef struct CompressParam {
+    QemuThread thread;
+    QemuCond cond;
+    /* protected by comp_lock */
+    bool busy;
+    bool quit;
+    /* owned by the thread while busy, by the migration thread otherwise */
+    bool pending;
+    RAMBlock *block;
+    ram_addr_t offset;
+    uint8_t *buf;
+    unsigned long len;      /* 0 if buf holds the page uncompressed */
+    uint64_t pages;
+    uint64_t bytes;
+    int64_t busy_time;      /* ns */
+} CompressParam;
+
+static QemuMutex comp_lock;
+static QemuCond comp_done_cond;
+static CompressParam *comp_param;
+static int comp_thread_count;
+static bool comp_param_running;
+static int comp_level;
+
+static void *do_compress_thread(void *opaque)
 {
-    int bytes_sent;
-    int cont;
-    ram_addr_t current_addr;
-    MemoryRegion *mr = block->mr;
+    CompressParam *param = opaque;
+    uLongf len;
     uint8_t *p;
-    int ret;
-    bool send_async = true;
+    int64_t t0;
 
-    cont = (block == last_sent_block) ? RAM_SAVE_FLAG_CONTINUE : 0;
+    qemu_mutex_lock(&comp_lock);
+    while (!param->quit) {
+        if (!param->busy) {
+            qemu_cond_wait(&param->cond, &comp_lock);
+            continue;
+        }
+        qemu_mutex_unlock(&comp_lock);
 
-    p = memory_region_get_ram_ptr(mr) + offset;
+        t0 = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        p = memory_region_get_ram_ptr(param->block->mr) + param->offset;
+        len = compressBound(TARGET_PAGE_SIZE);
+        if (compress2(param->buf, &len, p, TARGET_PAGE_SIZE,
+                      comp_level) != Z_OK || len >= TARGET_PAGE_SIZE) {
+            /* Not worth it, send the page as it is */
+            memcpy(param->buf, p, TARGET_PAGE_SIZE);
+            len = 0;
+        }
 
-    /* In doubt sent page as normal */
-    bytes_sent = -1;
-    ret = ram_control_save_page(f, block->offset,
-                           offset, TARGET_PAGE_SIZE, &bytes_sent);
+        qemu_mutex_lock(&comp_lock);
+        param->len = len;
+        param->busy_time += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - t0;
+        param->pending = true;
+        param->busy = false;
+        qemu_cond_signal(&comp_done_cond);
+    }
+    qemu_mutex_unlock(&comp_lock);
+
+    return NULL;
+}
 
-    XBZRLE_cache_lock();
+static void compress_threads_start(void)
+{
+    int i;
 
-    current_addr = block->offset + offset;
-    if (ret != RAM_SAVE_CONTROL_NOT_SUPP) {
-        if (ret != RAM_SAVE_CONTROL_DELAYED) {
-            if (bytes_sent > 0) {
-                acct_info.norm_pages++;
-            } else if (bytes_sent == 0) {
-                acct_info.dup_pages++;
-            }
-        }
-    } else if (is_zero_range(p, TARGET_PAGE_SIZE)) {
-        acct_info.dup_pages++;
-        bytes_sent = save_block_hdr(f, block, offset, cont,
-                                    RAM_SAVE_FLAG_COMPRESS);
-        qemu_put_byte(f, 0);
-        bytes_sent++;
-        /* Must let xbzrle know, otherwise a previous (now 0'd) cached
-         * page would be stale
-         */
-        xbzrle_cache_zero_page(current_addr);
-    } else if (!ram_bulk_stage && migrate_use_xbzrle()) {
-        bytes_sent = save_xbzrle_page(f, &p, current_addr, block,
-                                      offset, cont, last_stage);
-        if (!last_stage) {
-            /* Can't send this cached data async, since the cache page
-             * might get updated before it gets to the wire
-             */
-            send_async = false;
-        }
+    /* The statistics of the previous migration are dropped only now */
+    g_free(comp_param);
+    acct_info.compress_pages = 0;
+    acct_info.compress_bytes = 0;
+    acct_info.compress_busy = 0;
+    comp_thread_count = migrate_compress_threads();
+    comp_level = migrate_compress_level();
+    comp_param = g_new0(CompressParam, comp_thread_count);
+    for (i = 0; i < comp_thread_count; i++) {
+        comp_param[i].buf = g_malloc(compressBound(TARGET_PAGE_SIZE));
+        qemu_cond_init(&comp_param[i].cond);
+        qemu_thread_create(&comp_param[i].thread, "compress",
+                           do_compress_thread, &comp_param[i],
+                           QEMU_THREAD_JOINABLE);
     }
+    comp_param_running = true;
+}
 
-    /* XBZRLE overflow or normal page */
-    if (bytes_sent == -1) {
-        bytes_sent = save_block_hdr(f, block, offset, cont, RAM_SAVE_FLAG_PAGE);
-        if (send_async) {
-            qemu_put_buffer_async(f, p, TARGET_PAGE_SIZE);
-        } else {
-            qemu_put_buffer(f, p, TARGET_PAGE_SIZE);
-        }
+static void compress_threads_stop(void)
+{
+    int i;
+
+    if (!comp_param_running) {
+        return;
+    }
+
+    qemu_mutex_lock(&comp_lock);
+    for (i = 0; i < comp_thread_count; i++) {
+        comp_param[i].quit = true;
+        qemu_cond_signal(&comp_param[i].cond);
+    }
+    qemu_mutex_unlock(&comp_lock);
+
+    for (i = 0; i < comp_thread_count; i++) {
+        qemu_thread_join(&comp_param[i].thread);
+        qemu_cond_destroy(&comp_param[i].cond);
+        g_free(comp_param[i].buf);
+        comp_param[i].buf = NULL;
+        comp_param[i].pending = false;
+    }
+    comp_param_running = false;
+}
+
+/* Write the result of an idle thread to the stream */
+static int flush_compressed_page(QEMUFile *f, CompressParam *param)
+{
+    int bytes_sent;
+
+    if (param->len) {
+        bytes_sent = save_block_hdr(f, param->block, param->offset,
+                                    RAM_SAVE_FLAG_COMPRESS_PAGE);
+        qemu_put_be32(f, param->len);
+        qemu_put_buffer(f, param->buf, param->len);
+        bytes_sent += 4 + param->len;
+        param->pages++;
+        param->bytes += param->len;
+        acct_info.compress_pages++;
+        acct_info.compress_bytes += param->len;
+    } else {
+        bytes_sent = save_block_hdr(f, param->block, param->offset,
+                                    RAM_SAVE_FLAG_PAGE);
+        qemu_put_buffer(f, param->buf, TARGET_PAGE_SIZE);
         bytes_sent += TARGET_PAGE_SIZE;
         acct_info.norm_pages++;
     }
-
-    XBZRLE_cache_unlock();
+    param->pending = false;
 
     return bytes_sent;
 }
 
 /*
- * ram_find_and_save_block: Finds a page to send and sends it to f
+ * compress_page_with_multi_thread: Queue a page for compression
  *
- * Returns:  The number of bytes written.
- *           0 means no dirty pages
+ * Returns: Number of bytes written for a page queued earlier, if the thread
+ *          that takes this one had a result.
  */
-
-static int ram_find_and_save_block(QEMUFile *f, bool last_stage)
+static int compress_page_with_multi_thread(QEMUFile *f, RAMBlock *block,
+                                           ram_addr_t offset)
 {
-    RAMBlock *block = last_seen_block;
-    ram_addr_t offset = last_offset;
-    bool complete_round = false;
+    CompressParam *param = NULL;
     int bytes_sent = 0;
-    MemoryRegion *mr;
-
-    if (!block)
-        block = QTAILQ_FIRST(&ram_list.blocks);
+    int i;
 
-    while (true) {
-        mr = block->mr;
+    qemu_mutex_lock(&comp_lock);
+    while (!param) {
+        for (i = 0; i < comp_thread_count; i++) {
+            if (!comp_param[i].busy) {
+                param = &comp_param[i];
+                break;
+            }
+        }
+        if (!param) {
+            acct_info.compress_busy++;
+            qemu_cond_wait(&comp_done_cond, &comp_lock);
+        }
+    }
+    qemu_mutex_unlock(&comp_lock);
+
+    if (param->pending) {
+        bytes_sent = flush_compressed_page(f, param);
+    }
+
+    qemu_mutex_lock(&comp_lock);
+    param->block = block;
+    param->offset = offset;
+    param->busy = true;
+    qemu_cond_signal(&param->cond);
+    qemu_mutex_unlock(&comp_lock);
+
+    return bytes_sent;
+}
+
+/*
+ * flush_compressed_data: Wait for all the queued pages and send them
+ *
+ * Must be called with the ramlist lock held, before the end of the round.
+ *
+ * Returns: Number of bytes written.
+ */
+static int flush_compressed_data(QEMUFile *f)
+{
+    int bytes_sent = 0;
+    int i;
+
+    if (!comp_param_running) {
+        return 0;
+    }
+
+    qemu_mutex_lock(&comp_lock);
+    for (i = 0; i < comp_thread_count; i++) {
+        while (comp_param[i].busy) {
+            qemu_cond_wait(&comp_done_cond, &comp_lock);
+        }
+    }
+    qemu_mutex_unlock(&comp_lock);
+
+    for (i = 0; i < comp_thread_count; i++) {
+        if (comp_param[i].pending) {
+            bytes_sent += flush_compressed_page(f, &comp_param[i]);
+        }
+    }
+
+    return bytes_sent;
+}
+
+CompressionStats *compress_mig_stats(void)
+{
+    CompressionStats *stats = g_malloc0(sizeof(*stats));
+    CompressThreadStatsList **tail = &stats->threads;
+    int i;
+
+    stats->pages = acct_info.compress_pages;
+    stats->compressed_size = acct_info.compress_bytes;
+    stats->busy = acct_info.compress_busy;
+    if (acct_info.compress_bytes) {
+        stats->compression_rate = (double)acct_info.compress_pages *
+            TARGET_PAGE_SIZE / acct_info.compress_bytes;
+    }
+
+    for (i = 0; comp_param && i < comp_thread_count; i++) {
+        CompressThreadStatsList *entry = g_malloc0(sizeof(*entry));
+
+        entry->value = g_malloc0(sizeof(*entry->value));
+        entry->value->pages = comp_param[i].pages;
+        entry->value->compressed_size = comp_param[i].bytes;
+        entry->value->busy_time = comp_param[i].busy_time / 1000000;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return stats;
+}
+
+/* Multiple channels for RAM pages
+ *
+ * With the multifd capability, the TCP transport opens extra connections
+ * next to the main one (see migration-tcp.c).  The pages that would be
+ * sent as they are go over them instead, from one thread per channel, in
+ * packets of up to MULTIFD_PACKET_PAGES pages of a single block that are
+ * written straight from guest memory.  Everything else stays on the main
+ * channel.
+ *
+ * At the end of each round, every channel gets a sync packet and the main
+ * channel a RAM_SAVE_FLAG_MULTIFD_SYNC record.  The destination holds each
+ * side at its sync point until the other has reached it, so that a page
+ * sent again in the next round, on whatever channel, always lands last.
+ */
+
+#define MULTIFD_MAGIC 0x514d4644 /* "QMFD" */
+#define MULTIFD_VERSION 1
+#define MULTIFD_PACKET_PAGES 128
+#define MULTIFD_FLAG_SYNC 0x1
+
+typedef struct QEMU_PACKED MultiFDHello {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t id;
+} MultiFDHello;
+
+typedef struct QEMU_PACKED MultiFDPacket {
+    uint32_t flags;
+    uint32_t num;
+    char idstr[256];
+    uint64_t offset[MULTIFD_PACKET_PAGES];
+} MultiFDPacket;
+
+typedef struct MultiFDSendParam {
+    QemuThread thread;
+    QemuCond cond;
+    int fd;
+    int id;
+    /* protected by multifd_send_lock */
+    bool busy;
+    bool quit;
+    /* owned by the thread while busy, by the migration thread otherwise */
+    RAMBlock *block;
+    MultiFDPacket packet;
+    struct iovec iov[MULTIFD_PACKET_PAGES + 1];
+} MultiFDSendParam;
+
+static QemuMutex multifd_send_lock;
+static QemuCond multifd_send_done_cond;
+static MultiFDSendParam *multifd_send;
+static int multifd_send_count;
+static int multifd_send_next;
+static bool multifd_send_running;
+static bool multifd_send_failed;
+
+/* The packet being filled by the migration thread */
+static struct {
+    RAMBlock *block;
+    int num;
+    ram_addr_t offset[MULTIFD_PACKET_PAGES];
+} multifd_pages;
+
+static void *multifd_send_thread(void *opaque)
+{
+    MultiFDSendParam *p = opaque;
+    MultiFDHello hello;
+    uint8_t *base;
+    size_t size;
+    int i, num;
+    bool failed;
+
+    hello.magic = cpu_to_be32(MULTIFD_MAGIC);
+    hello.version = cpu_to_be32(MULTIFD_VERSION);
+    hello.id = cpu_to_be32(p->id);
+    failed = qemu_send_full(p->fd, &hello, sizeof(hello), 0) != sizeof(hello);
+
+    qemu_mutex_lock(&multifd_send_lock);
+    for (;;) {
+        if (!p->busy) {
+            if (p->quit) {
+                break;
+            }
+            qemu_cond_wait(&p->cond, &multifd_send_lock);
+            continue;
+        }
+        qemu_mutex_unlock(&multifd_send_lock);
+
+        num = p->packet.num;
+        base = num ? memory_region_get_ram_ptr(p->block->mr) : NULL;
+        for (i = 0; i < num; i++) {
+            p->iov[i + 1].iov_base = base + p->packet.offset[i];
+            p->iov[i + 1].iov_len = TARGET_PAGE_SIZE;
+            p->packet.offset[i] = cpu_to_be64(p->packet.offset[i]);
+        }
+        p->packet.flags = cpu_to_be32(p->packet.flags);
+        p->packet.num = cpu_to_be32(num);
+        p->iov[0].iov_base = &p->packet;
+        p->iov[0].iov_len = sizeof(p->packet);
+        size = sizeof(p->packet) + (size_t)num * TARGET_PAGE_SIZE;
+        if (!failed) {
+            failed = iov_send(p->fd, p->iov, num + 1, 0, size) != size;
+        }
+
+        qemu_mutex_lock(&multifd_send_lock);
+        if (failed) {
+            multifd_send_failed = true;
+        }
+        p->busy = false;
+        qemu_cond_signal(&multifd_send_done_cond);
+    }
+    qemu_mutex_unlock(&multifd_send_lock);
+
+    return NULL;
+}
+
+static void multifd_send_start(int *fds, int count)
+{
+    int i;
+
+    multifd_send_count = count;
+    multifd_send_next = 0;
+    multifd_send_failed = false;
+    multifd_pages.num = 0;
+    multifd_send = g_new0(MultiFDSendParam, count);
+    for (i = 0; i < count; i++) {
+        MultiFDSendParam *p = &multifd_send[i];
+
+        p->fd = fds[i];
+        p->id = i;
+        qemu_cond_init(&p->cond);
+        qemu_thread_create(&p->thread, "multifd_send", multifd_send_thread,
+                           p, QEMU_THREAD_JOINABLE);
+    }
+    multifd_send_running = true;
+}
+
+static void multifd_send_stop(void)
+{
+    int i;
+
+    if (!multifd_send_running) {
+        return;
+    }
+
+    qemu_mutex_lock(&multifd_send_lock);
+    for (i = 0; i < multifd_send_count; i++) {
+        multifd_send[i].quit = true;
+        qemu_cond_signal(&multifd_send[i].cond);
+    }
+    qemu_mutex_unlock(&multifd_send_lock);
+
+    for (i = 0; i < multifd_send_count; i++) {
+        qemu_thread_join(&multifd_send[i].thread);
+        qemu_cond_destroy(&multifd_send[i].cond);
+    }
+    g_free(multifd_send);
+    multifd_send = NULL;
+    multifd_send_running = false;
+}
+
+/* Hand a packet to @p, which must be idle */
+static void multifd_send_packet(MultiFDSendParam *p, uint32_t flags)
+{
+    int i;
+
+    p->block = multifd_pages.block;
+    p->packet.flags = flags;
+    p->packet.num = multifd_pages.num;
+    for (i = 0; i < multifd_pages.num; i++) {
+        p->packet.offset[i] = multifd_pages.offset[i];
+    }
+    memset(p->packet.idstr, 0, sizeof(p->packet.idstr));
+    if (multifd_pages.num) {
+        pstrcpy(p->packet.idstr, sizeof(p->packet.idstr),
+                multifd_pages.block->idstr);
+    }
+    multifd_pages.num = 0;
+
+    qemu_mutex_lock(&multifd_send_lock);
+    p->busy = true;
+    qemu_cond_signal(&p->cond);
+    qemu_mutex_unlock(&multifd_send_lock);
+}
+
+/* Send the queued pages on the next idle channel */
+static void multifd_send_pages(void)
+{
+    MultiFDSendParam *p = NULL;
+    int i;
+
+    qemu_mutex_lock(&multifd_send_lock);
+    while (!p) {
+        for (i = 0; i < multifd_send_count; i++) {
+            int n = (multifd_send_next + i) % multifd_send_count;
+
+            if (!multifd_send[n].busy) {
+                p = &multifd_send[n];
+                multifd_send_next = n + 1;
+                break;
+            }
+        }
+        if (!p) {
+            qemu_cond_wait(&multifd_send_done_cond, &multifd_send_lock);
+        }
+    }
+    qemu_mutex_unlock(&multifd_send_lock);
+
+    multifd_send_packet(p, 0);
+}
+
+/*
+ * multifd_queue_page: Queue a page for the extra channels
+ *
+ * Returns: Number of bytes accounted for the page.
+ */
+static int multifd_queue_page(QEMUFile *f, RAMBlock *block,
+                              ram_addr_t offset)
+{
+    if (multifd_pages.num && multifd_pages.block != block) {
+        multifd_send_pages();
+    }
+    multifd_pages.block = block;
+    multifd_pages.offset[multifd_pages.num++] = offset;
+    if (multifd_pages.num == MULTIFD_PACKET_PAGES) {
+        multifd_send_pages();
+    }
+
+    /* For the rate limit and the bandwidth estimate of the main channel */
+    qemu_file_update_transfer(f, TARGET_PAGE_SIZE);
+    acct_info.norm_pages++;
+
+    return TARGET_PAGE_SIZE;
+}
+
+/*
+ * multifd_send_sync: End the round on all channels
+ *
+ * Sends the queued pages and a sync packet on every channel, waits for
+ * them to be written, and writes the matching record to the main channel.
+ * Must be called with the ramlist lock held, before the EOS of the round.
+ *
+ * Returns: Number of bytes written to @f.
+ */
+static int multifd_send_sync(QEMUFile *f)
+{
+    int i;
+
+    if (!multifd_send_running) {
+        return 0;
+    }
+
+    if (multifd_pages.num) {
+        multifd_send_pages();
+    }
+
+    for (i = 0; i < multifd_send_count; i++) {
+        qemu_mutex_lock(&multifd_send_lock);
+        while (multifd_send[i].busy) {
+            qemu_cond_wait(&multifd_send_done_cond, &multifd_send_lock);
+        }
+        qemu_mutex_unlock(&multifd_send_lock);
+        multifd_send_packet(&multifd_send[i], MULTIFD_FLAG_SYNC);
+    }
+
+    /* The threads look at the blocks, which may go once the lock is gone */
+    qemu_mutex_lock(&multifd_send_lock);
+    for (i = 0; i < multifd_send_count; i++) {
+        while (multifd_send[i].busy) {
+            qemu_cond_wait(&multifd_send_done_cond, &multifd_send_lock);
+        }
+    }
+    if (multifd_send_failed) {
+        qemu_file_set_error(f, -EIO);
+    }
+    qemu_mutex_unlock(&multifd_send_lock);
+
+    qemu_put_be64(f, RAM_SAVE_FLAG_MULTIFD_SYNC);
+    return 8;
+}
+
+/*
+ * ram_save_page: Send the given page to the stream
+ *
+ * Returns: Number of bytes written.  With compression, this can be 0 for a
+ *          page that has been queued, and includes pages queued earlier.
+ */
+static int ram_save_page(QEMUFile *f, RAMBlock* block, ram_addr_t offset,
+                         bool last_stage)
+{
+    int bytes_sent;
+    ram_addr_t current_addr;
+    MemoryRegion *mr = block->mr;
+    uint8_t *p;
+    int ret;
+    bool send_async = true;
+
+    p = memory_region_get_ram_ptr(mr) + offset;
+
+    /* In doubt sent page as normal */
+    bytes_sent = -1;
+    ret = ram_control_save_page(f, block->offset,
+                           offset, TARGET_PAGE_SIZE, &bytes_sent);
+
+    current_addr = block->offset + offset;
+    if (ret != RAM_SAVE_CONTROL_NOT_SUPP) {
+        if (ret != RAM_SAVE_CONTROL_DELAYED) {
+            if (bytes_sent > 0) {
+                acct_info.norm_pages++;
+            } else if (bytes_sent == 0) {
+                acct_info.dup_pages++;
+            }
+        }
+    } else if (ram_bulk_stage && ram_page_untouched(block, p)) {
+        acct_info.skipped_pages++;
+        bytes_sent = save_block_hdr(f, block, offset, RAM_SAVE_FLAG_COMPRESS);
+        qemu_put_byte(f, 0);
+        bytes_sent++;
+    } else if (is_zero_range(p, TARGET_PAGE_SIZE)) {
+        acct_info.dup_pages++;
+        bytes_sent = save_block_hdr(f, block, offset, RAM_SAVE_FLAG_COMPRESS);
+        qemu_put_byte(f, 0);
+        bytes_sent++;
+        /* Must let xbzrle know, otherwise a previous (now 0'd) cached
+         * page would be stale
+         */
+        xbzrle_cache_zero_page(current_addr);
+    } else if (!ram_bulk_stage && !ram_postcopy_active &&
+               migrate_use_xbzrle()) {
+        bytes_sent = save_xbzrle_page(f, &p, current_addr, block,
+                                      offset, last_stage);
+        if (!last_stage) {
+            /* Can't send this cached data async, since the cache page
+             * might get updated before it gets to the wire
+             */
+            send_async = false;
+        }
+    }
+
+    /* XBZRLE overflow or normal page.  In post-copy, the destination
+     * places each page as it reads it, so it must come whole and in this
+     * stream.
+     */
+    if (bytes_sent == -1 && send_async && comp_param_running &&
+        !ram_postcopy_active) {
+        /* The page is read again by the compression thread, so this
+         * is only done for pages that could have been sent async.
+         */
+        bytes_sent = compress_page_with_multi_thread(f, block, offset);
+    } else if (bytes_sent == -1 && send_async && multifd_send_running &&
+               !ram_postcopy_active) {
+        bytes_sent = multifd_queue_page(f, block, offset);
+    } else if (bytes_sent == -1) {
+        bytes_sent = save_block_hdr(f, block, offset, RAM_SAVE_FLAG_PAGE);
+        if (send_async) {
+            qemu_put_buffer_async(f, p, TARGET_PAGE_SIZE);
+        } else {
+            qemu_put_buffer(f, p, TARGET_PAGE_SIZE);
+        }
+        bytes_sent += TARGET_PAGE_SIZE;
+        acct_info.norm_pages++;
+    }
+
+    return bytes_sent;
+}
+
+/*
+ * ram_find_and_save_block: Finds a page to send and sends it to f
+ *
+ * Returns:  The number of bytes written.
+ *           0 means no dirty pages
+ */
+
+static int ram_find_and_save_block(QEMUFile *f, bool last_stage)
+{
+    RAMBlock *block = last_seen_block;
+    ram_addr_t offset = last_offset;
+    bool complete_round = false;
+    int bytes_sent = 0;
+    MemoryRegion *mr;
+
+    if (!block)
+        block = QTAILQ_FIRST(&ram_list.blocks);
+
+    while (true) {
+        mr = block->mr;
         offset = migration_bitmap_find_and_reset_dirty(mr, offset);
         if (complete_round && block == last_seen_block &&
             offset >= last_offset) {
@@ -669,9 +1495,8 @@ static int ram_find_and_save_block(QEMUFile *f, bool last_stage)
         } else {
             bytes_sent = ram_save_page(f, block, offset, last_stage);
 
-            /* if page is unmodified, continue to the next */
+            /* if page is unmodified or queued, continue to the next */
             if (bytes_sent > 0) {
-                last_sent_block = block;
                 break;
             }
         }
@@ -679,362 +1504,1215 @@ static int ram_find_and_save_block(QEMUFile *f, bool last_stage)
     last_seen_block = block;
     last_offset = offset;
 
-    return bytes_sent;
-}
+    return bytes_sent;
+}
+
+static uint64_t bytes_transferred;
+
+void ram_save_queue_page(const char *idstr, ram_addr_t offset)
+{
+    RAMPageRequest *req = g_new0(RAMPageRequest, 1);
+
+    trace_ram_save_queue_page(idstr, offset);
+    pstrcpy(req->idstr, sizeof(req->idstr), idstr);
+    req->offset = offset & TARGET_PAGE_MASK;
+
+    qemu_mutex_lock(&page_request_lock);
+    QSIMPLEQ_INSERT_TAIL(&page_requests, req, next);
+    acct_info.postcopy_requests++;
+    qemu_mutex_unlock(&page_request_lock);
+}
+
+uint64_t ram_postcopy_requests(void)
+{
+    return acct_info.postcopy_requests;
+}
+
+/*
+ * ram_save_queued_pages: Send the pages requested by the destination
+ *
+ * Called with the ramlist lock held.
+ *
+ * Returns: Number of bytes written.
+ */
+static int ram_save_queued_pages(QEMUFile *f)
+{
+    RAMPageRequest *req;
+    int total_sent = 0;
+
+    for (;;) {
+        RAMBlock *block;
+        unsigned long nr;
+
+        qemu_mutex_lock(&page_request_lock);
+        req = QSIMPLEQ_FIRST(&page_requests);
+        if (req) {
+            QSIMPLEQ_REMOVE_HEAD(&page_requests, next);
+        }
+        qemu_mutex_unlock(&page_request_lock);
+        if (!req) {
+            break;
+        }
+
+        block = ram_find_block(req->idstr);
+        if (!block || req->offset >= block->length) {
+            error_report("Page request for bad page %s:" RAM_ADDR_FMT,
+                         req->idstr, req->offset);
+            g_free(req);
+            qemu_file_set_error(f, -EINVAL);
+            break;
+        }
+
+        /* Sent even if clean: it may still be on its way */
+        nr = (block->mr->ram_addr + req->offset) >> TARGET_PAGE_BITS;
+        if (test_and_clear_bit(nr, migration_bitmap)) {
+            migration_dirty_pages--;
+        }
+        total_sent += ram_save_page(f, block, req->offset, true);
+        g_free(req);
+    }
+    if (total_sent) {
+        qemu_fflush(f);
+    }
+    return total_sent;
+}
+
+/*
+ * ram_postcopy_send_discard: Tell the destination which pages to drop
+ *
+ * Called with the guest stopped, when switching to post-copy.  The pages
+ * dirty at this point are stale on the destination, which discards them
+ * so that the guest faults on them.
+ *
+ * Returns: 0 on success, negative on error.
+ */
+#define MAX_DISCARD_RANGES 256
+
+int ram_postcopy_send_discard(QEMUFile *f)
+{
+    uint64_t start[MAX_DISCARD_RANGES], length[MAX_DISCARD_RANGES];
+    RAMBlock *block;
+    uint64_t pages = 0;
+
+    qemu_mutex_lock_ramlist();
+    migration_bitmap_sync();
+    ram_postcopy_active = true;
+    ram_bulk_stage = false;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        unsigned long base = block->mr->ram_addr >> TARGET_PAGE_BITS;
+        unsigned long end = base + (block->length >> TARGET_PAGE_BITS);
+        unsigned long first, last = base;
+        int n = 0;
+
+        while ((first = find_next_bit(migration_bitmap, end, last)) < end) {
+            last = find_next_zero_bit(migration_bitmap, end, first);
+            start[n] = (uint64_t)(first - base) << TARGET_PAGE_BITS;
+            length[n] = (uint64_t)(last - first) << TARGET_PAGE_BITS;
+            pages += last - first;
+            if (++n == MAX_DISCARD_RANGES) {
+                qemu_savevm_send_postcopy_ram_discard(f, block->idstr, n,
+                                                      start, length);
+                n = 0;
+            }
+        }
+        if (n) {
+            qemu_savevm_send_postcopy_ram_discard(f, block->idstr, n,
+                                                  start, length);
+        }
+    }
+    qemu_mutex_unlock_ramlist();
+
+    trace_ram_postcopy_send_discard(pages);
+    return qemu_file_get_error(f);
+}
+
+void acct_update_position(QEMUFile *f, size_t size, bool zero)
+{
+    uint64_t pages = size / TARGET_PAGE_SIZE;
+    if (zero) {
+        acct_info.dup_pages += pages;
+    } else {
+        acct_info.norm_pages += pages;
+        bytes_transferred += size;
+        qemu_update_position(f, size);
+    }
+}
+
+static ram_addr_t ram_save_remaining(void)
+{
+    return migration_dirty_pages;
+}
+
+uint64_t ram_bytes_remaining(void)
+{
+    return ram_save_remaining() * TARGET_PAGE_SIZE;
+}
+
+uint64_t ram_bytes_transferred(void)
+{
+    return bytes_transferred;
+}
+
+uint64_t ram_bytes_total(void)
+{
+    RAMBlock *block;
+    uint64_t total = 0;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next)
+        total += block->length;
+
+    return total;
+}
+
+void free_xbzrle_decoded_buf(void)
+{
+    g_free(xbzrle_decoded_buf);
+    xbzrle_decoded_buf = NULL;
+}
+
+static void migration_end(void)
+{
+    RAMPageRequest *req;
+
+    compress_threads_stop();
+    multifd_send_stop();
+    migration_bitmap_sync_threads_stop();
+    g_free(sync_pool.chunks);
+    sync_pool.chunks = NULL;
+    ram_pagemap_close();
+
+    ram_postcopy_active = false;
+    qemu_mutex_lock(&page_request_lock);
+    while ((req = QSIMPLEQ_FIRST(&page_requests))) {
+        QSIMPLEQ_REMOVE_HEAD(&page_requests, next);
+        g_free(req);
+    }
+    qemu_mutex_unlock(&page_request_lock);
+
+    if (migration_bitmap) {
+        memory_global_dirty_log_stop();
+        g_free(migration_bitmap);
+        migration_bitmap = NULL;
+    }
+
+    if (XBZRLE.cache) {
+        cache_fini(XBZRLE.cache);
+        g_free(XBZRLE.cache);
+        g_free(XBZRLE.encoded_buf);
+        g_free(XBZRLE.current_buf);
+        XBZRLE.cache = NULL;
+        XBZRLE.encoded_buf = NULL;
+        XBZRLE.current_buf = NULL;
+    }
+}
+
+static void ram_migration_cancel(void *opaque)
+{
+    migration_end();
+}
+
+static void reset_ram_globals(void)
+{
+    last_seen_block = NULL;
+    last_sent_block = NULL;
+    last_offset = 0;
+    last_version = ram_list.version;
+    ram_bulk_stage = true;
+}
+
+#define MAX_WAIT 50 /* ms, half buffered_file limit */
+
+static int ram_save_setup(QEMUFile *f, void *opaque)
+{
+    MigrationState *s;
+    RAMBlock *block;
+    int64_t ram_bitmap_pages; /* Size of bitmap in pages, including gaps */
+
+    mig_throttle_on = false;
+    dirty_rate_high_cnt = 0;
+    bitmap_sync_count = 0;
+
+    if (migrate_use_xbzrle()) {
+        XBZRLE.cache = cache_init(migrate_xbzrle_cache_size() /
+                                  TARGET_PAGE_SIZE,
+                                  TARGET_PAGE_SIZE);
+        if (!XBZRLE.cache) {
+            error_report("Error creating cache");
+            return -1;
+        }
+
+        /* We prefer not to abort if there is no memory */
+        XBZRLE.encoded_buf = g_try_malloc0(TARGET_PAGE_SIZE);
+        if (!XBZRLE.encoded_buf) {
+            error_report("Error allocating encoded_buf");
+            return -1;
+        }
+
+        XBZRLE.current_buf = g_try_malloc(TARGET_PAGE_SIZE);
+        if (!XBZRLE.current_buf) {
+            error_report("Error allocating current_buf");
+            g_free(XBZRLE.encoded_buf);
+            XBZRLE.encoded_buf = NULL;
+            return -1;
+        }
+
+        acct_clear();
+    }
+
+    qemu_mutex_lock_iothread();
+    qemu_mutex_lock_ramlist();
+    bytes_transferred = 0;
+    acct_info.postcopy_requests = 0;
+    reset_ram_globals();
+
+    /* Under the iothread lock, query-migrate looks at the thread stats */
+    if (migrate_use_compression()) {
+        compress_threads_start();
+    }
+    /* Only for a migration whose transport opened extra channels */
+    s = migrate_get_current();
+    if (s->file == f && s->multifd_fd_count) {
+        multifd_send_start(s->multifd_fds, s->multifd_fd_count);
+    }
+
+    migration_bitmap_sync_threads_start();
+
+    ram_bitmap_pages = last_ram_offset() >> TARGET_PAGE_BITS;
+    migration_bitmap = bitmap_new(ram_bitmap_pages);
+    bitmap_set(migration_bitmap, 0, ram_bitmap_pages);
+
+    /*
+     * Count the total number of pages used by ram blocks not including any
+     * gaps due to alignment or unplugs.
+     */
+    migration_dirty_pages = 0;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        uint64_t block_pages;
+
+        block_pages = block->length >> TARGET_PAGE_BITS;
+        migration_dirty_pages += block_pages;
+    }
+
+    memory_global_dirty_log_start();
+    migration_bitmap_sync();
+    qemu_mutex_unlock_iothread();
+
+    /* Only read once the dirty log catches the guest's writes */
+    ram_pagemap_open();
+
+    qemu_put_be64(f, ram_bytes_total() | RAM_SAVE_FLAG_MEM_SIZE);
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        qemu_put_byte(f, strlen(block->idstr));
+        qemu_put_buffer(f, (uint8_t *)block->idstr, strlen(block->idstr));
+        qemu_put_be64(f, block->length);
+    }
+
+    qemu_mutex_unlock_ramlist();
+
+    ram_control_before_iterate(f, RAM_CONTROL_SETUP);
+    ram_control_after_iterate(f, RAM_CONTROL_SETUP);
+
+    qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
+
+    return 0;
+}
+
+static int ram_save_iterate(QEMUFile *f, void *opaque)
+{
+    int ret;
+    int i;
+    int64_t t0;
+    int total_sent = 0;
+
+    qemu_mutex_lock_ramlist();
+
+    if (ram_list.version != last_version) {
+        reset_ram_globals();
+    }
+    xbzrle_cache_update_size();
+
+    ram_control_before_iterate(f, RAM_CONTROL_ROUND);
+
+    t0 = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    i = 0;
+    while ((ret = qemu_file_rate_limit(f)) == 0) {
+        int bytes_sent;
+
+        if (ram_postcopy_active) {
+            total_sent += ram_save_queued_pages(f);
+        }
+        bytes_sent = ram_find_and_save_block(f, false);
+        /* no more blocks to sent */
+        if (bytes_sent == 0) {
+            break;
+        }
+        total_sent += bytes_sent;
+        acct_info.iterations++;
+        check_guest_throttling();
+        /* we want to check in the 1st loop, just in case it was the 1st time
+           and we had to sync the dirty bitmap.
+           qemu_get_clock_ns() is a bit expensive, so we only check each some
+           iterations
+        */
+        if ((i & 63) == 0) {
+            uint64_t t1 = (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - t0) / 1000000;
+            if (t1 > MAX_WAIT) {
+                DPRINTF("big wait: %" PRIu64 " milliseconds, %d iterations\n",
+                        t1, i);
+                break;
+            }
+        }
+        i++;
+    }
+
+    /* Nothing was queued since the switch to post-copy */
+    if (!ram_postcopy_active) {
+        total_sent += flush_compressed_data(f);
+        total_sent += multifd_send_sync(f);
+    }
+
+    qemu_mutex_unlock_ramlist();
+
+    /*
+     * Must occur before EOS (or any QEMUFile operation)
+     * because of RDMA protocol.
+     */
+    ram_control_after_iterate(f, RAM_CONTROL_ROUND);
+
+    bytes_transferred += total_sent;
+
+    /*
+     * Do not count these 8 bytes into total_sent, so that we can
+     * return 0 if no page had been dirtied.
+     */
+    qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
+    bytes_transferred += 8;
+
+    ret = qemu_file_get_error(f);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return total_sent;
+}
+
+static int ram_save_complete(QEMUFile *f, void *opaque)
+{
+    qemu_mutex_lock_ramlist();
+    migration_bitmap_sync();
+
+    ram_control_before_iterate(f, RAM_CONTROL_FINISH);
+
+    /* try transferring iterative blocks of memory */
+
+    /* flush all remaining blocks regardless of rate limiting */
+    while (true) {
+        int bytes_sent;
+
+        bytes_sent = ram_find_and_save_block(f, true);
+        /* no more blocks to sent */
+        if (bytes_sent == 0) {
+            break;
+        }
+        bytes_transferred += bytes_sent;
+    }
+
+    if (!ram_postcopy_active) {
+        bytes_transferred += flush_compressed_data(f);
+        bytes_transferred += multifd_send_sync(f);
+    }
+
+    ram_control_after_iterate(f, RAM_CONTROL_FINISH);
+    migration_end();
+
+    qemu_mutex_unlock_ramlist();
+    qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
 
-static uint64_t bytes_transferred;
+    return 0;
+}
 
-void acct_update_position(QEMUFile *f, size_t size, bool zero)
+static uint64_t ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size)
 {
-    uint64_t pages = size / TARGET_PAGE_SIZE;
-    if (zero) {
-        acct_info.dup_pages += pages;
-    } else {
-        acct_info.norm_pages += pages;
-        bytes_transferred += size;
-        qemu_update_position(f, size);
+    uint64_t remaining_size;
+
+    remaining_size = ram_save_remaining() * TARGET_PAGE_SIZE;
+
+    if (remaining_size < max_size) {
+        int64_t sync_start;
+
+        /* The vCPUs only wait for the log to be fetched */
+        qemu_mutex_lock_iothread();
+        sync_start = migration_bitmap_sync_log();
+        qemu_mutex_unlock_iothread();
+
+        qemu_mutex_lock_ramlist();
+        migration_bitmap_sync_end(sync_start);
+        qemu_mutex_unlock_ramlist();
+        remaining_size = ram_save_remaining() * TARGET_PAGE_SIZE;
     }
+    return remaining_size;
 }
 
-static ram_addr_t ram_save_remaining(void)
+static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
 {
-    return migration_dirty_pages;
+    unsigned int xh_len;
+    int xh_flags;
+
+    if (!xbzrle_decoded_buf) {
+        xbzrle_decoded_buf = g_malloc(TARGET_PAGE_SIZE);
+    }
+
+    /* extract RLE header */
+    xh_flags = qemu_get_byte(f);
+    xh_len = qemu_get_be16(f);
+
+    if (xh_flags != ENCODING_FLAG_XBZRLE) {
+        error_report("Failed to load XBZRLE page - wrong compression!");
+        return -1;
+    }
+
+    if (xh_len > TARGET_PAGE_SIZE) {
+        error_report("Failed to load XBZRLE page - len overflow!");
+        return -1;
+    }
+    /* load data and decode */
+    qemu_get_buffer(f, xbzrle_decoded_buf, xh_len);
+
+    /* decode RLE */
+    if (xbzrle_decode_buffer(xbzrle_decoded_buf, xh_len, host,
+                             TARGET_PAGE_SIZE) == -1) {
+        error_report("Failed to load XBZRLE page - decode error!");
+        return -1;
+    }
+
+    return 0;
 }
 
-uint64_t ram_bytes_remaining(void)
+static inline void *host_from_stream_offset(QEMUFile *f,
+                                            ram_addr_t offset,
+                                            int flags)
 {
-    return ram_save_remaining() * TARGET_PAGE_SIZE;
+    static RAMBlock *block = NULL;
+    char id[256];
+    uint8_t len;
+
+    if (flags & RAM_SAVE_FLAG_CONTINUE) {
+        if (!block) {
+            error_report("Ack, bad migration stream!");
+            return NULL;
+        }
+
+        return memory_region_get_ram_ptr(block->mr) + offset;
+    }
+
+    len = qemu_get_byte(f);
+    qemu_get_buffer(f, (uint8_t *)id, len);
+    id[len] = 0;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (!strncmp(id, block->idstr, sizeof(id)))
+            return memory_region_get_ram_ptr(block->mr) + offset;
+    }
+
+    error_report("Can't find block %s!", id);
+    return NULL;
 }
 
-uint64_t ram_bytes_transferred(void)
+/*
+ * If a page (or a whole RDMA chunk) has been
+ * determined to be zero, then zap it.
+ */
+void ram_handle_compressed(void *host, uint8_t ch, uint64_t size)
 {
-    return bytes_transferred;
+    if (ch != 0 || !is_zero_range(host, size)) {
+        memset(host, ch, size);
+    }
 }
 
-uint64_t ram_bytes_total(void)
+/* Destination side of the compressed pages: ram_load() hands the data to
+ * a pool of threads that inflate it in place, and waits for them before
+ * returning.  Since a page comes at most once per round, and a round is
+ * loaded by one call, no two threads ever write the same page.
+ */
+
+typedef struct DecompressParam {
+    QemuThread thread;
+    QemuCond cond;
+    /* protected by decomp_lock */
+    bool busy;
+    bool quit;
+    /* owned by the thread while busy, by ram_load otherwise */
+    void *host;
+    uint8_t *buf;
+    unsigned long len;
+} DecompressParam;
+
+static QemuMutex decomp_lock;
+static QemuCond decomp_done_cond;
+static DecompressParam *decomp_param;
+static int decomp_thread_count;
+static bool decomp_failed;
+
+static void *do_decompress_thread(void *opaque)
 {
-    RAMBlock *block;
-    uint64_t total = 0;
+    DecompressParam *param = opaque;
+    uLongf len;
+    int ret;
 
-    QTAILQ_FOREACH(block, &ram_list.blocks, next)
-        total += block->length;
+    qemu_mutex_lock(&decomp_lock);
+    while (!param->quit) {
+        if (!param->busy) {
+            qemu_cond_wait(&param->cond, &decomp_lock);
+            continue;
+        }
+        qemu_mutex_unlock(&decomp_lock);
 
-    return total;
+        len = TARGET_PAGE_SIZE;
+        ret = uncompress(param->host, &len, param->buf, param->len);
+
+        qemu_mutex_lock(&decomp_lock);
+        if (ret != Z_OK || len != TARGET_PAGE_SIZE) {
+            decomp_failed = true;
+        }
+        param->busy = false;
+        qemu_cond_signal(&decomp_done_cond);
+    }
+    qemu_mutex_unlock(&decomp_lock);
+
+    return NULL;
 }
 
-void free_xbzrle_decoded_buf(void)
+static void decompress_threads_start(void)
 {
-    g_free(xbzrle_decoded_buf);
-    xbzrle_decoded_buf = NULL;
+    int i;
+
+    decomp_thread_count = migrate_decompress_threads();
+    decomp_param = g_new0(DecompressParam, decomp_thread_count);
+    for (i = 0; i < decomp_thread_count; i++) {
+        decomp_param[i].buf = g_malloc(compressBound(TARGET_PAGE_SIZE));
+        qemu_cond_init(&decomp_param[i].cond);
+        qemu_thread_create(&decomp_param[i].thread, "decompress",
+                           do_decompress_thread, &decomp_param[i],
+                           QEMU_THREAD_JOINABLE);
+    }
 }
 
-static void migration_end(void)
+/* The threads are started by the first compressed page, and are left
+ * idle until the incoming migration is over.
+ */
+void migrate_decompress_threads_join(void)
 {
-    if (migration_bitmap) {
-        memory_global_dirty_log_stop();
-        g_free(migration_bitmap);
-        migration_bitmap = NULL;
+    int i;
+
+    if (!decomp_param) {
+        return;
     }
 
-    XBZRLE_cache_lock();
-    if (XBZRLE.cache) {
-        cache_fini(XBZRLE.cache);
-        g_free(XBZRLE.cache);
-        g_free(XBZRLE.encoded_buf);
-        g_free(XBZRLE.current_buf);
-        XBZRLE.cache = NULL;
-        XBZRLE.encoded_buf = NULL;
-        XBZRLE.current_buf = NULL;
+    qemu_mutex_lock(&decomp_lock);
+    for (i = 0; i < decomp_thread_count; i++) {
+        decomp_param[i].quit = true;
+        qemu_cond_signal(&decomp_param[i].cond);
+    }
+    qemu_mutex_unlock(&decomp_lock);
+
+    for (i = 0; i < decomp_thread_count; i++) {
+        qemu_thread_join(&decomp_param[i].thread);
+        qemu_cond_destroy(&decomp_param[i].cond);
+        g_free(decomp_param[i].buf);
     }
-    XBZRLE_cache_unlock();
+    g_free(decomp_param);
+    decomp_param = NULL;
 }
 
-static void ram_migration_cancel(void *opaque)
+static void decompress_data_with_multi_threads(QEMUFile *f, void *host,
+                                               int len)
 {
-    migration_end();
+    DecompressParam *param = NULL;
+    int i;
+
+    if (!decomp_param) {
+        decompress_threads_start();
+    }
+
+    qemu_mutex_lock(&decomp_lock);
+    while (!param) {
+        for (i = 0; i < decomp_thread_count; i++) {
+            if (!decomp_param[i].busy) {
+                param = &decomp_param[i];
+                break;
+            }
+        }
+        if (!param) {
+            qemu_cond_wait(&decomp_done_cond, &decomp_lock);
+        }
+    }
+    qemu_mutex_unlock(&decomp_lock);
+
+    qemu_get_buffer(f, param->buf, len);
+    param->host = host;
+    param->len = len;
+
+    qemu_mutex_lock(&decomp_lock);
+    param->busy = true;
+    qemu_cond_signal(&param->cond);
+    qemu_mutex_unlock(&decomp_lock);
 }
 
-static void reset_ram_globals(void)
+/* Returns: -1 if a page failed to decompress since the last call */
+static int wait_for_decompress_done(void)
 {
-    last_seen_block = NULL;
-    last_sent_block = NULL;
-    last_offset = 0;
-    last_version = ram_list.version;
-    ram_bulk_stage = true;
+    int ret = 0;
+    int i;
+
+    if (!decomp_param) {
+        return 0;
+    }
+
+    qemu_mutex_lock(&decomp_lock);
+    for (i = 0; i < decomp_thread_count; i++) {
+        while (decomp_param[i].busy) {
+            qemu_cond_wait(&decomp_done_cond, &decomp_lock);
+        }
+    }
+    if (decomp_failed) {
+        decomp_failed = false;
+        ret = -1;
+    }
+    qemu_mutex_unlock(&decomp_lock);
+
+    return ret;
 }
 
-#define MAX_WAIT 50 /* ms, half buffered_file limit */
+/* Destination side of the extra channels: each thread writes the pages it
+ * receives straight into guest memory, and waits at each sync packet for
+ * ram_load() to reach the matching record of the main channel.
+ */
 
-static int ram_save_setup(QEMUFile *f, void *opaque)
+typedef struct MultiFDRecvParam {
+    QemuThread thread;
+    int fd;
+    /* protected by multifd_recv_lock */
+    int synced;             /* sync packets reached, INT_MAX on failure */
+    MultiFDPacket packet;
+    struct iovec iov[MULTIFD_PACKET_PAGES];
+} MultiFDRecvParam;
+
+static QemuMutex multifd_recv_lock;
+static QemuCond multifd_recv_cond;
+static MultiFDRecvParam *multifd_recv;
+static int multifd_recv_count;
+static int multifd_recv_synced; /* sync records reached by ram_load() */
+static bool multifd_recv_quit;
+static bool multifd_recv_failed;
+
+static int multifd_recv_packet(MultiFDRecvParam *p)
 {
+    MultiFDPacket *packet = &p->packet;
     RAMBlock *block;
-    int64_t ram_bitmap_pages; /* Size of bitmap in pages, including gaps */
+    uint8_t *base;
+    size_t size;
+    int i, num;
 
-    mig_throttle_on = false;
-    dirty_rate_high_cnt = 0;
-    bitmap_sync_count = 0;
+    if (qemu_recv_full(p->fd, packet, sizeof(*packet), 0) !=
+        sizeof(*packet)) {
+        return -1;
+    }
+    packet->flags = be32_to_cpu(packet->flags);
+    num = be32_to_cpu(packet->num);
+    if (num < 0 || num > MULTIFD_PACKET_PAGES) {
+        return -1;
+    }
+    if (!num) {
+        return 0;
+    }
 
-    if (migrate_use_xbzrle()) {
-        XBZRLE_cache_lock();
-        XBZRLE.cache = cache_init(migrate_xbzrle_cache_size() /
-                                  TARGET_PAGE_SIZE,
-                                  TARGET_PAGE_SIZE);
-        if (!XBZRLE.cache) {
-            XBZRLE_cache_unlock();
-            error_report("Error creating cache");
-            return -1;
-        }
-        XBZRLE_cache_unlock();
+    packet->idstr[sizeof(packet->idstr) - 1] = 0;
+    block = ram_find_block(packet->idstr);
+    if (!block) {
+        return -1;
+    }
+    base = memory_region_get_ram_ptr(block->mr);
+    for (i = 0; i < num; i++) {
+        uint64_t offset = be64_to_cpu(packet->offset[i]);
 
-        /* We prefer not to abort if there is no memory */
-        XBZRLE.encoded_buf = g_try_malloc0(TARGET_PAGE_SIZE);
-        if (!XBZRLE.encoded_buf) {
-            error_report("Error allocating encoded_buf");
+        if ((offset & ~TARGET_PAGE_MASK) || offset >= block->length) {
             return -1;
         }
+        p->iov[i].iov_base = base + offset;
+        p->iov[i].iov_len = TARGET_PAGE_SIZE;
+    }
+    size = (size_t)num * TARGET_PAGE_SIZE;
+    if (iov_recv(p->fd, p->iov, num, 0, size) != size) {
+        return -1;
+    }
+    return 0;
+}
 
-        XBZRLE.current_buf = g_try_malloc(TARGET_PAGE_SIZE);
-        if (!XBZRLE.current_buf) {
-            error_report("Error allocating current_buf");
-            g_free(XBZRLE.encoded_buf);
-            XBZRLE.encoded_buf = NULL;
-            return -1;
-        }
+static void *multifd_recv_thread(void *opaque)
+{
+    MultiFDRecvParam *p = opaque;
+    MultiFDHello hello;
+
+    if (qemu_recv_full(p->fd, &hello, sizeof(hello), 0) != sizeof(hello) ||
+        be32_to_cpu(hello.magic) != MULTIFD_MAGIC ||
+        be32_to_cpu(hello.version) != MULTIFD_VERSION ||
+        be32_to_cpu(hello.id) >= multifd_recv_count) {
+        goto fail;
+    }
 
-        acct_clear();
+    while (multifd_recv_packet(p) == 0) {
+        if (p->packet.flags & MULTIFD_FLAG_SYNC) {
+            qemu_mutex_lock(&multifd_recv_lock);
+            p->synced++;
+            qemu_cond_broadcast(&multifd_recv_cond);
+            while (multifd_recv_synced < p->synced && !multifd_recv_quit) {
+                qemu_cond_wait(&multifd_recv_cond, &multifd_recv_lock);
+            }
+            qemu_mutex_unlock(&multifd_recv_lock);
+        }
     }
 
-    qemu_mutex_lock_iothread();
-    qemu_mutex_lock_ramlist();
-    bytes_transferred = 0;
-    reset_ram_globals();
+fail:
+    /* Also the way out once the source closes the channel */
+    qemu_mutex_lock(&multifd_recv_lock);
+    multifd_recv_failed = true;
+    p->synced = INT_MAX;
+    qemu_cond_broadcast(&multifd_recv_cond);
+    qemu_mutex_unlock(&multifd_recv_lock);
 
-    ram_bitmap_pages = last_ram_offset() >> TARGET_PAGE_BITS;
-    migration_bitmap = bitmap_new(ram_bitmap_pages);
-    bitmap_set(migration_bitmap, 0, ram_bitmap_pages);
+    return NULL;
+}
 
-    /*
-     * Count the total number of pages used by ram blocks not including any
-     * gaps due to alignment or unplugs.
-     */
-    migration_dirty_pages = 0;
-    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
-        uint64_t block_pages;
+/* Takes over the @count connections accepted for an incoming migration */
+void multifd_load_setup(int *fds, int count)
+{
+    int i;
 
-        block_pages = block->length >> TARGET_PAGE_BITS;
-        migration_dirty_pages += block_pages;
+    multifd_recv_count = count;
+    multifd_recv_synced = 0;
+    multifd_recv_quit = false;
+    multifd_recv_failed = false;
+    multifd_recv = g_new0(MultiFDRecvParam, count);
+    for (i = 0; i < count; i++) {
+        multifd_recv[i].fd = fds[i];
+        qemu_thread_create(&multifd_recv[i].thread, "multifd_recv",
+                           multifd_recv_thread, &multifd_recv[i],
+                           QEMU_THREAD_JOINABLE);
     }
+}
 
-    memory_global_dirty_log_start();
-    migration_bitmap_sync();
-    qemu_mutex_unlock_iothread();
-
-    qemu_put_be64(f, ram_bytes_total() | RAM_SAVE_FLAG_MEM_SIZE);
+void multifd_load_cleanup(void)
+{
+    int i;
 
-    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
-        qemu_put_byte(f, strlen(block->idstr));
-        qemu_put_buffer(f, (uint8_t *)block->idstr, strlen(block->idstr));
-        qemu_put_be64(f, block->length);
+    if (!multifd_recv) {
+        return;
     }
 
-    qemu_mutex_unlock_ramlist();
-
-    ram_control_before_iterate(f, RAM_CONTROL_SETUP);
-    ram_control_after_iterate(f, RAM_CONTROL_SETUP);
-
-    qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
+    qemu_mutex_lock(&multifd_recv_lock);
+    multifd_recv_quit = true;
+    qemu_cond_broadcast(&multifd_recv_cond);
+    qemu_mutex_unlock(&multifd_recv_lock);
 
-    return 0;
+    for (i = 0; i < multifd_recv_count; i++) {
+        shutdown(multifd_recv[i].fd, SHUT_RDWR);
+        qemu_thread_join(&multifd_recv[i].thread);
+        closesocket(multifd_recv[i].fd);
+    }
+    g_free(multifd_recv);
+    multifd_recv = NULL;
+    multifd_recv_count = 0;
 }
 
-static int ram_save_iterate(QEMUFile *f, void *opaque)
+/* Returns: -1 if a channel failed */
+static int multifd_recv_sync_main(void)
 {
-    int ret;
+    int ret = 0;
     int i;
-    int64_t t0;
-    int total_sent = 0;
-
-    qemu_mutex_lock_ramlist();
 
-    if (ram_list.version != last_version) {
-        reset_ram_globals();
+    if (!multifd_recv_count) {
+        error_report("multifd stream, but no multifd channels");
+        return -1;
     }
 
-    ram_control_before_iterate(f, RAM_CONTROL_ROUND);
-
-    t0 = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
-    i = 0;
-    while ((ret = qemu_file_rate_limit(f)) == 0) {
-        int bytes_sent;
-
-        bytes_sent = ram_find_and_save_block(f, false);
-        /* no more blocks to sent */
-        if (bytes_sent == 0) {
-            break;
-        }
-        total_sent += bytes_sent;
-        acct_info.iterations++;
-        check_guest_throttling();
-        /* we want to check in the 1st loop, just in case it was the 1st time
-           and we had to sync the dirty bitmap.
-           qemu_get_clock_ns() is a bit expensive, so we only check each some
-           iterations
-        */
-        if ((i & 63) == 0) {
-            uint64_t t1 = (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - t0) / 1000000;
-            if (t1 > MAX_WAIT) {
-                DPRINTF("big wait: %" PRIu64 " milliseconds, %d iterations\n",
-                        t1, i);
-                break;
-            }
+    qemu_mutex_lock(&multifd_recv_lock);
+    multifd_recv_synced++;
+    qemu_cond_broadcast(&multifd_recv_cond);
+    for (i = 0; i < multifd_recv_count; i++) {
+        while (multifd_recv[i].synced < multifd_recv_synced) {
+            qemu_cond_wait(&multifd_recv_cond, &multifd_recv_lock);
         }
-        i++;
     }
+    if (multifd_recv_failed) {
+        error_report("multifd channel failed");
+        ret = -1;
+    }
+    qemu_mutex_unlock(&multifd_recv_lock);
 
-    qemu_mutex_unlock_ramlist();
+    return ret;
+}
 
-    /*
-     * Must occur before EOS (or any QEMUFile operation)
-     * because of RDMA protocol.
-     */
-    ram_control_after_iterate(f, RAM_CONTROL_ROUND);
+int ram_discard_range(const char *idstr, ram_addr_t start, ram_addr_t length)
+{
+    RAMBlock *block = ram_find_block(idstr);
 
-    bytes_transferred += total_sent;
+    if (!block) {
+        error_report("Can't discard pages of unknown block %s", idstr);
+        return -EINVAL;
+    }
+    if ((start | length) & ~TARGET_PAGE_MASK || start > block->length ||
+        length > block->length - start) {
+        error_report("Bad discard range " RAM_ADDR_FMT "+" RAM_ADDR_FMT
+                     " in block %s", start, length, idstr);
+        return -EINVAL;
+    }
+    return postcopy_ram_discard_range(
+        memory_region_get_ram_ptr(block->mr) + start, length);
+}
 
-    /*
-     * Do not count these 8 bytes into total_sent, so that we can
-     * return 0 if no page had been dirtied.
-     */
-    qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
-    bytes_transferred += 8;
+static int ram_postcopy_foreach_block(int (*func)(const char *idstr,
+                                                  void *host, size_t length))
+{
+    RAMBlock *block;
+    int ret;
 
-    ret = qemu_file_get_error(f);
-    if (ret < 0) {
-        return ret;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        ret = func(block->idstr, memory_region_get_ram_ptr(block->mr),
+                   block->length);
+        if (ret < 0) {
+            return ret;
+        }
     }
-
-    return total_sent;
+    return 0;
 }
 
-static int ram_save_complete(QEMUFile *f, void *opaque)
+int ram_postcopy_incoming_check(void)
 {
-    qemu_mutex_lock_ramlist();
-    migration_bitmap_sync();
-
-    ram_control_before_iterate(f, RAM_CONTROL_FINISH);
+    return ram_postcopy_foreach_block(postcopy_ram_check_block);
+}
 
-    /* try transferring iterative blocks of memory */
+int ram_postcopy_incoming_register(void)
+{
+    return ram_postcopy_foreach_block(postcopy_ram_register_block);
+}
 
-    /* flush all remaining blocks regardless of rate limiting */
-    while (true) {
-        int bytes_sent;
+#ifndef _WIN32
+/*
+ * RAM image for savevm_file/loadvm_file: a header listing the blocks,
+ * then the contents of each block at an offset aligned to the host page
+ * size, so that restoring can map the file instead of reading it.  Zero
+ * pages are left as holes.
+ */
+#define RAM_FILE_MAGIC    0x5152414d    /* "QRAM" */
+#define RAM_FILE_VERSION  1
+
+typedef struct RAMFileBlock {
+    char idstr[256];
+    uint8_t length[8];
+    uint8_t offset[8];
+} RAMFileBlock;
+
+typedef struct RAMFileHeader {
+    uint8_t magic[4];
+    uint8_t version[4];
+    uint8_t align[4];
+    uint8_t nr_blocks[4];
+} RAMFileHeader;
+
+static int ram_file_pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+    ssize_t ret;
 
-        bytes_sent = ram_find_and_save_block(f, true);
-        /* no more blocks to sent */
-        if (bytes_sent == 0) {
-            break;
+    while (len) {
+        ret = pwrite(fd, buf, len, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
         }
-        bytes_transferred += bytes_sent;
+        if (ret <= 0) {
+            return ret < 0 ? -errno : -EIO;
+        }
+        buf = (const uint8_t *)buf + ret;
+        offset += ret;
+        len -= ret;
     }
-
-    ram_control_after_iterate(f, RAM_CONTROL_FINISH);
-    migration_end();
-
-    qemu_mutex_unlock_ramlist();
-    qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
-
     return 0;
 }
 
-static uint64_t ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size)
+static int ram_file_pread(int fd, void *buf, size_t len, off_t offset)
 {
-    uint64_t remaining_size;
-
-    remaining_size = ram_save_remaining() * TARGET_PAGE_SIZE;
+    ssize_t ret;
 
-    if (remaining_size < max_size) {
-        qemu_mutex_lock_iothread();
-        migration_bitmap_sync();
-        qemu_mutex_unlock_iothread();
-        remaining_size = ram_save_remaining() * TARGET_PAGE_SIZE;
+    while (len) {
+        ret = pread(fd, buf, len, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return ret < 0 ? -errno : -EIO;
+        }
+        buf = (uint8_t *)buf + ret;
+        offset += ret;
+        len -= ret;
     }
-    return remaining_size;
+    return 0;
 }
 
-static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
+/* Write the runs of non-zero pages of @block at @offset in the file */
+static int ram_save_file_block(int fd, RAMBlock *block, off_t offset)
 {
-    unsigned int xh_len;
-    int xh_flags;
+    uint8_t *host = memory_region_get_ram_ptr(block->mr);
+    ram_addr_t start, end;
+    int ret;
 
-    if (!xbzrle_decoded_buf) {
-        xbzrle_decoded_buf = g_malloc(TARGET_PAGE_SIZE);
+    for (start = 0; start < block->length; start = end) {
+        while (start < block->length &&
+               (ram_page_untouched(block, host + start) ||
+                is_zero_range(host + start, TARGET_PAGE_SIZE))) {
+            start += TARGET_PAGE_SIZE;
+        }
+        for (end = start; end < block->length &&
+             !is_zero_range(host + end, TARGET_PAGE_SIZE);
+             end += TARGET_PAGE_SIZE) {
+        }
+        if (end > start) {
+            ret = ram_file_pwrite(fd, host + start, end - start,
+                                  offset + start);
+            if (ret < 0) {
+                return ret;
+            }
+        }
     }
+    return 0;
+}
 
-    /* extract RLE header */
-    xh_flags = qemu_get_byte(f);
-    xh_len = qemu_get_be16(f);
+/*
+ * The image is written to a new file that then replaces @filename, as
+ * VMs restored from it may still have the old one mapped.
+ */
+int ram_save_file(const char *filename)
+{
+    size_t align = MAX(getpagesize(), TARGET_PAGE_SIZE);
+    char *tmp_filename = g_strdup_printf("%s.XXXXXX", filename);
+    RAMFileHeader *header;
+    RAMFileBlock *entries;
+    RAMBlock *block;
+    size_t header_size;
+    uint32_t nr_blocks = 0;
+    bool pagemap_opened;
+    off_t offset;
+    int fd, i, ret;
+
+    fd = mkstemp(tmp_filename);
+    if (fd < 0) {
+        ret = -errno;
+        error_report("Could not create '%s': %s", tmp_filename,
+                     strerror(-ret));
+        g_free(tmp_filename);
+        return ret;
+    }
 
-    if (xh_flags != ENCODING_FLAG_XBZRLE) {
-        error_report("Failed to load XBZRLE page - wrong compression!");
-        return -1;
+    qemu_mutex_lock_ramlist();
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        nr_blocks++;
     }
+    header_size = sizeof(*header) + nr_blocks * sizeof(*entries);
+    header = g_malloc0(header_size);
+    entries = (RAMFileBlock *)(header + 1);
+    stl_be_p(header->magic, RAM_FILE_MAGIC);
+    stl_be_p(header->version, RAM_FILE_VERSION);
+    stl_be_p(header->align, align);
+    stl_be_p(header->nr_blocks, nr_blocks);
 
-    if (xh_len > TARGET_PAGE_SIZE) {
-        error_report("Failed to load XBZRLE page - len overflow!");
-        return -1;
+    i = 0;
+    offset = ROUND_UP(header_size, align);
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        pstrcpy(entries[i].idstr, sizeof(entries[i].idstr), block->idstr);
+        stq_be_p(entries[i].length, block->length);
+        stq_be_p(entries[i].offset, offset);
+        offset += ROUND_UP(block->length, align);
+        i++;
     }
-    /* load data and decode */
-    qemu_get_buffer(f, xbzrle_decoded_buf, xh_len);
 
-    /* decode RLE */
-    if (xbzrle_decode_buffer(xbzrle_decoded_buf, xh_len, host,
-                             TARGET_PAGE_SIZE) == -1) {
-        error_report("Failed to load XBZRLE page - decode error!");
-        return -1;
+    /* Size the file first so that the zero pages stay unallocated */
+    if (ftruncate(fd, offset) < 0) {
+        ret = -errno;
+        goto out;
+    }
+    ret = ram_file_pwrite(fd, header, header_size, 0);
+    pagemap_opened = ram_pagemap_open();
+    i = 0;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (ret < 0) {
+            break;
+        }
+        ret = ram_save_file_block(fd, block, ldq_be_p(entries[i++].offset));
+    }
+    if (pagemap_opened) {
+        ram_pagemap_close();
     }
 
-    return 0;
+out:
+    qemu_mutex_unlock_ramlist();
+    g_free(header);
+    if (close(fd) < 0 && ret == 0) {
+        ret = -errno;
+    }
+    if (ret == 0 && rename(tmp_filename, filename) < 0) {
+        ret = -errno;
+    }
+    if (ret < 0) {
+        error_report("Could not write RAM to '%s': %s", filename,
+                     strerror(-ret));
+        unlink(tmp_filename);
+    }
+    g_free(tmp_filename);
+    return ret;
 }
 
-static inline void *host_from_stream_offset(QEMUFile *f,
-                                            ram_addr_t offset,
-                                            int flags)
+/*
+ * Map the RAM image over guest RAM, so that restoring costs one fault
+ * per page the guest touches.  RAM that QEMU did not allocate itself
+ * (-mem-path, Xen) is read instead.
+ */
+int ram_load_file(const char *filename)
 {
-    static RAMBlock *block = NULL;
-    char id[256];
-    uint8_t len;
+    RAMFileHeader header;
+    RAMFileBlock *entries = NULL;
+    RAMBlock *block, **blocks = NULL;
+    uint32_t align, nr_blocks, i, n = 0;
+    struct stat st;
+    int fd, ret;
+
+    fd = qemu_open(filename, O_RDONLY);
+    if (fd < 0) {
+        error_report("Could not open '%s': %s", filename, strerror(errno));
+        return -errno;
+    }
 
-    if (flags & RAM_SAVE_FLAG_CONTINUE) {
-        if (!block) {
-            error_report("Ack, bad migration stream!");
-            return NULL;
-        }
+    ret = fstat(fd, &st) < 0 ? -errno : 0;
+    if (ret == 0) {
+        ret = ram_file_pread(fd, &header, sizeof(header), 0);
+    }
+    if (ret < 0) {
+        error_report("Could not read '%s': %s", filename, strerror(-ret));
+        goto out;
+    }
+    align = ldl_be_p(header.align);
+    nr_blocks = ldl_be_p(header.nr_blocks);
+    if (ldl_be_p(header.magic) != RAM_FILE_MAGIC ||
+        ldl_be_p(header.version) != RAM_FILE_VERSION ||
+        align < TARGET_PAGE_SIZE || (align & (align - 1)) ||
+        nr_blocks > 1024) {
+        error_report("'%s' is not a RAM image", filename);
+        ret = -EINVAL;
+        goto out;
+    }
+    entries = g_new(RAMFileBlock, nr_blocks);
+    ret = ram_file_pread(fd, entries, nr_blocks * sizeof(*entries),
+                         sizeof(header));
+    if (ret < 0) {
+        error_report("Could not read '%s': %s", filename, strerror(-ret));
+        goto out;
+    }
 
-        return memory_region_get_ram_ptr(block->mr) + offset;
+    /* Check the whole image before guest RAM is touched */
+    qemu_mutex_lock_ramlist();
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        n++;
+    }
+    if (n != nr_blocks) {
+        error_report("RAM image '%s' has %" PRIu32 " blocks, expected %"
+                     PRIu32, filename, nr_blocks, n);
+        ret = -EINVAL;
+        goto out_unlock;
+    }
+    blocks = g_new0(RAMBlock *, nr_blocks);
+    for (i = 0; i < nr_blocks; i++) {
+        uint64_t offset = ldq_be_p(entries[i].offset);
+
+        entries[i].idstr[sizeof(entries[i].idstr) - 1] = '\0';
+        block = ram_find_block(entries[i].idstr);
+        if (!block || ldq_be_p(entries[i].length) != block->length ||
+            offset % align || offset > st.st_size ||
+            st.st_size - offset < block->length) {
+            error_report("RAM image '%s' does not match block %s", filename,
+                         entries[i].idstr);
+            ret = -EINVAL;
+            goto out_unlock;
+        }
+        for (n = 0; n < i; n++) {
+            if (blocks[n] == block) {
+                error_report("RAM image '%s' has block %s twice", filename,
+                             block->idstr);
+                ret = -EINVAL;
+                goto out_unlock;
+            }
+        }
+        blocks[i] = block;
     }
 
-    len = qemu_get_byte(f);
-    qemu_get_buffer(f, (uint8_t *)id, len);
-    id[len] = 0;
+    for (i = 0; i < nr_blocks; i++) {
+        off_t offset = ldq_be_p(entries[i].offset);
 
-    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
-        if (!strncmp(id, block->idstr, sizeof(id)))
-            return memory_region_get_ram_ptr(block->mr) + offset;
+        block = blocks[i];
+        if (align % getpagesize() == 0 &&
+            qemu_ram_remap_file(block->offset, fd, offset) == 0) {
+            continue;
+        }
+        ret = ram_file_pread(fd, memory_region_get_ram_ptr(block->mr),
+                             block->length, offset);
+        if (ret < 0) {
+            error_report("Could not read block %s from '%s': %s",
+                         block->idstr, filename, strerror(-ret));
+            break;
+        }
     }
 
-    error_report("Can't find block %s!", id);
-    return NULL;
+out_unlock:
+    qemu_mutex_unlock_ramlist();
+out:
+    g_free(blocks);
+    g_free(entries);
+    close(fd);
+    return ret;
+}
+#else
+int ram_save_file(const char *filename)
+{
+    error_report("RAM images are not supported on this host");
+    return -ENOTSUP;
 }
 
-/*
- * If a page (or a whole RDMA chunk) has been
- * determined to be zero, then zap it.
+int ram_load_file(const char *filename)
+{
+    error_report("RAM images are not supported on this host");
+    return -ENOTSUP;
+}
+#endif
+
+/* After the switch to post-copy, the guest runs while its pages come in,
+ * so they are filled atomically rather than written in place.
  */
-void ram_handle_compressed(void *host, uint8_t ch, uint64_t size)
+static int ram_load_postcopy_page(QEMUFile *f, void *host, int flags)
 {
-    if (ch != 0 || !is_zero_range(host, size)) {
-        memset(host, ch, size);
+    void *page = postcopy_get_tmp_page();
+    uint8_t ch;
+
+    if (flags & RAM_SAVE_FLAG_COMPRESS) {
+        ch = qemu_get_byte(f);
+        if (ch == 0) {
+            return postcopy_place_zero_page(host);
+        }
+        memset(page, ch, TARGET_PAGE_SIZE);
+    } else {
+        qemu_get_buffer(f, page, TARGET_PAGE_SIZE);
+    }
+    if (qemu_file_get_error(f)) {
+        return qemu_file_get_error(f);
     }
+    return postcopy_place_page(host, page);
 }
 
 static int ram_load(QEMUFile *f, void *opaque, int version_id)
@@ -1096,7 +2774,26 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
             }
         }
 
-        if (flags & RAM_SAVE_FLAG_COMPRESS) {
+        if (postcopy_ram_incoming_active() &&
+            (flags & ~(RAM_SAVE_FLAG_CONTINUE | RAM_SAVE_FLAG_EOS))) {
+            void *host;
+
+            if (flags & ~(RAM_SAVE_FLAG_CONTINUE | RAM_SAVE_FLAG_COMPRESS |
+                          RAM_SAVE_FLAG_PAGE)) {
+                error_report("Unexpected RAM flags %#x in post-copy", flags);
+                ret = -EINVAL;
+                goto done;
+            }
+            host = host_from_stream_offset(f, addr, flags);
+            if (!host) {
+                ret = -EINVAL;
+                goto done;
+            }
+            ret = ram_load_postcopy_page(f, host, flags);
+            if (ret < 0) {
+                goto done;
+            }
+        } else if (flags & RAM_SAVE_FLAG_COMPRESS) {
             void *host;
             uint8_t ch;
 
@@ -1129,6 +2826,27 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                 ret = -EINVAL;
                 goto done;
             }
+        } else if (flags & RAM_SAVE_FLAG_COMPRESS_PAGE) {
+            void *host = host_from_stream_offset(f, addr, flags);
+            unsigned int len;
+
+            if (!host) {
+                ret = -EINVAL;
+                goto done;
+            }
+
+            len = qemu_get_be32(f);
+            if (len == 0 || len > compressBound(TARGET_PAGE_SIZE)) {
+                error_report("Invalid compressed page length %u", len);
+                ret = -EINVAL;
+                goto done;
+            }
+            decompress_data_with_multi_threads(f, host, len);
+        } else if (flags & RAM_SAVE_FLAG_MULTIFD_SYNC) {
+            if (multifd_recv_sync_main() < 0) {
+                ret = -EIO;
+                goto done;
+            }
         } else if (flags & RAM_SAVE_FLAG_HOOK) {
             ram_control_load_hook(f, flags);
         }
@@ -1140,6 +2858,12 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
     } while (!(flags & RAM_SAVE_FLAG_EOS));
 
 done:
+    if (wait_for_decompress_done() < 0) {
+        error_report("Failed to decompress page");
+        if (!ret) {
+            ret = -EINVAL;
+        }
+    }
     DPRINTF("Completed load of VM with exit code %d seq iteration "
             "%" PRIu64 "\n", ret, seq_iter);
     return ret;
@@ -1156,7 +2880,18 @@ static SaveVMHandlers savevm_ram_handlers = {
 
 void ram_mig_init(void)
 {
-    qemu_mutex_init(&XBZRLE.lock);
+    qemu_mutex_init(&comp_lock);
+    qemu_cond_init(&comp_done_cond);
+    qemu_mutex_init(&decomp_lock);
+    qemu_cond_init(&decomp_done_cond);
+    qemu_mutex_init(&multifd_send_lock);
+    qemu_cond_init(&multifd_send_done_cond);
+    qemu_mutex_init(&multifd_recv_lock);
+    qemu_cond_init(&multifd_recv_cond);
+    qemu_mutex_init(&page_request_lock);
+    qemu_mutex_init(&sync_pool.lock);
+    qemu_cond_init(&sync_pool.cond);
+    qemu_cond_init(&sync_pool.done_cond);
     register_savevm_live(NULL, "ram", 0, 4, &savevm_ram_handlers, NULL);
 }
 
@@ -35,6 +35,9 @@
 #include "qemu/envlist.h"
 
 int singlestep;
+int tb_profile;
+int tb_perf_map;
+unsigned int tb_trace_threshold;
 #if defined(CONFIG_USE_GUEST_BASE)
 unsigned long mmap_min_addr;
 unsigned long guest_base;
@@ -21,6 +21,7 @@
 #include "disas/disas.h"
 #include "tcg.h"
 #include "qemu/atomic.h"
+#include "exec/helper-proto.h"
 #include "sysemu/qtest.h"
 
 void cpu_loop_exit(CPUState *cpu)
@@ -168,7 +169,12 @@ static TranslationBlock *tb_find_slow(CPUArchState *env,
     return tb;
 }
 
-static inline TranslationBlock *tb_find_fast(CPUArchState *env)
+/* The jump cache is private to the CPU, so a hit needs no lock; this
+   lets the threads of a linux-user process run cached code without
+   contending on tb_lock.  The lock is only taken to search the physical
+   hash table or translate, and is left held for the caller.  */
+static inline TranslationBlock *tb_find_fast(CPUArchState *env,
+                                             volatile bool *have_tb_lock)
 {
     CPUState *cpu = ENV_GET_CPU(env);
     TranslationBlock *tb;
@@ -182,11 +188,75 @@ static inline TranslationBlock *tb_find_fast(CPUArchState *env)
     tb = cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
     if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
                  tb->flags != flags)) {
+        spin_lock(&tcg_ctx.tb_ctx.tb_lock);
+        *have_tb_lock = true;
         tb = tb_find_slow(env, pc, cs_base, flags);
     }
     return tb;
 }
 
+/* Called from generated code at the end of a TB whose successor is not
+   known at translation time, e.g. after an indirect jump or a return.
+   Probe the jump cache and return the host code of the next TB, or the
+   TCG epilogue if it is not there so that cpu_exec looks it up.  */
+void *helper_lookup_tb_ptr(void *opaque)
+{
+    CPUArchState *env = opaque;
+    CPUState *cpu = ENV_GET_CPU(env);
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    int flags;
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    tb = cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
+                 tb->flags != flags)) {
+        return tcg_ctx.code_gen_epilogue;
+    }
+#ifdef TARGET_HAS_TB_TRACE
+    /* Let cpu_exec replace the block by a trace.  */
+    if (unlikely(tb_trace_threshold && tb->cflags == 0 &&
+                 tb->exec_count >= tb_trace_threshold)) {
+        return tcg_ctx.code_gen_epilogue;
+    }
+#endif
+    return tb->tc_ptr;
+}
+
+#ifdef TARGET_HAS_TB_TRACE
+/* Replace a hot TB by a trace that extends it along its direct jumps, so
+   that the code on the hot path is optimized as a whole and does not pay
+   for chaining between the blocks.
+
+   Called with tb_lock held.  @tb may come from the jump cache, which is
+   probed without the lock, so another thread may have invalidated it
+   since, e.g. by writing to its page or by building the trace itself
+   when two threads reach the threshold on the same block.  The block is
+   therefore looked up again, and the trace is only built if the lookup
+   still finds @tb; otherwise whatever it found is run.  */
+static TranslationBlock *tb_gen_trace(CPUArchState *env, TranslationBlock *tb)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    TranslationBlock *found;
+    target_ulong cs_base, pc;
+    int flags;
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    found = tb_find_slow(env, pc, cs_base, flags);
+    if (found != tb || found->cflags != 0 ||
+        found->exec_count < tb_trace_threshold) {
+        return found;
+    }
+
+    tb_phys_invalidate(tb, -1);
+    /* The block that jumped here may be the one just invalidated */
+    tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
+    tb = tb_gen_code(cpu, pc, cs_base, flags, CF_TRACE);
+    cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)] = tb;
+    return tb;
+}
+#endif
+
 static CPUDebugExcpHandler *debug_excp_handler;
 
 void cpu_set_debug_excp_handler(CPUDebugExcpHandler *handler)
@@ -604,12 +674,21 @@ int cpu_exec(CPUArchState *env)
                     cpu->exception_index = EXCP_INTERRUPT;
                     cpu_loop_exit(cpu);
                 }
-                spin_lock(&tcg_ctx.tb_ctx.tb_lock);
-                have_tb_lock = true;
-                tb = tb_find_fast(env);
+                tb = tb_find_fast(env, &have_tb_lock);
+#ifdef TARGET_HAS_TB_TRACE
+                if (unlikely(tb_trace_threshold && tb->cflags == 0 &&
+                             tb->exec_count >= tb_trace_threshold)) {
+                    if (!have_tb_lock) {
+                        spin_lock(&tcg_ctx.tb_ctx.tb_lock);
+                        have_tb_lock = true;
+                    }
+                    tb = tb_gen_trace(env, tb);
+                }
+#endif
                 /* Note: we do it here to avoid a gcc bug on Mac OS X when
-                   doing it in tb_find_slow */
-                if (tcg_ctx.tb_ctx.tb_invalidated_flag) {
+                   doing it in tb_find_slow.  The flag is only accessed
+                   under tb_lock, which a jump cache hit does not take.  */
+                if (have_tb_lock && tcg_ctx.tb_ctx.tb_invalidated_flag) {
                     /* as some TB could have been invalidated because
                        of memory exceptions while generating the code, we
                        must recompute the hash index here */
@@ -624,11 +703,31 @@ int cpu_exec(CPUArchState *env)
                    spans two pages, we cannot safely do a direct
                    jump. */
                 if (next_tb != 0 && tb->page_addr[1] == -1) {
-                    tb_add_jump((TranslationBlock *)(next_tb & ~TB_EXIT_MASK),
-                                next_tb & TB_EXIT_MASK, tb);
+                    TranslationBlock *last_tb =
+                        (TranslationBlock *)(next_tb & ~TB_EXIT_MASK);
+                    int n = next_tb & TB_EXIT_MASK;
+
+                    /* Patching code needs the lock; most exits that come
+                       back here are already chained or cannot be.  */
+                    if (!last_tb->jmp_next[n]) {
+                        if (!have_tb_lock) {
+                            spin_lock(&tcg_ctx.tb_ctx.tb_lock);
+                            have_tb_lock = true;
+                        }
+                        /* Another thread may have invalidated TBs since
+                           the jump cache was probed; do not chain then.  */
+                        if (tcg_ctx.tb_ctx.tb_invalidated_flag) {
+                            next_tb = 0;
+                            tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
+                        } else {
+                            tb_add_jump(last_tb, n, tb);
+                        }
+                    }
+                }
+                if (have_tb_lock) {
+                    have_tb_lock = false;
+                    spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
                 }
-                have_tb_lock = false;
-                spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
 
                 /* cpu_interrupt might be called while translating the
                    TB, but before it is linked into a potentially
@@ -20,6 +20,36 @@
 #include "disas/bfd.h"
 #include "tcg/tcg.h"
 
+/* Names of the opcodes which TCI adds to those of TCG. */
+static const char *const tci_op_names[TCI_op_last - TCI_op_first] = {
+    [TCI_op_addi_i32 - TCI_op_first] = "addi_i32",
+    [TCI_op_subi_i32 - TCI_op_first] = "subi_i32",
+    [TCI_op_muli_i32 - TCI_op_first] = "muli_i32",
+    [TCI_op_andi_i32 - TCI_op_first] = "andi_i32",
+    [TCI_op_ori_i32 - TCI_op_first] = "ori_i32",
+    [TCI_op_xori_i32 - TCI_op_first] = "xori_i32",
+    [TCI_op_shli_i32 - TCI_op_first] = "shli_i32",
+    [TCI_op_shri_i32 - TCI_op_first] = "shri_i32",
+    [TCI_op_sari_i32 - TCI_op_first] = "sari_i32",
+    [TCI_op_rotli_i32 - TCI_op_first] = "rotli_i32",
+    [TCI_op_rotri_i32 - TCI_op_first] = "rotri_i32",
+    [TCI_op_setcondi_i32 - TCI_op_first] = "setcondi_i32",
+    [TCI_op_brcondi_i32 - TCI_op_first] = "brcondi_i32",
+    [TCI_op_addi_i64 - TCI_op_first] = "addi_i64",
+    [TCI_op_subi_i64 - TCI_op_first] = "subi_i64",
+    [TCI_op_muli_i64 - TCI_op_first] = "muli_i64",
+    [TCI_op_andi_i64 - TCI_op_first] = "andi_i64",
+    [TCI_op_ori_i64 - TCI_op_first] = "ori_i64",
+    [TCI_op_xori_i64 - TCI_op_first] = "xori_i64",
+    [TCI_op_shli_i64 - TCI_op_first] = "shli_i64",
+    [TCI_op_shri_i64 - TCI_op_first] = "shri_i64",
+    [TCI_op_sari_i64 - TCI_op_first] = "sari_i64",
+    [TCI_op_rotli_i64 - TCI_op_first] = "rotli_i64",
+    [TCI_op_rotri_i64 - TCI_op_first] = "rotri_i64",
+    [TCI_op_setcondi_i64 - TCI_op_first] = "setcondi_i64",
+    [TCI_op_brcondi_i64 - TCI_op_first] = "brcondi_i64",
+};
+
 /* Disassemble TCI bytecode. */
 int print_insn_tci(bfd_vma addr, disassemble_info *info)
 {
@@ -43,7 +73,10 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
     }
     length = byte;
 
-    if (op >= tcg_op_defs_max) {
+    if ((int)op >= TCI_op_first && (int)op < TCI_op_last) {
+        info->fprintf_func(info->stream, "%s",
+                           tci_op_names[op - TCI_op_first]);
+    } else if (op >= tcg_op_defs_max) {
         info->fprintf_func(info->stream, "illegal opcode %d", op);
     } else {
         const TCGOpDef *def = &tcg_op_defs[op];
@@ -53,6 +53,7 @@
 #include "qemu/cache-utils.h"
 
 #include "qemu/range.h"
+#include "qemu/rcu.h"
 
 //#define DEBUG_SUBPAGE
 
@@ -114,12 +115,15 @@ typedef struct PhysPageMap {
 } PhysPageMap;
 
 struct AddressSpaceDispatch {
+    struct rcu_head rcu;
+
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
      */
     PhysPageEntry phys_map;
     PhysPageMap map;
     AddressSpace *as;
+    QEMUBH *free_bh;
 };
 
 #define SUBPAGE_IDX(addr) ((addr) & ~TARGET_PAGE_MASK)
@@ -360,8 +364,10 @@ MemoryRegion *address_space_translate(AddressSpace *as, hwaddr addr,
     MemoryRegion *mr;
     hwaddr len = *plen;
 
+    rcu_read_lock();
     for (;;) {
-        section = address_space_translate_internal(as->dispatch, addr, &addr, plen, true);
+        AddressSpaceDispatch *d = atomic_rcu_read(&as->dispatch);
+        section = address_space_translate_internal(d, addr, &addr, plen, true);
         mr = section->mr;
 
         if (!mr->iommu_ops) {
@@ -387,6 +393,7 @@ MemoryRegion *address_space_translate(AddressSpace *as, hwaddr addr,
 
     *plen = len;
     *xlat = addr;
+    rcu_read_unlock();
     return mr;
 }
 
@@ -789,6 +796,32 @@ void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t length,
     }
 }
 
+/* Like cpu_physical_memory_reset_dirty, but atomic with respect to
+ * concurrent dirtying, and returns whether any page in the range was dirty.
+ */
+bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
+                                              ram_addr_t length,
+                                              unsigned client)
+{
+    unsigned long end, page;
+    bool dirty;
+
+    if (length == 0) {
+        return false;
+    }
+
+    assert(client < DIRTY_MEMORY_NUM);
+    end = TARGET_PAGE_ALIGN(start + length) >> TARGET_PAGE_BITS;
+    page = start >> TARGET_PAGE_BITS;
+    dirty = bitmap_test_and_clear_atomic(ram_list.dirty_memory[client],
+                                         page, end - page);
+
+    if (dirty && tcg_enabled()) {
+        tlb_reset_dirty_range_all(start, length);
+    }
+    return dirty;
+}
+
 static void cpu_physical_memory_set_dirty_tracking(bool enable)
 {
     in_migration = enable;
@@ -988,6 +1021,45 @@ void qemu_mutex_unlock_ramlist(void)
 #ifdef __linux__
 
 #include <sys/vfs.h>
+#include <sys/syscall.h>
+
+#define QEMU_MPOL_BIND 2
+
+/* Bind the memory of each guest NUMA node that has a hostnode= to that
+ * host node.  Boards lay the nodes out one after another in the main RAM
+ * block, so only a block of exactly ram_size is affected.
+ */
+static void ram_bind_numa_nodes(void *host, ram_addr_t size)
+{
+#ifdef __NR_mbind
+    unsigned long nodemask[BITS_TO_LONGS(MAX_NODES)];
+    uintptr_t pagesize = getpagesize();
+    uintptr_t start, end;
+    ram_addr_t offset = 0;
+    int i;
+
+    if (size != ram_size) {
+        return;
+    }
+    for (i = 0; i < nb_numa_nodes; i++) {
+        start = ROUND_UP((uintptr_t)host + offset, pagesize);
+        offset += node_mem[i];
+        end = ROUND_UP((uintptr_t)host + MIN(offset, size), pagesize);
+        if (node_host[i] < 0 || start >= end) {
+            continue;
+        }
+
+        bitmap_zero(nodemask, MAX_NODES);
+        set_bit(node_host[i], nodemask);
+        if (syscall(__NR_mbind, start, end - start, QEMU_MPOL_BIND,
+                    nodemask, MAX_NODES + 1, 0)) {
+            fprintf(stderr, "qemu: cannot bind NUMA node %d to host node "
+                    "%d: %s\n", i, node_host[i], strerror(errno));
+            exit(1);
+        }
+    }
+#endif
+}
 
 #define HUGETLBFS_MAGIC       0x958458f6
 
@@ -1011,11 +1083,197 @@ static long gethugepagesize(const char *path)
     return fs.f_bsize;
 }
 
-static sigjmp_buf sigjump;
+#define MAX_PREALLOC_THREADS 16
+
+/* Smaller areas, such as ROMs and video RAM, are touched by the calling
+ * thread and without progress reports.
+ */
+#define PREALLOC_THREADED_MIN (64 << 20)
+
+/* Pages touched between two updates of the shared progress counter */
+#define PREALLOC_BATCH 256
+
+typedef struct PreallocProgress {
+    QemuMutex lock;
+    void *area;
+    unsigned long pages_done;
+    unsigned long numpages;
+    int64_t last_report;
+} PreallocProgress;
+
+typedef struct PreallocThread {
+    QemuThread thread;
+    char *addr;
+    unsigned long numpages;
+    unsigned long hpagesize;
+    PreallocProgress *progress;
+    bool failed;
+} PreallocThread;
+
+static __thread sigjmp_buf *prealloc_sigjump;
 
 static void sigbus_handler(int signal)
 {
-    siglongjmp(sigjump, 1);
+    siglongjmp(*prealloc_sigjump, 1);
+}
+
+/* Report progress at most once per second, from whichever worker gets
+ * there first.
+ */
+static void prealloc_add_progress(PreallocProgress *p, unsigned long pages)
+{
+    int64_t now;
+
+    if (!p) {
+        return;
+    }
+    qemu_mutex_lock(&p->lock);
+    p->pages_done += pages;
+    now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    if (p->pages_done < p->numpages && now - p->last_report >= 1000) {
+        trace_ram_prealloc_progress(p->area, p->pages_done, p->numpages);
+        p->last_report = now;
+    }
+    qemu_mutex_unlock(&p->lock);
+}
+
+/* Runs with SIGBUS unblocked, in a worker or in the caller of
+ * touch_all_pages.
+ */
+static void touch_pages(PreallocThread *t)
+{
+    sigjmp_buf env;
+    unsigned long i;
+
+    prealloc_sigjump = &env;
+    if (sigsetjmp(env, 1)) {
+        t->failed = true;
+        prealloc_sigjump = NULL;
+        return;
+    }
+
+    /* MAP_POPULATE silently ignores failures */
+    for (i = 0; i < t->numpages; i++) {
+        memset(t->addr + t->hpagesize * i, 0, 1);
+        if ((i + 1) % PREALLOC_BATCH == 0) {
+            prealloc_add_progress(t->progress, PREALLOC_BATCH);
+        }
+    }
+    prealloc_add_progress(t->progress, t->numpages % PREALLOC_BATCH);
+    prealloc_sigjump = NULL;
+}
+
+static void *do_touch_pages(void *opaque)
+{
+    sigset_t set;
+
+    /* qemu_thread_create blocks all signals, but the SIGBUS of a failed
+     * allocation must reach this thread.
+     */
+    sigemptyset(&set);
+    sigaddset(&set, SIGBUS);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+    touch_pages(opaque);
+    return NULL;
+}
+
+/* Touch every page of the area, splitting the work across host CPUs;
+ * faulting in pages is dominated by clearing them.  Progress is reported
+ * through trace events.
+ */
+static void touch_all_pages(void *area, ram_addr_t memory,
+                            unsigned long hpagesize)
+{
+    PreallocThread threads[MAX_PREALLOC_THREADS];
+    PreallocProgress progress;
+    unsigned long numpages = memory / hpagesize;
+    unsigned long per_thread;
+    struct sigaction act, oldact;
+    sigset_t set, oldset;
+    int64_t start_time;
+    long nr_threads;
+    int i, ret;
+    bool report = memory >= PREALLOC_THREADED_MIN;
+    bool failed = false;
+
+    if (numpages == 0) {
+        return;
+    }
+    if (!report) {
+        nr_threads = 1;
+    } else {
+        nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        nr_threads = MAX(1, MIN(nr_threads, MAX_PREALLOC_THREADS));
+    }
+    per_thread = DIV_ROUND_UP(numpages, nr_threads);
+    nr_threads = DIV_ROUND_UP(numpages, per_thread);
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = &sigbus_handler;
+    act.sa_flags = 0;
+
+    ret = sigaction(SIGBUS, &act, &oldact);
+    if (ret) {
+        perror("qemu: failed to install signal handler");
+        exit(1);
+    }
+
+    start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    if (report) {
+        trace_ram_prealloc_start(area, memory, hpagesize, nr_threads);
+        qemu_mutex_init(&progress.lock);
+        progress.area = area;
+        progress.pages_done = 0;
+        progress.numpages = numpages;
+        progress.last_report = start_time;
+    }
+    for (i = 0; i < nr_threads; i++) {
+        threads[i].addr = (char *)area
+                          + (ram_addr_t)per_thread * hpagesize * i;
+        threads[i].numpages = MIN(per_thread, numpages - per_thread * i);
+        threads[i].hpagesize = hpagesize;
+        threads[i].progress = report ? &progress : NULL;
+        threads[i].failed = false;
+    }
+
+    if (nr_threads == 1) {
+        sigemptyset(&set);
+        sigaddset(&set, SIGBUS);
+        pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
+        touch_pages(&threads[0]);
+        failed = threads[0].failed;
+    } else {
+        for (i = 0; i < nr_threads; i++) {
+            qemu_thread_create(&threads[i].thread, "touch_pages",
+                               do_touch_pages, &threads[i],
+                               QEMU_THREAD_JOINABLE);
+        }
+        for (i = 0; i < nr_threads; i++) {
+            qemu_thread_join(&threads[i].thread);
+            failed |= threads[i].failed;
+        }
+    }
+
+    if (report) {
+        qemu_mutex_destroy(&progress.lock);
+        trace_ram_prealloc_done(area, qemu_clock_get_ms(QEMU_CLOCK_REALTIME)
+                                      - start_time);
+    }
+
+    ret = sigaction(SIGBUS, &oldact, NULL);
+    if (ret) {
+        perror("qemu: failed to reinstall signal handler");
+        exit(1);
+    }
+    if (nr_threads == 1) {
+        pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+    }
+
+    if (failed) {
+        fprintf(stderr, "qemu: failed to preallocate guest memory\n");
+        exit(1);
+    }
 }
 
 static void *file_ram_alloc(RAMBlock *block,
@@ -1081,43 +1339,11 @@ static void *file_ram_alloc(RAMBlock *block,
         goto error;
     }
 
-    if (mem_prealloc) {
-        int ret, i;
-        struct sigaction act, oldact;
-        sigset_t set, oldset;
-
-        memset(&act, 0, sizeof(act));
-        act.sa_handler = &sigbus_handler;
-        act.sa_flags = 0;
-
-        ret = sigaction(SIGBUS, &act, &oldact);
-        if (ret) {
-            perror("file_ram_alloc: failed to install signal handler");
-            exit(1);
-        }
-
-        /* unblock SIGBUS */
-        sigemptyset(&set);
-        sigaddset(&set, SIGBUS);
-        pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
-
-        if (sigsetjmp(sigjump, 1)) {
-            fprintf(stderr, "file_ram_alloc: failed to preallocate pages\n");
-            exit(1);
-        }
+    /* Place the pages before they are touched */
+    ram_bind_numa_nodes(area, memory);
 
-        /* MAP_POPULATE silently ignores failures */
-        for (i = 0; i < (memory/hpagesize); i++) {
-            memset(area + (hpagesize*i), 0, 1);
-        }
-
-        ret = sigaction(SIGBUS, &oldact, NULL);
-        if (ret) {
-            perror("file_ram_alloc: failed to reinstall signal handler");
-            exit(1);
-        }
-
-        pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+    if (mem_prealloc) {
+        touch_all_pages(area, memory, hpagesize);
     }
 
     block->fd = fd;
@@ -1130,6 +1356,15 @@ error:
     return NULL;
 }
 #else
+static void ram_bind_numa_nodes(void *host, ram_addr_t size)
+{
+}
+
+static void touch_all_pages(void *area, ram_addr_t memory,
+                            unsigned long hpagesize)
+{
+}
+
 static void *file_ram_alloc(RAMBlock *block,
                             ram_addr_t memory,
                             const char *path)
@@ -1293,6 +1528,10 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
                 exit(1);
             }
             memory_try_enable_merging(new_block->host, size);
+            ram_bind_numa_nodes(new_block->host, size);
+            if (phys_mem_alloc == qemu_anon_ram_alloc) {
+                new_block->flags |= RAM_ANON_MASK;
+            }
         }
     }
     new_block->length = size;
@@ -1326,7 +1565,15 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
     cpu_physical_memory_set_dirty_range(new_block->offset, size);
 
     qemu_ram_setup_dump(new_block->host, size);
-    qemu_madvise(new_block->host, size, QEMU_MADV_HUGEPAGE);
+    if (qemu_opt_get_bool(qemu_get_machine_opts(), "mem-thp", true)) {
+        qemu_madvise(new_block->host, size, QEMU_MADV_HUGEPAGE);
+    } else {
+        qemu_madvise(new_block->host, size, QEMU_MADV_NOHUGEPAGE);
+    }
+    /* -mem-path memory was already touched by file_ram_alloc */
+    if (mem_prealloc && !host && new_block->fd < 0 && !xen_enabled()) {
+        touch_all_pages(new_block->host, size, getpagesize());
+    }
     qemu_madvise(new_block->host, size, QEMU_MADV_DONTFORK);
 
     if (kvm_enabled())
@@ -1442,6 +1689,41 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
         }
     }
 }
+
+/*
+ * Replace the whole RAM block at @addr with a private mapping of @fd from
+ * @offset, so that its pages are read from the file when first touched.
+ * Returns -ENOTSUP for blocks whose memory QEMU does not allocate itself.
+ */
+int qemu_ram_remap_file(ram_addr_t addr, int fd, off_t offset)
+{
+    RAMBlock *block;
+    void *area;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (block->offset != addr) {
+            continue;
+        }
+        if ((block->flags & RAM_PREALLOC_MASK) || block->fd >= 0 ||
+            xen_enabled() || phys_mem_alloc != qemu_anon_ram_alloc) {
+            return -ENOTSUP;
+        }
+
+        area = mmap(block->host, block->length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_FIXED, fd, offset);
+        if (area != block->host) {
+            fprintf(stderr, "Could not map RAM block %s: %s\n",
+                    block->idstr, strerror(errno));
+            exit(1);
+        }
+        memory_try_enable_merging(block->host, block->length);
+        qemu_ram_setup_dump(block->host, block->length);
+        qemu_madvise(block->host, block->length, QEMU_MADV_DONTFORK);
+        block->flags &= ~RAM_ANON_MASK;
+        return 0;
+    }
+    return -ENOENT;
+}
 #endif /* !_WIN32 */
 
 /* Return a host pointer to ram allocated with qemu_ram_alloc.
@@ -1809,6 +2091,25 @@ static void mem_begin(MemoryListener *listener)
     as->next_dispatch = d;
 }
 
+static void address_space_dispatch_free_bh(void *opaque)
+{
+    AddressSpaceDispatch *d = opaque;
+
+    qemu_bh_delete(d->free_bh);
+    phys_sections_free(&d->map);
+    g_free(d);
+}
+
+/* Readers may still be walking the old map, so it is freed after a grace
+ * period.  Dropping the section references can destroy memory regions,
+ * so finish the job in the main loop.
+ */
+static void address_space_dispatch_free(AddressSpaceDispatch *d)
+{
+    d->free_bh = qemu_bh_new(address_space_dispatch_free_bh, d);
+    qemu_bh_schedule(d->free_bh);
+}
+
 static void mem_commit(MemoryListener *listener)
 {
     AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
@@ -1817,11 +2118,10 @@ static void mem_commit(MemoryListener *listener)
 
     phys_page_compact_all(next, next->map.nodes_nb);
 
-    as->dispatch = next;
+    atomic_rcu_set(&as->dispatch, next);
 
     if (cur) {
-        phys_sections_free(&cur->map);
-        g_free(cur);
+        call_rcu(cur, address_space_dispatch_free, rcu);
     }
 }
 
@@ -1876,8 +2176,10 @@ void address_space_destroy_dispatch(AddressSpace *as)
     AddressSpaceDispatch *d = as->dispatch;
 
     memory_listener_unregister(&as->dispatch_listener);
-    g_free(d);
-    as->dispatch = NULL;
+    atomic_rcu_set(&as->dispatch, NULL);
+    if (d) {
+        call_rcu(d, address_space_dispatch_free, rcu);
+    }
 }
 
 static void memory_map_init(void)
@@ -2002,6 +2304,7 @@ bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
     MemoryRegion *mr;
     bool error = false;
 
+    rcu_read_lock();
     while (len > 0) {
         l = len;
         mr = address_space_translate(as, addr, &addr1, &l, is_write);
@@ -2080,6 +2383,7 @@ bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
         buf += l;
         addr += l;
     }
+    rcu_read_unlock();
 
     return error;
 }
@@ -2217,12 +2521,14 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_
     MemoryRegion *mr;
     hwaddr l, xlat;
 
+    rcu_read_lock();
     while (len > 0) {
         l = len;
         mr = address_space_translate(as, addr, &xlat, &l, is_write);
         if (!memory_access_is_direct(mr, is_write)) {
             l = memory_access_size(mr, l, addr);
             if (!memory_region_access_valid(mr, xlat, l, is_write)) {
+                rcu_read_unlock();
                 return false;
             }
         }
@@ -2230,6 +2536,7 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_
         len -= l;
         addr += l;
     }
+    rcu_read_unlock();
     return true;
 }
 
@@ -2256,9 +2563,11 @@ void *address_space_map(AddressSpace *as,
     }
 
     l = len;
+    rcu_read_lock();
     mr = address_space_translate(as, addr, &xlat, &l, is_write);
     if (!memory_access_is_direct(mr, is_write)) {
         if (bounce.buffer) {
+            rcu_read_unlock();
             return NULL;
         }
         /* Avoid unbounded allocations */
@@ -2272,6 +2581,7 @@ void *address_space_map(AddressSpace *as,
         if (!is_write) {
             address_space_read(as, addr, bounce.buffer, l);
         }
+        rcu_read_unlock();
 
         *plen = l;
         return bounce.buffer;
@@ -2296,6 +2606,7 @@ void *address_space_map(AddressSpace *as,
     }
 
     memory_region_ref(mr);
+    rcu_read_unlock();
     *plen = done;
     return qemu_ram_ptr_length(raddr + base, plen);
 }
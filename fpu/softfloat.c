@@ -2016,6 +2016,143 @@ static float32 subFloat32Sigs( float32 a, float32 b, flag zSign STATUS_PARAM)
 
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast path.  When rounding to nearest-even, an operation on normal
+| or zero operands whose result is a normal number can raise no exception
+| other than inexact, and the host FPU computes the same correctly rounded
+| result as the integer implementation.  So if the inexact flag is already
+| set in `status', which is the common case as guests rarely clear it, the
+| host result can be returned as is.  Any other case, including tiny, zero
+| or overflowing results, falls back to the integer implementation.  This
+| requires the host to evaluate float and double expressions in their own
+| precision, which rules out the x87 FPU.
+*----------------------------------------------------------------------------*/
+#if defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ == 0
+#define USE_HOST_FPU 1
+#include <float.h>
+#include <math.h>
+
+enum {
+    host_op_add,
+    host_op_sub,
+    host_op_mul,
+    host_op_div,
+    host_op_sqrt,
+};
+
+static inline int host_fpu_usable(float_status *status)
+{
+    return STATUS(float_rounding_mode) == float_round_nearest_even
+        && (STATUS(float_exception_flags) & float_flag_inexact);
+}
+
+static inline int float32_is_zero_or_normal(float32 a)
+{
+    int_fast16_t aExp = extractFloat32Exp(a);
+    return aExp != 0xFF && (aExp != 0 || extractFloat32Frac(a) == 0);
+}
+
+static inline int float64_is_zero_or_normal(float64 a)
+{
+    int_fast16_t aExp = extractFloat64Exp(a);
+    return aExp != 0x7FF && (aExp != 0 || extractFloat64Frac(a) == 0);
+}
+
+/* Compute `a' op `b' on the host into `*res'.  Return 0 if the result
+   must be computed by softfloat instead.  */
+static inline int float32_host_op(int op, float32 a, float32 b, float32 *res
+                                  STATUS_PARAM)
+{
+    union {
+        uint32_t i;
+        float h;
+    } ua, ub, ur;
+
+    if (!host_fpu_usable(status)
+        || !float32_is_zero_or_normal(a) || !float32_is_zero_or_normal(b)) {
+        return 0;
+    }
+    ua.i = float32_val(a);
+    ub.i = float32_val(b);
+    switch (op) {
+    case host_op_add:
+        ur.h = ua.h + ub.h;
+        break;
+    case host_op_sub:
+        ur.h = ua.h - ub.h;
+        break;
+    case host_op_mul:
+        ur.h = ua.h * ub.h;
+        break;
+    case host_op_div:
+        if (float32_is_zero(b)) {
+            return 0;
+        }
+        ur.h = ua.h / ub.h;
+        break;
+    case host_op_sqrt:
+        if (extractFloat32Sign(a)) {
+            return 0;
+        }
+        ur.h = sqrtf(ua.h);
+        break;
+    default:
+        abort();
+    }
+    if (isinf(ur.h) || fabsf(ur.h) <= FLT_MIN) {
+        return 0;
+    }
+    *res = make_float32(ur.i);
+    return 1;
+}
+
+static inline int float64_host_op(int op, float64 a, float64 b, float64 *res
+                                  STATUS_PARAM)
+{
+    union {
+        uint64_t i;
+        double h;
+    } ua, ub, ur;
+
+    if (!host_fpu_usable(status)
+        || !float64_is_zero_or_normal(a) || !float64_is_zero_or_normal(b)) {
+        return 0;
+    }
+    ua.i = float64_val(a);
+    ub.i = float64_val(b);
+    switch (op) {
+    case host_op_add:
+        ur.h = ua.h + ub.h;
+        break;
+    case host_op_sub:
+        ur.h = ua.h - ub.h;
+        break;
+    case host_op_mul:
+        ur.h = ua.h * ub.h;
+        break;
+    case host_op_div:
+        if (float64_is_zero(b)) {
+            return 0;
+        }
+        ur.h = ua.h / ub.h;
+        break;
+    case host_op_sqrt:
+        if (extractFloat64Sign(a)) {
+            return 0;
+        }
+        ur.h = sqrt(ua.h);
+        break;
+    default:
+        abort();
+    }
+    if (isinf(ur.h) || fabs(ur.h) <= DBL_MIN) {
+        return 0;
+    }
+    *res = make_float64(ur.i);
+    return 1;
+}
+#endif
+
 /*----------------------------------------------------------------------------
 | Returns the result of adding the single-precision floating-point values `a'
 | and `b'.  The operation is performed according to the IEC/IEEE Standard for
@@ -2025,6 +2162,12 @@ static float32 subFloat32Sigs( float32 a, float32 b, flag zSign STATUS_PARAM)
 float32 float32_add( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
+#ifdef USE_HOST_FPU
+    float32 hr;
+    if (float32_host_op(host_op_add, a, b, &hr STATUS_VAR)) {
+        return hr;
+    }
+#endif
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2048,6 +2191,12 @@ float32 float32_add( float32 a, float32 b STATUS_PARAM )
 float32 float32_sub( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
+#ifdef USE_HOST_FPU
+    float32 hr;
+    if (float32_host_op(host_op_sub, a, b, &hr STATUS_VAR)) {
+        return hr;
+    }
+#endif
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2076,6 +2225,12 @@ float32 float32_mul( float32 a, float32 b STATUS_PARAM )
     uint64_t zSig64;
     uint32_t zSig;
 
+#ifdef USE_HOST_FPU
+    float32 hr;
+    if (float32_host_op(host_op_mul, a, b, &hr STATUS_VAR)) {
+        return hr;
+    }
+#endif
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2136,6 +2291,12 @@ float32 float32_div( float32 a, float32 b STATUS_PARAM )
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
     uint32_t aSig, bSig, zSig;
+#ifdef USE_HOST_FPU
+    float32 hr;
+    if (float32_host_op(host_op_div, a, b, &hr STATUS_VAR)) {
+        return hr;
+    }
+#endif
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2527,6 +2688,12 @@ float32 float32_sqrt( float32 a STATUS_PARAM )
     int_fast16_t aExp, zExp;
     uint32_t aSig, zSig;
     uint64_t rem, term;
+#ifdef USE_HOST_FPU
+    float32 hr;
+    if (float32_host_op(host_op_sqrt, a, a, &hr STATUS_VAR)) {
+        return hr;
+    }
+#endif
     a = float32_squash_input_denormal(a STATUS_VAR);
 
     aSig = extractFloat32Frac( a );
@@ -3769,6 +3936,12 @@ static float64 subFloat64Sigs( float64 a, float64 b, flag zSign STATUS_PARAM )
 float64 float64_add( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
+#ifdef USE_HOST_FPU
+    float64 hr;
+    if (float64_host_op(host_op_add, a, b, &hr STATUS_VAR)) {
+        return hr;
+    }
+#endif
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3792,6 +3965,12 @@ float64 float64_add( float64 a, float64 b STATUS_PARAM )
 float64 float64_sub( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
+#ifdef USE_HOST_FPU
+    float64 hr;
+    if (float64_host_op(host_op_sub, a, b, &hr STATUS_VAR)) {
+        return hr;
+    }
+#endif
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3818,6 +3997,12 @@ float64 float64_mul( float64 a, float64 b STATUS_PARAM )
     int_fast16_t aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig0, zSig1;
 
+#ifdef USE_HOST_FPU
+    float64 hr;
+    if (float64_host_op(host_op_mul, a, b, &hr STATUS_VAR)) {
+        return hr;
+    }
+#endif
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3880,6 +4065,12 @@ float64 float64_div( float64 a, float64 b STATUS_PARAM )
     uint64_t aSig, bSig, zSig;
     uint64_t rem0, rem1;
     uint64_t term0, term1;
+#ifdef USE_HOST_FPU
+    float64 hr;
+    if (float64_host_op(host_op_div, a, b, &hr STATUS_VAR)) {
+        return hr;
+    }
+#endif
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -4283,6 +4474,12 @@ float64 float64_sqrt( float64 a STATUS_PARAM )
     int_fast16_t aExp, zExp;
     uint64_t aSig, zSig, doubleZSig;
     uint64_t rem0, rem1, term0, term1;
+#ifdef USE_HOST_FPU
+    float64 hr;
+    if (float64_host_op(host_op_sqrt, a, a, &hr STATUS_VAR)) {
+        return hr;
+    }
+#endif
     a = float64_squash_input_denormal(a STATUS_VAR);
 
     aSig = extractFloat64Frac( a );
@@ -356,6 +356,52 @@ STEXI
 @item delvm @var{tag}|@var{id}
 @findex delvm
 Delete the snapshot identified by @var{tag} or @var{id}.
+ETEXI
+
+    {
+        .name       = "savevm_file",
+        .args_type  = "filename:F",
+        .params     = "filename",
+        .help       = "save the VM state to filename and its RAM to filename.ram",
+        .mhandler.cmd = do_savevm_file,
+    },
+
+STEXI
+@item savevm_file @var{filename}
+@findex savevm_file
+Save the device state of the virtual machine to @var{filename} and its
+RAM to @var{filename}.ram, with every page at a page-aligned offset and
+the zero pages left as holes. Disk contents are not saved, so the disks
+should be read-only or opened with @option{-snapshot} if the state is to
+be restored more than once.
+ETEXI
+
+    {
+        .name       = "loadvm_file",
+        .args_type  = "template:-t,filename:F",
+        .params     = "[-t] filename",
+        .help       = "restore the VM state saved by savevm_file "
+                      "(-t to clone a template shared by several VMs)",
+        .mhandler.cmd = do_loadvm_file,
+    },
+
+STEXI
+@item loadvm_file [-t] @var{filename}
+@findex loadvm_file
+Restore the state saved by @code{savevm_file}. Guest RAM is mapped
+copy-on-write from @var{filename}.ram rather than read, so pages are only
+loaded when the guest touches them, and VMs restored from the same file
+share the pages they do not write to.
+
+With @option{-t}, the state is a template that several VMs are cloned
+from. Each clone needs its own disk images, for example qcow2 overlays
+created with @code{qemu-img create -b}.
+
+The network cards keep the MAC address of the template whatever their
+@option{mac} property says, and a warning is printed when it differs.
+Only networks private to each clone, such as user mode networking
+(@option{-netdev user}), are therefore safe; on a shared tap or bridge
+the clones would all use the same address.
 ETEXI
 
     {
@@ -917,6 +963,23 @@ STEXI
 @findex migrate_cancel
 Cancel the current VM migration.
 
+ETEXI
+
+    {
+        .name       = "migrate_start_postcopy",
+        .args_type  = "",
+        .params     = "",
+        .help       = "switch the current VM migration to post-copy",
+        .mhandler.cmd = hmp_migrate_start_postcopy,
+    },
+
+STEXI
+@item migrate_start_postcopy
+@findex migrate_start_postcopy
+Switch the current VM migration to post-copy: the VM runs on the
+destination, which fetches the pages it is missing. Needs the postcopy-ram
+capability.
+
 ETEXI
 
     {
@@ -979,6 +1042,21 @@ STEXI
 @item migrate_set_capability @var{capability} @var{state}
 @findex migrate_set_capability
 Enable/Disable the usage of a capability @var{capability} for migration.
+ETEXI
+
+    {
+        .name       = "migrate_set_parameter",
+        .args_type  = "parameter:s,value:i",
+        .params     = "parameter value",
+        .help       = "Set the parameter for migration",
+        .mhandler.cmd = hmp_migrate_set_parameter,
+    },
+
+STEXI
+@item migrate_set_parameter @var{parameter} @var{value}
+@findex migrate_set_parameter
+Set the parameter @var{parameter} (compress-level, compress-threads,
+decompress-threads, multifd-channels or rdma-pinned-max) for migration.
 ETEXI
 
     {
@@ -1762,6 +1840,8 @@ show migration status
 show current migration capabilities
 @item info migrate_cache_size
 show current migration XBZRLE cache size
+@item info migrate_parameters
+show current migration parameters
 @item info balloon
 show balloon information
 @item info qtree
@@ -1772,6 +1852,9 @@ show qdev device model list
 show roms
 @item info tpm
 show the TPM device
+@item info tb-hotspots [@var{count}]
+show the @var{count} most frequently executed translated blocks (default 20),
+requires -tb-profile
 @end table
 ETEXI
 
@@ -185,12 +185,19 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->ram->duplicate);
         monitor_printf(mon, "skipped: %" PRIu64 " pages\n",
                        info->ram->skipped);
+        monitor_printf(mon, "skipped bytes: %" PRIu64 " kbytes\n",
+                       info->ram->skipped_bytes >> 10);
         monitor_printf(mon, "normal: %" PRIu64 " pages\n",
                        info->ram->normal);
         monitor_printf(mon, "normal bytes: %" PRIu64 " kbytes\n",
                        info->ram->normal_bytes >> 10);
         monitor_printf(mon, "dirty sync count: %" PRIu64 "\n",
                        info->ram->dirty_sync_count);
+        monitor_printf(mon, "dirty sync time: %" PRIu64 " us (%" PRIu64
+                       " us locked, max %" PRIu64 " us)\n",
+                       info->ram->dirty_sync_time,
+                       info->ram->dirty_sync_locked_time,
+                       info->ram->dirty_sync_time_max);
         if (info->ram->dirty_pages_rate) {
             monitor_printf(mon, "dirty pages rate: %" PRIu64 " pages\n",
                            info->ram->dirty_pages_rate);
@@ -221,6 +228,39 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->xbzrle_cache->overflow);
     }
 
+    if (info->has_compression) {
+        CompressThreadStatsList *thread;
+        int i = 0;
+
+        monitor_printf(mon, "compressed pages: %" PRIu64 " pages\n",
+                       info->compression->pages);
+        monitor_printf(mon, "compressed size: %" PRIu64 " kbytes\n",
+                       info->compression->compressed_size >> 10);
+        monitor_printf(mon, "compression rate: %0.2f\n",
+                       info->compression->compression_rate);
+        monitor_printf(mon, "compression busy: %" PRIu64 "\n",
+                       info->compression->busy);
+        for (thread = info->compression->threads; thread;
+             thread = thread->next, i++) {
+            monitor_printf(mon, "compress thread %d: %" PRIu64 " pages, %"
+                           PRIu64 " kbytes, busy %" PRIu64 " milliseconds\n",
+                           i, thread->value->pages,
+                           thread->value->compressed_size >> 10,
+                           thread->value->busy_time);
+        }
+    }
+
+    if (info->has_postcopy) {
+        monitor_printf(mon, "postcopy requests: %" PRIu64 " pages\n",
+                       info->postcopy->requests);
+        monitor_printf(mon, "postcopy faults: %" PRIu64 " pages\n",
+                       info->postcopy->faults);
+        monitor_printf(mon, "postcopy fault latency: %" PRIu64
+                       " us average, %" PRIu64 " us max\n",
+                       info->postcopy->fault_latency_avg,
+                       info->postcopy->fault_latency_max);
+    }
+
     qapi_free_MigrationInfo(info);
     qapi_free_MigrationCapabilityStatusList(caps);
 }
@@ -250,6 +290,24 @@ void hmp_info_migrate_cache_size(Monitor *mon, const QDict *qdict)
                    qmp_query_migrate_cache_size(NULL) >> 10);
 }
 
+void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
+{
+    MigrationParameters *params;
+
+    params = qmp_query_migrate_parameters(NULL);
+
+    monitor_printf(mon, "parameters: compress-level: %" PRId64
+                   " compress-threads: %" PRId64
+                   " decompress-threads: %" PRId64
+                   " multifd-channels: %" PRId64
+                   " rdma-pinned-max: %" PRId64 "\n",
+                   params->compress_level, params->compress_threads,
+                   params->decompress_threads, params->multifd_channels,
+                   params->rdma_pinned_max);
+
+    qapi_free_MigrationParameters(params);
+}
+
 void hmp_info_cpus(Monitor *mon, const QDict *qdict)
 {
     CpuInfoList *cpu_list, *cpu;
@@ -722,6 +780,30 @@ void hmp_info_tpm(Monitor *mon, const QDict *qdict)
     qapi_free_TPMInfoList(info_list);
 }
 
+void hmp_info_tb_hotspots(Monitor *mon, const QDict *qdict)
+{
+    TbHotspotList *list, *entry;
+    Error *err = NULL;
+    int count = qdict_get_try_int(qdict, "count", 20);
+
+    list = qmp_query_tb_hotspots(true, count, &err);
+    if (err) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+
+    monitor_printf(mon, "%-18s %10s %10s %20s\n",
+                   "guest pc", "guest size", "host size", "exec count");
+    for (entry = list; entry; entry = entry->next) {
+        TbHotspot *hs = entry->value;
+
+        monitor_printf(mon, "0x%016" PRIx64 " %10" PRId64 " %10" PRId64
+                       " %20" PRId64 "\n",
+                       hs->pc, hs->guest_size, hs->host_size, hs->count);
+    }
+    qapi_free_TbHotspotList(list);
+}
+
 void hmp_quit(Monitor *mon, const QDict *qdict)
 {
     monitor_suspend(mon);
@@ -1016,6 +1098,17 @@ void hmp_migrate_cancel(Monitor *mon, const QDict *qdict)
     qmp_migrate_cancel(NULL);
 }
 
+void hmp_migrate_start_postcopy(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+
+    qmp_migrate_start_postcopy(&err);
+    if (err) {
+        monitor_printf(mon, "%s\n", error_get_pretty(err));
+        error_free(err);
+    }
+}
+
 void hmp_migrate_set_downtime(Monitor *mon, const QDict *qdict)
 {
     double value = qdict_get_double(qdict, "value");
@@ -1073,6 +1166,38 @@ void hmp_migrate_set_capability(Monitor *mon, const QDict *qdict)
     }
 }
 
+void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
+{
+    const char *param = qdict_get_str(qdict, "parameter");
+    int64_t value = qdict_get_int(qdict, "value");
+    Error *err = NULL;
+
+    if (strcmp(param, "compress-level") == 0) {
+        qmp_migrate_set_parameters(true, value, false, 0, false, 0,
+                                   false, 0, false, 0, &err);
+    } else if (strcmp(param, "compress-threads") == 0) {
+        qmp_migrate_set_parameters(false, 0, true, value, false, 0,
+                                   false, 0, false, 0, &err);
+    } else if (strcmp(param, "decompress-threads") == 0) {
+        qmp_migrate_set_parameters(false, 0, false, 0, true, value,
+                                   false, 0, false, 0, &err);
+    } else if (strcmp(param, "multifd-channels") == 0) {
+        qmp_migrate_set_parameters(false, 0, false, 0, false, 0,
+                                   true, value, false, 0, &err);
+    } else if (strcmp(param, "rdma-pinned-max") == 0) {
+        qmp_migrate_set_parameters(false, 0, false, 0, false, 0,
+                                   false, 0, true, value, &err);
+    } else {
+        error_set(&err, QERR_INVALID_PARAMETER, param);
+    }
+
+    if (err) {
+        monitor_printf(mon, "migrate_set_parameter: %s\n",
+                       error_get_pretty(err));
+        error_free(err);
+    }
+}
+
 void hmp_set_password(Monitor *mon, const QDict *qdict)
 {
     const char *protocol  = qdict_get_str(qdict, "protocol");
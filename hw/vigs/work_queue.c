@@ -1,9 +1,12 @@
 #include "hw/work_queue.h"
+#include "qemu/rcu.h"
 
 static void *work_queue_run(void *arg)
 {
     struct work_queue *wq = arg;
 
+    rcu_register_thread();
+
     qemu_mutex_lock(&wq->mutex);
 
     while (true) {
@@ -33,6 +36,8 @@ static void *work_queue_run(void *arg)
 out:
     qemu_mutex_unlock(&wq->mutex);
 
+    rcu_unregister_thread();
+
     return NULL;
 }
 
@@ -142,9 +142,10 @@ struct TranslationBlock {
     uint64_t flags; /* flags defining in which context the code was generated */
     uint16_t size;      /* size of target code for this block (1 <=
                            size <= TARGET_PAGE_SIZE) */
-    uint16_t cflags;    /* compile flags */
+    uint32_t cflags;    /* compile flags */
 #define CF_COUNT_MASK  0x7fff
 #define CF_LAST_IO     0x8000 /* Last insn may be an IO access.  */
+#define CF_TRACE       0x10000 /* Follow direct jumps (hot block).  */
 
     void *tc_ptr;    /* pointer to the translated code */
     /* next matching tb for physical address. */
@@ -169,6 +170,9 @@ struct TranslationBlock {
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
     uint32_t icount;
+    /* number of times this block was entered, only maintained when
+       translated with -tb-profile */
+    uint64_t exec_count;
 };
 
 #include "exec/spinlock.h"
@@ -385,6 +389,19 @@ void cpu_set_debug_excp_handler(CPUDebugExcpHandler *handler);
 
 /* vl.c */
 extern int singlestep;
+/* count TB executions (-tb-profile) */
+extern int tb_profile;
+/* write a /tmp/perf-<pid>.map symbol file for the translated code */
+extern int tb_perf_map;
+/* retranslate TBs executed that many times as traces (-tb-trace) */
+extern unsigned int tb_trace_threshold;
+
+/* Whether the entry of @tb is instrumented with an execution counter,
+   either for -tb-profile or to detect hot blocks for -tb-trace.  */
+static inline bool tb_counts_exec(TranslationBlock *tb)
+{
+    return tb_profile || (tb_trace_threshold && !(tb->cflags & CF_TRACE));
+}
 
 /* cpu-exec.c */
 extern volatile sig_atomic_t exit_request;
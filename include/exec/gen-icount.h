@@ -21,21 +21,31 @@ static inline void gen_tb_start(void)
     tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, exitreq_label);
     tcg_temp_free_i32(flag);
 
-    if (!use_icount)
-        return;
+    if (use_icount) {
+        icount_label = gen_new_label();
+        count = tcg_temp_local_new_i32();
+        tcg_gen_ld_i32(count, cpu_env,
+                       -ENV_OFFSET + offsetof(CPUState, icount_decr.u32));
+        /* This is a horrid hack to allow fixing up the value later.  */
+        icount_arg = tcg_ctx.gen_opparam_ptr + 1;
+        tcg_gen_subi_i32(count, count, 0xdeadbeef);
+
+        tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, icount_label);
+        tcg_gen_st16_i32(count, cpu_env,
+                         -ENV_OFFSET + offsetof(CPUState, icount_decr.u16.low));
+        tcg_temp_free_i32(count);
+    }
 
-    icount_label = gen_new_label();
-    count = tcg_temp_local_new_i32();
-    tcg_gen_ld_i32(count, cpu_env,
-                   -ENV_OFFSET + offsetof(CPUState, icount_decr.u32));
-    /* This is a horrid hack to allow fixing up the value later.  */
-    icount_arg = tcg_ctx.gen_opparam_ptr + 1;
-    tcg_gen_subi_i32(count, count, 0xdeadbeef);
+    if (tcg_ctx.tb_exec_count) {
+        TCGv_ptr ptr = tcg_const_ptr(tcg_ctx.tb_exec_count);
+        TCGv_i64 exec_count = tcg_temp_new_i64();
 
-    tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, icount_label);
-    tcg_gen_st16_i32(count, cpu_env,
-                     -ENV_OFFSET + offsetof(CPUState, icount_decr.u16.low));
-    tcg_temp_free_i32(count);
+        tcg_gen_ld_i64(exec_count, ptr, 0);
+        tcg_gen_addi_i64(exec_count, exec_count, 1);
+        tcg_gen_st_i64(exec_count, ptr, 0);
+        tcg_temp_free_i64(exec_count);
+        tcg_temp_free_ptr(ptr);
+    }
 }
 
 static void gen_tb_end(TranslationBlock *tb, int num_insns)
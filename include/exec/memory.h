@@ -202,6 +202,7 @@ struct AddressSpace {
     char *name;
     MemoryRegion *root;
     struct FlatView *current_map;
+    bool topology_changed;
     int ioeventfd_nb;
     struct MemoryRegionIoeventfd *ioeventfds;
     struct AddressSpaceDispatch *dispatch;
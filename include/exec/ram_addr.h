@@ -63,7 +63,8 @@ static inline void cpu_physical_memory_set_dirty_flag(ram_addr_t addr,
                                                       unsigned client)
 {
     assert(client < DIRTY_MEMORY_NUM);
-    set_bit(addr >> TARGET_PAGE_BITS, ram_list.dirty_memory[client]);
+    bitmap_set_atomic(ram_list.dirty_memory[client],
+                      addr >> TARGET_PAGE_BITS, 1);
 }
 
 static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
@@ -73,9 +74,12 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
 
     end = TARGET_PAGE_ALIGN(start + length) >> TARGET_PAGE_BITS;
     page = start >> TARGET_PAGE_BITS;
-    bitmap_set(ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION], page, end - page);
-    bitmap_set(ram_list.dirty_memory[DIRTY_MEMORY_VGA], page, end - page);
-    bitmap_set(ram_list.dirty_memory[DIRTY_MEMORY_CODE], page, end - page);
+    bitmap_set_atomic(ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION],
+                      page, end - page);
+    bitmap_set_atomic(ram_list.dirty_memory[DIRTY_MEMORY_VGA],
+                      page, end - page);
+    bitmap_set_atomic(ram_list.dirty_memory[DIRTY_MEMORY_CODE],
+                      page, end - page);
     xen_modified_memory(start, length);
 }
 
@@ -102,9 +106,12 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
             if (bitmap[k]) {
                 unsigned long temp = leul_to_cpu(bitmap[k]);
 
-                ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION][page + k] |= temp;
-                ram_list.dirty_memory[DIRTY_MEMORY_VGA][page + k] |= temp;
-                ram_list.dirty_memory[DIRTY_MEMORY_CODE][page + k] |= temp;
+                atomic_or(&ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION][page + k],
+                          temp);
+                atomic_or(&ram_list.dirty_memory[DIRTY_MEMORY_VGA][page + k],
+                          temp);
+                atomic_or(&ram_list.dirty_memory[DIRTY_MEMORY_CODE][page + k],
+                          temp);
             }
         }
         xen_modified_memory(start, pages);
@@ -140,11 +147,15 @@ static inline void cpu_physical_memory_clear_dirty_range(ram_addr_t start,
     assert(client < DIRTY_MEMORY_NUM);
     end = TARGET_PAGE_ALIGN(start + length) >> TARGET_PAGE_BITS;
     page = start >> TARGET_PAGE_BITS;
-    bitmap_clear(ram_list.dirty_memory[client], page, end - page);
+    bitmap_test_and_clear_atomic(ram_list.dirty_memory[client],
+                                 page, end - page);
 }
 
 void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t length,
                                      unsigned client);
+bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
+                                              ram_addr_t length,
+                                              unsigned client);
 
 #endif
 #endif
@@ -33,6 +33,24 @@
 #define QEMU_VM_SECTION_END          0x03
 #define QEMU_VM_SECTION_FULL         0x04
 #define QEMU_VM_SUBSECTION           0x05
+#define QEMU_VM_COMMAND              0x06
+
+/* Commands sent in QEMU_VM_COMMAND sections, followed by a be16 length
+ * and that many bytes of arguments.
+ */
+enum qemu_vm_cmd {
+    MIG_CMD_POSTCOPY_ADVISE = 1,  /* be64 page size; post-copy may follow */
+    MIG_CMD_POSTCOPY_RAM_DISCARD, /* Drop stale pages of a RAM block */
+    MIG_CMD_POSTCOPY_LISTEN,      /* Start serving faults on guest RAM */
+    MIG_CMD_PACKAGED,             /* be32 length; sections to load from it */
+};
+
+/* Messages from the destination to the source of a post-copy migration,
+ * a be16 type and a be16 length followed by the arguments.
+ */
+enum mig_rp_message_type {
+    MIG_RP_MSG_REQ_PAGE = 1,      /* be64 offset, byte + idstr of block */
+};
 
 struct MigrationParams {
     bool blk;
@@ -60,11 +78,31 @@ struct MigrationState
     int64_t dirty_bytes_rate;
     bool enabled_capabilities[MIGRATION_CAPABILITY_MAX];
     int64_t xbzrle_cache_size;
+    int compress_level;
+    int compress_threads;
+    int decompress_threads;
+    int multifd_channels;
+    int rdma_pinned_max;
+    int *multifd_fds;
+    int multifd_fd_count;
     int64_t setup_time;
     int64_t dirty_sync_count;
+    /* of the last synchronization of the dirty bitmap, in us */
+    int64_t dirty_sync_time;
+    int64_t dirty_sync_locked_time;
+    int64_t dirty_sync_time_max;
+
+    /* Post-copy: requested by migrate-start-postcopy, entered by the
+     * migration thread once the guest has been stopped here.
+     */
+    bool start_postcopy;
+    bool in_postcopy;
+    QEMUFile *return_path;
+    QemuThread rp_thread;
 };
 
 void process_incoming_migration(QEMUFile *f);
+void process_incoming_migration_end(QEMUFile *f, int ret);
 
 void qemu_start_incoming_migration(const char *uri, Error **errp);
 
@@ -100,6 +138,8 @@ void migrate_fd_connect(MigrationState *s);
 
 int migrate_fd_close(MigrationState *s);
 
+void migrate_multifd_close(MigrationState *s);
+
 void add_migration_state_change_notifier(Notifier *notify);
 void remove_migration_state_change_notifier(Notifier *notify);
 bool migration_in_setup(MigrationState *);
@@ -111,6 +151,18 @@ uint64_t ram_bytes_remaining(void);
 uint64_t ram_bytes_transferred(void);
 uint64_t ram_bytes_total(void);
 void free_xbzrle_decoded_buf(void);
+void migrate_decompress_threads_join(void);
+void multifd_load_setup(int *fds, int count);
+void multifd_load_cleanup(void);
+void ram_save_queue_page(const char *idstr, ram_addr_t offset);
+int ram_postcopy_send_discard(QEMUFile *f);
+int ram_discard_range(const char *idstr, ram_addr_t start,
+                      ram_addr_t length);
+int ram_postcopy_incoming_check(void);
+int ram_postcopy_incoming_register(void);
+uint64_t ram_postcopy_requests(void);
+int ram_save_file(const char *filename);
+int ram_load_file(const char *filename);
 
 void acct_update_position(QEMUFile *f, size_t size, bool zero);
 
@@ -125,6 +177,7 @@ uint64_t xbzrle_mig_pages_transferred(void);
 uint64_t xbzrle_mig_pages_overflow(void);
 uint64_t xbzrle_mig_pages_cache_miss(void);
 double xbzrle_mig_cache_miss_rate(void);
+CompressionStats *compress_mig_stats(void);
 
 void ram_handle_compressed(void *host, uint8_t ch, uint64_t size);
 
@@ -143,6 +196,7 @@ void migrate_add_blocker(Error *reason);
 void migrate_del_blocker(Error *reason);
 
 bool migrate_rdma_pin_all(void);
+int migrate_rdma_pinned_max(void);
 bool migrate_zero_blocks(void);
 
 bool migrate_auto_converge(void);
@@ -154,6 +208,16 @@ int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
 int migrate_use_xbzrle(void);
 int64_t migrate_xbzrle_cache_size(void);
 
+bool migrate_use_compression(void);
+int migrate_compress_level(void);
+int migrate_compress_threads(void);
+int migrate_decompress_threads(void);
+
+bool migrate_use_multifd(void);
+int migrate_multifd_channels(void);
+
+bool migrate_postcopy_ram(void);
+
 int64_t xbzrle_cache_resize(int64_t new_size);
 
 void ram_control_before_iterate(QEMUFile *f, uint64_t flags);
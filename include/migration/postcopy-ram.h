@@ -0,0 +1,46 @@
+/*
+ * Post-copy live migration, destination side
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_POSTCOPY_RAM_H
+#define QEMU_POSTCOPY_RAM_H
+
+#include "qemu-common.h"
+#include "qapi-types.h"
+
+/* Whether guest RAM can be demand paged here, in pages of @page_size */
+bool postcopy_ram_supported_by_host(uint64_t page_size);
+
+/* Whether the RAM block at @host can be demand paged, checked on advise */
+int postcopy_ram_check_block(const char *idstr, void *host, size_t length);
+
+/*
+ * Demand paging of guest RAM: postcopy_ram_incoming_init() opens the
+ * userfaultfd, the RAM blocks are then registered, and
+ * postcopy_ram_incoming_start() starts the thread that sends a request
+ * on @return_path for each page the guest faults on.
+ */
+int postcopy_ram_incoming_init(QEMUFile *return_path);
+int postcopy_ram_register_block(const char *idstr, void *host, size_t length);
+int postcopy_ram_incoming_start(void);
+void postcopy_ram_incoming_cleanup(void);
+bool postcopy_ram_incoming_active(void);
+
+/* Make the pages in [@host, @host + @length) fault again */
+int postcopy_ram_discard_range(void *host, size_t length);
+
+/*
+ * Fill a missing page atomically and wake up the threads that faulted on
+ * it; @from is a page-sized buffer, such as postcopy_get_tmp_page().
+ */
+int postcopy_place_page(void *host, void *from);
+int postcopy_place_zero_page(void *host);
+void *postcopy_get_tmp_page(void);
+
+/* Fault statistics, or NULL if no post-copy migration came in */
+PostcopyStats *postcopy_ram_incoming_stats(void);
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Interval trees
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A red-black tree of closed intervals [start, last], sorted by start and
+ * augmented with the largest last of each subtree, so that the intervals
+ * overlapping a range are found in O(log n) each.  Intervals may overlap
+ * each other.
+ *
+ * The tree does no allocation and no locking: nodes are embedded in the
+ * caller's structures and are found back with container_of().
+ */
+
+typedef struct IntervalTreeNode IntervalTreeNode;
+
+struct IntervalTreeNode {
+    IntervalTreeNode *parent;
+    IntervalTreeNode *left;
+    IntervalTreeNode *right;
+    bool red;
+
+    uint64_t start;
+    uint64_t last;
+    uint64_t subtree_last;
+};
+
+typedef struct IntervalTreeRoot {
+    IntervalTreeNode *root;
+} IntervalTreeRoot;
+
+/**
+ * interval_tree_insert:
+ * @node: Node to insert, with start and last set.
+ * @root: Tree to insert into.
+ */
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_tree_remove:
+ * @node: Node to remove, which must be in @root.
+ * @root: Tree to remove from.
+ */
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_tree_iter_first:
+ * @root: Tree to search.
+ * @start: First value of the range.
+ * @last: Last value of the range, inclusive.
+ *
+ * Return the node with the lowest start among those that overlap
+ * [@start, @last], or NULL if there is none.
+ */
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last);
+
+/**
+ * interval_tree_iter_next:
+ * @node: Node returned by the previous call for the same range.
+ * @start: First value of the range.
+ * @last: Last value of the range, inclusive.
+ *
+ * Return the next node in start order that overlaps [@start, @last], or
+ * NULL.  The tree must not be modified during the iteration.
+ */
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last);
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * Read-copy-update for QEMU
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef QEMU_RCU_H
+#define QEMU_RCU_H
+
+#include <assert.h>
+#include <stddef.h>
+#include "qemu/atomic.h"
+#include "qemu/queue.h"
+
+/* Read-copy-update
+ *
+ * Readers bracket their accesses to an RCU-protected data structure with
+ * rcu_read_lock() and rcu_read_unlock().  These only touch thread-local
+ * data and never block, and they can be nested.
+ *
+ * Writers build a new copy of the data structure, publish it with
+ * atomic_rcu_set() and hand the old copy to call_rcu(), which frees it
+ * once every reader that could still see it has left its critical section.
+ * Writers still need their own lock (usually the iothread mutex) against
+ * each other.
+ *
+ * A thread must call rcu_register_thread() before its first
+ * rcu_read_lock(), and rcu_unregister_thread() before it exits.  The main
+ * thread is registered automatically.
+ */
+
+struct rcu_reader_data {
+    /* Grace period counter snapshot, 0 if outside a critical section.  */
+    unsigned long ctr;
+    unsigned depth;
+    QLIST_ENTRY(rcu_reader_data) node;
+};
+
+extern unsigned long rcu_gp_ctr;
+extern __thread struct rcu_reader_data rcu_reader;
+
+static inline void rcu_read_lock(void)
+{
+    struct rcu_reader_data *p_rcu_reader = &rcu_reader;
+
+    if (p_rcu_reader->depth++ > 0) {
+        return;
+    }
+
+    /* The full barrier in atomic_xchg orders the snapshot before the
+     * accesses in the critical section.
+     */
+    atomic_xchg(&p_rcu_reader->ctr, atomic_read(&rcu_gp_ctr));
+}
+
+static inline void rcu_read_unlock(void)
+{
+    struct rcu_reader_data *p_rcu_reader = &rcu_reader;
+
+    assert(p_rcu_reader->depth != 0);
+    if (--p_rcu_reader->depth > 0) {
+        return;
+    }
+
+    atomic_xchg(&p_rcu_reader->ctr, 0);
+}
+
+void rcu_register_thread(void);
+void rcu_unregister_thread(void);
+
+/* Wait until every critical section that was active on entry has ended.
+ * Must not be called from within a critical section.
+ */
+void synchronize_rcu(void);
+
+struct rcu_head;
+typedef void RCUCBFunc(struct rcu_head *head);
+
+struct rcu_head {
+    struct rcu_head *next;
+    RCUCBFunc *func;
+};
+
+/* Run @func on @head from a separate thread after a grace period.  */
+void call_rcu1(struct rcu_head *head, RCUCBFunc *func);
+
+/* Same, but @func takes a pointer to the structure that embeds @head as
+ * @field.  @field must be the first member so that the cast is valid.
+ */
+#define call_rcu(head, func, field)                                      \
+    call_rcu1(({                                                         \
+         char __attribute__((unused))                                    \
+            offset_must_be_zero[-offsetof(typeof(*(head)), field)],      \
+            func_type_invalid = (func) - (void (*)(typeof(head)))(func); \
+         &(head)->field;                                                 \
+      }),                                                                \
+      (RCUCBFunc *)(func))
+
+/* Publish a pointer to an RCU-protected structure, and read it back.  */
+#define atomic_rcu_set(ptr, i) do {                                      \
+    smp_wmb();                                                           \
+    atomic_set(ptr, i);                                                  \
+} while (0)
+
+#define atomic_rcu_read(ptr) ({                                          \
+    typeof(*(ptr)) _val = atomic_read(ptr);                              \
+    smp_read_barrier_depends();                                          \
+    _val;                                                                \
+})
+
+#endif
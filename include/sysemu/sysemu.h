@@ -74,6 +74,9 @@ void qemu_add_machine_init_done_notifier(Notifier *notify);
 void do_savevm(Monitor *mon, const QDict *qdict);
 int load_vmstate(const char *name);
 void do_delvm(Monitor *mon, const QDict *qdict);
+void do_savevm_file(Monitor *mon, const QDict *qdict);
+int load_vmstate_file(const char *filename, bool template);
+void qemu_add_vm_clone_notifier(Notifier *notify);
 void do_info_snapshots(Monitor *mon, const QDict *qdict);
 
 void qemu_announce_self(void);
@@ -85,6 +88,12 @@ int qemu_savevm_state_iterate(QEMUFile *f);
 void qemu_savevm_state_complete(QEMUFile *f);
 void qemu_savevm_state_cancel(void);
 uint64_t qemu_savevm_state_pending(QEMUFile *f, uint64_t max_size);
+void qemu_savevm_send_postcopy_advise(QEMUFile *f);
+void qemu_savevm_send_postcopy_ram_discard(QEMUFile *f, const char *idstr,
+                                           uint16_t len, uint64_t *start,
+                                           uint64_t *length);
+int qemu_savevm_state_postcopy_start(QEMUFile *f);
+void qemu_savevm_state_complete_postcopy(QEMUFile *f);
 int qemu_loadvm_state(QEMUFile *f);
 
 /* SLIRP */
@@ -143,6 +152,7 @@ extern QEMUClockType rtc_clock;
 
 extern int nb_numa_nodes;
 extern uint64_t node_mem[MAX_NODES];
+extern int node_host[MAX_NODES];
 extern unsigned long *node_cpumask[MAX_NODES];
 
 #define MAX_OPTION_ROMS 16
@@ -38,11 +38,15 @@
 char *exec_path;
 
 int singlestep;
+int tb_profile;
+int tb_perf_map;
+unsigned int tb_trace_threshold;
 const char *filename;
 const char *argv0;
 int gdbstub_port;
 envlist_t *envlist;
 static const char *cpu_model;
+static const char *tb_cache_dir;
 unsigned long mmap_min_addr;
 #if defined(CONFIG_USE_GUEST_BASE)
 unsigned long guest_base;
@@ -3610,6 +3614,25 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static void handle_arg_tb_trace(const char *arg)
+{
+    tb_trace_threshold = atoi(arg);
+    if (tb_trace_threshold == 0) {
+        fprintf(stderr, "invalid trace threshold '%s'\n", arg);
+        exit(1);
+    }
+}
+
+static void handle_arg_perfmap(const char *arg)
+{
+    tb_perf_map = 1;
+}
+
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_dir = arg;
+}
+
 static void handle_arg_strace(const char *arg)
 {
     do_strace = 1;
@@ -3665,6 +3688,13 @@ static const struct qemu_argument arg_table[] = {
      "pagesize",   "set the host page size to 'pagesize'"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
+    {"tb-trace",   "QEMU_TB_TRACE",    true,  handle_arg_tb_trace,
+     "threshold",  "retranslate blocks executed 'threshold' times as traces"},
+    {"perfmap",    "QEMU_PERFMAP",     false, handle_arg_perfmap,
+     "",           "write a perf map of the translated code"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "keep a profile of translated blocks in 'dir' and "
+     "translate them ahead on later runs"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"version",    "QEMU_VERSION",     false, handle_arg_version,
@@ -4376,6 +4406,10 @@ int main(int argc, char **argv, char **envp)
         }
         gdb_handlesig(cpu, 0);
     }
+    /* Breakpoints and single-stepping change the code of every block */
+    if (tb_cache_dir && !gdbstub_port && !singlestep) {
+        tb_cache_start(cpu, tb_cache_dir, exec_path, info->load_bias);
+    }
     cpu_loop(env);
     /* never exits */
     return 0;
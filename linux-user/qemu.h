@@ -268,6 +268,11 @@ void cpu_list_unlock(void);
 void mmap_fork_start(void);
 void mmap_fork_end(int child);
 
+/* tbcache.c */
+void tb_cache_start(CPUState *cpu, const char *dir, const char *exec_path,
+                    abi_ulong load_bias);
+void tb_cache_save(void);
+
 /* main.c */
 extern unsigned long guest_stack_size;
 
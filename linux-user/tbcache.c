@@ -0,0 +1,368 @@
+/*
+ *  Persistent translation profile for qemu-user
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* When a guest binary exits, the guest blocks that were translated are
+ * written to a file keyed by the binary and its load address.  The next
+ * run of the same binary starts a thread that translates those blocks in
+ * the background while the guest runs, so that the CPU finds them already
+ * in the physical hash table.
+ *
+ * Only guest addresses, TB flags and a checksum of the guest code are
+ * stored, never host code; a block is translated again only if the guest
+ * code at that address is still the same, so a stale file costs time but
+ * cannot produce wrong code.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <link.h>
+#include <sys/stat.h>
+
+#include "qemu.h"
+#include "qemu-common.h"
+#include "qemu/thread.h"
+#include "qemu/atomic.h"
+#include "tcg.h"
+
+#define TB_CACHE_MAGIC "QEMUTBC2"
+#define TB_CACHE_MAX_ENTRIES 65536
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+/* Guest code that the translator may look at past the end of a block */
+#define TB_CACHE_CODE_SLACK 16
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    uint64_t key;
+    uint32_t count;
+    uint32_t pad;
+} TBCacheHeader;
+
+typedef struct TBCacheEntry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t sum;
+    uint64_t flags;
+    uint32_t size;
+    uint32_t pad;
+} TBCacheEntry;
+
+static char *tb_cache_file;
+static uint64_t tb_cache_key;
+static TBCacheEntry *tb_cache_entries;
+static uint32_t tb_cache_count;
+static CPUState *tb_cache_cpu;
+static QemuThread tb_cache_thread;
+static int tb_cache_stop;
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    while (len--) {
+        h = (h ^ *p++) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t guest_code_sum(target_ulong pc, uint32_t size)
+{
+    return fnv1a(0xcbf29ce484222325ULL, g2h(pc), size);
+}
+
+/* Same search as tb_find_slow, without translating.  */
+static bool tb_cache_present(target_ulong pc, target_ulong cs_base,
+                             uint64_t flags)
+{
+    TranslationBlock *tb;
+
+    tb = tcg_ctx.tb_ctx.tb_phys_hash[tb_phys_hash_func(pc)];
+    for (; tb; tb = tb->phys_hash_next) {
+        if (tb->pc == pc && tb->cs_base == cs_base && tb->flags == flags) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool tb_cache_buffer_full(void)
+{
+    /* Never cause a flush under the feet of the running guest */
+    return tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks / 2 ||
+        (size_t)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer) >=
+        tcg_ctx.code_gen_buffer_max_size / 2;
+}
+
+/* Try to translate one entry; returns false if its code is not mapped
+ * yet, e.g. because the dynamic loader has not loaded the library.
+ * Locks are taken in the same order as fork_start().
+ */
+static bool tb_cache_warm_one(TBCacheEntry *e)
+{
+    target_ulong pc = e->pc;
+    bool done = true;
+
+    spin_lock(&tcg_ctx.tb_ctx.tb_lock);
+    mmap_lock();
+    if (page_check_range(pc, e->size + TB_CACHE_CODE_SLACK,
+                         PAGE_READ | PAGE_EXEC) < 0) {
+        done = false;
+    } else if (!tb_cache_buffer_full() &&
+               guest_code_sum(pc, e->size) == e->sum &&
+               !tb_cache_present(pc, e->cs_base, e->flags)) {
+        tb_gen_code(tb_cache_cpu, pc, e->cs_base, e->flags, 0);
+    }
+    mmap_unlock();
+    spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
+    return done;
+}
+
+static void *tb_cache_warm(void *opaque)
+{
+    bool *done = g_new0(bool, tb_cache_count);
+    uint32_t i, remaining = tb_cache_count;
+    int idle_passes = 0;
+
+    /* Blocks of libraries show up as the loader maps them, so retry the
+     * missing ones for a while.
+     */
+    while (remaining && idle_passes < 100) {
+        uint32_t before = remaining;
+
+        for (i = 0; i < tb_cache_count; i++) {
+            if (atomic_read(&tb_cache_stop)) {
+                goto out;
+            }
+            if (!done[i] && tb_cache_warm_one(&tb_cache_entries[i])) {
+                done[i] = true;
+                remaining--;
+            }
+        }
+        if (remaining == before) {
+            idle_passes++;
+            g_usleep(10000);
+        } else {
+            idle_passes = 0;
+        }
+    }
+out:
+    g_free(done);
+    return NULL;
+}
+
+/* The GNU build id note of the QEMU executable, the first object */
+static int tb_cache_hash_build_id(struct dl_phdr_info *info, size_t size,
+                                  void *opaque)
+{
+    uint64_t *key = opaque;
+    int i;
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        const char *p, *end;
+
+        if (phdr->p_type != PT_NOTE) {
+            continue;
+        }
+        p = (const char *)(info->dlpi_addr + phdr->p_vaddr);
+        end = p + phdr->p_memsz;
+        while (p + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr) *note = (const ElfW(Nhdr) *)p;
+            const char *name = p + sizeof(*note);
+            const char *desc = name + ROUND_UP(note->n_namesz, 4);
+
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+                !memcmp(name, "GNU", 4) && desc + note->n_descsz <= end) {
+                *key = fnv1a(*key, desc, note->n_descsz);
+                return 1;
+            }
+            p = desc + ROUND_UP(note->n_descsz, 4);
+        }
+    }
+    return -1;
+}
+
+/* Blocks translated by another build of QEMU may have other flags, so
+ * the key includes the build id, or the contents of the executable if
+ * it was linked without one.
+ */
+static uint64_t tb_cache_hash_qemu(uint64_t key)
+{
+    char buf[65536];
+    size_t len;
+    FILE *f;
+
+    if (dl_iterate_phdr(tb_cache_hash_build_id, &key) > 0) {
+        return key;
+    }
+    f = fopen("/proc/self/exe", "rb");
+    if (!f) {
+        return 0;
+    }
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+        key = fnv1a(key, buf, len);
+    }
+    fclose(f);
+    return key;
+}
+
+static bool tb_cache_load(void)
+{
+    TBCacheHeader hdr;
+    FILE *f;
+
+    f = fopen(tb_cache_file, "rb");
+    if (!f) {
+        return false;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr.magic, TB_CACHE_MAGIC, sizeof(hdr.magic)) ||
+        hdr.key != tb_cache_key || hdr.count > TB_CACHE_MAX_ENTRIES) {
+        fclose(f);
+        return false;
+    }
+    tb_cache_entries = g_new(TBCacheEntry, hdr.count);
+    tb_cache_count = fread(tb_cache_entries, sizeof(TBCacheEntry),
+                           hdr.count, f);
+    fclose(f);
+    return tb_cache_count > 0;
+}
+
+void tb_cache_start(CPUState *cpu, const char *dir, const char *exec_path,
+                    abi_ulong load_bias)
+{
+    struct stat st;
+    uint64_t key;
+
+    if (stat(exec_path, &st) < 0) {
+        return;
+    }
+
+    /* The file identifies the binary; the checksums catch the rest */
+    key = tb_cache_hash_qemu(0xcbf29ce484222325ULL);
+    if (!key) {
+        return;
+    }
+    key = fnv1a(key, &st.st_dev, sizeof(st.st_dev));
+    key = fnv1a(key, &st.st_ino, sizeof(st.st_ino));
+    key = fnv1a(key, &st.st_size, sizeof(st.st_size));
+    key = fnv1a(key, &st.st_mtime, sizeof(st.st_mtime));
+    key = fnv1a(key, &load_bias, sizeof(load_bias));
+
+    tb_cache_key = key;
+    tb_cache_file = g_strdup_printf("%s/%016" PRIx64 ".tbc", dir, key);
+
+    if (tb_cache_load()) {
+        /* The translator may update the CPU it is given, so the thread
+         * gets its own copy, kept out of the list of guest threads.
+         */
+        tb_cache_cpu = ENV_GET_CPU(cpu_copy(cpu->env_ptr));
+        cpu_list_lock();
+        QTAILQ_REMOVE(&cpus, tb_cache_cpu, node);
+        cpu_list_unlock();
+        qemu_thread_create(&tb_cache_thread, "tb-cache", tb_cache_warm,
+                           NULL, QEMU_THREAD_DETACHED);
+    }
+}
+
+void tb_cache_save(void)
+{
+    GHashTable *seen;
+    TBCacheHeader hdr;
+    TBCacheEntry e;
+    char *tmp;
+    FILE *f;
+    int i;
+
+    if (!tb_cache_file) {
+        return;
+    }
+    atomic_mb_set(&tb_cache_stop, 1);
+
+    tmp = g_strdup_printf("%s.%d", tb_cache_file, (int)getpid());
+    f = fopen(tmp, "wb");
+    if (!f) {
+        g_free(tmp);
+        return;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TB_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.key = tb_cache_key;
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+        goto fail;
+    }
+
+    /* Blocks translated in this run, then the ones from earlier runs
+     * that this run did not reach.
+     */
+    seen = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    spin_lock(&tcg_ctx.tb_ctx.tb_lock);
+    mmap_lock();
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs &&
+         hdr.count < TB_CACHE_MAX_ENTRIES; i++) {
+        TranslationBlock *tb = &tcg_ctx.tb_ctx.tbs[i];
+
+        if (tb->cflags || tb->size == 0 ||
+            page_check_range(tb->pc, tb->size, PAGE_READ) < 0) {
+            continue;
+        }
+        e.pc = tb->pc;
+        e.cs_base = tb->cs_base;
+        e.flags = tb->flags;
+        e.size = tb->size;
+        e.sum = guest_code_sum(tb->pc, tb->size);
+        if (fwrite(&e, sizeof(e), 1, f) != 1) {
+            break;
+        }
+        g_hash_table_insert(seen, g_memdup(&e.pc, sizeof(e.pc)), &tb->pc);
+        hdr.count++;
+    }
+    for (i = 0; i < tb_cache_count && hdr.count < TB_CACHE_MAX_ENTRIES; i++) {
+        if (g_hash_table_lookup(seen, &tb_cache_entries[i].pc) ||
+            fwrite(&tb_cache_entries[i], sizeof(e), 1, f) != 1) {
+            continue;
+        }
+        hdr.count++;
+    }
+    mmap_unlock();
+    spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
+    g_hash_table_destroy(seen);
+
+    /* Publish atomically, concurrent runs of the same binary may race */
+    if (fseek(f, 0, SEEK_SET) == 0 &&
+        fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+        fclose(f) == 0) {
+        if (rename(tmp, tb_cache_file) < 0) {
+            unlink(tmp);
+        }
+        g_free(tmp);
+        return;
+    }
+    unlink(tmp);
+    g_free(tmp);
+    return;
+
+fail:
+    fclose(f);
+    unlink(tmp);
+    g_free(tmp);
+}
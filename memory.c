@@ -111,6 +111,12 @@ static bool memory_listener_match(MemoryListener *listener,
         || listener->address_space_filter == section->address_space;
 }
 
+static bool memory_listener_changed(MemoryListener *listener)
+{
+    return !listener->address_space_filter
+        || listener->address_space_filter->topology_changed;
+}
+
 #define MEMORY_LISTENER_CALL_GLOBAL(_callback, _direction, _args...)    \
     do {                                                                \
         MemoryListener *_listener;                                      \
@@ -136,6 +142,36 @@ static bool memory_listener_match(MemoryListener *listener,
         }                                                               \
     } while (0)
 
+/* Like MEMORY_LISTENER_CALL_GLOBAL, but skip the listeners that only watch
+ * an address space whose topology did not change.
+ */
+#define MEMORY_LISTENER_CALL_CHANGED(_callback, _direction)             \
+    do {                                                                \
+        MemoryListener *_listener;                                      \
+                                                                        \
+        switch (_direction) {                                           \
+        case Forward:                                                   \
+            QTAILQ_FOREACH(_listener, &memory_listeners, link) {        \
+                if (_listener->_callback                                \
+                    && memory_listener_changed(_listener)) {            \
+                    _listener->_callback(_listener);                    \
+                }                                                       \
+            }                                                           \
+            break;                                                      \
+        case Reverse:                                                   \
+            QTAILQ_FOREACH_REVERSE(_listener, &memory_listeners,        \
+                                   memory_listeners, link) {            \
+                if (_listener->_callback                                \
+                    && memory_listener_changed(_listener)) {            \
+                    _listener->_callback(_listener);                    \
+                }                                                       \
+            }                                                           \
+            break;                                                      \
+        default:                                                        \
+            abort();                                                    \
+        }                                                               \
+    } while (0)
+
 #define MEMORY_LISTENER_CALL(_callback, _direction, _section, _args...) \
     do {                                                                \
         MemoryListener *_listener;                                      \
@@ -260,6 +296,23 @@ static bool flatrange_equal(FlatRange *a, FlatRange *b)
         && a->readonly == b->readonly;
 }
 
+/* Compare two views, including the dirty logging state of each range. */
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i])
+            || a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static void flatview_init(FlatView *view)
 {
     view->ref = 1;
@@ -756,11 +809,12 @@ static void address_space_update_topology_pass(AddressSpace *as,
 }
 
 
-static void address_space_update_topology(AddressSpace *as)
+static void address_space_update_topology(AddressSpace *as,
+                                          FlatView *new_view)
 {
     FlatView *old_view = address_space_get_flatview(as);
-    FlatView *new_view = generate_memory_topology(as->root);
 
+    flatview_ref(new_view);
     address_space_update_topology_pass(as, old_view, new_view, false);
     address_space_update_topology_pass(as, old_view, new_view, true);
 
@@ -776,8 +830,6 @@ static void address_space_update_topology(AddressSpace *as)
      * counting is necessary.
      */
     flatview_unref(old_view);
-
-    address_space_update_ioeventfds(as);
 }
 
 void memory_region_transaction_begin(void)
@@ -788,19 +840,66 @@ void memory_region_transaction_begin(void)
 
 void memory_region_transaction_commit(void)
 {
-    AddressSpace *as;
+    AddressSpace *as, *other;
+    FlatView **views;
+    unsigned nr, i, j;
 
     assert(memory_region_transaction_depth);
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth && memory_region_update_pending) {
         memory_region_update_pending = false;
-        MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
+        /* Render each root once, even if several address spaces (e.g. the
+         * bus master address spaces of PCI devices) share it, and find out
+         * which address spaces actually changed.  Listeners that only
+         * watch an unchanged address space are left alone.
+         */
+        nr = 0;
         QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-            address_space_update_topology(as);
+            ++nr;
         }
+        views = g_new0(FlatView *, nr);
+        i = 0;
+        QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+            j = 0;
+            QTAILQ_FOREACH(other, &address_spaces, address_spaces_link) {
+                if (j == i) {
+                    views[i] = generate_memory_topology(as->root);
+                    break;
+                }
+                if (other->root == as->root) {
+                    views[i] = views[j];
+                    flatview_ref(views[i]);
+                    break;
+                }
+                ++j;
+            }
+            if (!flatview_equal(as->current_map, views[i])) {
+                as->topology_changed = true;
+            }
+            ++i;
+        }
+
+        MEMORY_LISTENER_CALL_CHANGED(begin, Forward);
+
+        i = 0;
+        QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+            if (as->topology_changed) {
+                address_space_update_topology(as, views[i]);
+            }
+            address_space_update_ioeventfds(as);
+            ++i;
+        }
+
+        MEMORY_LISTENER_CALL_CHANGED(commit, Forward);
 
-        MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+        i = 0;
+        QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+            as->topology_changed = false;
+            flatview_unref(views[i]);
+            ++i;
+        }
+        g_free(views);
     }
 }
 
@@ -1188,13 +1287,9 @@ void memory_region_set_dirty(MemoryRegion *mr, hwaddr addr,
 bool memory_region_test_and_clear_dirty(MemoryRegion *mr, hwaddr addr,
                                         hwaddr size, unsigned client)
 {
-    bool ret;
     assert(mr->terminates);
-    ret = cpu_physical_memory_get_dirty(mr->ram_addr + addr, size, client);
-    if (ret) {
-        cpu_physical_memory_reset_dirty(mr->ram_addr + addr, size, client);
-    }
-    return ret;
+    return cpu_physical_memory_test_and_clear_dirty(mr->ram_addr + addr,
+                                                    size, client);
 }
 
 
@@ -1711,6 +1806,8 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->root = root;
     as->current_map = g_new(FlatView, 1);
     flatview_init(as->current_map);
+    /* The dispatch listener needs a full update even if the view is empty. */
+    as->topology_changed = true;
     as->ioeventfd_nb = 0;
     as->ioeventfds = NULL;
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
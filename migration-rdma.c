@@ -18,6 +18,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
 #include "qemu/bitmap.h"
+#include "qemu/queue.h"
 #include "block/coroutine.h"
 #include <stdio.h>
 #include <sys/types.h>
@@ -74,6 +75,13 @@
 
 #define RDMA_REG_CHUNK_SHIFT 20 /* 1 MB */
 
+/*
+ * Most chunks registered ahead of a write, and most chunks unregistered,
+ * by a single control message.
+ */
+#define RDMA_REG_AHEAD 8
+#define RDMA_UNREG_BATCH 64
+
 /*
  * This is only for non-live state being migrated.
  * Instead of RDMA_WRITE messages, we use RDMA_SEND
@@ -93,12 +101,15 @@
  * Capabilities for negotiation.
  */
 #define RDMA_CAPABILITY_PIN_ALL 0x01
+/* The dest answers a REGISTER_REQUEST with one result per registration */
+#define RDMA_CAPABILITY_REG_BATCH 0x02
 
 /*
  * Add the other flags above to this list of known capabilities
  * as they are introduced.
  */
-static uint32_t known_capabilities = RDMA_CAPABILITY_PIN_ALL;
+static uint32_t known_capabilities = RDMA_CAPABILITY_PIN_ALL |
+                                     RDMA_CAPABILITY_REG_BATCH;
 
 #define CHECK_ERROR_STATE() \
     do { \
@@ -233,6 +244,18 @@ static void network_to_caps(RDMACapabilities *cap)
     cap->flags = ntohl(cap->flags);
 }
 
+/*
+ * A chunk registered on both sides with dynamic registration.  The
+ * source keeps them in the order they were last written, so that it can
+ * unregister the oldest ones when 'rdma-pinned-max' is reached.
+ */
+typedef struct RDMARegChunk {
+    QTAILQ_ENTRY(RDMARegChunk) next;
+    uint64_t block_offset;     /* the index of the block may change */
+    uint64_t chunk;
+    bool     registered;
+} RDMARegChunk;
+
 /*
  * Representation of a RAMBlock from an RDMA perspective.
  * This is not transmitted, only local.
@@ -252,8 +275,8 @@ typedef struct RDMALocalBlock {
     int      index;            /* which block are we */
     bool     is_ram_block;
     int      nb_chunks;
-    unsigned long *transit_bitmap;
-    unsigned long *unregister_bitmap;
+    uint16_t *transit;         /* RDMA writes in flight, per chunk */
+    RDMARegChunk *reg_chunks;  /* LRU entries, per chunk */
 } RDMALocalBlock;
 
 /*
@@ -347,6 +370,9 @@ typedef struct RDMAContext {
 
     bool pin_all;
 
+    /* the dest answers several registrations in one message */
+    bool reg_batch;
+
     /*
      * infiniband-specific variables for opening the device
      * and maintaining connection state and so forth.
@@ -389,8 +415,14 @@ typedef struct RDMAContext {
     int total_registrations;
     int total_writes;
 
-    int unregister_current, unregister_next;
-    uint64_t unregistrations[RDMA_SIGNALED_SEND_MAX];
+    /*
+     * Chunks registered with dynamic registration, least recently
+     * written first, and the most there may be (0 if unlimited).
+     */
+    QTAILQ_HEAD(, RDMARegChunk) reg_lru;
+    int nb_reg_chunks;
+    int max_reg_chunks;
+    int total_unregistrations;
 
     GHashTable *blockmap;
 } RDMAContext;
@@ -568,10 +600,8 @@ static int __qemu_rdma_add_block(RDMAContext *rdma, void *host_addr,
     block->length = length;
     block->index = local->nb_blocks;
     block->nb_chunks = ram_chunk_index(host_addr, host_addr + length) + 1UL;
-    block->transit_bitmap = bitmap_new(block->nb_chunks);
-    bitmap_clear(block->transit_bitmap, 0, block->nb_chunks);
-    block->unregister_bitmap = bitmap_new(block->nb_chunks);
-    bitmap_clear(block->unregister_bitmap, 0, block->nb_chunks);
+    block->transit = g_new0(uint16_t, block->nb_chunks);
+    block->reg_chunks = g_new0(RDMARegChunk, block->nb_chunks);
     block->remote_keys = g_malloc0(block->nb_chunks * sizeof(uint32_t));
 
     block->is_ram_block = local->init ? false : true;
@@ -651,11 +681,17 @@ static int __qemu_rdma_delete_block(RDMAContext *rdma, ram_addr_t block_offset)
         block->mr = NULL;
     }
 
-    g_free(block->transit_bitmap);
-    block->transit_bitmap = NULL;
+    for (x = 0; x < block->nb_chunks; x++) {
+        if (block->reg_chunks[x].registered) {
+            QTAILQ_REMOVE(&rdma->reg_lru, &block->reg_chunks[x], next);
+            rdma->nb_reg_chunks--;
+        }
+    }
+    g_free(block->reg_chunks);
+    block->reg_chunks = NULL;
 
-    g_free(block->unregister_bitmap);
-    block->unregister_bitmap = NULL;
+    g_free(block->transit);
+    block->transit = NULL;
 
     g_free(block->remote_keys);
     block->remote_keys = NULL;
@@ -1215,111 +1251,6 @@ const char *print_wrid(int wrid)
     return wrid_desc[wrid];
 }
 
-/*
- * RDMA requires memory registration (mlock/pinning), but this is not good for
- * overcommitment.
- *
- * In preparation for the future where LRU information or workload-specific
- * writable writable working set memory access behavior is available to QEMU
- * it would be nice to have in place the ability to UN-register/UN-pin
- * particular memory regions from the RDMA hardware when it is determine that
- * those regions of memory will likely not be accessed again in the near future.
- *
- * While we do not yet have such information right now, the following
- * compile-time option allows us to perform a non-optimized version of this
- * behavior.
- *
- * By uncommenting this option, you will cause *all* RDMA transfers to be
- * unregistered immediately after the transfer completes on both sides of the
- * connection. This has no effect in 'rdma-pin-all' mode, only regular mode.
- *
- * This will have a terrible impact on migration performance, so until future
- * workload information or LRU information is available, do not attempt to use
- * this feature except for basic testing.
- */
-//#define RDMA_UNREGISTRATION_EXAMPLE
-
-/*
- * Perform a non-optimized memory unregistration after every transfer
- * for demonsration purposes, only if pin-all is not requested.
- *
- * Potential optimizations:
- * 1. Start a new thread to run this function continuously
-        - for bit clearing
-        - and for receipt of unregister messages
- * 2. Use an LRU.
- * 3. Use workload hints.
- */
-static int qemu_rdma_unregister_waiting(RDMAContext *rdma)
-{
-    while (rdma->unregistrations[rdma->unregister_current]) {
-        int ret;
-        uint64_t wr_id = rdma->unregistrations[rdma->unregister_current];
-        uint64_t chunk =
-            (wr_id & RDMA_WRID_CHUNK_MASK) >> RDMA_WRID_CHUNK_SHIFT;
-        uint64_t index =
-            (wr_id & RDMA_WRID_BLOCK_MASK) >> RDMA_WRID_BLOCK_SHIFT;
-        RDMALocalBlock *block =
-            &(rdma->local_ram_blocks.block[index]);
-        RDMARegister reg = { .current_index = index };
-        RDMAControlHeader resp = { .type = RDMA_CONTROL_UNREGISTER_FINISHED,
-                                 };
-        RDMAControlHeader head = { .len = sizeof(RDMARegister),
-                                   .type = RDMA_CONTROL_UNREGISTER_REQUEST,
-                                   .repeat = 1,
-                                 };
-
-        DDPRINTF("Processing unregister for chunk: %" PRIu64
-                 " at position %d\n", chunk, rdma->unregister_current);
-
-        rdma->unregistrations[rdma->unregister_current] = 0;
-        rdma->unregister_current++;
-
-        if (rdma->unregister_current == RDMA_SIGNALED_SEND_MAX) {
-            rdma->unregister_current = 0;
-        }
-
-
-        /*
-         * Unregistration is speculative (because migration is single-threaded
-         * and we cannot break the protocol's inifinband message ordering).
-         * Thus, if the memory is currently being used for transmission,
-         * then abort the attempt to unregister and try again
-         * later the next time a completion is received for this memory.
-         */
-        clear_bit(chunk, block->unregister_bitmap);
-
-        if (test_bit(chunk, block->transit_bitmap)) {
-            DDPRINTF("Cannot unregister inflight chunk: %" PRIu64 "\n", chunk);
-            continue;
-        }
-
-        DDPRINTF("Sending unregister for chunk: %" PRIu64 "\n", chunk);
-
-        ret = ibv_dereg_mr(block->pmr[chunk]);
-        block->pmr[chunk] = NULL;
-        block->remote_keys[chunk] = 0;
-
-        if (ret != 0) {
-            perror("unregistration chunk failed");
-            return -ret;
-        }
-        rdma->total_registrations--;
-
-        reg.key.chunk = chunk;
-        register_to_network(&reg);
-        ret = qemu_rdma_exchange_send(rdma, &head, (uint8_t *) &reg,
-                                &resp, NULL, NULL);
-        if (ret < 0) {
-            return ret;
-        }
-
-        DDPRINTF("Unregister for chunk: %" PRIu64 " complete.\n", chunk);
-    }
-
-    return 0;
-}
-
 static uint64_t qemu_rdma_make_wrid(uint64_t wr_id, uint64_t index,
                                          uint64_t chunk)
 {
@@ -1331,35 +1262,6 @@ static uint64_t qemu_rdma_make_wrid(uint64_t wr_id, uint64_t index,
     return result;
 }
 
-/*
- * Set bit for unregistration in the next iteration.
- * We cannot transmit right here, but will unpin later.
- */
-static void qemu_rdma_signal_unregister(RDMAContext *rdma, uint64_t index,
-                                        uint64_t chunk, uint64_t wr_id)
-{
-    if (rdma->unregistrations[rdma->unregister_next] != 0) {
-        fprintf(stderr, "rdma migration: queue is full!\n");
-    } else {
-        RDMALocalBlock *block = &(rdma->local_ram_blocks.block[index]);
-
-        if (!test_and_set_bit(chunk, block->unregister_bitmap)) {
-            DDPRINTF("Appending unregister chunk %" PRIu64
-                    " at position %d\n", chunk, rdma->unregister_next);
-
-            rdma->unregistrations[rdma->unregister_next++] =
-                    qemu_rdma_make_wrid(wr_id, index, chunk);
-
-            if (rdma->unregister_next == RDMA_SIGNALED_SEND_MAX) {
-                rdma->unregister_next = 0;
-            }
-        } else {
-            DDPRINTF("Unregister chunk %" PRIu64 " already in queue.\n",
-                    chunk);
-        }
-    }
-}
-
 /*
  * Consult the connection manager to see a work request
  * (of any kind) has completed.
@@ -1414,23 +1316,13 @@ static uint64_t qemu_rdma_poll(RDMAContext *rdma, uint64_t *wr_id_out,
                  print_wrid(wr_id), wr_id, rdma->nb_sent, index, chunk,
                  block->local_host_addr, (void *)block->remote_host_addr);
 
-        clear_bit(chunk, block->transit_bitmap);
+        if (block->transit[chunk]) {
+            block->transit[chunk]--;
+        }
 
         if (rdma->nb_sent > 0) {
             rdma->nb_sent--;
         }
-
-        if (!rdma->pin_all) {
-            /*
-             * FYI: If one wanted to signal a specific chunk to be unregistered
-             * using LRU or workload-specific information, this is the function
-             * you would call to do so. That chunk would then get asynchronously
-             * unregistered later.
-             */
-#ifdef RDMA_UNREGISTRATION_EXAMPLE
-            qemu_rdma_signal_unregister(rdma, index, chunk, wc.wr_id);
-#endif
-        }
     } else {
         DDDPRINTF("other completion %s (%" PRId64 ") received left %d\n",
             print_wrid(wr_id), wr_id, rdma->nb_sent);
@@ -1547,6 +1439,169 @@ err_block_for_wrid:
     return ret;
 }
 
+/*
+ * RDMA requires memory registration (mlock/pinning), but this is not good for
+ * overcommitment.  Unless 'rdma-pin-all' is on, chunks are registered on both
+ * sides the first time they are written and stay registered; with
+ * 'rdma-pinned-max' set, the chunks written least recently are unregistered
+ * to make room for new ones.
+ */
+static void qemu_rdma_lru_touch(RDMAContext *rdma, RDMALocalBlock *block,
+                                uint64_t chunk)
+{
+    RDMARegChunk *rc = &block->reg_chunks[chunk];
+
+    if (rc->registered) {
+        QTAILQ_REMOVE(&rdma->reg_lru, rc, next);
+    } else {
+        rc->block_offset = block->offset;
+        rc->chunk = chunk;
+        rc->registered = true;
+        rdma->nb_reg_chunks++;
+    }
+    QTAILQ_INSERT_TAIL(&rdma->reg_lru, rc, next);
+}
+
+/* Make a chunk the first to be unregistered */
+static void qemu_rdma_lru_demote(RDMAContext *rdma, RDMALocalBlock *block,
+                                 uint64_t chunk)
+{
+    RDMARegChunk *rc = &block->reg_chunks[chunk];
+
+    if (rc->registered) {
+        QTAILQ_REMOVE(&rdma->reg_lru, rc, next);
+        QTAILQ_INSERT_HEAD(&rdma->reg_lru, rc, next);
+    }
+}
+
+static int qemu_rdma_send_unregister(RDMAContext *rdma, RDMARegister *regs,
+                                     int nb)
+{
+    RDMAControlHeader resp = { .type = RDMA_CONTROL_UNREGISTER_FINISHED };
+    RDMAControlHeader head = { .len = nb * sizeof(RDMARegister),
+                               .type = RDMA_CONTROL_UNREGISTER_REQUEST,
+                               .repeat = nb,
+                             };
+    int ret;
+
+    DDPRINTF("Sending unregister for %d chunks\n", nb);
+
+    ret = qemu_rdma_exchange_send(rdma, &head, (uint8_t *) regs,
+                                  &resp, NULL, NULL);
+    if (ret < 0) {
+        return ret;
+    }
+    rdma->total_unregistrations += nb;
+    return 0;
+}
+
+/*
+ * Unregister the chunks written least recently until @needed new ones fit
+ * below the limit, with an eighth of it to spare so that this is not done
+ * again for the next chunk.  Chunks with writes in flight are skipped, and
+ * if all of them are, wait for a write to complete.
+ */
+static int qemu_rdma_unregister_lru(RDMAContext *rdma, int needed)
+{
+    RDMARegister regs[RDMA_UNREG_BATCH];
+    int target, nb = 0, ret;
+
+    if (!rdma->max_reg_chunks ||
+        rdma->nb_reg_chunks + needed <= rdma->max_reg_chunks) {
+        return 0;
+    }
+    target = MAX(rdma->max_reg_chunks - needed - rdma->max_reg_chunks / 8, 0);
+
+    while (rdma->nb_reg_chunks > target) {
+        RDMALocalBlock *block = NULL;
+        RDMARegChunk *rc;
+
+        QTAILQ_FOREACH(rc, &rdma->reg_lru, next) {
+            block = g_hash_table_lookup(rdma->blockmap,
+                                        (void *)(uintptr_t) rc->block_offset);
+            if (!block->transit[rc->chunk]) {
+                break;
+            }
+        }
+
+        if (!rc) {
+            if (nb) {
+                break;
+            }
+            ret = qemu_rdma_block_for_wrid(rdma, RDMA_WRID_RDMA_WRITE, NULL);
+            if (ret < 0) {
+                return ret;
+            }
+            continue;
+        }
+
+        QTAILQ_REMOVE(&rdma->reg_lru, rc, next);
+        rc->registered = false;
+        rdma->nb_reg_chunks--;
+
+        if (block->pmr && block->pmr[rc->chunk]) {
+            ret = ibv_dereg_mr(block->pmr[rc->chunk]);
+            block->pmr[rc->chunk] = NULL;
+            if (ret != 0) {
+                perror("unregistration chunk failed");
+                return -ret;
+            }
+            rdma->total_registrations--;
+        }
+        block->remote_keys[rc->chunk] = 0;
+
+        regs[nb].current_index = block->index;
+        regs[nb].key.chunk = rc->chunk;
+        regs[nb].chunks = 0;
+        register_to_network(&regs[nb]);
+
+        if (++nb == RDMA_UNREG_BATCH) {
+            ret = qemu_rdma_send_unregister(rdma, regs, nb);
+            if (ret < 0) {
+                return ret;
+            }
+            nb = 0;
+        }
+    }
+
+    if (nb) {
+        return qemu_rdma_send_unregister(rdma, regs, nb);
+    }
+    return 0;
+}
+
+/*
+ * The bulk stage writes RAM in order, so the chunks after one that needs
+ * registering will soon need it too.  Fill @reg with those that are not
+ * registered yet, up to the first one that is zero, so that a single
+ * message registers them all.
+ */
+static int qemu_rdma_register_ahead(RDMALocalBlock *block, uint64_t chunk,
+                                    RDMARegister *reg, uint64_t *chunks,
+                                    int max)
+{
+    int nb = 0;
+
+    for (; nb < max && chunk < block->nb_chunks; chunk++) {
+        uint8_t *start = ram_chunk_start(block, chunk);
+        size_t len = ram_chunk_end(block, chunk) - start;
+
+        if (block->remote_keys[chunk] ||
+            (can_use_buffer_find_nonzero_offset(start, len) &&
+             buffer_find_nonzero_offset(start, len) == len)) {
+            break;
+        }
+
+        reg[nb].current_index = block->index;
+        reg[nb].key.current_addr = block->offset +
+                                   (start - block->local_host_addr);
+        reg[nb].chunks = 0;
+        chunks[nb] = chunk;
+        nb++;
+    }
+    return nb;
+}
+
 /*
  * Post a SEND message work request for the control channel
  * containing some data and block until the post completes.
@@ -1849,11 +1904,12 @@ static int qemu_rdma_write_one(QEMUFile *f, RDMAContext *rdma,
     struct ibv_sge sge;
     struct ibv_send_wr send_wr = { 0 };
     struct ibv_send_wr *bad_wr;
-    int reg_result_idx, ret, count = 0;
+    int reg_result_idx, ret, i, nb_reg;
     uint64_t chunk, chunks;
     uint8_t *chunk_start, *chunk_end;
     RDMALocalBlock *block = &(rdma->local_ram_blocks.block[current_index]);
-    RDMARegister reg;
+    RDMARegister reg[1 + RDMA_REG_AHEAD];
+    uint64_t reg_chunks[1 + RDMA_REG_AHEAD];
     RDMARegisterResult *reg_result;
     RDMAControlHeader resp = { .type = RDMA_CONTROL_REGISTER_RESULT };
     RDMAControlHeader head = { .len = sizeof(RDMARegister),
@@ -1888,30 +1944,11 @@ retry:
 
     chunk_end = ram_chunk_end(block, chunk + chunks);
 
-    if (!rdma->pin_all) {
-#ifdef RDMA_UNREGISTRATION_EXAMPLE
-        qemu_rdma_unregister_waiting(rdma);
-#endif
-    }
-
-    while (test_bit(chunk, block->transit_bitmap)) {
-        (void)count;
-        DDPRINTF("(%d) Not clobbering: block: %d chunk %" PRIu64
-                " current %" PRIu64 " len %" PRIu64 " %d %d\n",
-                count++, current_index, chunk,
-                sge.addr, length, rdma->nb_sent, block->nb_chunks);
-
-        ret = qemu_rdma_block_for_wrid(rdma, RDMA_WRID_RDMA_WRITE, NULL);
-
-        if (ret < 0) {
-            fprintf(stderr, "Failed to Wait for previous write to complete "
-                    "block %d chunk %" PRIu64
-                    " current %" PRIu64 " len %" PRIu64 " %d\n",
-                    current_index, chunk, sge.addr, length, rdma->nb_sent);
-            return ret;
-        }
-    }
-
+    /*
+     * Writes to a chunk that already has some in flight are posted without
+     * waiting for them: the queue pair keeps them in order, and only
+     * unregistering the chunk needs them to have completed.
+     */
     if (!rdma->pin_all || !block->is_ram_block) {
         if (!block->remote_keys[chunk]) {
             /*
@@ -1951,23 +1988,41 @@ retry:
                 return 1;
             }
 
+            ret = qemu_rdma_unregister_lru(rdma, 1 + RDMA_REG_AHEAD);
+            if (ret < 0) {
+                return ret;
+            }
+
             /*
-             * Otherwise, tell other side to register.
+             * Otherwise, tell other side to register, along with the
+             * chunks that follow if the dest can answer for all of them.
              */
-            reg.current_index = current_index;
+            reg[0].current_index = current_index;
             if (block->is_ram_block) {
-                reg.key.current_addr = current_addr;
+                reg[0].key.current_addr = current_addr;
             } else {
-                reg.key.chunk = chunk;
+                reg[0].key.chunk = chunk;
+            }
+            reg[0].chunks = chunks;
+            reg_chunks[0] = chunk;
+            nb_reg = 1;
+
+            if (rdma->reg_batch && block->is_ram_block) {
+                nb_reg += qemu_rdma_register_ahead(block, chunk + chunks + 1,
+                                                   &reg[1], &reg_chunks[1],
+                                                   RDMA_REG_AHEAD);
             }
-            reg.chunks = chunks;
 
             DDPRINTF("Sending registration request chunk %" PRIu64 " for %d "
-                    "bytes, index: %d, offset: %" PRId64 "...\n",
-                    chunk, sge.length, current_index, current_addr);
+                    "bytes, index: %d, offset: %" PRId64 ", %d chunks...\n",
+                    chunk, sge.length, current_index, current_addr, nb_reg);
 
-            register_to_network(&reg);
-            ret = qemu_rdma_exchange_send(rdma, &head, (uint8_t *) &reg,
+            for (i = 0; i < nb_reg; i++) {
+                register_to_network(&reg[i]);
+            }
+            head.len = nb_reg * sizeof(RDMARegister);
+            head.repeat = nb_reg;
+            ret = qemu_rdma_exchange_send(rdma, &head, (uint8_t *) reg,
                                     &resp, &reg_result_idx, NULL);
             if (ret < 0) {
                 return ret;
@@ -1982,17 +2037,26 @@ retry:
                 return -EINVAL;
             }
 
+            if (resp.len != nb_reg * sizeof(RDMARegisterResult)) {
+                fprintf(stderr, "rdma migration: expected %d registration"
+                        " results, got %d bytes\n", nb_reg, resp.len);
+                return -EIO;
+            }
+
             reg_result = (RDMARegisterResult *)
                     rdma->wr_data[reg_result_idx].control_curr;
 
-            network_to_result(reg_result);
+            for (i = 0; i < nb_reg; i++) {
+                network_to_result(&reg_result[i]);
 
-            DDPRINTF("Received registration result:"
-                    " my key: %x their key %x, chunk %" PRIu64 "\n",
-                    block->remote_keys[chunk], reg_result->rkey, chunk);
+                DDPRINTF("Received registration result:"
+                        " their key %x, chunk %" PRIu64 "\n",
+                        reg_result[i].rkey, reg_chunks[i]);
 
-            block->remote_keys[chunk] = reg_result->rkey;
-            block->remote_host_addr = reg_result->host_addr;
+                block->remote_keys[reg_chunks[i]] = reg_result[i].rkey;
+                qemu_rdma_lru_touch(rdma, block, reg_chunks[i]);
+            }
+            block->remote_host_addr = reg_result[0].host_addr;
         } else {
             /* already registered before */
             if (qemu_rdma_register_and_get_keys(rdma, block,
@@ -2005,6 +2069,7 @@ retry:
         }
 
         send_wr.wr.rdma.rkey = block->remote_keys[chunk];
+        qemu_rdma_lru_touch(rdma, block, chunk);
     } else {
         send_wr.wr.rdma.rkey = block->remote_rkey;
 
@@ -2059,7 +2124,7 @@ retry:
         return -ret;
     }
 
-    set_bit(chunk, block->transit_bitmap);
+    block->transit[chunk]++;
     acct_update_position(f, sge.length, false);
     rdma->total_writes++;
 
@@ -2197,6 +2262,11 @@ static void qemu_rdma_cleanup(RDMAContext *rdma)
     struct rdma_cm_event *cm_event;
     int ret, idx;
 
+    if (rdma->total_unregistrations) {
+        DPRINTF("Unregistered %d chunks to stay below rdma-pinned-max\n",
+                rdma->total_unregistrations);
+    }
+
     if (rdma->cm_id && rdma->connected) {
         if (rdma->error_state) {
             RDMAControlHeader head = { .len = 0,
@@ -2280,6 +2350,8 @@ static int qemu_rdma_source_init(RDMAContext *rdma, Error **errp, bool pin_all)
      * after the connect() completes.
      */
     rdma->pin_all = pin_all;
+    rdma->max_reg_chunks = ((uint64_t) migrate_rdma_pinned_max() << 20) >>
+                           RDMA_REG_CHUNK_SHIFT;
 
     ret = qemu_rdma_resolve_host(rdma, temp);
     if (ret) {
@@ -2344,6 +2416,8 @@ static int qemu_rdma_connect(RDMAContext *rdma, Error **errp)
     if (rdma->pin_all) {
         DPRINTF("Server pin-all memory requested.\n");
         cap.flags |= RDMA_CAPABILITY_PIN_ALL;
+    } else {
+        cap.flags |= RDMA_CAPABILITY_REG_BATCH;
     }
 
     caps_to_network(&cap);
@@ -2390,7 +2464,12 @@ static int qemu_rdma_connect(RDMAContext *rdma, Error **errp)
         rdma->pin_all = false;
     }
 
+    rdma->reg_batch = !rdma->pin_all &&
+                      (cap.flags & RDMA_CAPABILITY_REG_BATCH);
+
     DPRINTF("Pin all memory: %s\n", rdma->pin_all ? "enabled" : "disabled");
+    DPRINTF("Batched registration: %s\n",
+            rdma->reg_batch ? "enabled" : "disabled");
 
     rdma_ack_cm_event(cm_event);
 
@@ -2504,6 +2583,7 @@ static void *qemu_rdma_data_init(const char *host_port, Error **errp)
         memset(rdma, 0, sizeof(RDMAContext));
         rdma->current_index = -1;
         rdma->current_chunk = -1;
+        QTAILQ_INIT(&rdma->reg_lru);
 
         addr = inet_parse(host_port, NULL);
         if (addr != NULL) {
@@ -2647,8 +2727,6 @@ static int qemu_rdma_drain_cq(QEMUFile *f, RDMAContext *rdma)
         }
     }
 
-    qemu_rdma_unregister_waiting(rdma);
-
     return 0;
 }
 
@@ -2681,12 +2759,10 @@ static int qemu_rdma_close(void *opaque)
  *
  *    @size == 0 :
  *        A 'hint' or 'advice' that means that we wish to speculatively
- *        and asynchronously unregister this memory. In this case, there is no
- *        guarantee that the unregister will actually happen, for example,
- *        if the memory is being actively transmitted. Additionally, the memory
- *        may be re-registered at any future time if a write within the same
- *        chunk was requested again, even if you attempted to unregister it
- *        here.
+ *        unregister this memory. Its chunk becomes the first one to be
+ *        unregistered when 'rdma-pinned-max' is reached, which may never
+ *        happen. Additionally, the memory may be re-registered at any future
+ *        time if a write within the same chunk was requested again.
  *
  *    @size < 0 : TODO, not yet supported
  *        Unregister the memory NOW. This means that the caller does not
@@ -2755,16 +2831,8 @@ static size_t qemu_rdma_save_page(QEMUFile *f, void *opaque,
             goto err;
         }
 
-        qemu_rdma_signal_unregister(rdma, index, chunk, 0);
-
-        /*
-         * TODO: Synchronous, guaranteed unregistration (should not occur during
-         * fast-path). Otherwise, unregisters will process on the next call to
-         * qemu_rdma_drain_cq()
-        if (size < 0) {
-            qemu_rdma_unregister_waiting(rdma);
-        }
-        */
+        qemu_rdma_lru_demote(rdma, &rdma->local_ram_blocks.block[index],
+                             chunk);
     }
 
     /*
@@ -3052,6 +3120,7 @@ static int qemu_rdma_registration_handle(QEMUFile *f, void *opaque,
             DDPRINTF("There are %d registration requests\n", head.repeat);
 
             reg_resp.repeat = head.repeat;
+            reg_resp.len = head.repeat * sizeof(RDMARegisterResult);
             registers = (RDMARegister *) rdma->wr_data[idx].control_curr;
 
             for (count = 0; count < head.repeat; count++) {
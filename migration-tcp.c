@@ -22,6 +22,7 @@
 #include "migration/qemu-file.h"
 #include "block/block.h"
 #include "qemu/main-loop.h"
+#include "qemu/timer.h"
 
 //#define DEBUG_MIGRATION_TCP
 
@@ -33,6 +34,118 @@
     do { } while (0)
 #endif
 
+/* The extra channels of a multifd migration go to the peer of the main
+ * connection.  The destination accepts them right after the main channel,
+ * so they are connected, one at a time and without blocking the main loop,
+ * before anything is sent on it.
+ */
+typedef struct TCPChannelConnect {
+    MigrationState *s;
+    int fd;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+} TCPChannelConnect;
+
+static void tcp_connect_next_channel(TCPChannelConnect *t);
+
+static void tcp_connect_channels_done(TCPChannelConnect *t, bool ok)
+{
+    MigrationState *s = t->s;
+    int fd = t->fd;
+
+    g_free(t);
+    if (!ok) {
+        migrate_multifd_close(s);
+        closesocket(fd);
+        s->file = NULL;
+        migrate_fd_error(s);
+        return;
+    }
+
+    DPRINTF("connected %d migration channels\n", s->multifd_fd_count);
+    s->file = qemu_fopen_socket(fd, "wb");
+    migrate_fd_connect(s);
+}
+
+static void tcp_wait_for_channel(void *opaque)
+{
+    TCPChannelConnect *t = opaque;
+    MigrationState *s = t->s;
+    int c = s->multifd_fds[s->multifd_fd_count];
+    int val = 0;
+    socklen_t len = sizeof(val);
+
+    qemu_set_fd_handler2(c, NULL, NULL, NULL, NULL);
+    if (qemu_getsockopt(c, SOL_SOCKET, SO_ERROR, &val, &len) < 0) {
+        val = socket_error();
+    }
+    if (val) {
+        error_report("could not connect migration channel (%s)",
+                     strerror(val));
+        closesocket(c);
+        tcp_connect_channels_done(t, false);
+        return;
+    }
+
+    /* The sender threads write whole packets */
+    qemu_set_block(c);
+    s->multifd_fd_count++;
+    tcp_connect_next_channel(t);
+}
+
+static void tcp_connect_next_channel(TCPChannelConnect *t)
+{
+    MigrationState *s = t->s;
+    int c, rc;
+
+    if (s->multifd_fd_count == migrate_multifd_channels()) {
+        tcp_connect_channels_done(t, true);
+        return;
+    }
+
+    c = qemu_socket(t->addr.ss_family, SOCK_STREAM, 0);
+    if (c < 0) {
+        error_report("could not create migration channel (%s)",
+                     strerror(socket_error()));
+        tcp_connect_channels_done(t, false);
+        return;
+    }
+    qemu_set_nonblock(c);
+    do {
+        rc = 0;
+        if (connect(c, (struct sockaddr *)&t->addr, t->addrlen) < 0) {
+            rc = -socket_error();
+        }
+    } while (rc == -EINTR);
+
+    if (rc < 0 && rc != -EINPROGRESS && rc != -EWOULDBLOCK) {
+        error_report("could not connect migration channel (%s)",
+                     strerror(-rc));
+        closesocket(c);
+        tcp_connect_channels_done(t, false);
+        return;
+    }
+    s->multifd_fds[s->multifd_fd_count] = c;
+    qemu_set_fd_handler2(c, NULL, NULL, tcp_wait_for_channel, t);
+}
+
+static void tcp_connect_channels(MigrationState *s, int fd)
+{
+    TCPChannelConnect *t = g_new0(TCPChannelConnect, 1);
+
+    t->s = s;
+    t->fd = fd;
+    t->addrlen = sizeof(t->addr);
+    s->multifd_fds = g_new(int, migrate_multifd_channels());
+    if (getpeername(fd, (struct sockaddr *)&t->addr, &t->addrlen) < 0) {
+        error_report("could not get migration peer address (%s)",
+                     strerror(socket_error()));
+        tcp_connect_channels_done(t, false);
+        return;
+    }
+    tcp_connect_next_channel(t);
+}
+
 static void tcp_wait_for_connect(int fd, void *opaque)
 {
     MigrationState *s = opaque;
@@ -41,6 +154,8 @@ static void tcp_wait_for_connect(int fd, void *opaque)
         DPRINTF("migrate connect error\n");
         s->file = NULL;
         migrate_fd_error(s);
+    } else if (migrate_use_multifd()) {
+        tcp_connect_channels(s, fd);
     } else {
         DPRINTF("migrate connect success\n");
         s->file = qemu_fopen_socket(fd, "wb");
@@ -53,12 +168,120 @@ void tcp_start_outgoing_migration(MigrationState *s, const char *host_port, Erro
     inet_nonblocking_connect(host_port, tcp_wait_for_connect, s, errp);
 }
 
+/* Time the source has to open the extra channels of a multifd migration
+ * once the main one is up, e.g. in case it does not have multifd enabled.
+ */
+#define TCP_CHANNEL_ACCEPT_TIMEOUT 10000 /* ms */
+
+typedef struct TCPChannelAccept {
+    int listen_fd;
+    int fd;
+    int *fds;
+    int count;
+    QEMUTimer *timer;
+} TCPChannelAccept;
+
+static void tcp_incoming_start(int c)
+{
+    QEMUFile *f;
+
+    f = qemu_fopen_socket(c, "rb");
+    if (f == NULL) {
+        error_report("could not qemu_fopen socket");
+        multifd_load_cleanup();
+        closesocket(c);
+        return;
+    }
+
+    process_incoming_migration(f);
+}
+
+static void tcp_accept_channels_done(TCPChannelAccept *t, bool ok)
+{
+    int fd = t->fd;
+    int i;
+
+    qemu_set_fd_handler2(t->listen_fd, NULL, NULL, NULL, NULL);
+    closesocket(t->listen_fd);
+    timer_del(t->timer);
+    timer_free(t->timer);
+
+    if (ok) {
+        DPRINTF("accepted %d migration channels\n", t->count);
+        multifd_load_setup(t->fds, t->count);
+    } else {
+        for (i = 0; i < t->count; i++) {
+            closesocket(t->fds[i]);
+        }
+        closesocket(fd);
+    }
+    g_free(t->fds);
+    g_free(t);
+
+    if (ok) {
+        tcp_incoming_start(fd);
+    }
+}
+
+static void tcp_accept_channels_timeout(void *opaque)
+{
+    TCPChannelAccept *t = opaque;
+
+    error_report("migration channels not opened, is multifd enabled "
+                 "on the source with the same multifd-channels?");
+    tcp_accept_channels_done(t, false);
+}
+
+static void tcp_accept_channel(void *opaque)
+{
+    TCPChannelAccept *t = opaque;
+    int c, err;
+
+    do {
+        c = qemu_accept(t->listen_fd, NULL, NULL);
+        err = socket_error();
+    } while (c < 0 && err == EINTR);
+
+    if (c < 0) {
+        if (err == EAGAIN || err == EWOULDBLOCK) {
+            return;
+        }
+        error_report("could not accept migration channel (%s)",
+                     strerror(err));
+        tcp_accept_channels_done(t, false);
+        return;
+    }
+
+    qemu_set_block(c);
+    t->fds[t->count++] = c;
+    if (t->count == migrate_multifd_channels()) {
+        tcp_accept_channels_done(t, true);
+    }
+}
+
+/* Accept the extra channels of a multifd migration, which the source
+ * opens right after the main one.  The main loop keeps running meanwhile.
+ */
+static void tcp_accept_channels(int s, int c)
+{
+    TCPChannelAccept *t = g_new0(TCPChannelAccept, 1);
+
+    t->listen_fd = s;
+    t->fd = c;
+    t->fds = g_new(int, migrate_multifd_channels());
+    t->timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                            tcp_accept_channels_timeout, t);
+    timer_mod(t->timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                        TCP_CHANNEL_ACCEPT_TIMEOUT);
+    qemu_set_nonblock(s);
+    qemu_set_fd_handler2(s, NULL, tcp_accept_channel, NULL, t);
+}
+
 static void tcp_accept_incoming_migration(void *opaque)
 {
     struct sockaddr_in addr;
     socklen_t addrlen = sizeof(addr);
     int s = (intptr_t)opaque;
-    QEMUFile *f;
     int c, err;
 
     do {
@@ -66,27 +289,22 @@ static void tcp_accept_incoming_migration(void *opaque)
         err = socket_error();
     } while (c < 0 && err == EINTR);
     qemu_set_fd_handler2(s, NULL, NULL, NULL, NULL);
-    closesocket(s);
 
     DPRINTF("accepted migration\n");
 
     if (c < 0) {
         error_report("could not accept migration connection (%s)",
                      strerror(err));
+        closesocket(s);
         return;
     }
 
-    f = qemu_fopen_socket(c, "rb");
-    if (f == NULL) {
-        error_report("could not qemu_fopen socket");
-        goto out;
+    if (migrate_use_multifd()) {
+        tcp_accept_channels(s, c);
+        return;
     }
-
-    process_incoming_migration(f);
-    return;
-
-out:
-    closesocket(c);
+    closesocket(s);
+    tcp_incoming_start(c);
 }
 
 void tcp_start_incoming_migration(const char *host_port, Error **errp)
@@ -18,6 +18,7 @@
 #include "migration/migration.h"
 #include "monitor/monitor.h"
 #include "migration/qemu-file.h"
+#include "migration/postcopy-ram.h"
 #include "sysemu/sysemu.h"
 #include "block/block.h"
 #include "qemu/sockets.h"
@@ -46,6 +47,19 @@ enum {
 /* Migration XBZRLE default cache size */
 #define DEFAULT_MIGRATE_CACHE_SIZE (64 * 1024 * 1024)
 
+/* Default compression parameters, level 1 is the fastest of zlib */
+#define DEFAULT_MIGRATE_COMPRESS_LEVEL 1
+#define DEFAULT_MIGRATE_COMPRESS_THREADS 8
+#define DEFAULT_MIGRATE_DECOMPRESS_THREADS 2
+#define MAX_MIGRATE_COMPRESS_THREADS 255
+
+/* Default number of extra channels of a multifd migration */
+#define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
+#define MAX_MIGRATE_MULTIFD_CHANNELS 16
+
+/* Smallest limit on the RAM an RDMA migration keeps registered, in MB */
+#define MIN_MIGRATE_RDMA_PINNED_MAX 32
+
 static NotifierList migration_state_notifiers =
     NOTIFIER_LIST_INITIALIZER(migration_state_notifiers);
 
@@ -59,6 +73,10 @@ MigrationState *migrate_get_current(void)
         .state = MIG_STATE_NONE,
         .bandwidth_limit = MAX_THROTTLE,
         .xbzrle_cache_size = DEFAULT_MIGRATE_CACHE_SIZE,
+        .compress_level = DEFAULT_MIGRATE_COMPRESS_LEVEL,
+        .compress_threads = DEFAULT_MIGRATE_COMPRESS_THREADS,
+        .decompress_threads = DEFAULT_MIGRATE_DECOMPRESS_THREADS,
+        .multifd_channels = DEFAULT_MIGRATE_MULTIFD_CHANNELS,
         .mbps = -1,
     };
 
@@ -95,12 +113,10 @@ static void process_incoming_migration_co(void *opaque)
     int ret;
 
     ret = qemu_loadvm_state(f);
-    qemu_fclose(f);
-    free_xbzrle_decoded_buf();
-    if (ret < 0) {
-        fprintf(stderr, "load of migration failed\n");
-        exit(EXIT_FAILURE);
+    if (ret <= 0) {
+        process_incoming_migration_end(f, ret);
     }
+    /* else post-copy: the guest runs while its RAM is still coming in */
     qemu_announce_self();
 
     bdrv_clear_incoming_migration_all();
@@ -119,6 +135,18 @@ static void process_incoming_migration_co(void *opaque)
     }
 }
 
+void process_incoming_migration_end(QEMUFile *f, int ret)
+{
+    qemu_fclose(f);
+    free_xbzrle_decoded_buf();
+    migrate_decompress_threads_join();
+    multifd_load_cleanup();
+    if (ret < 0) {
+        fprintf(stderr, "load of migration failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
 void process_incoming_migration(QEMUFile *f)
 {
     Coroutine *co = qemu_coroutine_create(process_incoming_migration_co);
@@ -179,6 +207,25 @@ static void get_xbzrle_cache_stats(MigrationInfo *info)
     }
 }
 
+static void get_compression_stats(MigrationInfo *info)
+{
+    if (migrate_use_compression()) {
+        info->has_compression = true;
+        info->compression = compress_mig_stats();
+    }
+}
+
+static void get_postcopy_stats(MigrationInfo *info)
+{
+    MigrationState *s = migrate_get_current();
+
+    if (s->in_postcopy) {
+        info->has_postcopy = true;
+        info->postcopy = g_malloc0(sizeof(*info->postcopy));
+        info->postcopy->requests = ram_postcopy_requests();
+    }
+}
+
 MigrationInfo *qmp_query_migrate(Error **errp)
 {
     MigrationInfo *info = g_malloc0(sizeof(*info));
@@ -186,7 +233,9 @@ MigrationInfo *qmp_query_migrate(Error **errp)
 
     switch (s->state) {
     case MIG_STATE_NONE:
-        /* no migration has happened ever */
+        /* no migration has happened ever, but this may be its target */
+        info->postcopy = postcopy_ram_incoming_stats();
+        info->has_postcopy = info->postcopy != NULL;
         break;
     case MIG_STATE_SETUP:
         info->has_status = true;
@@ -212,11 +261,15 @@ MigrationInfo *qmp_query_migrate(Error **errp)
         info->ram->total = ram_bytes_total();
         info->ram->duplicate = dup_mig_pages_transferred();
         info->ram->skipped = skipped_mig_pages_transferred();
+        info->ram->skipped_bytes = skipped_mig_bytes_transferred();
         info->ram->normal = norm_mig_pages_transferred();
         info->ram->normal_bytes = norm_mig_bytes_transferred();
         info->ram->dirty_pages_rate = s->dirty_pages_rate;
         info->ram->mbps = s->mbps;
         info->ram->dirty_sync_count = s->dirty_sync_count;
+        info->ram->dirty_sync_time = s->dirty_sync_time;
+        info->ram->dirty_sync_locked_time = s->dirty_sync_locked_time;
+        info->ram->dirty_sync_time_max = s->dirty_sync_time_max;
 
         if (blk_mig_active()) {
             info->has_disk = true;
@@ -227,9 +280,13 @@ MigrationInfo *qmp_query_migrate(Error **errp)
         }
 
         get_xbzrle_cache_stats(info);
+        get_compression_stats(info);
+        get_postcopy_stats(info);
         break;
     case MIG_STATE_COMPLETED:
         get_xbzrle_cache_stats(info);
+        get_compression_stats(info);
+        get_postcopy_stats(info);
 
         info->has_status = true;
         info->status = g_strdup("completed");
@@ -247,10 +304,14 @@ MigrationInfo *qmp_query_migrate(Error **errp)
         info->ram->total = ram_bytes_total();
         info->ram->duplicate = dup_mig_pages_transferred();
         info->ram->skipped = skipped_mig_pages_transferred();
+        info->ram->skipped_bytes = skipped_mig_bytes_transferred();
         info->ram->normal = norm_mig_pages_transferred();
         info->ram->normal_bytes = norm_mig_bytes_transferred();
         info->ram->mbps = s->mbps;
         info->ram->dirty_sync_count = s->dirty_sync_count;
+        info->ram->dirty_sync_time = s->dirty_sync_time;
+        info->ram->dirty_sync_locked_time = s->dirty_sync_locked_time;
+        info->ram->dirty_sync_time_max = s->dirty_sync_time_max;
         break;
     case MIG_STATE_ERROR:
         info->has_status = true;
@@ -281,6 +342,89 @@ void qmp_migrate_set_capabilities(MigrationCapabilityStatusList *params,
     }
 }
 
+MigrationParameters *qmp_query_migrate_parameters(Error **errp)
+{
+    MigrationParameters *params = g_malloc0(sizeof(*params));
+    MigrationState *s = migrate_get_current();
+
+    params->compress_level = s->compress_level;
+    params->compress_threads = s->compress_threads;
+    params->decompress_threads = s->decompress_threads;
+    params->multifd_channels = s->multifd_channels;
+    params->rdma_pinned_max = s->rdma_pinned_max;
+
+    return params;
+}
+
+void qmp_migrate_set_parameters(bool has_compress_level,
+                                int64_t compress_level,
+                                bool has_compress_threads,
+                                int64_t compress_threads,
+                                bool has_decompress_threads,
+                                int64_t decompress_threads,
+                                bool has_multifd_channels,
+                                int64_t multifd_channels,
+                                bool has_rdma_pinned_max,
+                                int64_t rdma_pinned_max, Error **errp)
+{
+    MigrationState *s = migrate_get_current();
+
+    if (s->state == MIG_STATE_ACTIVE || s->state == MIG_STATE_SETUP) {
+        error_set(errp, QERR_MIGRATION_ACTIVE);
+        return;
+    }
+
+    if (has_compress_level && (compress_level < 0 || compress_level > 9)) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "compress-level",
+                  "is invalid, it should be in the range of 0 to 9");
+        return;
+    }
+    if (has_compress_threads &&
+        (compress_threads < 1 ||
+         compress_threads > MAX_MIGRATE_COMPRESS_THREADS)) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "compress-threads",
+                  "is invalid, it should be in the range of 1 to 255");
+        return;
+    }
+    if (has_decompress_threads &&
+        (decompress_threads < 1 ||
+         decompress_threads > MAX_MIGRATE_COMPRESS_THREADS)) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "decompress-threads",
+                  "is invalid, it should be in the range of 1 to 255");
+        return;
+    }
+    if (has_multifd_channels &&
+        (multifd_channels < 1 ||
+         multifd_channels > MAX_MIGRATE_MULTIFD_CHANNELS)) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "multifd-channels",
+                  "is invalid, it should be in the range of 1 to 16");
+        return;
+    }
+    if (has_rdma_pinned_max && rdma_pinned_max != 0 &&
+        (rdma_pinned_max < MIN_MIGRATE_RDMA_PINNED_MAX ||
+         rdma_pinned_max > INT_MAX)) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "rdma-pinned-max",
+                  "is invalid, it should be 0 or at least 32");
+        return;
+    }
+
+    if (has_compress_level) {
+        s->compress_level = compress_level;
+    }
+    if (has_compress_threads) {
+        s->compress_threads = compress_threads;
+    }
+    if (has_decompress_threads) {
+        s->decompress_threads = decompress_threads;
+    }
+    if (has_multifd_channels) {
+        s->multifd_channels = multifd_channels;
+    }
+    if (has_rdma_pinned_max) {
+        s->rdma_pinned_max = rdma_pinned_max;
+    }
+}
+
 /* shared migration helpers */
 
 static void migrate_set_state(MigrationState *s, int old_state, int new_state)
@@ -290,6 +434,18 @@ static void migrate_set_state(MigrationState *s, int old_state, int new_state)
     }
 }
 
+void migrate_multifd_close(MigrationState *s)
+{
+    int i;
+
+    for (i = 0; i < s->multifd_fd_count; i++) {
+        closesocket(s->multifd_fds[i]);
+    }
+    g_free(s->multifd_fds);
+    s->multifd_fds = NULL;
+    s->multifd_fd_count = 0;
+}
+
 static void migrate_fd_cleanup(void *opaque)
 {
     MigrationState *s = opaque;
@@ -316,6 +472,9 @@ static void migrate_fd_cleanup(void *opaque)
         }
     }
 
+    /* The RAM code is done with the extra channels by now */
+    migrate_multifd_close(s);
+
     notifier_list_notify(&migration_state_notifiers, s);
 }
 
@@ -331,6 +490,7 @@ void migrate_fd_error(MigrationState *s)
 static void migrate_fd_cancel(MigrationState *s)
 {
     int old_state ;
+    int i;
     trace_migrate_fd_cancel();
 
     do {
@@ -340,6 +500,11 @@ static void migrate_fd_cancel(MigrationState *s)
         }
         migrate_set_state(s, old_state, MIG_STATE_CANCELLING);
     } while (s->state != MIG_STATE_CANCELLING);
+
+    /* Unblock the threads sending on the extra channels */
+    for (i = 0; i < s->multifd_fd_count; i++) {
+        shutdown(s->multifd_fds[i], SHUT_RDWR);
+    }
 }
 
 void add_migration_state_change_notifier(Notifier *notify)
@@ -374,6 +539,11 @@ static MigrationState *migrate_init(const MigrationParams *params)
     int64_t bandwidth_limit = s->bandwidth_limit;
     bool enabled_capabilities[MIGRATION_CAPABILITY_MAX];
     int64_t xbzrle_cache_size = s->xbzrle_cache_size;
+    int compress_level = s->compress_level;
+    int compress_threads = s->compress_threads;
+    int decompress_threads = s->decompress_threads;
+    int multifd_channels = s->multifd_channels;
+    int rdma_pinned_max = s->rdma_pinned_max;
 
     memcpy(enabled_capabilities, s->enabled_capabilities,
            sizeof(enabled_capabilities));
@@ -383,6 +553,11 @@ static MigrationState *migrate_init(const MigrationParams *params)
     memcpy(s->enabled_capabilities, enabled_capabilities,
            sizeof(enabled_capabilities));
     s->xbzrle_cache_size = xbzrle_cache_size;
+    s->compress_level = compress_level;
+    s->compress_threads = compress_threads;
+    s->decompress_threads = decompress_threads;
+    s->multifd_channels = multifd_channels;
+    s->rdma_pinned_max = rdma_pinned_max;
 
     s->bandwidth_limit = bandwidth_limit;
     s->state = MIG_STATE_SETUP;
@@ -467,7 +642,83 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
 
 void qmp_migrate_cancel(Error **errp)
 {
-    migrate_fd_cancel(migrate_get_current());
+    MigrationState *s = migrate_get_current();
+
+    if (s->in_postcopy && s->state == MIG_STATE_ACTIVE) {
+        error_setg(errp, "The guest already runs on the destination");
+        return;
+    }
+    migrate_fd_cancel(s);
+}
+
+/* Reads the page requests of the destination of a post-copy migration */
+static void *source_return_path_thread(void *opaque)
+{
+    QEMUFile *rp = opaque;
+    char idstr[256];
+
+    for (;;) {
+        uint16_t type = qemu_get_be16(rp);
+        uint16_t len = qemu_get_be16(rp);
+        uint64_t offset;
+        int idlen;
+
+        if (qemu_file_get_error(rp)) {
+            break;
+        }
+        if (type != MIG_RP_MSG_REQ_PAGE) {
+            error_report("Unknown return path message %d", type);
+            break;
+        }
+
+        offset = qemu_get_be64(rp);
+        idlen = qemu_get_byte(rp);
+        if (len != 8 + 1 + idlen) {
+            error_report("Bad length %d for page request", len);
+            break;
+        }
+        qemu_get_buffer(rp, (uint8_t *)idstr, idlen);
+        idstr[idlen] = 0;
+        if (qemu_file_get_error(rp)) {
+            break;
+        }
+        trace_source_return_path_request(idstr, offset);
+        ram_save_queue_page(idstr, offset);
+    }
+    return NULL;
+}
+
+void qmp_migrate_start_postcopy(Error **errp)
+{
+    MigrationState *s = migrate_get_current();
+
+    if (!migrate_postcopy_ram()) {
+        error_setg(errp, "Enable the postcopy-ram capability before "
+                   "starting the migration");
+        return;
+    }
+    if (s->state != MIG_STATE_ACTIVE) {
+        error_setg(errp, "No migration is running");
+        return;
+    }
+    if (s->params.blk) {
+        error_setg(errp, "Post-copy does not support block migration");
+        return;
+    }
+    if (s->start_postcopy) {
+        return;
+    }
+
+    /* Listen before the destination can make any request */
+    s->return_path = qemu_file_get_return_path(s->file);
+    if (!s->return_path) {
+        error_setg(errp, "Post-copy needs a tcp or unix migration");
+        return;
+    }
+    qemu_thread_create(&s->rp_thread, "mig/return",
+                       source_return_path_thread, s->return_path,
+                       QEMU_THREAD_JOINABLE);
+    s->start_postcopy = true;
 }
 
 void qmp_migrate_set_cache_size(int64_t value, Error **errp)
@@ -538,6 +789,15 @@ bool migrate_rdma_pin_all(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_RDMA_PIN_ALL];
 }
 
+int migrate_rdma_pinned_max(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->rdma_pinned_max;
+}
+
 bool migrate_auto_converge(void)
 {
     MigrationState *s;
@@ -574,6 +834,103 @@ int64_t migrate_xbzrle_cache_size(void)
     return s->xbzrle_cache_size;
 }
 
+bool migrate_use_compression(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_COMPRESS];
+}
+
+int migrate_compress_level(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->compress_level;
+}
+
+int migrate_compress_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->compress_threads;
+}
+
+int migrate_decompress_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->decompress_threads;
+}
+
+bool migrate_use_multifd(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
+}
+
+int migrate_multifd_channels(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->multifd_channels;
+}
+
+bool migrate_postcopy_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_RAM];
+}
+
+/*
+ * Switch to post-copy: stop the guest, drop the pages it dirtied since
+ * they were sent, and send the device state.  The guest then runs on the
+ * destination while the migration thread sends the remaining pages,
+ * those requested first.
+ */
+static int postcopy_start(MigrationState *s, bool *old_vm_running)
+{
+    int64_t start_time;
+    int ret;
+
+    qemu_mutex_lock_iothread();
+    start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    qemu_system_wakeup_request(QEMU_WAKEUP_REASON_OTHER);
+    *old_vm_running = runstate_is_running();
+
+    ret = vm_stop_force_state(RUN_STATE_FINISH_MIGRATE);
+    if (ret >= 0) {
+        trace_migrate_postcopy_start();
+        ret = ram_postcopy_send_discard(s->file);
+    }
+    if (ret >= 0) {
+        ret = qemu_savevm_state_postcopy_start(s->file);
+    }
+    if (ret >= 0) {
+        s->in_postcopy = true;
+        s->downtime = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - start_time;
+        qemu_file_set_rate_limit(s->file, INT64_MAX);
+    }
+    qemu_mutex_unlock_iothread();
+
+    return ret;
+}
+
 /* migration thread support */
 
 static void *migration_thread(void *opaque)
@@ -585,8 +942,13 @@ static void *migration_thread(void *opaque)
     int64_t max_size = 0;
     int64_t start_time = initial_time;
     bool old_vm_running = false;
+    QEMUFile *return_path;
+    QemuThread rp_thread;
 
     qemu_savevm_state_begin(s->file, &s->params);
+    if (migrate_postcopy_ram()) {
+        qemu_savevm_send_postcopy_advise(s->file);
+    }
 
     s->setup_time = qemu_clock_get_ms(QEMU_CLOCK_HOST) - setup_start;
     migrate_set_state(s, MIG_STATE_SETUP, MIG_STATE_ACTIVE);
@@ -598,8 +960,23 @@ static void *migration_thread(void *opaque)
         if (!qemu_file_rate_limit(s->file)) {
             pending_size = qemu_savevm_state_pending(s->file, max_size);
             trace_migrate_pending(pending_size, max_size);
-            if (pending_size && pending_size >= max_size) {
+            if (s->start_postcopy && !s->in_postcopy &&
+                pending_size && pending_size >= max_size) {
+                if (postcopy_start(s, &old_vm_running) < 0) {
+                    migrate_set_state(s, MIG_STATE_ACTIVE, MIG_STATE_ERROR);
+                    break;
+                }
+            } else if (pending_size && pending_size >= max_size) {
                 qemu_savevm_state_iterate(s->file);
+            } else if (s->in_postcopy) {
+                qemu_mutex_lock_iothread();
+                qemu_savevm_state_complete_postcopy(s->file);
+                qemu_mutex_unlock_iothread();
+
+                if (!qemu_file_get_error(s->file)) {
+                    migrate_set_state(s, MIG_STATE_ACTIVE, MIG_STATE_COMPLETED);
+                    break;
+                }
             } else {
                 int ret;
 
@@ -664,20 +1041,37 @@ static void *migration_thread(void *opaque)
         int64_t end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
         uint64_t transferred_bytes = qemu_ftell(s->file);
         s->total_time = end_time - s->total_time;
-        s->downtime = end_time - start_time;
+        if (!s->in_postcopy) {
+            s->downtime = end_time - start_time;
+        }
         if (s->total_time) {
             s->mbps = (((double) transferred_bytes * 8.0) /
                        ((double) s->total_time)) / 1000;
         }
         runstate_set(RUN_STATE_POSTMIGRATE);
     } else {
-        if (old_vm_running) {
+        /* Once in post-copy, the destination may have run the guest */
+        if (old_vm_running && !s->in_postcopy) {
             vm_start();
         }
     }
+    return_path = s->return_path;
+    rp_thread = s->rp_thread;
+    s->return_path = NULL;
     qemu_bh_schedule(s->cleanup_bh);
     qemu_mutex_unlock_iothread();
 
+    /* After a successful migration, the destination closes its side of
+     * the connection once it has read the whole stream.
+     */
+    if (return_path) {
+        if (s->state != MIG_STATE_COMPLETED) {
+            shutdown(qemu_get_fd(return_path), SHUT_RDWR);
+        }
+        qemu_thread_join(&rp_thread);
+        qemu_fclose(return_path);
+    }
+
     return NULL;
 }
 
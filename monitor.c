@@ -2282,6 +2282,19 @@ static void do_loadvm(Monitor *mon, const QDict *qdict)
     }
 }
 
+static void do_loadvm_file(Monitor *mon, const QDict *qdict)
+{
+    int saved_vm_running  = runstate_is_running();
+    const char *filename = qdict_get_str(qdict, "filename");
+    bool template = qdict_get_try_bool(qdict, "template", 0);
+
+    vm_stop(RUN_STATE_RESTORE_VM);
+
+    if (load_vmstate_file(filename, template) == 0 && saved_vm_running) {
+        vm_start();
+    }
+}
+
 int monitor_get_fd(Monitor *mon, const char *fdname, Error **errp)
 {
     mon_fd_t *monfd;
@@ -2915,6 +2928,13 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show current migration xbzrle cache size",
         .mhandler.cmd = hmp_info_migrate_cache_size,
     },
+    {
+        .name       = "migrate_parameters",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show current migration parameters",
+        .mhandler.cmd = hmp_info_migrate_parameters,
+    },
     {
         .name       = "balloon",
         .args_type  = "",
@@ -2957,6 +2977,13 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show the TPM device",
         .mhandler.cmd = hmp_info_tpm,
     },
+    {
+        .name       = "tb-hotspots",
+        .args_type  = "count:i?",
+        .params     = "[count]",
+        .help       = "show the most frequently executed translated blocks",
+        .mhandler.cmd = hmp_info_tb_hotspots,
+    },
     {
         .name       = NULL,
     },
@@ -38,6 +38,7 @@
 #include "hw/qdev.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
+#include "sysemu/sysemu.h"
 #include "qapi-visit.h"
 #include "qapi/opts-visitor.h"
 #include "qapi/dealloc-visitor.h"
@@ -1149,6 +1150,44 @@ void qmp_set_link(const char *name, bool up, Error **errp)
     }
 }
 
+/*
+ * The MAC of a NIC is part of its migrated state, so a clone keeps the
+ * one of the template whatever its own mac= says.  Only NICs that report
+ * their receive filter can be checked.
+ */
+static void net_clone_check_mac(NICState *nic, void *opaque)
+{
+    NetClientState *nc = qemu_get_queue(nic);
+    const uint8_t *mac = nic->conf->macaddr.a;
+    char *conf_mac;
+    RxFilterInfo *info;
+
+    if (!nc->info->query_rx_filter) {
+        error_report("warning: cannot check the MAC of %s, which may be the "
+                     "template's", nc->name);
+        return;
+    }
+
+    conf_mac = g_strdup_printf("%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
+                               mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    info = nc->info->query_rx_filter(nc);
+    if (strcmp(info->main_mac, conf_mac)) {
+        error_report("warning: %s keeps the template's MAC %s, not %s",
+                     nc->name, info->main_mac, conf_mac);
+    }
+    qapi_free_RxFilterInfo(info);
+    g_free(conf_mac);
+}
+
+static void net_vm_cloned(Notifier *notifier, void *data)
+{
+    qemu_foreach_nic(net_clone_check_mac, NULL);
+}
+
+static Notifier net_vm_clone_notifier = {
+    .notify = net_vm_cloned,
+};
+
 void net_cleanup(void)
 {
     NetClientState *nc;
@@ -1250,6 +1289,7 @@ int net_init_clients(void)
     }
 
     QTAILQ_INIT(&net_clients);
+    qemu_add_vm_clone_notifier(&net_vm_clone_notifier);
 
     if (qemu_opts_foreach(qemu_find_opts("netdev"), net_init_netdev, NULL, 1) == -1)
         return -1;
@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is base on a hash of the page address, and set-associative
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -23,6 +23,7 @@
 #include <glib.h>
 
 #include "qemu-common.h"
+#include "qemu/host-utils.h"
 #include "migration/page_cache.h"
 
 #ifdef DEBUG_CACHE
@@ -41,10 +42,18 @@ struct CacheItem {
     uint8_t *it_data;
 };
 
+/* The items are grouped in sets of up to CACHE_WAYS.  A page can go in
+ * any item of the set its address hashes to, and replaces the one used
+ * least recently; a lookup compares the addresses of a single set.
+ */
+#define CACHE_WAYS 4
+
 struct PageCache {
     CacheItem *page_cache;
     unsigned int page_size;
     int64_t max_num_items;
+    unsigned int ways;
+    unsigned int set_bits;
     uint64_t max_item_age;
     int64_t num_items;
 };
@@ -75,6 +84,8 @@ PageCache *cache_init(int64_t num_pages, unsigned int page_size)
     cache->num_items = 0;
     cache->max_item_age = 0;
     cache->max_num_items = num_pages;
+    cache->ways = MIN(num_pages, CACHE_WAYS);
+    cache->set_bits = ctz64(num_pages / cache->ways);
 
     DPRINTF("Setting cache buckets to %" PRId64 "\n", cache->max_num_items);
 
@@ -111,43 +122,73 @@ void cache_fini(PageCache *cache)
     cache->page_cache = NULL;
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
+/* Guest RAM is often dirtied with a power-of-two stride, which the low
+ * bits of the page number alone would map to a few sets.
+ */
+static CacheItem *cache_get_set(const PageCache *cache, uint64_t address)
 {
-    size_t pos;
+    uint64_t page = address / cache->page_size;
+    size_t set = 0;
 
     g_assert(cache->max_num_items);
-    pos = (address / cache->page_size) & (cache->max_num_items - 1);
-    return pos;
+    if (cache->set_bits) {
+        set = (page * 0x9e3779b97f4a7c15ULL) >> (64 - cache->set_bits);
+    }
+    return &cache->page_cache[set * cache->ways];
 }
 
-bool cache_is_cached(const PageCache *cache, uint64_t addr)
+static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
 {
-    size_t pos;
+    CacheItem *set;
+    unsigned int i;
 
     g_assert(cache);
     g_assert(cache->page_cache);
 
-    pos = cache_get_cache_pos(cache, addr);
-
-    return (cache->page_cache[pos].it_addr == addr);
+    set = cache_get_set(cache, addr);
+    for (i = 0; i < cache->ways; i++) {
+        if (set[i].it_addr == addr) {
+            return &set[i];
+        }
+    }
+    return NULL;
 }
 
-static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+/* The item to fill with @addr: its own, a free one, or the oldest one */
+static CacheItem *cache_get_victim(const PageCache *cache, uint64_t addr)
 {
-    size_t pos;
-
-    g_assert(cache);
-    g_assert(cache->page_cache);
-
-    pos = cache_get_cache_pos(cache, addr);
+    CacheItem *set, *victim;
+    unsigned int i;
+
+    set = cache_get_set(cache, addr);
+    victim = &set[0];
+    for (i = 0; i < cache->ways; i++) {
+        if (set[i].it_addr == addr) {
+            return &set[i];
+        }
+        if (!set[i].it_data) {
+            victim = &set[i];
+        } else if (victim->it_data && set[i].it_age < victim->it_age) {
+            victim = &set[i];
+        }
+    }
+    return victim;
+}
 
-    return &cache->page_cache[pos];
+bool cache_is_cached(const PageCache *cache, uint64_t addr)
+{
+    return cache_get_by_addr(cache, addr) != NULL;
 }
 
-uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
+uint8_t *get_cached_data(PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    if (!it) {
+        return NULL;
+    }
+    it->it_age = ++cache->max_item_age;
+    return it->it_data;
 }
 
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata)
@@ -159,7 +200,7 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata)
     g_assert(cache->page_cache);
 
     /* actual update of entry */
-    it = cache_get_by_addr(cache, addr);
+    it = cache_get_victim(cache, addr);
 
     /* allocate page */
     if (!it->it_data) {
@@ -208,10 +249,9 @@ int64_t cache_resize(PageCache *cache, int64_t new_num_pages)
     for (i = 0; i < cache->max_num_items; i++) {
         old_it = &cache->page_cache[i];
         if (old_it->it_addr != -1) {
-            /* check for collision, if there is, keep MRU page */
-            new_it = cache_get_by_addr(new_cache, old_it->it_addr);
+            /* if the set is full, keep the MRU pages */
+            new_it = cache_get_victim(new_cache, old_it->it_addr);
             if (new_it->it_data && new_it->it_age >= old_it->it_age) {
-                /* keep the MRU page */
                 g_free(old_it->it_data);
             } else {
                 if (!new_it->it_data) {
@@ -228,6 +268,8 @@ int64_t cache_resize(PageCache *cache, int64_t new_num_pages)
     g_free(cache->page_cache);
     cache->page_cache = new_cache->page_cache;
     cache->max_num_items = new_cache->max_num_items;
+    cache->ways = new_cache->ways;
+    cache->set_bits = new_cache->set_bits;
     cache->num_items = new_cache->num_items;
 
     g_free(new_cache);
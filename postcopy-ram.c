@@ -0,0 +1,473 @@
+/*
+ * Post-copy live migration, destination side
+ *
+ * After the switch-over the guest runs here while its RAM is still
+ * coming in.  Pages it touches before they arrive are caught with
+ * userfaultfd and requested from the source on the return path.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include "qemu-common.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/error-report.h"
+#include "migration/migration.h"
+#include "migration/qemu-file.h"
+#include "migration/postcopy-ram.h"
+#include "trace.h"
+
+#ifdef CONFIG_USERFAULTFD
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+#include "qemu/event_notifier.h"
+
+typedef struct PostcopyBlock {
+    char idstr[256];
+    uint8_t *host;
+    size_t length;
+} PostcopyBlock;
+
+/* The fault thread reads the faults and sends the requests; the pages are
+ * placed by the thread that reads the migration stream, which wakes up
+ * the faulting threads.
+ */
+static struct {
+    bool initialized;
+    bool active;
+    int uffd;
+    EventNotifier quit;
+    QemuThread fault_thread;
+    QEMUFile *return_path;
+    GArray *blocks;          /* of PostcopyBlock, fixed once started */
+    void *tmp_page;
+
+    QemuMutex lock;
+    /* protected by lock */
+    GHashTable *pending;     /* page -> time of its fault, in ns */
+    int64_t faults;
+    int64_t resolved;
+    int64_t latency_total;   /* in us */
+    int64_t latency_max;
+} pc;
+
+static int userfaultfd_open(void)
+{
+    struct uffdio_api api = { .api = UFFD_API };
+    int fd;
+
+    fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) {
+        return -errno;
+    }
+    if (ioctl(fd, UFFDIO_API, &api) < 0) {
+        int ret = -errno;
+
+        close(fd);
+        return ret;
+    }
+    return fd;
+}
+
+bool postcopy_ram_supported_by_host(uint64_t page_size)
+{
+    int fd;
+
+    if (page_size != getpagesize()) {
+        error_report("Post-copy needs pages of the host size, got %" PRIu64,
+                     page_size);
+        return false;
+    }
+    fd = userfaultfd_open();
+    if (fd < 0) {
+        error_report("Post-copy needs userfaultfd: %s", strerror(-fd));
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+static PostcopyBlock *postcopy_find_block(uint8_t *addr)
+{
+    unsigned int i;
+
+    for (i = 0; i < pc.blocks->len; i++) {
+        PostcopyBlock *block = &g_array_index(pc.blocks, PostcopyBlock, i);
+
+        if (addr >= block->host && addr - block->host < block->length) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+static void postcopy_request_page(PostcopyBlock *block, uint8_t *page)
+{
+    QEMUFile *rp = pc.return_path;
+    int len = strlen(block->idstr);
+
+    trace_postcopy_ram_fault(block->idstr, page - block->host);
+    qemu_put_be16(rp, MIG_RP_MSG_REQ_PAGE);
+    qemu_put_be16(rp, 8 + 1 + len);
+    qemu_put_be64(rp, page - block->host);
+    qemu_put_byte(rp, len);
+    qemu_put_buffer(rp, (uint8_t *)block->idstr, len);
+    qemu_fflush(rp);
+}
+
+static void *postcopy_ram_fault_thread(void *opaque)
+{
+    uintptr_t page_mask = ~(uintptr_t)(getpagesize() - 1);
+    struct pollfd pfd[2];
+
+    pfd[0].fd = pc.uffd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = event_notifier_get_fd(&pc.quit);
+    pfd[1].events = POLLIN;
+
+    for (;;) {
+        struct uffd_msg msg;
+        PostcopyBlock *block;
+        uint8_t *page;
+        int64_t *fault_time;
+        bool first = false;
+        ssize_t len;
+
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_report("Post-copy fault thread: poll: %s", strerror(errno));
+            break;
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+
+        len = read(pc.uffd, &msg, sizeof(msg));
+        if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+            continue;
+        }
+        if (len != sizeof(msg)) {
+            error_report("Post-copy fault thread: cannot read userfaultfd");
+            break;
+        }
+        if (msg.event != UFFD_EVENT_PAGEFAULT) {
+            continue;
+        }
+
+        page = (uint8_t *)((uintptr_t)msg.arg.pagefault.address & page_mask);
+        block = postcopy_find_block(page);
+        if (!block) {
+            error_report("Post-copy fault at %p outside guest RAM", page);
+            continue;
+        }
+
+        /* Several threads may fault on a page before it arrives */
+        qemu_mutex_lock(&pc.lock);
+        fault_time = g_hash_table_lookup(pc.pending, page);
+        if (!fault_time) {
+            fault_time = g_new(int64_t, 1);
+            *fault_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+            g_hash_table_insert(pc.pending, page, fault_time);
+            pc.faults++;
+            first = true;
+        }
+        qemu_mutex_unlock(&pc.lock);
+
+        if (first) {
+            postcopy_request_page(block, page);
+        }
+    }
+    return NULL;
+}
+
+int postcopy_ram_incoming_init(QEMUFile *return_path)
+{
+    int fd;
+
+    fd = userfaultfd_open();
+    if (fd < 0) {
+        error_report("Post-copy needs userfaultfd: %s", strerror(-fd));
+        return fd;
+    }
+    if (event_notifier_init(&pc.quit, false) < 0) {
+        close(fd);
+        return -errno;
+    }
+
+    if (!pc.initialized) {
+        qemu_mutex_init(&pc.lock);
+        pc.initialized = true;
+    }
+    pc.uffd = fd;
+    pc.return_path = return_path;
+    pc.blocks = g_array_new(FALSE, TRUE, sizeof(PostcopyBlock));
+    pc.tmp_page = qemu_memalign(getpagesize(), getpagesize());
+    pc.pending = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                       NULL, g_free);
+    pc.faults = pc.resolved = pc.latency_total = pc.latency_max = 0;
+    return 0;
+}
+
+static int postcopy_ram_register_range(int uffd, const char *idstr,
+                                       void *host, size_t length)
+{
+    struct uffdio_register reg = {
+        .range = { .start = (uintptr_t)host, .len = length },
+        .mode = UFFDIO_REGISTER_MODE_MISSING,
+    };
+    int ret;
+
+    if (ioctl(uffd, UFFDIO_REGISTER, &reg) < 0) {
+        ret = -errno;
+        error_report("Post-copy cannot register RAM block %s: %s",
+                     idstr, strerror(-ret));
+        return ret;
+    }
+    if (!(reg.ioctls & (1ULL << _UFFDIO_COPY))) {
+        error_report("Post-copy cannot place pages in RAM block %s", idstr);
+        return -ENOTSUP;
+    }
+    return 0;
+}
+
+int postcopy_ram_check_block(const char *idstr, void *host, size_t length)
+{
+    int fd, ret;
+
+    fd = userfaultfd_open();
+    if (fd < 0) {
+        error_report("Post-copy needs userfaultfd: %s", strerror(-fd));
+        return fd;
+    }
+    /* Closing the userfaultfd unregisters the range */
+    ret = postcopy_ram_register_range(fd, idstr, host, length);
+    close(fd);
+    return ret;
+}
+
+int postcopy_ram_register_block(const char *idstr, void *host, size_t length)
+{
+    PostcopyBlock block;
+    int ret;
+
+    ret = postcopy_ram_register_range(pc.uffd, idstr, host, length);
+    if (ret < 0) {
+        return ret;
+    }
+
+    pstrcpy(block.idstr, sizeof(block.idstr), idstr);
+    block.host = host;
+    block.length = length;
+    g_array_append_val(pc.blocks, block);
+    return 0;
+}
+
+int postcopy_ram_incoming_start(void)
+{
+    qemu_thread_create(&pc.fault_thread, "postcopy/fault",
+                       postcopy_ram_fault_thread, NULL,
+                       QEMU_THREAD_JOINABLE);
+    pc.active = true;
+    return 0;
+}
+
+/* Called once the whole migration stream has been read */
+void postcopy_ram_incoming_cleanup(void)
+{
+    unsigned int i;
+
+    if (!pc.blocks) {
+        return;
+    }
+    if (pc.active) {
+        event_notifier_set(&pc.quit);
+        qemu_thread_join(&pc.fault_thread);
+        pc.active = false;
+    }
+
+    for (i = 0; i < pc.blocks->len; i++) {
+        PostcopyBlock *block = &g_array_index(pc.blocks, PostcopyBlock, i);
+        struct uffdio_range range = {
+            .start = (uintptr_t)block->host,
+            .len = block->length,
+        };
+
+        ioctl(pc.uffd, UFFDIO_UNREGISTER, &range);
+    }
+    close(pc.uffd);
+    event_notifier_cleanup(&pc.quit);
+    if (pc.return_path) {
+        qemu_fclose(pc.return_path);
+        pc.return_path = NULL;
+    }
+    g_array_free(pc.blocks, TRUE);
+    pc.blocks = NULL;
+    qemu_vfree(pc.tmp_page);
+
+    qemu_mutex_lock(&pc.lock);
+    g_hash_table_destroy(pc.pending);
+    pc.pending = NULL;
+    qemu_mutex_unlock(&pc.lock);
+}
+
+bool postcopy_ram_incoming_active(void)
+{
+    return pc.active;
+}
+
+int postcopy_ram_discard_range(void *host, size_t length)
+{
+    if (qemu_madvise(host, length, QEMU_MADV_DONTNEED) < 0) {
+        error_report("Post-copy cannot discard %zu bytes at %p: %s",
+                     length, host, strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+static void postcopy_page_arrived(void *host)
+{
+    int64_t *fault_time;
+    int64_t latency;
+
+    qemu_mutex_lock(&pc.lock);
+    fault_time = g_hash_table_lookup(pc.pending, host);
+    if (fault_time) {
+        latency = (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - *fault_time) /
+                  1000;
+        trace_postcopy_ram_page_arrived(host, latency);
+        pc.resolved++;
+        pc.latency_total += latency;
+        pc.latency_max = MAX(pc.latency_max, latency);
+        g_hash_table_remove(pc.pending, host);
+    }
+    qemu_mutex_unlock(&pc.lock);
+}
+
+int postcopy_place_page(void *host, void *from)
+{
+    struct uffdio_copy copy = {
+        .dst = (uintptr_t)host,
+        .src = (uintptr_t)from,
+        .len = getpagesize(),
+    };
+
+    /* A page requested after it was sent comes twice */
+    if (ioctl(pc.uffd, UFFDIO_COPY, &copy) < 0 && errno != EEXIST) {
+        error_report("Post-copy cannot place page at %p: %s",
+                     host, strerror(errno));
+        return -errno;
+    }
+    postcopy_page_arrived(host);
+    return 0;
+}
+
+int postcopy_place_zero_page(void *host)
+{
+    struct uffdio_zeropage zero = {
+        .range = { .start = (uintptr_t)host, .len = getpagesize() },
+    };
+
+    if (ioctl(pc.uffd, UFFDIO_ZEROPAGE, &zero) < 0 && errno != EEXIST) {
+        error_report("Post-copy cannot place zero page at %p: %s",
+                     host, strerror(errno));
+        return -errno;
+    }
+    postcopy_page_arrived(host);
+    return 0;
+}
+
+void *postcopy_get_tmp_page(void)
+{
+    return pc.tmp_page;
+}
+
+PostcopyStats *postcopy_ram_incoming_stats(void)
+{
+    PostcopyStats *stats;
+
+    if (!pc.initialized) {
+        return NULL;
+    }
+
+    stats = g_malloc0(sizeof(*stats));
+    qemu_mutex_lock(&pc.lock);
+    stats->faults = pc.faults;
+    stats->fault_latency_avg = pc.resolved ?
+                               pc.latency_total / pc.resolved : 0;
+    stats->fault_latency_max = pc.latency_max;
+    qemu_mutex_unlock(&pc.lock);
+    return stats;
+}
+
+#else
+
+bool postcopy_ram_supported_by_host(uint64_t page_size)
+{
+    error_report("Post-copy is not supported on this host");
+    return false;
+}
+
+int postcopy_ram_incoming_init(QEMUFile *return_path)
+{
+    error_report("Post-copy is not supported on this host");
+    return -ENOSYS;
+}
+
+int postcopy_ram_check_block(const char *idstr, void *host, size_t length)
+{
+    return -ENOSYS;
+}
+
+int postcopy_ram_register_block(const char *idstr, void *host, size_t length)
+{
+    return -ENOSYS;
+}
+
+int postcopy_ram_incoming_start(void)
+{
+    return -ENOSYS;
+}
+
+void postcopy_ram_incoming_cleanup(void)
+{
+}
+
+bool postcopy_ram_incoming_active(void)
+{
+    return false;
+}
+
+int postcopy_ram_discard_range(void *host, size_t length)
+{
+    return -ENOSYS;
+}
+
+int postcopy_place_page(void *host, void *from)
+{
+    return -ENOSYS;
+}
+
+int postcopy_place_zero_page(void *host)
+{
+    return -ENOSYS;
+}
+
+void *postcopy_get_tmp_page(void)
+{
+    return NULL;
+}
+
+PostcopyStats *postcopy_ram_incoming_stats(void)
+{
+    return NULL;
+}
+
+#endif
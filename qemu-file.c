@@ -358,6 +358,11 @@ bool qemu_file_mode_is_not_valid(const char *mode)
     return false;
 }
 
+static inline bool qemu_file_is_writable(QEMUFile *f)
+{
+    return f->ops->writev_buffer || f->ops->put_buffer;
+}
+
 QEMUFile *qemu_fopen_socket(int fd, const char *mode)
 {
     QEMUFileSocket *s;
@@ -377,6 +382,95 @@ QEMUFile *qemu_fopen_socket(int fd, const char *mode)
     return s->file;
 }
 
+/* Open a stream in the other direction on the socket under @f, for the
+ * messages that the destination of a post-copy migration sends back.
+ * Returns NULL if @f is not backed by a socket.
+ */
+QEMUFile *qemu_file_get_return_path(QEMUFile *f)
+{
+#ifndef _WIN32
+    int fd = qemu_get_fd(f);
+    int so_type;
+    socklen_t optlen = sizeof(so_type);
+
+    if (fd < 0 ||
+        getsockopt(fd, SOL_SOCKET, SO_TYPE, &so_type, &optlen) < 0 ||
+        so_type != SOCK_STREAM) {
+        return NULL;
+    }
+    fd = dup(fd);
+    if (fd < 0) {
+        return NULL;
+    }
+    return qemu_fopen_socket(fd, qemu_file_is_writable(f) ? "rb" : "wb");
+#else
+    return NULL;
+#endif
+}
+
+typedef struct QEMUFileBuffer {
+    GByteArray *buf;
+    QEMUFile *file;
+} QEMUFileBuffer;
+
+static int buf_put_buffer(void *opaque, const uint8_t *buf, int64_t pos,
+                          int size)
+{
+    QEMUFileBuffer *s = opaque;
+
+    g_byte_array_append(s->buf, buf, size);
+    return size;
+}
+
+static int buf_get_buffer(void *opaque, uint8_t *buf, int64_t pos, int size)
+{
+    QEMUFileBuffer *s = opaque;
+
+    if (pos >= s->buf->len) {
+        return 0;
+    }
+    size = MIN(size, s->buf->len - pos);
+    memcpy(buf, s->buf->data + pos, size);
+    return size;
+}
+
+static int buf_close(void *opaque)
+{
+    g_free(opaque);
+    return 0;
+}
+
+static const QEMUFileOps buf_read_ops = {
+    .get_buffer = buf_get_buffer,
+    .close =      buf_close
+};
+
+static const QEMUFileOps buf_write_ops = {
+    .put_buffer = buf_put_buffer,
+    .close =      buf_close
+};
+
+/* A stream over @buf, which stays owned by the caller: writes append to it,
+ * reads start at its beginning.
+ */
+QEMUFile *qemu_bufopen(GByteArray *buf, const char *mode)
+{
+    QEMUFileBuffer *s;
+
+    if (qemu_file_mode_is_not_valid(mode)) {
+        return NULL;
+    }
+
+    s = g_malloc0(sizeof(QEMUFileBuffer));
+    s->buf = buf;
+    if (mode[0] == 'w') {
+        s->file = qemu_fopen_ops(s, &buf_write_ops);
+    } else {
+        s->file = qemu_fopen_ops(s, &buf_read_ops);
+    }
+    return s->file;
+}
+
 QEMUFile *qemu_fopen(const char *filename, const char *mode)
 {
     QEMUFileStdio *s;
@@ -433,11 +527,6 @@ void qemu_file_set_error(QEMUFile *f, int ret)
     }
 }
 
-static inline bool qemu_file_is_writable(QEMUFile *f)
-{
-    return f->ops->writev_buffer || f->ops->put_buffer;
-}
-
 /**
  * Flushes QEMUFile buffer
  *
@@ -828,6 +917,15 @@ void qemu_file_set_rate_limit(QEMUFile *f, int64_t limit)
     f->xfer_limit = limit;
 }
 
+/* Account for data sent on behalf of @f by other means, such as the extra
+ * channels of a multifd migration, in its position and its rate limit.
+ */
+void qemu_file_update_transfer(QEMUFile *f, int64_t len)
+{
+    f->pos += len;
+    f->bytes_xfer += len;
+}
+
 void qemu_file_reset_rate_limit(QEMUFile *f)
 {
     f->bytes_xfer = 0;
@@ -35,7 +35,8 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                kernel_irqchip=on|off controls accelerated irqchip support\n"
     "                kvm_shadow_mem=size of KVM shadow MMU\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
-    "                mem-merge=on|off controls memory merge support (default: on)\n",
+    "                mem-merge=on|off controls memory merge support (default: on)\n"
+    "                mem-thp=on|off controls transparent huge pages for guest memory (default: on)\n",
     QEMU_ARCH_ALL)
 STEXI
 @item -machine [type=]@var{name}[,prop=@var{value}[,...]]
@@ -58,6 +59,9 @@ Include guest memory in a core dump. The default is on.
 Enables or disables memory merge support. This feature, when supported by
 the host, de-duplicates identical memory pages among VMs instances
 (enabled by default).
+@item mem-thp=on|off
+Enables or disables transparent huge pages for guest memory, when supported
+by the host (enabled by default).
 @end table
 ETEXI
 
@@ -95,12 +99,13 @@ specifies the maximum number of hotpluggable CPUs.
 ETEXI
 
 DEF("numa", HAS_ARG, QEMU_OPTION_numa,
-    "-numa node[,mem=size][,cpus=cpu[-cpu]][,nodeid=node]\n", QEMU_ARCH_ALL)
+    "-numa node[,mem=size][,cpus=cpu[-cpu]][,nodeid=node][,hostnode=node]\n", QEMU_ARCH_ALL)
 STEXI
 @item -numa @var{opts}
 @findex -numa
 Simulate a multi node NUMA system. If mem and cpus are omitted, resources
-are split equally.
+are split equally. @option{hostnode} binds the memory of the guest node to
+the given host NUMA node (Linux hosts only).
 ETEXI
 
 DEF("add-fd", HAS_ARG, QEMU_OPTION_add_fd,
@@ -232,12 +237,14 @@ Allocate guest RAM from a temporarily created file in @var{path}.
 ETEXI
 
 DEF("mem-prealloc", 0, QEMU_OPTION_mem_prealloc,
-    "-mem-prealloc   preallocate guest memory (use with -mem-path)\n",
+    "-mem-prealloc   preallocate guest memory\n",
     QEMU_ARCH_ALL)
 STEXI
 @item -mem-prealloc
 @findex -mem-prealloc
-Preallocate memory when using -mem-path.
+Preallocate guest memory, whether it comes from -mem-path or not.  The
+pages are touched by one thread per host CPU, after any NUMA binding
+requested with -numa hostnode.
 ETEXI
 
 DEF("k", HAS_ARG, QEMU_OPTION_k,
@@ -2690,6 +2697,43 @@ STEXI
 Run the emulation in single step mode.
 ETEXI
 
+DEF("tb-profile", 0, QEMU_OPTION_tb_profile, \
+    "-tb-profile     count executions of each translated block\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tb-profile
+@findex -tb-profile
+Instrument the entry of every translated block with an execution counter.
+The most frequently executed blocks can then be listed with the
+@code{info tb-hotspots} monitor command.  Counting slows down the emulation
+slightly and has no effect with KVM.
+ETEXI
+
+DEF("tb-trace", HAS_ARG, QEMU_OPTION_tb_trace, \
+    "-tb-trace threshold\n"
+    "                retranslate blocks executed 'threshold' times as traces\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tb-trace @var{threshold}
+@findex -tb-trace
+Count the executions of each translated block and, once a block has run
+@var{threshold} times, translate it again as a trace that continues along
+the direct jumps and calls it contains.  Condition codes and other state
+are then optimized across the whole trace instead of being materialized
+at every block boundary.  Only the x86 targets build traces.
+ETEXI
+
+DEF("perfmap", 0, QEMU_OPTION_perfmap, \
+    "-perfmap        write a perf map of the translated code to /tmp/perf-<pid>.map\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -perfmap
+@findex -perfmap
+Describe every translated block in @file{/tmp/perf-<pid>.map} so that the
+Linux @command{perf} tool can attribute samples taken in generated code to
+the guest address it was translated from.
+ETEXI
+
 DEF("S", 0, QEMU_OPTION_S, \
     "-S              freeze CPU at startup (use 'c' to start execution)\n",
     QEMU_ARCH_ALL)
@@ -2832,6 +2876,30 @@ STEXI
 Start right away with a saved state (@code{loadvm} in monitor)
 ETEXI
 
+DEF("loadvm-file", HAS_ARG, QEMU_OPTION_loadvm_file, \
+    "-loadvm-file file\n" \
+    "                start right away with a state saved by savevm_file\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -loadvm-file @var{file}
+@findex -loadvm-file
+Start right away with the state saved in @var{file} and @var{file}.ram
+(@code{loadvm_file} in monitor)
+ETEXI
+
+DEF("loadvm-template", HAS_ARG, QEMU_OPTION_loadvm_template, \
+    "-loadvm-template file\n" \
+    "                start right away as a clone of a state saved by savevm_file\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -loadvm-template @var{file}
+@findex -loadvm-template
+Start right away as a clone of the state saved in @var{file} and
+@var{file}.ram (@code{loadvm_file -t} in monitor).  The network cards
+keep the MAC address of the template, so only user mode networking or
+other networks private to each clone should be used.
+ETEXI
+
 #ifndef _WIN32
 DEF("daemonize", 0, QEMU_OPTION_daemonize, \
     "-daemonize      daemonize QEMU after initializing\n", QEMU_ARCH_ALL)
@@ -661,6 +661,29 @@ Example:
 -> { "execute": "migrate_cancel" }
 <- { "return": {} }
 
+EQMP
+
+    {
+        .name       = "migrate-start-postcopy",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_migrate_start_postcopy,
+    },
+
+SQMP
+migrate-start-postcopy
+----------------------
+
+Switch the current migration to post-copy.  The guest is stopped on the
+source and started on the destination, which fetches the pages it faults
+on while the others keep being sent.  Needs the postcopy-ram capability.
+
+Arguments: None.
+
+Example:
+
+-> { "execute": "migrate-start-postcopy" }
+<- { "return": {} }
+
 EQMP
 {
         .name       = "migrate-set-cache-size",
@@ -2963,7 +2986,9 @@ The main json-object contains the following:
          - "duplicate": number of pages filled entirely with the same
             byte (json-int)
             These are sent over the wire much more efficiently.
-         - "skipped": number of skipped zero pages (json-int)
+         - "skipped": number of zero pages sent without reading them,
+            because the guest had never touched them (json-int)
+         - "skipped-bytes": bytes of RAM not read for that reason (json-int)
          - "normal" : number of whole pages transferred.  I.e. they
             were not sent as duplicate or xbzrle pages (json-int)
          - "normal-bytes" : number of bytes transferred in whole
@@ -2971,6 +2996,12 @@ The main json-object contains the following:
             but this way upper levels don't need to care about page
             size (json-int)
          - "dirty-sync-count": times that dirty ram was synchronized (json-int)
+         - "dirty-sync-time": duration of the last synchronization of dirty
+            ram, in microseconds (json-int)
+         - "dirty-sync-locked-time": part of "dirty-sync-time" during which
+            the guest could not run, in microseconds (json-int)
+         - "dirty-sync-time-max": longest synchronization of dirty ram, in
+            microseconds (json-int)
 - "disk": only present if "status" is "active" and it is a block migration,
   it is a json-object with the following disk information:
          - "transferred": amount transferred in bytes (json-int)
@@ -2987,6 +3018,31 @@ The main json-object contains the following:
            that the XBZRLE encoding was bigger than just sent the
            whole page, and then we sent the whole page instead (as as
            normal page).
+- "compression": only present if the compress capability is active.
+  It is a json-object with the following information:
+         - "pages": number of pages sent compressed (json-int)
+         - "compressed-size": number of bytes of these pages once
+           compressed (json-int)
+         - "compression-rate": ratio of the size of these pages to their
+           compressed size (json-number)
+         - "busy": number of times a page waited for a compression
+           thread (json-int)
+         - "threads": json-array with, for each compression thread:
+             - "pages": number of pages it compressed (json-int)
+             - "compressed-size": number of bytes of these pages once
+               compressed (json-int)
+             - "busy-time": milliseconds spent compressing (json-int)
+- "postcopy": only present once the migration has entered post-copy, on
+  the source, and on the destination of such a migration.
+  It is a json-object with the following information:
+         - "requests": number of pages requested by the destination,
+           counted on the source (json-int)
+         - "faults": number of pages the guest faulted on, counted on
+           the destination (json-int)
+         - "fault-latency-avg": average microseconds from a fault to the
+           arrival of the page, on the destination (json-int)
+         - "fault-latency-max": longest such time, in microseconds, on
+           the destination (json-int)
 
 Examples:
 
@@ -3112,6 +3168,9 @@ migrate-set-capabilities
 Enable/Disable migration capabilities
 
 - "xbzrle": XBZRLE support
+- "compress": multi-threaded compression of RAM pages
+- "multifd": RAM pages over several TCP connections
+- "postcopy-ram": allow switching to post-copy with migrate-start-postcopy
 
 Arguments:
 
@@ -3152,6 +3211,69 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_query_migrate_capabilities,
     },
 
+SQMP
+migrate-set-parameters
+----------------------
+
+Set migration parameters
+
+Arguments:
+
+- "compress-level": zlib compression level, 0 to 9 (json-int, optional)
+- "compress-threads": number of compression threads on the source, 1 to 255
+                      (json-int, optional)
+- "decompress-threads": number of decompression threads on the target,
+                        1 to 255 (json-int, optional)
+- "multifd-channels": number of extra TCP connections for RAM pages,
+                      1 to 16 (json-int, optional)
+- "rdma-pinned-max": MB of guest RAM kept registered by an RDMA migration,
+                     0 for no limit or at least 32 (json-int, optional)
+
+Example:
+
+-> { "execute": "migrate-set-parameters" , "arguments":
+     { "compress-level": 1, "compress-threads": 4 } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "migrate-set-parameters",
+        .args_type  =
+            "compress-level:i?,compress-threads:i?,decompress-threads:i?,"
+            "multifd-channels:i?,rdma-pinned-max:i?",
+        .mhandler.cmd_new = qmp_marshal_input_migrate_set_parameters,
+    },
+
+SQMP
+query-migrate-parameters
+------------------------
+
+Query current migration parameters
+
+- "compress-level": zlib compression level (json-int)
+- "compress-threads": number of compression threads (json-int)
+- "decompress-threads": number of decompression threads (json-int)
+- "multifd-channels": number of extra TCP connections (json-int)
+- "rdma-pinned-max": MB of guest RAM kept registered by RDMA (json-int)
+
+Arguments:
+
+Example:
+
+-> { "execute": "query-migrate-parameters" }
+<- { "return": { "compress-level": 1, "compress-threads": 8,
+                 "decompress-threads": 2, "multifd-channels": 2,
+                 "rdma-pinned-max": 0 } }
+
+EQMP
+
+    {
+        .name       = "query-migrate-parameters",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_migrate_parameters,
+    },
+
 SQMP
 query-balloon
 -------------
@@ -3572,3 +3694,42 @@ Example:
                    } } ] }
 
 EQMP
+
+SQMP
+query-tb-hotspots
+-----------------
+
+Show the most frequently executed translated blocks.  Execution counts are
+only maintained when QEMU is started with -tb-profile.
+
+Arguments:
+
+- "count": maximum number of blocks to return (json-int, optional,
+           default 20)
+
+Return a json-array sorted by decreasing execution count.  Each block is
+represented by a json-object, which contains:
+
+- "pc": guest virtual address of the block (json-int)
+- "guest-size": size of the guest code in bytes (json-int)
+- "host-addr": address of the generated host code (json-int)
+- "host-size": size of the generated host code in bytes (json-int)
+- "count": number of times the block was entered (json-int)
+
+Example:
+
+-> { "execute": "query-tb-hotspots", "arguments": { "count": 2 } }
+<- { "return": [
+        { "pc": 3222313536, "guest-size": 12, "host-addr": 140307891564544,
+          "host-size": 96, "count": 1835211 },
+        { "pc": 3222313552, "guest-size": 7, "host-addr": 140307891564672,
+          "host-size": 64, "count": 1602088 }
+     ] }
+
+EQMP
+
+    {
+        .name       = "query-tb-hotspots",
+        .args_type  = "count:i?",
+        .mhandler.cmd_new = qmp_marshal_input_query_tb_hotspots,
+    },
@@ -32,6 +32,7 @@
 #include "qemu/timer.h"
 #include "audio/audio.h"
 #include "migration/migration.h"
+#include "migration/postcopy-ram.h"
 #include "qemu/sockets.h"
 #include "qemu/queue.h"
 #include "sysemu/cpus.h"
@@ -461,6 +462,51 @@ bool qemu_savevm_state_blocked(Error **errp)
     return false;
 }
 
+static void qemu_savevm_command_send(QEMUFile *f, enum qemu_vm_cmd command,
+                                     uint16_t len, const uint8_t *data)
+{
+    trace_savevm_command_send(command, len);
+    qemu_put_byte(f, QEMU_VM_COMMAND);
+    qemu_put_be16(f, command);
+    qemu_put_be16(f, len);
+    qemu_put_buffer(f, data, len);
+}
+
+/* Tell the destination to get ready for a switch to post-copy */
+void qemu_savevm_send_postcopy_advise(QEMUFile *f)
+{
+    uint8_t buf[8];
+
+    stq_be_p(buf, TARGET_PAGE_SIZE);
+    qemu_savevm_command_send(f, MIG_CMD_POSTCOPY_ADVISE, sizeof(buf), buf);
+}
+
+/* Send @len ranges of the RAM block @idstr, whose copy on the destination
+ * is stale; the arguments must fit in the 16-bit length of a command.
+ */
+void qemu_savevm_send_postcopy_ram_discard(QEMUFile *f, const char *idstr,
+                                           uint16_t len, uint64_t *start,
+                                           uint64_t *length)
+{
+    size_t idlen = strlen(idstr);
+    size_t size = 1 + idlen + len * 16;
+    uint8_t *buf, *p;
+    int i;
+
+    assert(size <= UINT16_MAX);
+    buf = g_malloc(size);
+    buf[0] = idlen;
+    memcpy(buf + 1, idstr, idlen);
+    p = buf + 1 + idlen;
+    for (i = 0; i < len; i++) {
+        stq_be_p(p, start[i]);
+        stq_be_p(p + 8, length[i]);
+        p += 16;
+    }
+    qemu_savevm_command_send(f, MIG_CMD_POSTCOPY_RAM_DISCARD, size, buf);
+    g_free(buf);
+}
+
 void qemu_savevm_state_begin(QEMUFile *f,
                              const MigrationParams *params)
 {
@@ -555,15 +601,11 @@ int qemu_savevm_state_iterate(QEMUFile *f)
     return ret;
 }
 
-void qemu_savevm_state_complete(QEMUFile *f)
+static int qemu_savevm_state_complete_live(QEMUFile *f)
 {
     SaveStateEntry *se;
     int ret;
 
-    trace_savevm_state_complete();
-
-    cpu_synchronize_all_states();
-
     QTAILQ_FOREACH(se, &savevm_handlers, entry) {
         if (!se->ops || !se->ops->save_live_complete) {
             continue;
@@ -582,9 +624,15 @@ void qemu_savevm_state_complete(QEMUFile *f)
         trace_savevm_section_end(se->idstr, se->section_id);
         if (ret < 0) {
             qemu_file_set_error(f, ret);
-            return;
+            return ret;
         }
     }
+    return 0;
+}
+
+static void qemu_savevm_state_devices(QEMUFile *f)
+{
+    SaveStateEntry *se;
 
     QTAILQ_FOREACH(se, &savevm_handlers, entry) {
         int len;
@@ -608,11 +656,66 @@ void qemu_savevm_state_complete(QEMUFile *f)
         vmstate_save(f, se);
         trace_savevm_section_end(se->idstr, se->section_id);
     }
+}
+
+void qemu_savevm_state_complete(QEMUFile *f)
+{
+    trace_savevm_state_complete();
+
+    cpu_synchronize_all_states();
+
+    if (qemu_savevm_state_complete_live(f) < 0) {
+        return;
+    }
+    qemu_savevm_state_devices(f);
 
     qemu_put_byte(f, QEMU_VM_EOF);
     qemu_fflush(f);
 }
 
+/*
+ * Switch to post-copy, with the guest stopped and the stale pages
+ * discarded.  The device state goes in a package that the destination
+ * reads whole: it starts serving faults on guest RAM, from pages that
+ * keep coming on the stream, before it loads the devices.
+ */
+int qemu_savevm_state_postcopy_start(QEMUFile *f)
+{
+    GByteArray *buf = g_byte_array_new();
+    QEMUFile *fb = qemu_bufopen(buf, "wb");
+    uint8_t len[4];
+    int ret;
+
+    cpu_synchronize_all_states();
+
+    qemu_savevm_command_send(fb, MIG_CMD_POSTCOPY_LISTEN, 0, NULL);
+    qemu_savevm_state_devices(fb);
+    qemu_put_byte(fb, QEMU_VM_EOF);
+    ret = qemu_fclose(fb);
+
+    if (ret == 0) {
+        stl_be_p(len, buf->len);
+        qemu_savevm_command_send(f, MIG_CMD_PACKAGED, sizeof(len), len);
+        qemu_put_buffer(f, buf->data, buf->len);
+        qemu_fflush(f);
+        ret = qemu_file_get_error(f);
+    }
+    g_byte_array_free(buf, TRUE);
+    return ret;
+}
+
+/* End of a post-copy migration, once the remaining pages have been sent */
+void qemu_savevm_state_complete_postcopy(QEMUFile *f)
+{
+    trace_savevm_state_complete();
+
+    if (qemu_savevm_state_complete_live(f) < 0) {
+        return;
+    }
+    qemu_put_byte(f, QEMU_VM_EOF);
+    qemu_fflush(f);
+}
+
 uint64_t qemu_savevm_state_pending(QEMUFile *f, uint64_t max_size)
 {
     SaveStateEntry *se;
@@ -743,32 +846,216 @@ typedef struct LoadStateEntry {
     int version_id;
 } LoadStateEntry;
 
-int qemu_loadvm_state(QEMUFile *f)
+typedef QLIST_HEAD(LoadStateEntryList, LoadStateEntry) LoadStateEntryList;
+
+/* Returned when the listen thread has taken the stream over */
+#define LOADVM_QUIT 1
+
+/* Incoming migration stream; once the destination of a post-copy
+ * migration has started the guest, the listen thread reads it.
+ */
+static QEMUFile *loadvm_stream;
+static LoadStateEntryList loadvm_handlers =
+    QLIST_HEAD_INITIALIZER(loadvm_handlers);
+static bool loadvm_listening;
+static QemuThread loadvm_listen_thread;
+static QEMUBH *loadvm_postcopy_end_bh;
+static int loadvm_listen_ret;
+
+static int qemu_loadvm_state_main(QEMUFile *f, LoadStateEntryList *handlers);
+
+static void loadvm_free_handlers(LoadStateEntryList *handlers)
 {
-    QLIST_HEAD(, LoadStateEntry) loadvm_handlers =
-        QLIST_HEAD_INITIALIZER(loadvm_handlers);
     LoadStateEntry *le, *new_le;
-    uint8_t section_type;
-    unsigned int v;
+
+    QLIST_FOREACH_SAFE(le, handlers, entry, new_le) {
+        QLIST_REMOVE(le, entry);
+        g_free(le);
+    }
+}
+
+static int loadvm_postcopy_advise(uint64_t page_size)
+{
+    if (!postcopy_ram_supported_by_host(page_size)) {
+        return -EINVAL;
+    }
+    /* Fail now, while the VM still runs on the source, rather than once
+     * the source has stopped it for LISTEN.
+     */
+    return ram_postcopy_incoming_check();
+}
+
+static int loadvm_postcopy_ram_discard(QEMUFile *f, uint16_t len)
+{
+    char idstr[256];
+    int idlen;
     int ret;
 
-    if (qemu_savevm_state_blocked(NULL)) {
+    idlen = qemu_get_byte(f);
+    if (len < 1 + idlen || (len - 1 - idlen) % 16) {
+        fprintf(stderr, "Bad post-copy discard command length %d\n", len);
         return -EINVAL;
     }
+    qemu_get_buffer(f, (uint8_t *)idstr, idlen);
+    idstr[idlen] = 0;
 
-    v = qemu_get_be32(f);
-    if (v != QEMU_VM_FILE_MAGIC) {
+    for (len -= 1 + idlen; len; len -= 16) {
+        uint64_t start = qemu_get_be64(f);
+        uint64_t length = qemu_get_be64(f);
+
+        ret = ram_discard_range(idstr, start, length);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return qemu_file_get_error(f);
+}
+
+static void loadvm_postcopy_end(void *opaque)
+{
+    int ret = loadvm_listen_ret;
+
+    qemu_bh_delete(loadvm_postcopy_end_bh);
+    loadvm_postcopy_end_bh = NULL;
+    qemu_thread_join(&loadvm_listen_thread);
+    trace_loadvm_postcopy_end(ret);
+
+    process_incoming_migration_end(loadvm_stream, ret);
+    postcopy_ram_incoming_cleanup();
+    loadvm_free_handlers(&loadvm_handlers);
+    loadvm_listening = false;
+    loadvm_stream = NULL;
+}
+
+static void *loadvm_postcopy_listen_thread(void *opaque)
+{
+    QEMUFile *f = opaque;
+    int ret;
+
+    ret = qemu_loadvm_state_main(f, &loadvm_handlers);
+    if (ret == 0) {
+        ret = qemu_file_get_error(f);
+    }
+    loadvm_listen_ret = ret;
+    qemu_bh_schedule(loadvm_postcopy_end_bh);
+    return NULL;
+}
+
+static int loadvm_postcopy_listen(void)
+{
+    QEMUFile *rp;
+    int ret;
+
+    if (!loadvm_stream || loadvm_listening) {
+        fprintf(stderr, "Unexpected post-copy listen command\n");
         return -EINVAL;
     }
 
-    v = qemu_get_be32(f);
-    if (v == QEMU_VM_FILE_VERSION_COMPAT) {
-        fprintf(stderr, "SaveVM v2 format is obsolete and don't work anymore\n");
-        return -ENOTSUP;
+    rp = qemu_file_get_return_path(loadvm_stream);
+    if (!rp) {
+        fprintf(stderr, "Post-copy needs a socket migration transport\n");
+        return -EINVAL;
     }
-    if (v != QEMU_VM_FILE_VERSION) {
-        return -ENOTSUP;
+    ret = postcopy_ram_incoming_init(rp);
+    if (ret < 0) {
+        qemu_fclose(rp);
+        return ret;
+    }
+    ret = ram_postcopy_incoming_register();
+    if (ret == 0) {
+        ret = postcopy_ram_incoming_start();
     }
+    if (ret < 0) {
+        postcopy_ram_incoming_cleanup();
+        return ret;
+    }
+    trace_loadvm_postcopy_listen();
+
+    /* The main loop may now fault on guest RAM, so the rest of the stream
+     * is read by a thread of its own.
+     */
+    qemu_set_block(qemu_get_fd(loadvm_stream));
+    loadvm_listening = true;
+    loadvm_postcopy_end_bh = qemu_bh_new(loadvm_postcopy_end, NULL);
+    qemu_thread_create(&loadvm_listen_thread, "postcopy/listen",
+                       loadvm_postcopy_listen_thread, loadvm_stream,
+                       QEMU_THREAD_JOINABLE);
+    return 0;
+}
+
+/* Load the sections of a package, which come from memory while the stream
+ * itself may already be read by the listen thread.
+ */
+static int loadvm_handle_packaged(QEMUFile *f)
+{
+    LoadStateEntryList handlers = QLIST_HEAD_INITIALIZER(handlers);
+    uint32_t length = qemu_get_be32(f);
+    GByteArray *buf;
+    QEMUFile *packf;
+    int ret;
+
+    buf = g_byte_array_sized_new(length);
+    g_byte_array_set_size(buf, length);
+    if (qemu_get_buffer(f, buf->data, length) != length) {
+        g_byte_array_free(buf, TRUE);
+        fprintf(stderr, "Truncated package of %u bytes\n", length);
+        return -EINVAL;
+    }
+
+    packf = qemu_bufopen(buf, "rb");
+    ret = qemu_loadvm_state_main(packf, &handlers);
+    loadvm_free_handlers(&handlers);
+    qemu_fclose(packf);
+    g_byte_array_free(buf, TRUE);
+
+    if (ret == 0 && loadvm_listening) {
+        ret = LOADVM_QUIT;
+    }
+    return ret;
+}
+
+static int loadvm_process_command(QEMUFile *f)
+{
+    uint16_t cmd = qemu_get_be16(f);
+    uint16_t len = qemu_get_be16(f);
+
+    trace_loadvm_process_command(cmd, len);
+    switch (cmd) {
+    case MIG_CMD_POSTCOPY_ADVISE:
+        if (len != 8) {
+            break;
+        }
+        return loadvm_postcopy_advise(qemu_get_be64(f));
+    case MIG_CMD_POSTCOPY_RAM_DISCARD:
+        return loadvm_postcopy_ram_discard(f, len);
+    case MIG_CMD_POSTCOPY_LISTEN:
+        if (len != 0) {
+            break;
+        }
+        return loadvm_postcopy_listen();
+    case MIG_CMD_PACKAGED:
+        if (len != 4) {
+            break;
+        }
+        return loadvm_handle_packaged(f);
+    default:
+        fprintf(stderr, "Unknown savevm command %d\n", cmd);
+        return -EINVAL;
+    }
+
+    fprintf(stderr, "Bad length %d for savevm command %d\n", len, cmd);
+    return -EINVAL;
+}
+
+/*
+ * Load sections until the end of @f.  Returns LOADVM_QUIT if the listen
+ * thread has been started and now reads @f.
+ */
+static int qemu_loadvm_state_main(QEMUFile *f, LoadStateEntryList *handlers)
+{
+    LoadStateEntry *le;
+    uint8_t section_type;
+    int ret;
 
     while ((section_type = qemu_get_byte(f)) != QEMU_VM_EOF) {
         uint32_t instance_id, version_id, section_id;
@@ -791,16 +1078,14 @@ int qemu_loadvm_state(QEMUFile *f)
             se = find_se(idstr, instance_id);
             if (se == NULL) {
                 fprintf(stderr, "Unknown savevm section or instance '%s' %d\n", idstr, instance_id);
-                ret = -EINVAL;
-                goto out;
+                return -EINVAL;
             }
 
             /* Validate version */
             if (version_id > se->version_id) {
                 fprintf(stderr, "savevm: unsupported version %d for '%s' v%d\n",
                         version_id, idstr, se->version_id);
-                ret = -EINVAL;
-                goto out;
+                return -EINVAL;
             }
 
             /* Add entry */
@@ -809,54 +1094,92 @@ int qemu_loadvm_state(QEMUFile *f)
             le->se = se;
             le->section_id = section_id;
             le->version_id = version_id;
-            QLIST_INSERT_HEAD(&loadvm_handlers, le, entry);
+            QLIST_INSERT_HEAD(handlers, le, entry);
 
             ret = vmstate_load(f, le->se, le->version_id);
             if (ret < 0) {
                 fprintf(stderr, "qemu: warning: error while loading state for instance 0x%x of device '%s'\n",
                         instance_id, idstr);
-                goto out;
+                return ret;
             }
             break;
         case QEMU_VM_SECTION_PART:
         case QEMU_VM_SECTION_END:
             section_id = qemu_get_be32(f);
 
-            QLIST_FOREACH(le, &loadvm_handlers, entry) {
+            QLIST_FOREACH(le, handlers, entry) {
                 if (le->section_id == section_id) {
                     break;
                 }
             }
             if (le == NULL) {
                 fprintf(stderr, "Unknown savevm section %d\n", section_id);
-                ret = -EINVAL;
-                goto out;
+                return -EINVAL;
             }
 
             ret = vmstate_load(f, le->se, le->version_id);
             if (ret < 0) {
                 fprintf(stderr, "qemu: warning: error while loading state section id %d\n",
                         section_id);
-                goto out;
+                return ret;
+            }
+            break;
+        case QEMU_VM_COMMAND:
+            ret = loadvm_process_command(f);
+            if (ret < 0 || ret == LOADVM_QUIT) {
+                return ret;
             }
             break;
         default:
             fprintf(stderr, "Unknown savevm section type %d\n", section_type);
-            ret = -EINVAL;
-            goto out;
+            return -EINVAL;
         }
     }
+    return 0;
+}
 
-    cpu_synchronize_all_post_init();
+/*
+ * Returns 0 once the whole state has been loaded, or 1 if the destination
+ * of a post-copy migration may start the guest while the rest of its RAM
+ * is read in the background: process_incoming_migration_end() is then
+ * called when the stream ends.
+ */
+int qemu_loadvm_state(QEMUFile *f)
+{
+    unsigned int v;
+    int ret;
 
-    ret = 0;
+    if (qemu_savevm_state_blocked(NULL)) {
+        return -EINVAL;
+    }
 
-out:
-    QLIST_FOREACH_SAFE(le, &loadvm_handlers, entry, new_le) {
-        QLIST_REMOVE(le, entry);
-        g_free(le);
+    v = qemu_get_be32(f);
+    if (v != QEMU_VM_FILE_MAGIC) {
+        return -EINVAL;
+    }
+
+    v = qemu_get_be32(f);
+    if (v == QEMU_VM_FILE_VERSION_COMPAT) {
+        fprintf(stderr, "SaveVM v2 format is obsolete and don't work anymore\n");
+        return -ENOTSUP;
+    }
+    if (v != QEMU_VM_FILE_VERSION) {
+        return -ENOTSUP;
+    }
+
+    loadvm_stream = f;
+    ret = qemu_loadvm_state_main(f, &loadvm_handlers);
+    if (ret == LOADVM_QUIT) {
+        cpu_synchronize_all_post_init();
+        return 1;
+    }
+    if (ret == 0) {
+        cpu_synchronize_all_post_init();
     }
 
+    loadvm_free_handlers(&loadvm_handlers);
+    loadvm_stream = NULL;
+
     if (ret == 0) {
         ret = qemu_file_get_error(f);
     }
@@ -1108,6 +1431,99 @@ int load_vmstate(const char *name)
     return 0;
 }
 
+/*
+ * Snapshot to plain files rather than to a disk image: the device state
+ * goes to @filename and guest RAM to @filename.ram, laid out so that
+ * load_vmstate_file() can map it instead of reading it.  Disk contents
+ * are not part of the snapshot.
+ */
+void do_savevm_file(Monitor *mon, const QDict *qdict)
+{
+    const char *filename = qdict_get_str(qdict, "filename");
+    char *ram_filename = g_strdup_printf("%s.ram", filename);
+    int saved_vm_running;
+    QEMUFile *f;
+    int ret;
+
+    saved_vm_running = runstate_is_running();
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    ret = ram_save_file(ram_filename);
+    if (ret < 0) {
+        monitor_printf(mon, "Error %d while writing VM RAM\n", ret);
+        goto the_end;
+    }
+
+    f = qemu_fopen(filename, "wb");
+    if (!f) {
+        monitor_printf(mon, "Could not open VM state file '%s'\n", filename);
+        goto the_end;
+    }
+    ret = qemu_save_device_state(f);
+    qemu_fclose(f);
+    if (ret < 0) {
+        monitor_printf(mon, "Error %d while writing VM state\n", ret);
+    }
+
+ the_end:
+    g_free(ram_filename);
+    if (saved_vm_running) {
+        vm_start();
+    }
+}
+
+static NotifierList vm_clone_notifiers =
+    NOTIFIER_LIST_INITIALIZER(vm_clone_notifiers);
+
+/*
+ * Run after a state shared by many VMs was loaded with @template set,
+ * to change what must be unique to this one.
+ */
+void qemu_add_vm_clone_notifier(Notifier *notify)
+{
+    notifier_list_add(&vm_clone_notifiers, notify);
+}
+
+/*
+ * Any number of VMs can load the same state at once: the RAM image is
+ * only read, and its pages are shared until a guest writes to them.
+ * Each VM needs its own disk images, such as qcow2 overlays backed by
+ * the images of the VM that saved the state.
+ */
+int load_vmstate_file(const char *filename, bool template)
+{
+    char *ram_filename = g_strdup_printf("%s.ram", filename);
+    QEMUFile *f;
+    int ret;
+
+    f = qemu_fopen(filename, "rb");
+    if (!f) {
+        error_report("Could not open VM state file '%s'", filename);
+        g_free(ram_filename);
+        return -EINVAL;
+    }
+
+    /* Flush all IO requests so they don't interfere with the new state.  */
+    bdrv_drain_all();
+
+    /* Reset first, as it rewrites the ROMs in guest RAM */
+    qemu_system_reset(VMRESET_SILENT);
+    ret = ram_load_file(ram_filename);
+    if (ret == 0) {
+        ret = qemu_loadvm_state(f);
+        if (ret < 0) {
+            error_report("Error %d while loading VM state", ret);
+        }
+    }
+    if (ret == 0 && template) {
+        notifier_list_notify(&vm_clone_notifiers, NULL);
+    }
+
+    qemu_fclose(f);
+    g_free(ram_filename);
+    return ret;
+}
+
 void do_delvm(Monitor *mon, const QDict *qdict)
 {
     BlockDriverState *bs, *bs1;
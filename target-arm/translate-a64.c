@@ -9170,8 +9170,8 @@ static void disas_simd_3same_int(DisasContext *s, uint32_t insn)
             case 0x10: /* ADD, SUB */
             {
                 static NeonGenTwoOpFn * const fns[3][2] = {
-                    { gen_helper_neon_add_u8, gen_helper_neon_sub_u8 },
-                    { gen_helper_neon_add_u16, gen_helper_neon_sub_u16 },
+                    { tcg_gen_vec_add8_i32, tcg_gen_vec_sub8_i32 },
+                    { tcg_gen_vec_add16_i32, tcg_gen_vec_sub16_i32 },
                     { tcg_gen_add_i32, tcg_gen_sub_i32 },
                 };
                 genfn = fns[size][u];
@@ -9228,8 +9228,8 @@ static void disas_simd_3same_int(DisasContext *s, uint32_t insn)
             if (opcode == 0xf || opcode == 0x12) {
                 /* SABA, UABA, MLA, MLS: accumulating ops */
                 static NeonGenTwoOpFn * const fns[3][2] = {
-                    { gen_helper_neon_add_u8, gen_helper_neon_sub_u8 },
-                    { gen_helper_neon_add_u16, gen_helper_neon_sub_u16 },
+                    { tcg_gen_vec_add8_i32, tcg_gen_vec_sub8_i32 },
+                    { tcg_gen_vec_add16_i32, tcg_gen_vec_sub16_i32 },
                     { tcg_gen_add_i32, tcg_gen_sub_i32 },
                 };
                 bool is_sub = (opcode == 0x12 && u); /* MLS */
@@ -9981,9 +9981,9 @@ static void disas_simd_two_reg_misc(DisasContext *s, uint32_t insn)
                     if (u) {
                         TCGv_i32 tcg_zero = tcg_const_i32(0);
                         if (size) {
-                            gen_helper_neon_sub_u16(tcg_res, tcg_zero, tcg_op);
+                            tcg_gen_vec_sub16_i32(tcg_res, tcg_zero, tcg_op);
                         } else {
-                            gen_helper_neon_sub_u8(tcg_res, tcg_zero, tcg_op);
+                            tcg_gen_vec_sub8_i32(tcg_res, tcg_zero, tcg_op);
                         }
                         tcg_temp_free_i32(tcg_zero);
                     } else {
@@ -10242,7 +10242,7 @@ static void disas_simd_indexed(DisasContext *s, uint32_t insn)
             case 0x8: /* MUL */
             {
                 static NeonGenTwoOpFn * const fns[2][2] = {
-                    { gen_helper_neon_add_u16, gen_helper_neon_sub_u16 },
+                    { tcg_gen_vec_add16_i32, tcg_gen_vec_sub16_i32 },
                     { tcg_gen_add_i32, tcg_gen_sub_i32 },
                 };
                 NeonGenTwoOpFn *genfn;
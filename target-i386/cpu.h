@@ -36,6 +36,9 @@
 
 #define TARGET_HAS_ICE 1
 
+/* translator follows direct jumps in TBs compiled with CF_TRACE */
+#define TARGET_HAS_TB_TRACE 1
+
 #ifdef TARGET_X86_64
 #define ELF_MACHINE     EM_X86_64
 #define ELF_MACHINE_UNAME "x86_64"
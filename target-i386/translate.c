@@ -2546,12 +2546,16 @@ static void gen_debug(DisasContext *s, target_ulong cur_eip)
 }
 
 /* generate a generic end of block. Trace exception is also generated
-   if needed */
-static void gen_eob(DisasContext *s)
+   if needed.  If JR, try to jump to the next block through the jump
+   cache instead of going back to the main loop.  This is not done after
+   an interrupt shadow, as a pending interrupt must be delivered by
+   cpu_exec. */
+static void gen_eob_worker(DisasContext *s, bool jr)
 {
     gen_update_cc_op(s);
     if (s->tb->flags & HF_INHIBIT_IRQ_MASK) {
         gen_helper_reset_inhibit_irq(cpu_env);
+        jr = false;
     }
     if (s->tb->flags & HF_RF_MASK) {
         gen_helper_reset_rf(cpu_env);
@@ -2560,12 +2564,26 @@ static void gen_eob(DisasContext *s)
         gen_helper_debug(cpu_env);
     } else if (s->tf) {
         gen_helper_single_step(cpu_env);
+    } else if (jr) {
+        tcg_gen_lookup_and_goto_ptr(cpu_env);
     } else {
         tcg_gen_exit_tb(0);
     }
     s->is_jmp = DISAS_TB_JUMP;
 }
 
+static void gen_eob(DisasContext *s)
+{
+    gen_eob_worker(s, false);
+}
+
+/* end of block after an indirect jump, call or return; EIP is already
+   updated */
+static void gen_jr(DisasContext *s)
+{
+    gen_eob_worker(s, true);
+}
+
 /* generate a jump to eip. No segment change must happen before as a
    direct call to the next block may occur */
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num)
@@ -2586,6 +2604,21 @@ static void gen_jmp(DisasContext *s, target_ulong eip)
     gen_jmp_tb(s, eip, 0);
 }
 
+/* direct jump or call to eip.  When translating a trace, the destination
+   is translated in the same block if it lies further down the first page,
+   so that the lazy flags state survives the jump. */
+static void gen_jmp_direct(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+
+    if ((s->tb->cflags & CF_TRACE) && s->jmp_opt && pc >= s->pc &&
+        (pc & TARGET_PAGE_MASK) == (s->tb->pc & TARGET_PAGE_MASK)) {
+        s->pc = pc;
+        return;
+    }
+    gen_jmp(s, eip);
+}
+
 static inline void gen_ldq_env_A0(DisasContext *s, int offset)
 {
     tcg_gen_qemu_ld_i64(cpu_tmp1_i64, cpu_A0, s->mem_index, MO_LEQ);
@@ -2974,6 +3007,77 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+static void gen_pandn_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_andc_i64(d, b, a);
+}
+
+/* Expand the most common integer and logical MMX/SSE operations inline,
+   one 64-bit half at a time, instead of calling the ops_sse.h helpers.
+   Return false if B is not one of them. */
+static bool gen_sse_inline(int b, int is_xmm, int op1_offset, int op2_offset)
+{
+    void (*gen)(TCGv_i64, TCGv_i64, TCGv_i64);
+    TCGv_i64 t0;
+    int i, ofs;
+
+    switch (b) {
+    case 0x54: /* andps, andpd */
+    case 0xdb: /* pand */
+        gen = tcg_gen_and_i64;
+        break;
+    case 0x55: /* andnps, andnpd */
+    case 0xdf: /* pandn */
+        gen = gen_pandn_i64;
+        break;
+    case 0x56: /* orps, orpd */
+    case 0xeb: /* por */
+        gen = tcg_gen_or_i64;
+        break;
+    case 0x57: /* xorps, xorpd */
+    case 0xef: /* pxor */
+        gen = tcg_gen_xor_i64;
+        break;
+    case 0xfc: /* paddb */
+        gen = tcg_gen_vec_add8_i64;
+        break;
+    case 0xfd: /* paddw */
+        gen = tcg_gen_vec_add16_i64;
+        break;
+    case 0xfe: /* paddl */
+        gen = tcg_gen_vec_add32_i64;
+        break;
+    case 0xd4: /* paddq */
+        gen = tcg_gen_add_i64;
+        break;
+    case 0xf8: /* psubb */
+        gen = tcg_gen_vec_sub8_i64;
+        break;
+    case 0xf9: /* psubw */
+        gen = tcg_gen_vec_sub16_i64;
+        break;
+    case 0xfa: /* psubl */
+        gen = tcg_gen_vec_sub32_i64;
+        break;
+    case 0xfb: /* psubq */
+        gen = tcg_gen_sub_i64;
+        break;
+    default:
+        return false;
+    }
+
+    t0 = tcg_temp_new_i64();
+    for (i = 0; i < (is_xmm ? 2 : 1); i++) {
+        ofs = is_xmm ? offsetof(XMMReg, XMM_Q(i)) : 0;
+        tcg_gen_ld_i64(cpu_tmp1_i64, cpu_env, op1_offset + ofs);
+        tcg_gen_ld_i64(t0, cpu_env, op2_offset + ofs);
+        gen(cpu_tmp1_i64, cpu_tmp1_i64, t0);
+        tcg_gen_st_i64(cpu_tmp1_i64, cpu_env, op1_offset + ofs);
+    }
+    tcg_temp_free_i64(t0);
+    return true;
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -4389,6 +4493,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (gen_sse_inline(b, is_xmm, op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4944,7 +5051,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             tcg_gen_movi_tl(cpu_T[1], next_eip);
             gen_push_v(s, cpu_T[1]);
             gen_op_jmp_v(cpu_T[0]);
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 3: /* lcall Ev */
             gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
@@ -4971,7 +5078,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
                 tcg_gen_ext16u_tl(cpu_T[0], cpu_T[0]);
             }
             gen_op_jmp_v(cpu_T[0]);
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 5: /* ljmp Ev */
             gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
@@ -6385,14 +6492,14 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         gen_stack_update(s, val + (1 << ot));
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(cpu_T[0]);
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xc3: /* ret */
         ot = gen_pop_T0(s);
         gen_pop_update(s, ot);
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(cpu_T[0]);
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xca: /* lret im */
         val = cpu_ldsw_code(env, s->pc);
@@ -6460,7 +6567,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             }
             tcg_gen_movi_tl(cpu_T[0], next_eip);
             gen_push_v(s, cpu_T[0]);
-            gen_jmp(s, tval);
+            gen_jmp_direct(s, tval);
         }
         break;
     case 0x9a: /* lcall im */
@@ -6489,7 +6596,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         } else if (!CODE64(s)) {
             tval &= 0xffffffff;
         }
-        gen_jmp(s, tval);
+        gen_jmp_direct(s, tval);
         break;
     case 0xea: /* ljmp im */
         {
@@ -6511,7 +6618,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         if (dflag == MO_16) {
             tval &= 0xffff;
         }
-        gen_jmp(s, tval);
+        gen_jmp_direct(s, tval);
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(env, s, MO_8);
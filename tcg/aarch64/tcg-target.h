@@ -100,6 +100,7 @@ typedef enum {
 #define TCG_TARGET_HAS_mulsh_i64        1
 
 #define TCG_TARGET_HAS_new_ldst         1
+#define TCG_TARGET_HAS_goto_ptr         0
 
 static inline void flush_icache_range(uintptr_t start, uintptr_t stop)
 {
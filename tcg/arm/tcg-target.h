@@ -87,6 +87,7 @@ extern bool use_idiv_instructions;
 #define TCG_TARGET_HAS_rem_i32          0
 
 #define TCG_TARGET_HAS_new_ldst         1
+#define TCG_TARGET_HAS_goto_ptr         0
 
 extern bool tcg_target_deposit_valid(int ofs, int len);
 #define TCG_TARGET_deposit_i32_valid  tcg_target_deposit_valid
@@ -131,6 +131,7 @@ extern bool have_bmi1;
 #endif
 
 #define TCG_TARGET_HAS_new_ldst         1
+#define TCG_TARGET_HAS_goto_ptr         1
 
 #define TCG_TARGET_deposit_i32_valid(ofs, len) \
     (((ofs) == 0 && (len) == 8) || ((ofs) == 8 && (len) == 8) || \
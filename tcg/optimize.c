@@ -51,6 +51,39 @@ struct tcg_temp_info {
 
 static struct tcg_temp_info temps[TCG_MAX_TEMPS];
 
+/* Host memory loads (typically of CPUArchState fields that are not TCG
+   globals) whose result is still available in a temporary.  */
+#define MAX_MEM_LOADS 8
+
+struct tcg_mem_load {
+    TCGOpcode op;
+    TCGArg base;
+    TCGArg offset;
+    TCGArg val;
+};
+
+static struct tcg_mem_load mem_loads[MAX_MEM_LOADS];
+static int nb_mem_loads;
+
+static void reset_mem_loads(void)
+{
+    nb_mem_loads = 0;
+}
+
+/* Forget the loads whose base or result is held in TEMP.  */
+static void reset_mem_loads_temp(TCGArg temp)
+{
+    int i;
+
+    for (i = 0; i < nb_mem_loads; ) {
+        if (mem_loads[i].base == temp || mem_loads[i].val == temp) {
+            mem_loads[i] = mem_loads[--nb_mem_loads];
+        } else {
+            i++;
+        }
+    }
+}
+
 /* Reset TEMP's state to TCG_TEMP_UNDEF.  If TEMP only had one copy, remove
    the copy flag from the left temp.  */
 static void reset_temp(TCGArg temp)
@@ -65,6 +98,7 @@ static void reset_temp(TCGArg temp)
     }
     temps[temp].state = TCG_TEMP_UNDEF;
     temps[temp].mask = -1;
+    reset_mem_loads_temp(temp);
 }
 
 /* Reset all temporaries, given that there are NB_TEMPS of them.  */
@@ -75,6 +109,97 @@ static void reset_all_temps(int nb_temps)
         temps[i].state = TCG_TEMP_UNDEF;
         temps[i].mask = -1;
     }
+    reset_mem_loads();
+}
+
+/* Reset the normal temporaries, which die at the end of a basic block, but
+   keep what is known about globals and local temporaries.  This is used on
+   the fall-through path of conditional branches, which stays within the
+   same extended basic block.  */
+static void reset_ebb_temps(TCGContext *s, int nb_temps)
+{
+    int i;
+    for (i = s->nb_globals; i < nb_temps; i++) {
+        if (!s->temps[i].temp_local) {
+            reset_temp(i);
+        }
+    }
+    reset_mem_loads();
+}
+
+/* Return the size in bytes of the host memory access done by OP.  */
+static int mem_op_size(TCGOpcode op)
+{
+    switch (op) {
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(st8):
+        return 1;
+    CASE_OP_32_64(ld16u):
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(st16):
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_st_i32:
+    case INDEX_op_st32_i64:
+        return 4;
+    case INDEX_op_ld_i64:
+    case INDEX_op_st_i64:
+        return 8;
+    default:
+        tcg_abort();
+    }
+}
+
+static TCGArg find_mem_load(TCGOpcode op, TCGArg base, TCGArg offset)
+{
+    int i;
+
+    for (i = 0; i < nb_mem_loads; i++) {
+        if (mem_loads[i].op == op && mem_loads[i].base == base
+            && mem_loads[i].offset == offset) {
+            return mem_loads[i].val;
+        }
+    }
+    return (TCGArg)-1;
+}
+
+static void record_mem_load(TCGOpcode op, TCGArg base, TCGArg offset,
+                            TCGArg val)
+{
+    if (nb_mem_loads == MAX_MEM_LOADS) {
+        memmove(&mem_loads[0], &mem_loads[1],
+                (MAX_MEM_LOADS - 1) * sizeof(mem_loads[0]));
+        nb_mem_loads--;
+    }
+    mem_loads[nb_mem_loads].op = op;
+    mem_loads[nb_mem_loads].base = base;
+    mem_loads[nb_mem_loads].offset = offset;
+    mem_loads[nb_mem_loads].val = val;
+    nb_mem_loads++;
+}
+
+/* Forget the loads that a host memory store of OP to BASE + OFFSET may
+   overwrite.  Different base temporaries may alias each other.  */
+static void reset_mem_loads_store(TCGOpcode op, TCGArg base, TCGArg offset)
+{
+    tcg_target_long st_start = offset;
+    tcg_target_long st_end = st_start + mem_op_size(op);
+    int i;
+
+    for (i = 0; i < nb_mem_loads; ) {
+        tcg_target_long ld_start = mem_loads[i].offset;
+        tcg_target_long ld_end = ld_start + mem_op_size(mem_loads[i].op);
+
+        if (mem_loads[i].base != base
+            || (ld_start < st_end && st_start < ld_end)) {
+            mem_loads[i] = mem_loads[--nb_mem_loads];
+        } else {
+            i++;
+        }
+    }
 }
 
 static int op_bits(TCGOpcode op)
@@ -568,6 +693,14 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             nb_args = def->nb_args;
         }
 
+        /* Forget the cached loads this op may clobber: helpers and
+           guest memory accesses may write anywhere in CPUArchState, and
+           globals are synced back to memory at the end of basic blocks. */
+        if (def->flags & (TCG_OPF_BB_END | TCG_OPF_CALL_CLOBBER
+                          | TCG_OPF_SIDE_EFFECTS)) {
+            reset_mem_loads();
+        }
+
         /* Do copy propagation */
         for (i = nb_oargs; i < nb_oargs + nb_iargs; i++) {
             if (temps[args[i]].state == TCG_TEMP_COPY) {
@@ -1226,7 +1359,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                 /* Simplify LT/GE comparisons vs zero to a single compare
                    vs the high word of the input.  */
             do_brcond_high:
-                reset_all_temps(nb_temps);
+                reset_ebb_temps(s, nb_temps);
                 s->gen_opc_buf[op_index] = INDEX_op_brcond_i32;
                 gen_args[0] = args[1];
                 gen_args[1] = args[3];
@@ -1251,7 +1384,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                     goto do_default;
                 }
             do_brcond_low:
-                reset_all_temps(nb_temps);
+                reset_ebb_temps(s, nb_temps);
                 s->gen_opc_buf[op_index] = INDEX_op_brcond_i32;
                 gen_args[0] = args[0];
                 gen_args[1] = args[2];
@@ -1354,6 +1487,54 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             args += 6;
             break;
 
+        CASE_OP_32_64(ld8u):
+        CASE_OP_32_64(ld8s):
+        CASE_OP_32_64(ld16u):
+        CASE_OP_32_64(ld16s):
+        CASE_OP_32_64(ld):
+        case INDEX_op_ld32u_i64:
+        case INDEX_op_ld32s_i64:
+            /* Reuse the result of an identical earlier load.  */
+            tmp = find_mem_load(op, args[1], args[2]);
+            if (tmp != (TCGArg)-1) {
+                if (temps_are_copies(args[0], tmp)) {
+                    s->gen_opc_buf[op_index] = INDEX_op_nop;
+                } else if (temps[tmp].state == TCG_TEMP_CONST) {
+                    tcg_opt_gen_movi(s, op_index, gen_args, op,
+                                     args[0], temps[tmp].val);
+                    gen_args += 2;
+                } else {
+                    tcg_opt_gen_mov(s, op_index, gen_args, op, args[0], tmp);
+                    gen_args += 2;
+                }
+                args += 3;
+                break;
+            }
+            reset_temp(args[0]);
+            temps[args[0]].mask = mask;
+            if (args[0] != args[1]) {
+                record_mem_load(op, args[1], args[2], args[0]);
+            }
+            gen_args[0] = args[0];
+            gen_args[1] = args[1];
+            gen_args[2] = args[2];
+            args += 3;
+            gen_args += 3;
+            break;
+
+        CASE_OP_32_64(st8):
+        CASE_OP_32_64(st16):
+        CASE_OP_32_64(st):
+        case INDEX_op_st32_i64:
+            reset_mem_loads_store(op, args[1], args[2]);
+            /* Forward the stored value to later loads of the same size.  */
+            if (op == INDEX_op_st_i32 && args[0] != args[1]) {
+                record_mem_load(INDEX_op_ld_i32, args[1], args[2], args[0]);
+            } else if (op == INDEX_op_st_i64 && args[0] != args[1]) {
+                record_mem_load(INDEX_op_ld_i64, args[1], args[2], args[0]);
+            }
+            goto do_default;
+
         case INDEX_op_call:
             if (!(args[nb_oargs + nb_iargs + 1]
                   & (TCG_CALL_NO_READ_GLOBALS | TCG_CALL_NO_WRITE_GLOBALS))) {
@@ -1371,7 +1552,14 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                block, otherwise we only trash the output args.  "mask" is
                the non-zero bits mask for the first output arg.  */
             if (def->flags & TCG_OPF_BB_END) {
-                reset_all_temps(nb_temps);
+                /* The fall-through path of a conditional branch continues
+                   the extended basic block.  */
+                if (op == INDEX_op_brcond_i32 || op == INDEX_op_brcond_i64
+                    || op == INDEX_op_brcond2_i32) {
+                    reset_ebb_temps(s, nb_temps);
+                } else {
+                    reset_all_temps(nb_temps);
+                }
             } else {
         do_reset_output:
                 for (i = 0; i < nb_oargs; i++) {
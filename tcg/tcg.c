@@ -1913,6 +1913,48 @@ static void tcg_reg_free(TCGContext *s, int reg)
     }
 }
 
+/* free call-clobbered register 'reg' before a helper call.  If the
+   corresponding temporary stays live across the call, move it to a free
+   call-saved register instead of spilling it to memory.  Globals are only
+   moved if the helper does not write them, as save_globals would drop
+   them from their register anyway. */
+static void tcg_reg_free_call(TCGContext *s, int reg, TCGRegSet allocated_regs,
+                              int flags)
+{
+    TCGTemp *ts;
+    TCGRegSet reg_ct;
+    int i, temp, new_reg;
+
+    temp = s->reg_to_temp[reg];
+    if (temp == -1) {
+        return;
+    }
+    ts = &s->temps[temp];
+    if (ts->fixed_reg
+        || (temp < s->nb_globals
+            && !(flags & (TCG_CALL_NO_READ_GLOBALS
+                          | TCG_CALL_NO_WRITE_GLOBALS)))) {
+        tcg_reg_free(s, reg);
+        return;
+    }
+
+    tcg_regset_andnot(reg_ct, tcg_target_available_regs[ts->type],
+                      tcg_target_call_clobber_regs);
+    tcg_regset_andnot(reg_ct, reg_ct, allocated_regs);
+    for(i = 0; i < ARRAY_SIZE(tcg_target_reg_alloc_order); i++) {
+        new_reg = tcg_target_reg_alloc_order[i];
+        if (tcg_regset_test_reg(reg_ct, new_reg)
+            && s->reg_to_temp[new_reg] == -1) {
+            tcg_out_mov(s, ts->type, new_reg, reg);
+            s->reg_to_temp[reg] = -1;
+            s->reg_to_temp[new_reg] = temp;
+            ts->reg = new_reg;
+            return;
+        }
+    }
+    tcg_reg_free(s, reg);
+}
+
 /* Allocate a register belonging to reg1 & ~reg2 */
 static int tcg_reg_alloc(TCGContext *s, TCGRegSet reg1, TCGRegSet reg2)
 {
@@ -2442,7 +2484,7 @@ static int tcg_reg_alloc_call(TCGContext *s, const TCGOpDef *def,
     /* clobber call registers */
     for(reg = 0; reg < TCG_TARGET_NB_REGS; reg++) {
         if (tcg_regset_test_reg(tcg_target_call_clobber_regs, reg)) {
-            tcg_reg_free(s, reg);
+            tcg_reg_free_call(s, reg, allocated_regs, flags);
         }
     }
 
@@ -70,9 +70,9 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_st16_i32, { R, R } },
     { INDEX_op_st_i32, { R, R } },
 
-    { INDEX_op_add_i32, { R, RI, RI } },
-    { INDEX_op_sub_i32, { R, RI, RI } },
-    { INDEX_op_mul_i32, { R, RI, RI } },
+    { INDEX_op_add_i32, { R, R, RI } },
+    { INDEX_op_sub_i32, { R, R, RI } },
+    { INDEX_op_mul_i32, { R, R, RI } },
 #if TCG_TARGET_HAS_div_i32
     { INDEX_op_div_i32, { R, R, R } },
     { INDEX_op_divu_i32, { R, R, R } },
@@ -82,32 +82,30 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_div2_i32, { R, R, "0", "1", R } },
     { INDEX_op_divu2_i32, { R, R, "0", "1", R } },
 #endif
-    /* TODO: Does R, RI, RI result in faster code than R, R, RI?
-       If both operands are constants, we can optimize. */
-    { INDEX_op_and_i32, { R, RI, RI } },
+    { INDEX_op_and_i32, { R, R, RI } },
 #if TCG_TARGET_HAS_andc_i32
-    { INDEX_op_andc_i32, { R, RI, RI } },
+    { INDEX_op_andc_i32, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_eqv_i32
-    { INDEX_op_eqv_i32, { R, RI, RI } },
+    { INDEX_op_eqv_i32, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_nand_i32
-    { INDEX_op_nand_i32, { R, RI, RI } },
+    { INDEX_op_nand_i32, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_nor_i32
-    { INDEX_op_nor_i32, { R, RI, RI } },
+    { INDEX_op_nor_i32, { R, R, R } },
 #endif
-    { INDEX_op_or_i32, { R, RI, RI } },
+    { INDEX_op_or_i32, { R, R, RI } },
 #if TCG_TARGET_HAS_orc_i32
-    { INDEX_op_orc_i32, { R, RI, RI } },
+    { INDEX_op_orc_i32, { R, R, R } },
 #endif
-    { INDEX_op_xor_i32, { R, RI, RI } },
-    { INDEX_op_shl_i32, { R, RI, RI } },
-    { INDEX_op_shr_i32, { R, RI, RI } },
-    { INDEX_op_sar_i32, { R, RI, RI } },
+    { INDEX_op_xor_i32, { R, R, RI } },
+    { INDEX_op_shl_i32, { R, R, RI } },
+    { INDEX_op_shr_i32, { R, R, RI } },
+    { INDEX_op_sar_i32, { R, R, RI } },
 #if TCG_TARGET_HAS_rot_i32
-    { INDEX_op_rotl_i32, { R, RI, RI } },
-    { INDEX_op_rotr_i32, { R, RI, RI } },
+    { INDEX_op_rotl_i32, { R, R, RI } },
+    { INDEX_op_rotr_i32, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_deposit_i32
     { INDEX_op_deposit_i32, { R, "0", R } },
@@ -150,9 +148,9 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_st32_i64, { R, R } },
     { INDEX_op_st_i64, { R, R } },
 
-    { INDEX_op_add_i64, { R, RI, RI } },
-    { INDEX_op_sub_i64, { R, RI, RI } },
-    { INDEX_op_mul_i64, { R, RI, RI } },
+    { INDEX_op_add_i64, { R, R, RI } },
+    { INDEX_op_sub_i64, { R, R, RI } },
+    { INDEX_op_mul_i64, { R, R, RI } },
 #if TCG_TARGET_HAS_div_i64
     { INDEX_op_div_i64, { R, R, R } },
     { INDEX_op_divu_i64, { R, R, R } },
@@ -162,30 +160,30 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_div2_i64, { R, R, "0", "1", R } },
     { INDEX_op_divu2_i64, { R, R, "0", "1", R } },
 #endif
-    { INDEX_op_and_i64, { R, RI, RI } },
+    { INDEX_op_and_i64, { R, R, RI } },
 #if TCG_TARGET_HAS_andc_i64
-    { INDEX_op_andc_i64, { R, RI, RI } },
+    { INDEX_op_andc_i64, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_eqv_i64
-    { INDEX_op_eqv_i64, { R, RI, RI } },
+    { INDEX_op_eqv_i64, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_nand_i64
-    { INDEX_op_nand_i64, { R, RI, RI } },
+    { INDEX_op_nand_i64, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_nor_i64
-    { INDEX_op_nor_i64, { R, RI, RI } },
+    { INDEX_op_nor_i64, { R, R, R } },
 #endif
-    { INDEX_op_or_i64, { R, RI, RI } },
+    { INDEX_op_or_i64, { R, R, RI } },
 #if TCG_TARGET_HAS_orc_i64
-    { INDEX_op_orc_i64, { R, RI, RI } },
+    { INDEX_op_orc_i64, { R, R, R } },
 #endif
-    { INDEX_op_xor_i64, { R, RI, RI } },
-    { INDEX_op_shl_i64, { R, RI, RI } },
-    { INDEX_op_shr_i64, { R, RI, RI } },
-    { INDEX_op_sar_i64, { R, RI, RI } },
+    { INDEX_op_xor_i64, { R, R, RI } },
+    { INDEX_op_shl_i64, { R, R, RI } },
+    { INDEX_op_shr_i64, { R, R, RI } },
+    { INDEX_op_sar_i64, { R, R, RI } },
 #if TCG_TARGET_HAS_rot_i64
-    { INDEX_op_rotl_i64, { R, RI, RI } },
-    { INDEX_op_rotr_i64, { R, RI, RI } },
+    { INDEX_op_rotl_i64, { R, R, RI } },
+    { INDEX_op_rotr_i64, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_deposit_i64
     { INDEX_op_deposit_i64, { R, "0", R } },
@@ -431,24 +429,60 @@ static void tcg_out_r(TCGContext *s, TCGArg t0)
     tcg_out8(s, t0);
 }
 
-/* Write register or constant (native size). */
-static void tcg_out_ri(TCGContext *s, int const_arg, TCGArg arg)
+#if TCG_TARGET_REG_BITS == 32
+/* Write register or constant (32 bit). */
+static void tcg_out_ri32(TCGContext *s, int const_arg, TCGArg arg)
 {
     if (const_arg) {
         assert(const_arg == 1);
         tcg_out8(s, TCG_CONST);
-        tcg_out_i(s, arg);
+        tcg_out32(s, arg);
     } else {
         tcg_out_r(s, arg);
     }
 }
+#endif
 
-/* Write register or constant (32 bit). */
-static void tcg_out_ri32(TCGContext *s, int const_arg, TCGArg arg)
+/* TCI opcodes of the operations with a constant last input operand. */
+static const uint8_t tci_const_ops[NB_OPS] = {
+    [INDEX_op_add_i32] = TCI_op_addi_i32,
+    [INDEX_op_sub_i32] = TCI_op_subi_i32,
+    [INDEX_op_mul_i32] = TCI_op_muli_i32,
+    [INDEX_op_and_i32] = TCI_op_andi_i32,
+    [INDEX_op_or_i32] = TCI_op_ori_i32,
+    [INDEX_op_xor_i32] = TCI_op_xori_i32,
+    [INDEX_op_shl_i32] = TCI_op_shli_i32,
+    [INDEX_op_shr_i32] = TCI_op_shri_i32,
+    [INDEX_op_sar_i32] = TCI_op_sari_i32,
+    [INDEX_op_rotl_i32] = TCI_op_rotli_i32,
+    [INDEX_op_rotr_i32] = TCI_op_rotri_i32,
+    [INDEX_op_setcond_i32] = TCI_op_setcondi_i32,
+    [INDEX_op_brcond_i32] = TCI_op_brcondi_i32,
+#if TCG_TARGET_REG_BITS == 64
+    [INDEX_op_add_i64] = TCI_op_addi_i64,
+    [INDEX_op_sub_i64] = TCI_op_subi_i64,
+    [INDEX_op_mul_i64] = TCI_op_muli_i64,
+    [INDEX_op_and_i64] = TCI_op_andi_i64,
+    [INDEX_op_or_i64] = TCI_op_ori_i64,
+    [INDEX_op_xor_i64] = TCI_op_xori_i64,
+    [INDEX_op_shl_i64] = TCI_op_shli_i64,
+    [INDEX_op_shr_i64] = TCI_op_shri_i64,
+    [INDEX_op_sar_i64] = TCI_op_sari_i64,
+    [INDEX_op_rotl_i64] = TCI_op_rotli_i64,
+    [INDEX_op_rotr_i64] = TCI_op_rotri_i64,
+    [INDEX_op_setcond_i64] = TCI_op_setcondi_i64,
+    [INDEX_op_brcond_i64] = TCI_op_brcondi_i64,
+#endif
+};
+
+/* Write the last input operand (32 bit).  A constant replaces the
+   opcode at op_ptr by that of the constant form. */
+static void tci_out_last_ri32(TCGContext *s, uint8_t *op_ptr,
+                              int const_arg, TCGArg arg)
 {
     if (const_arg) {
-        assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
+        assert(tci_const_ops[*op_ptr]);
+        *op_ptr = tci_const_ops[*op_ptr];
         tcg_out32(s, arg);
     } else {
         tcg_out_r(s, arg);
@@ -456,12 +490,13 @@ static void tcg_out_ri32(TCGContext *s, int const_arg, TCGArg arg)
 }
 
 #if TCG_TARGET_REG_BITS == 64
-/* Write register or constant (64 bit). */
-static void tcg_out_ri64(TCGContext *s, int const_arg, TCGArg arg)
+/* Write the last input operand (64 bit), see tci_out_last_ri32. */
+static void tci_out_last_ri64(TCGContext *s, uint8_t *op_ptr,
+                              int const_arg, TCGArg arg)
 {
     if (const_arg) {
-        assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
+        assert(tci_const_ops[*op_ptr]);
+        *op_ptr = tci_const_ops[*op_ptr];
         tcg_out64(s, arg);
     } else {
         tcg_out_r(s, arg);
@@ -546,7 +581,7 @@ static inline void tcg_out_call(TCGContext *s, tcg_insn_unit *arg)
 {
     uint8_t *old_code_ptr = s->code_ptr;
     tcg_out_op_t(s, INDEX_op_call);
-    tcg_out_ri(s, 1, (uintptr_t)arg);
+    tcg_out_i(s, (uintptr_t)arg);
     old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
@@ -580,7 +615,7 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_setcond_i32:
         tcg_out_r(s, args[0]);
         tcg_out_r(s, args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
+        tci_out_last_ri32(s, old_code_ptr, const_args[2], args[2]);
         tcg_out8(s, args[3]);   /* condition */
         break;
 #if TCG_TARGET_REG_BITS == 32
@@ -597,7 +632,7 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_setcond_i64:
         tcg_out_r(s, args[0]);
         tcg_out_r(s, args[1]);
-        tcg_out_ri64(s, const_args[2], args[2]);
+        tci_out_last_ri64(s, old_code_ptr, const_args[2], args[2]);
         tcg_out8(s, args[3]);   /* condition */
         break;
 #endif
@@ -636,14 +671,20 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_or_i32:
     case INDEX_op_orc_i32:      /* Optional (TCG_TARGET_HAS_orc_i32). */
     case INDEX_op_xor_i32:
+        tcg_out_r(s, args[0]);
+        tcg_out_r(s, args[1]);
+        tci_out_last_ri32(s, old_code_ptr, const_args[2], args[2]);
+        break;
     case INDEX_op_shl_i32:
     case INDEX_op_shr_i32:
     case INDEX_op_sar_i32:
     case INDEX_op_rotl_i32:     /* Optional (TCG_TARGET_HAS_rot_i32). */
     case INDEX_op_rotr_i32:     /* Optional (TCG_TARGET_HAS_rot_i32). */
+        /* Constant shift counts are reduced here, not when interpreted. */
         tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
+        tcg_out_r(s, args[1]);
+        tci_out_last_ri32(s, old_code_ptr, const_args[2],
+                          const_args[2] ? args[2] & 31 : args[2]);
         break;
     case INDEX_op_deposit_i32:  /* Optional (TCG_TARGET_HAS_deposit_i32). */
         tcg_out_r(s, args[0]);
@@ -667,14 +708,19 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_or_i64:
     case INDEX_op_orc_i64:      /* Optional (TCG_TARGET_HAS_orc_i64). */
     case INDEX_op_xor_i64:
+        tcg_out_r(s, args[0]);
+        tcg_out_r(s, args[1]);
+        tci_out_last_ri64(s, old_code_ptr, const_args[2], args[2]);
+        break;
     case INDEX_op_shl_i64:
     case INDEX_op_shr_i64:
     case INDEX_op_sar_i64:
     case INDEX_op_rotl_i64:     /* Optional (TCG_TARGET_HAS_rot_i64). */
     case INDEX_op_rotr_i64:     /* Optional (TCG_TARGET_HAS_rot_i64). */
         tcg_out_r(s, args[0]);
-        tcg_out_ri64(s, const_args[1], args[1]);
-        tcg_out_ri64(s, const_args[2], args[2]);
+        tcg_out_r(s, args[1]);
+        tci_out_last_ri64(s, old_code_ptr, const_args[2],
+                          const_args[2] ? args[2] & 63 : args[2]);
         break;
     case INDEX_op_deposit_i64:  /* Optional (TCG_TARGET_HAS_deposit_i64). */
         tcg_out_r(s, args[0]);
@@ -697,7 +743,7 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
         break;
     case INDEX_op_brcond_i64:
         tcg_out_r(s, args[0]);
-        tcg_out_ri64(s, const_args[1], args[1]);
+        tci_out_last_ri64(s, old_code_ptr, const_args[1], args[1]);
         tcg_out8(s, args[2]);           /* condition */
         tci_out_label(s, args[3]);
         break;
@@ -729,8 +775,8 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_rem_i32:      /* Optional (TCG_TARGET_HAS_div_i32). */
     case INDEX_op_remu_i32:     /* Optional (TCG_TARGET_HAS_div_i32). */
         tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
+        tcg_out_r(s, args[1]);
+        tcg_out_r(s, args[2]);
         break;
     case INDEX_op_div2_i32:     /* Optional (TCG_TARGET_HAS_div2_i32). */
     case INDEX_op_divu2_i32:    /* Optional (TCG_TARGET_HAS_div2_i32). */
@@ -763,7 +809,7 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
 #endif
     case INDEX_op_brcond_i32:
         tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
+        tci_out_last_ri32(s, old_code_ptr, const_args[1], args[1]);
         tcg_out8(s, args[2]);           /* condition */
         tci_out_label(s, args[3]);
         break;
@@ -874,8 +920,10 @@ static void tcg_target_init(TCGContext *s)
     }
 #endif
 
-    /* The current code uses uint8_t for tcg operations. */
-    assert(ARRAY_SIZE(tcg_op_defs) <= UINT8_MAX);
+    /* The current code uses uint8_t for tcg operations, and TCI opcodes
+       above those of TCG. */
+    assert(ARRAY_SIZE(tcg_op_defs) <= TCI_op_first);
+    QEMU_BUILD_BUG_ON(TCI_op_last > UINT8_MAX);
 
     /* Registers available for 32 bit operations. */
     tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0,
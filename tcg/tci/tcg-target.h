@@ -119,6 +119,7 @@
 #endif /* TCG_TARGET_REG_BITS == 64 */
 
 #define TCG_TARGET_HAS_new_ldst         0
+#define TCG_TARGET_HAS_goto_ptr         0
 
 /* Number of registers available.
    For 32 bit hosts, we need more than 8 registers (call arguments). */
@@ -168,6 +169,41 @@ typedef enum {
     TCG_CONST = UINT8_MAX
 } TCGReg;
 
+/* Bytecode opcodes which TCI adds to those of TCG (which must stay below
+   TCI_op_first): forms of the operations whose last input operand is a
+   constant.  The constant follows the register operands, so whether an
+   operand is a register or a constant is decided at translation time. */
+typedef enum {
+    TCI_op_first = 0xc0,
+    TCI_op_addi_i32 = TCI_op_first,
+    TCI_op_subi_i32,
+    TCI_op_muli_i32,
+    TCI_op_andi_i32,
+    TCI_op_ori_i32,
+    TCI_op_xori_i32,
+    TCI_op_shli_i32,
+    TCI_op_shri_i32,
+    TCI_op_sari_i32,
+    TCI_op_rotli_i32,
+    TCI_op_rotri_i32,
+    TCI_op_setcondi_i32,
+    TCI_op_brcondi_i32,
+    TCI_op_addi_i64,
+    TCI_op_subi_i64,
+    TCI_op_muli_i64,
+    TCI_op_andi_i64,
+    TCI_op_ori_i64,
+    TCI_op_xori_i64,
+    TCI_op_shli_i64,
+    TCI_op_shri_i64,
+    TCI_op_sari_i64,
+    TCI_op_rotli_i64,
+    TCI_op_rotri_i64,
+    TCI_op_setcondi_i64,
+    TCI_op_brcondi_i64,
+    TCI_op_last
+} TCIOpcode;
+
 #define TCG_AREG0                       (TCG_TARGET_NB_REGS - 2)
 
 /* Used for function call generation. */
@@ -36,6 +36,57 @@
         tcg_abort(); \
     } while (0)
 
+/* The bytecode of each operation starts with its opcode and its size.
+   Under GCC, each handler jumps straight to the handler of the next
+   operation through a table of label addresses ("threaded code"), so
+   that the host predicts every indirect jump separately instead of
+   funnelling all of them through the single one of the switch. */
+#if defined(__GNUC__)
+# define TCI_THREADED
+#endif
+
+#if defined(NDEBUG)
+# define TCI_FETCH_SIZE()
+#else
+# define TCI_FETCH_SIZE() (op_size = tb_ptr[1], old_code_ptr = tb_ptr)
+#endif
+
+#if defined(GETPC)
+# define TCI_FETCH_TB_PTR() (tci_tb_ptr = (uintptr_t)tb_ptr)
+#else
+# define TCI_FETCH_TB_PTR()
+#endif
+
+#define TCI_FETCH() \
+    do { \
+        TCI_FETCH_SIZE(); \
+        TCI_FETCH_TB_PTR(); \
+        opc = tb_ptr[0]; \
+        tb_ptr += 2; \
+    } while (0)
+
+#if defined(TCI_THREADED)
+# define TCI_LABEL(name) op_##name:
+# define TCI_DISPATCH() \
+    do { \
+        TCI_FETCH(); \
+        goto *tci_dispatch[opc]; \
+    } while (0)
+#else
+# define TCI_LABEL(name)
+# define TCI_DISPATCH() goto next
+#endif
+
+/* Continue with the operation which follows the current one. */
+#define TCI_NEXT() \
+    do { \
+        assert(tb_ptr == old_code_ptr + op_size); \
+        TCI_DISPATCH(); \
+    } while (0)
+
+#define CASE(name)      case INDEX_op_##name: TCI_LABEL(name)
+#define CASE_TCI(name)  case TCI_op_##name: TCI_LABEL(name)
+
 #if MAX_OPC_PARAM_IARGS != 5
 # error Fix needed, number of supported input arguments changed!
 #endif
@@ -291,21 +342,9 @@ static target_ulong tci_read_ulong(uint8_t **tb_ptr)
     return taddr;
 }
 
-/* Read indexed register or constant (native size) from bytecode. */
-static tcg_target_ulong tci_read_ri(uint8_t **tb_ptr)
-{
-    tcg_target_ulong value;
-    TCGReg r = **tb_ptr;
-    *tb_ptr += 1;
-    if (r == TCG_CONST) {
-        value = tci_read_i(tb_ptr);
-    } else {
-        value = tci_read_reg(r);
-    }
-    return value;
-}
-
-/* Read indexed register or constant (32 bit) from bytecode. */
+#if TCG_TARGET_REG_BITS == 32
+/* Read indexed register or constant (32 bit) from bytecode.
+   Only the double word comparisons still mix both in one operation. */
 static uint32_t tci_read_ri32(uint8_t **tb_ptr)
 {
     uint32_t value;
@@ -319,27 +358,12 @@ static uint32_t tci_read_ri32(uint8_t **tb_ptr)
     return value;
 }
 
-#if TCG_TARGET_REG_BITS == 32
 /* Read two indexed registers or constants (2 * 32 bit) from bytecode. */
 static uint64_t tci_read_ri64(uint8_t **tb_ptr)
 {
     uint32_t low = tci_read_ri32(tb_ptr);
     return tci_uint64(tci_read_ri32(tb_ptr), low);
 }
-#elif TCG_TARGET_REG_BITS == 64
-/* Read indexed register or constant (64 bit) from bytecode. */
-static uint64_t tci_read_ri64(uint8_t **tb_ptr)
-{
-    uint64_t value;
-    TCGReg r = **tb_ptr;
-    *tb_ptr += 1;
-    if (r == TCG_CONST) {
-        value = tci_read_i64(tb_ptr);
-    } else {
-        value = tci_read_reg64(r);
-    }
-    return value;
-}
 #endif
 
 static tcg_target_ulong tci_read_label(uint8_t **tb_ptr)
@@ -439,798 +463,1163 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
     long tcg_temps[CPU_TEMP_BUF_NLONGS];
     uintptr_t sp_value = (uintptr_t)(tcg_temps + CPU_TEMP_BUF_NLONGS);
     uintptr_t next_tb = 0;
-
-    tci_reg[TCG_AREG0] = (tcg_target_ulong)env;
-    tci_reg[TCG_REG_CALL_STACK] = sp_value;
-    assert(tb_ptr);
-
-    for (;;) {
-        TCGOpcode opc = tb_ptr[0];
+    uint8_t opc;
 #if !defined(NDEBUG)
-        uint8_t op_size = tb_ptr[1];
-        uint8_t *old_code_ptr = tb_ptr;
-#endif
-        tcg_target_ulong t0;
-        tcg_target_ulong t1;
-        tcg_target_ulong t2;
-        tcg_target_ulong label;
-        TCGCond condition;
-        target_ulong taddr;
+    uint8_t op_size;
+    uint8_t *old_code_ptr;
+#endif
+    tcg_target_ulong t0;
+    tcg_target_ulong t1;
+    tcg_target_ulong t2;
+    tcg_target_ulong label;
+    TCGCond condition;
+    target_ulong taddr;
 #ifndef CONFIG_SOFTMMU
-        tcg_target_ulong host_addr;
+    tcg_target_ulong host_addr;
+#endif
+    uint8_t tmp8;
+    uint16_t tmp16;
+    uint32_t tmp32;
+    uint64_t tmp64;
+#if TCG_TARGET_REG_BITS == 32
+    uint64_t v64;
+#endif
+#if defined(TCI_THREADED)
+    static const void *const tci_dispatch[256] = {
+        [0 ... 255] = &&op_illegal,
+        [INDEX_op_end] = &&op_end,
+        [INDEX_op_nop] = &&op_nop,
+        [INDEX_op_nop1] = &&op_nop1,
+        [INDEX_op_nop2] = &&op_nop2,
+        [INDEX_op_nop3] = &&op_nop3,
+        [INDEX_op_nopn] = &&op_nopn,
+        [INDEX_op_discard] = &&op_discard,
+        [INDEX_op_set_label] = &&op_set_label,
+        [INDEX_op_call] = &&op_call,
+        [INDEX_op_br] = &&op_br,
+        [INDEX_op_setcond_i32] = &&op_setcond_i32,
+        [TCI_op_setcondi_i32] = &&op_setcondi_i32,
+#if TCG_TARGET_REG_BITS == 32
+        [INDEX_op_setcond2_i32] = &&op_setcond2_i32,
+#elif TCG_TARGET_REG_BITS == 64
+        [INDEX_op_setcond_i64] = &&op_setcond_i64,
+        [TCI_op_setcondi_i64] = &&op_setcondi_i64,
+#endif
+        [INDEX_op_mov_i32] = &&op_mov_i32,
+        [INDEX_op_movi_i32] = &&op_movi_i32,
+        [INDEX_op_ld8u_i32] = &&op_ld8u_i32,
+        [INDEX_op_ld8s_i32] = &&op_ld8s_i32,
+        [INDEX_op_ld16u_i32] = &&op_ld16u_i32,
+        [INDEX_op_ld16s_i32] = &&op_ld16s_i32,
+        [INDEX_op_ld_i32] = &&op_ld_i32,
+        [INDEX_op_st8_i32] = &&op_st8_i32,
+        [INDEX_op_st16_i32] = &&op_st16_i32,
+        [INDEX_op_st_i32] = &&op_st_i32,
+        [INDEX_op_add_i32] = &&op_add_i32,
+        [TCI_op_addi_i32] = &&op_addi_i32,
+        [INDEX_op_sub_i32] = &&op_sub_i32,
+        [TCI_op_subi_i32] = &&op_subi_i32,
+        [INDEX_op_mul_i32] = &&op_mul_i32,
+        [TCI_op_muli_i32] = &&op_muli_i32,
+#if TCG_TARGET_HAS_div_i32
+        [INDEX_op_div_i32] = &&op_div_i32,
+        [INDEX_op_divu_i32] = &&op_divu_i32,
+        [INDEX_op_rem_i32] = &&op_rem_i32,
+        [INDEX_op_remu_i32] = &&op_remu_i32,
+#elif TCG_TARGET_HAS_div2_i32
+        [INDEX_op_div2_i32] = &&op_div2_i32,
+        [INDEX_op_divu2_i32] = &&op_divu2_i32,
+#endif
+        [INDEX_op_and_i32] = &&op_and_i32,
+        [TCI_op_andi_i32] = &&op_andi_i32,
+        [INDEX_op_or_i32] = &&op_or_i32,
+        [TCI_op_ori_i32] = &&op_ori_i32,
+        [INDEX_op_xor_i32] = &&op_xor_i32,
+        [TCI_op_xori_i32] = &&op_xori_i32,
+        [INDEX_op_shl_i32] = &&op_shl_i32,
+        [TCI_op_shli_i32] = &&op_shli_i32,
+        [INDEX_op_shr_i32] = &&op_shr_i32,
+        [TCI_op_shri_i32] = &&op_shri_i32,
+        [INDEX_op_sar_i32] = &&op_sar_i32,
+        [TCI_op_sari_i32] = &&op_sari_i32,
+#if TCG_TARGET_HAS_rot_i32
+        [INDEX_op_rotl_i32] = &&op_rotl_i32,
+        [TCI_op_rotli_i32] = &&op_rotli_i32,
+        [INDEX_op_rotr_i32] = &&op_rotr_i32,
+        [TCI_op_rotri_i32] = &&op_rotri_i32,
 #endif
-        uint8_t tmp8;
-        uint16_t tmp16;
-        uint32_t tmp32;
-        uint64_t tmp64;
+#if TCG_TARGET_HAS_deposit_i32
+        [INDEX_op_deposit_i32] = &&op_deposit_i32,
+#endif
+        [INDEX_op_brcond_i32] = &&op_brcond_i32,
+        [TCI_op_brcondi_i32] = &&op_brcondi_i32,
 #if TCG_TARGET_REG_BITS == 32
-        uint64_t v64;
+        [INDEX_op_add2_i32] = &&op_add2_i32,
+        [INDEX_op_sub2_i32] = &&op_sub2_i32,
+        [INDEX_op_brcond2_i32] = &&op_brcond2_i32,
+        [INDEX_op_mulu2_i32] = &&op_mulu2_i32,
+#endif /* TCG_TARGET_REG_BITS == 32 */
+#if TCG_TARGET_HAS_ext8s_i32
+        [INDEX_op_ext8s_i32] = &&op_ext8s_i32,
+#endif
+#if TCG_TARGET_HAS_ext16s_i32
+        [INDEX_op_ext16s_i32] = &&op_ext16s_i32,
+#endif
+#if TCG_TARGET_HAS_ext8u_i32
+        [INDEX_op_ext8u_i32] = &&op_ext8u_i32,
+#endif
+#if TCG_TARGET_HAS_ext16u_i32
+        [INDEX_op_ext16u_i32] = &&op_ext16u_i32,
+#endif
+#if TCG_TARGET_HAS_bswap16_i32
+        [INDEX_op_bswap16_i32] = &&op_bswap16_i32,
+#endif
+#if TCG_TARGET_HAS_bswap32_i32
+        [INDEX_op_bswap32_i32] = &&op_bswap32_i32,
+#endif
+#if TCG_TARGET_HAS_not_i32
+        [INDEX_op_not_i32] = &&op_not_i32,
+#endif
+#if TCG_TARGET_HAS_neg_i32
+        [INDEX_op_neg_i32] = &&op_neg_i32,
+#endif
+#if TCG_TARGET_REG_BITS == 64
+        [INDEX_op_mov_i64] = &&op_mov_i64,
+        [INDEX_op_movi_i64] = &&op_movi_i64,
+        [INDEX_op_ld8u_i64] = &&op_ld8u_i64,
+        [INDEX_op_ld8s_i64] = &&op_ld8s_i64,
+        [INDEX_op_ld16u_i64] = &&op_ld16u_i64,
+        [INDEX_op_ld16s_i64] = &&op_ld16s_i64,
+        [INDEX_op_ld32u_i64] = &&op_ld32u_i64,
+        [INDEX_op_ld32s_i64] = &&op_ld32s_i64,
+        [INDEX_op_ld_i64] = &&op_ld_i64,
+        [INDEX_op_st8_i64] = &&op_st8_i64,
+        [INDEX_op_st16_i64] = &&op_st16_i64,
+        [INDEX_op_st32_i64] = &&op_st32_i64,
+        [INDEX_op_st_i64] = &&op_st_i64,
+        [INDEX_op_add_i64] = &&op_add_i64,
+        [TCI_op_addi_i64] = &&op_addi_i64,
+        [INDEX_op_sub_i64] = &&op_sub_i64,
+        [TCI_op_subi_i64] = &&op_subi_i64,
+        [INDEX_op_mul_i64] = &&op_mul_i64,
+        [TCI_op_muli_i64] = &&op_muli_i64,
+#if TCG_TARGET_HAS_div_i64
+        [INDEX_op_div_i64] = &&op_div_i64,
+        [INDEX_op_divu_i64] = &&op_divu_i64,
+        [INDEX_op_rem_i64] = &&op_rem_i64,
+        [INDEX_op_remu_i64] = &&op_remu_i64,
+#elif TCG_TARGET_HAS_div2_i64
+        [INDEX_op_div2_i64] = &&op_div2_i64,
+        [INDEX_op_divu2_i64] = &&op_divu2_i64,
+#endif
+        [INDEX_op_and_i64] = &&op_and_i64,
+        [TCI_op_andi_i64] = &&op_andi_i64,
+        [INDEX_op_or_i64] = &&op_or_i64,
+        [TCI_op_ori_i64] = &&op_ori_i64,
+        [INDEX_op_xor_i64] = &&op_xor_i64,
+        [TCI_op_xori_i64] = &&op_xori_i64,
+        [INDEX_op_shl_i64] = &&op_shl_i64,
+        [TCI_op_shli_i64] = &&op_shli_i64,
+        [INDEX_op_shr_i64] = &&op_shr_i64,
+        [TCI_op_shri_i64] = &&op_shri_i64,
+        [INDEX_op_sar_i64] = &&op_sar_i64,
+        [TCI_op_sari_i64] = &&op_sari_i64,
+#if TCG_TARGET_HAS_rot_i64
+        [INDEX_op_rotl_i64] = &&op_rotl_i64,
+        [TCI_op_rotli_i64] = &&op_rotli_i64,
+        [INDEX_op_rotr_i64] = &&op_rotr_i64,
+        [TCI_op_rotri_i64] = &&op_rotri_i64,
+#endif
+#if TCG_TARGET_HAS_deposit_i64
+        [INDEX_op_deposit_i64] = &&op_deposit_i64,
+#endif
+        [INDEX_op_brcond_i64] = &&op_brcond_i64,
+        [TCI_op_brcondi_i64] = &&op_brcondi_i64,
+#if TCG_TARGET_HAS_ext8u_i64
+        [INDEX_op_ext8u_i64] = &&op_ext8u_i64,
+#endif
+#if TCG_TARGET_HAS_ext8s_i64
+        [INDEX_op_ext8s_i64] = &&op_ext8s_i64,
+#endif
+#if TCG_TARGET_HAS_ext16s_i64
+        [INDEX_op_ext16s_i64] = &&op_ext16s_i64,
+#endif
+#if TCG_TARGET_HAS_ext16u_i64
+        [INDEX_op_ext16u_i64] = &&op_ext16u_i64,
+#endif
+#if TCG_TARGET_HAS_ext32s_i64
+        [INDEX_op_ext32s_i64] = &&op_ext32s_i64,
+#endif
+#if TCG_TARGET_HAS_ext32u_i64
+        [INDEX_op_ext32u_i64] = &&op_ext32u_i64,
+#endif
+#if TCG_TARGET_HAS_bswap16_i64
+        [INDEX_op_bswap16_i64] = &&op_bswap16_i64,
+#endif
+#if TCG_TARGET_HAS_bswap32_i64
+        [INDEX_op_bswap32_i64] = &&op_bswap32_i64,
+#endif
+#if TCG_TARGET_HAS_bswap64_i64
+        [INDEX_op_bswap64_i64] = &&op_bswap64_i64,
+#endif
+#if TCG_TARGET_HAS_not_i64
+        [INDEX_op_not_i64] = &&op_not_i64,
+#endif
+#if TCG_TARGET_HAS_neg_i64
+        [INDEX_op_neg_i64] = &&op_neg_i64,
+#endif
+#endif /* TCG_TARGET_REG_BITS == 64 */
+        [INDEX_op_debug_insn_start] = &&op_debug_insn_start,
+        [INDEX_op_exit_tb] = &&op_exit_tb,
+        [INDEX_op_goto_tb] = &&op_goto_tb,
+        [INDEX_op_qemu_ld8u] = &&op_qemu_ld8u,
+        [INDEX_op_qemu_ld8s] = &&op_qemu_ld8s,
+        [INDEX_op_qemu_ld16u] = &&op_qemu_ld16u,
+        [INDEX_op_qemu_ld16s] = &&op_qemu_ld16s,
+#if TCG_TARGET_REG_BITS == 64
+        [INDEX_op_qemu_ld32u] = &&op_qemu_ld32u,
+        [INDEX_op_qemu_ld32s] = &&op_qemu_ld32s,
+#endif /* TCG_TARGET_REG_BITS == 64 */
+        [INDEX_op_qemu_ld32] = &&op_qemu_ld32,
+        [INDEX_op_qemu_ld64] = &&op_qemu_ld64,
+        [INDEX_op_qemu_st8] = &&op_qemu_st8,
+        [INDEX_op_qemu_st16] = &&op_qemu_st16,
+        [INDEX_op_qemu_st32] = &&op_qemu_st32,
+        [INDEX_op_qemu_st64] = &&op_qemu_st64,
+    };
 #endif
 
-#if defined(GETPC)
-        tci_tb_ptr = (uintptr_t)tb_ptr;
-#endif
-
-        /* Skip opcode and size entry. */
-        tb_ptr += 2;
-
-        switch (opc) {
-        case INDEX_op_end:
-        case INDEX_op_nop:
-            break;
-        case INDEX_op_nop1:
-        case INDEX_op_nop2:
-        case INDEX_op_nop3:
-        case INDEX_op_nopn:
-        case INDEX_op_discard:
-            TODO();
-            break;
-        case INDEX_op_set_label:
-            TODO();
-            break;
-        case INDEX_op_call:
-            t0 = tci_read_ri(&tb_ptr);
+    tci_reg[TCG_AREG0] = (tcg_target_ulong)env;
+    tci_reg[TCG_REG_CALL_STACK] = sp_value;
+    assert(tb_ptr);
+
+#if !defined(TCI_THREADED)
+next:
+#endif
+    TCI_FETCH();
+    switch (opc) {
+    CASE(end)
+    CASE(nop)
+        TCI_NEXT();
+    CASE(nop1)
+    CASE(nop2)
+    CASE(nop3)
+    CASE(nopn)
+    CASE(discard)
+        TODO();
+        TCI_NEXT();
+    CASE(set_label)
+        TODO();
+        TCI_NEXT();
+    CASE(call)
+        t0 = tci_read_i(&tb_ptr);
 #if TCG_TARGET_REG_BITS == 32
-            tmp64 = ((helper_function)t0)(tci_read_reg(TCG_REG_R0),
-                                          tci_read_reg(TCG_REG_R1),
-                                          tci_read_reg(TCG_REG_R2),
-                                          tci_read_reg(TCG_REG_R3),
-                                          tci_read_reg(TCG_REG_R5),
-                                          tci_read_reg(TCG_REG_R6),
-                                          tci_read_reg(TCG_REG_R7),
-                                          tci_read_reg(TCG_REG_R8),
-                                          tci_read_reg(TCG_REG_R9),
-                                          tci_read_reg(TCG_REG_R10));
-            tci_write_reg(TCG_REG_R0, tmp64);
-            tci_write_reg(TCG_REG_R1, tmp64 >> 32);
+        tmp64 = ((helper_function)t0)(tci_read_reg(TCG_REG_R0),
+                                      tci_read_reg(TCG_REG_R1),
+                                      tci_read_reg(TCG_REG_R2),
+                                      tci_read_reg(TCG_REG_R3),
+                                      tci_read_reg(TCG_REG_R5),
+                                      tci_read_reg(TCG_REG_R6),
+                                      tci_read_reg(TCG_REG_R7),
+                                      tci_read_reg(TCG_REG_R8),
+                                      tci_read_reg(TCG_REG_R9),
+                                      tci_read_reg(TCG_REG_R10));
+        tci_write_reg(TCG_REG_R0, tmp64);
+        tci_write_reg(TCG_REG_R1, tmp64 >> 32);
 #else
-            tmp64 = ((helper_function)t0)(tci_read_reg(TCG_REG_R0),
-                                          tci_read_reg(TCG_REG_R1),
-                                          tci_read_reg(TCG_REG_R2),
-                                          tci_read_reg(TCG_REG_R3),
-                                          tci_read_reg(TCG_REG_R5));
-            tci_write_reg(TCG_REG_R0, tmp64);
-#endif
-            break;
-        case INDEX_op_br:
-            label = tci_read_label(&tb_ptr);
-            assert(tb_ptr == old_code_ptr + op_size);
-            tb_ptr = (uint8_t *)label;
-            continue;
-        case INDEX_op_setcond_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            condition = *tb_ptr++;
-            tci_write_reg32(t0, tci_compare32(t1, t2, condition));
-            break;
+        tmp64 = ((helper_function)t0)(tci_read_reg(TCG_REG_R0),
+                                      tci_read_reg(TCG_REG_R1),
+                                      tci_read_reg(TCG_REG_R2),
+                                      tci_read_reg(TCG_REG_R3),
+                                      tci_read_reg(TCG_REG_R5));
+        tci_write_reg(TCG_REG_R0, tmp64);
+#endif
+        TCI_NEXT();
+    CASE(br)
+        label = tci_read_label(&tb_ptr);
+        assert(tb_ptr == old_code_ptr + op_size);
+        tb_ptr = (uint8_t *)label;
+        TCI_DISPATCH();
+    CASE(setcond_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        condition = *tb_ptr++;
+        tci_write_reg32(t0, tci_compare32(t1, t2, condition));
+        TCI_NEXT();
+    CASE_TCI(setcondi_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_i32(&tb_ptr);
+        condition = *tb_ptr++;
+        tci_write_reg32(t0, tci_compare32(t1, t2, condition));
+        TCI_NEXT();
 #if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_setcond2_i32:
-            t0 = *tb_ptr++;
-            tmp64 = tci_read_r64(&tb_ptr);
-            v64 = tci_read_ri64(&tb_ptr);
-            condition = *tb_ptr++;
-            tci_write_reg32(t0, tci_compare64(tmp64, v64, condition));
-            break;
+    CASE(setcond2_i32)
+        t0 = *tb_ptr++;
+        tmp64 = tci_read_r64(&tb_ptr);
+        v64 = tci_read_ri64(&tb_ptr);
+        condition = *tb_ptr++;
+        tci_write_reg32(t0, tci_compare64(tmp64, v64, condition));
+        TCI_NEXT();
 #elif TCG_TARGET_REG_BITS == 64
-        case INDEX_op_setcond_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            condition = *tb_ptr++;
-            tci_write_reg64(t0, tci_compare64(t1, t2, condition));
-            break;
-#endif
-        case INDEX_op_mov_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
-        case INDEX_op_movi_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_i32(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
-
-            /* Load/store operations (32 bit). */
-
-        case INDEX_op_ld8u_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            tci_write_reg8(t0, *(uint8_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld8s_i32:
-        case INDEX_op_ld16u_i32:
-            TODO();
-            break;
-        case INDEX_op_ld16s_i32:
-            TODO();
-            break;
-        case INDEX_op_ld_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            tci_write_reg32(t0, *(uint32_t *)(t1 + t2));
-            break;
-        case INDEX_op_st8_i32:
-            t0 = tci_read_r8(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            *(uint8_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st16_i32:
-            t0 = tci_read_r16(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            *(uint16_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st_i32:
-            t0 = tci_read_r32(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            assert(t1 != sp_value || (int32_t)t2 < 0);
-            *(uint32_t *)(t1 + t2) = t0;
-            break;
-
-            /* Arithmetic operations (32 bit). */
-
-        case INDEX_op_add_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 + t2);
-            break;
-        case INDEX_op_sub_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 - t2);
-            break;
-        case INDEX_op_mul_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 * t2);
-            break;
+    CASE(setcond_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        condition = *tb_ptr++;
+        tci_write_reg64(t0, tci_compare64(t1, t2, condition));
+        TCI_NEXT();
+    CASE_TCI(setcondi_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_i64(&tb_ptr);
+        condition = *tb_ptr++;
+        tci_write_reg64(t0, tci_compare64(t1, t2, condition));
+        TCI_NEXT();
+#endif
+    CASE(mov_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, t1);
+        TCI_NEXT();
+    CASE(movi_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_i32(&tb_ptr);
+        tci_write_reg32(t0, t1);
+        TCI_NEXT();
+
+        /* Load/store operations (32 bit). */
+
+    CASE(ld8u_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        tci_write_reg8(t0, *(uint8_t *)(t1 + t2));
+        TCI_NEXT();
+    CASE(ld8s_i32)
+    CASE(ld16u_i32)
+        TODO();
+        TCI_NEXT();
+    CASE(ld16s_i32)
+        TODO();
+        TCI_NEXT();
+    CASE(ld_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        tci_write_reg32(t0, *(uint32_t *)(t1 + t2));
+        TCI_NEXT();
+    CASE(st8_i32)
+        t0 = tci_read_r8(&tb_ptr);
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        *(uint8_t *)(t1 + t2) = t0;
+        TCI_NEXT();
+    CASE(st16_i32)
+        t0 = tci_read_r16(&tb_ptr);
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        *(uint16_t *)(t1 + t2) = t0;
+        TCI_NEXT();
+    CASE(st_i32)
+        t0 = tci_read_r32(&tb_ptr);
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        assert(t1 != sp_value || (int32_t)t2 < 0);
+        *(uint32_t *)(t1 + t2) = t0;
+        TCI_NEXT();
+
+        /* Arithmetic operations (32 bit). */
+
+    CASE(add_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, t1 + t2);
+        TCI_NEXT();
+    CASE_TCI(addi_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_i32(&tb_ptr);
+        tci_write_reg32(t0, t1 + t2);
+        TCI_NEXT();
+    CASE(sub_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, t1 - t2);
+        TCI_NEXT();
+    CASE_TCI(subi_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_i32(&tb_ptr);
+        tci_write_reg32(t0, t1 - t2);
+        TCI_NEXT();
+    CASE(mul_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, t1 * t2);
+        TCI_NEXT();
+    CASE_TCI(muli_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_i32(&tb_ptr);
+        tci_write_reg32(t0, t1 * t2);
+        TCI_NEXT();
 #if TCG_TARGET_HAS_div_i32
-        case INDEX_op_div_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, (int32_t)t1 / (int32_t)t2);
-            break;
-        case INDEX_op_divu_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 / t2);
-            break;
-        case INDEX_op_rem_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, (int32_t)t1 % (int32_t)t2);
-            break;
-        case INDEX_op_remu_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 % t2);
-            break;
+    CASE(div_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, (int32_t)t1 / (int32_t)t2);
+        TCI_NEXT();
+    CASE(divu_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, t1 / t2);
+        TCI_NEXT();
+    CASE(rem_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, (int32_t)t1 % (int32_t)t2);
+        TCI_NEXT();
+    CASE(remu_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, t1 % t2);
+        TCI_NEXT();
 #elif TCG_TARGET_HAS_div2_i32
-        case INDEX_op_div2_i32:
-        case INDEX_op_divu2_i32:
-            TODO();
-            break;
-#endif
-        case INDEX_op_and_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 & t2);
-            break;
-        case INDEX_op_or_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 | t2);
-            break;
-        case INDEX_op_xor_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 ^ t2);
-            break;
-
-            /* Shift/rotate operations (32 bit). */
-
-        case INDEX_op_shl_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 << (t2 & 31));
-            break;
-        case INDEX_op_shr_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 >> (t2 & 31));
-            break;
-        case INDEX_op_sar_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, ((int32_t)t1 >> (t2 & 31)));
-            break;
+    CASE(div2_i32)
+    CASE(divu2_i32)
+        TODO();
+        TCI_NEXT();
+#endif
+    CASE(and_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, t1 & t2);
+        TCI_NEXT();
+    CASE_TCI(andi_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_i32(&tb_ptr);
+        tci_write_reg32(t0, t1 & t2);
+        TCI_NEXT();
+    CASE(or_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, t1 | t2);
+        TCI_NEXT();
+    CASE_TCI(ori_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_i32(&tb_ptr);
+        tci_write_reg32(t0, t1 | t2);
+        TCI_NEXT();
+    CASE(xor_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, t1 ^ t2);
+        TCI_NEXT();
+    CASE_TCI(xori_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_i32(&tb_ptr);
+        tci_write_reg32(t0, t1 ^ t2);
+        TCI_NEXT();
+
+        /* Shift/rotate operations (32 bit). */
+
+    CASE(shl_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, t1 << (t2 & 31));
+        TCI_NEXT();
+    CASE_TCI(shli_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_i32(&tb_ptr);
+        tci_write_reg32(t0, t1 << t2);
+        TCI_NEXT();
+    CASE(shr_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, t1 >> (t2 & 31));
+        TCI_NEXT();
+    CASE_TCI(shri_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_i32(&tb_ptr);
+        tci_write_reg32(t0, t1 >> t2);
+        TCI_NEXT();
+    CASE(sar_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, ((int32_t)t1 >> (t2 & 31)));
+        TCI_NEXT();
+    CASE_TCI(sari_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_i32(&tb_ptr);
+        tci_write_reg32(t0, ((int32_t)t1 >> t2));
+        TCI_NEXT();
 #if TCG_TARGET_HAS_rot_i32
-        case INDEX_op_rotl_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, rol32(t1, t2 & 31));
-            break;
-        case INDEX_op_rotr_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, ror32(t1, t2 & 31));
-            break;
+    CASE(rotl_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, rol32(t1, t2 & 31));
+        TCI_NEXT();
+    CASE_TCI(rotli_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_i32(&tb_ptr);
+        tci_write_reg32(t0, rol32(t1, t2 & 31));
+        TCI_NEXT();
+    CASE(rotr_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, ror32(t1, t2 & 31));
+        TCI_NEXT();
+    CASE_TCI(rotri_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_i32(&tb_ptr);
+        tci_write_reg32(t0, ror32(t1, t2 & 31));
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_deposit_i32
-        case INDEX_op_deposit_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            t2 = tci_read_r32(&tb_ptr);
-            tmp16 = *tb_ptr++;
-            tmp8 = *tb_ptr++;
-            tmp32 = (((1 << tmp8) - 1) << tmp16);
-            tci_write_reg32(t0, (t1 & ~tmp32) | ((t2 << tmp16) & tmp32));
-            break;
-#endif
-        case INDEX_op_brcond_i32:
-            t0 = tci_read_r32(&tb_ptr);
-            t1 = tci_read_ri32(&tb_ptr);
-            condition = *tb_ptr++;
-            label = tci_read_label(&tb_ptr);
-            if (tci_compare32(t0, t1, condition)) {
-                assert(tb_ptr == old_code_ptr + op_size);
-                tb_ptr = (uint8_t *)label;
-                continue;
-            }
-            break;
+    CASE(deposit_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        t2 = tci_read_r32(&tb_ptr);
+        tmp16 = *tb_ptr++;
+        tmp8 = *tb_ptr++;
+        tmp32 = (((1 << tmp8) - 1) << tmp16);
+        tci_write_reg32(t0, (t1 & ~tmp32) | ((t2 << tmp16) & tmp32));
+        TCI_NEXT();
+#endif
+    CASE(brcond_i32)
+        t0 = tci_read_r32(&tb_ptr);
+        t1 = tci_read_r32(&tb_ptr);
+        condition = *tb_ptr++;
+        label = tci_read_label(&tb_ptr);
+        if (tci_compare32(t0, t1, condition)) {
+            assert(tb_ptr == old_code_ptr + op_size);
+            tb_ptr = (uint8_t *)label;
+            TCI_DISPATCH();
+        }
+        TCI_NEXT();
+    CASE_TCI(brcondi_i32)
+        t0 = tci_read_r32(&tb_ptr);
+        t1 = tci_read_i32(&tb_ptr);
+        condition = *tb_ptr++;
+        label = tci_read_label(&tb_ptr);
+        if (tci_compare32(t0, t1, condition)) {
+            assert(tb_ptr == old_code_ptr + op_size);
+            tb_ptr = (uint8_t *)label;
+            TCI_DISPATCH();
+        }
+        TCI_NEXT();
 #if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_add2_i32:
-            t0 = *tb_ptr++;
-            t1 = *tb_ptr++;
-            tmp64 = tci_read_r64(&tb_ptr);
-            tmp64 += tci_read_r64(&tb_ptr);
-            tci_write_reg64(t1, t0, tmp64);
-            break;
-        case INDEX_op_sub2_i32:
-            t0 = *tb_ptr++;
-            t1 = *tb_ptr++;
-            tmp64 = tci_read_r64(&tb_ptr);
-            tmp64 -= tci_read_r64(&tb_ptr);
-            tci_write_reg64(t1, t0, tmp64);
-            break;
-        case INDEX_op_brcond2_i32:
-            tmp64 = tci_read_r64(&tb_ptr);
-            v64 = tci_read_ri64(&tb_ptr);
-            condition = *tb_ptr++;
-            label = tci_read_label(&tb_ptr);
-            if (tci_compare64(tmp64, v64, condition)) {
-                assert(tb_ptr == old_code_ptr + op_size);
-                tb_ptr = (uint8_t *)label;
-                continue;
-            }
-            break;
-        case INDEX_op_mulu2_i32:
-            t0 = *tb_ptr++;
-            t1 = *tb_ptr++;
-            t2 = tci_read_r32(&tb_ptr);
-            tmp64 = tci_read_r32(&tb_ptr);
-            tci_write_reg64(t1, t0, t2 * tmp64);
-            break;
+    CASE(add2_i32)
+        t0 = *tb_ptr++;
+        t1 = *tb_ptr++;
+        tmp64 = tci_read_r64(&tb_ptr);
+        tmp64 += tci_read_r64(&tb_ptr);
+        tci_write_reg64(t1, t0, tmp64);
+        TCI_NEXT();
+    CASE(sub2_i32)
+        t0 = *tb_ptr++;
+        t1 = *tb_ptr++;
+        tmp64 = tci_read_r64(&tb_ptr);
+        tmp64 -= tci_read_r64(&tb_ptr);
+        tci_write_reg64(t1, t0, tmp64);
+        TCI_NEXT();
+    CASE(brcond2_i32)
+        tmp64 = tci_read_r64(&tb_ptr);
+        v64 = tci_read_ri64(&tb_ptr);
+        condition = *tb_ptr++;
+        label = tci_read_label(&tb_ptr);
+        if (tci_compare64(tmp64, v64, condition)) {
+            assert(tb_ptr == old_code_ptr + op_size);
+            tb_ptr = (uint8_t *)label;
+            TCI_DISPATCH();
+        }
+        TCI_NEXT();
+    CASE(mulu2_i32)
+        t0 = *tb_ptr++;
+        t1 = *tb_ptr++;
+        t2 = tci_read_r32(&tb_ptr);
+        tmp64 = tci_read_r32(&tb_ptr);
+        tci_write_reg64(t1, t0, t2 * tmp64);
+        TCI_NEXT();
 #endif /* TCG_TARGET_REG_BITS == 32 */
 #if TCG_TARGET_HAS_ext8s_i32
-        case INDEX_op_ext8s_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r8s(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
+    CASE(ext8s_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r8s(&tb_ptr);
+        tci_write_reg32(t0, t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext16s_i32
-        case INDEX_op_ext16s_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16s(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
+    CASE(ext16s_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r16s(&tb_ptr);
+        tci_write_reg32(t0, t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext8u_i32
-        case INDEX_op_ext8u_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r8(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
+    CASE(ext8u_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r8(&tb_ptr);
+        tci_write_reg32(t0, t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext16u_i32
-        case INDEX_op_ext16u_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
+    CASE(ext16u_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r16(&tb_ptr);
+        tci_write_reg32(t0, t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap16_i32
-        case INDEX_op_bswap16_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16(&tb_ptr);
-            tci_write_reg32(t0, bswap16(t1));
-            break;
+    CASE(bswap16_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r16(&tb_ptr);
+        tci_write_reg32(t0, bswap16(t1));
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap32_i32
-        case INDEX_op_bswap32_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg32(t0, bswap32(t1));
-            break;
+    CASE(bswap32_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, bswap32(t1));
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_not_i32
-        case INDEX_op_not_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg32(t0, ~t1);
-            break;
+    CASE(not_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, ~t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_neg_i32
-        case INDEX_op_neg_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg32(t0, -t1);
-            break;
+    CASE(neg_i32)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        tci_write_reg32(t0, -t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_REG_BITS == 64
-        case INDEX_op_mov_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
-        case INDEX_op_movi_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_i64(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
-
-            /* Load/store operations (64 bit). */
-
-        case INDEX_op_ld8u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            tci_write_reg8(t0, *(uint8_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld8s_i64:
-        case INDEX_op_ld16u_i64:
-        case INDEX_op_ld16s_i64:
-            TODO();
-            break;
-        case INDEX_op_ld32u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            tci_write_reg32(t0, *(uint32_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld32s_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            tci_write_reg32s(t0, *(int32_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            tci_write_reg64(t0, *(uint64_t *)(t1 + t2));
-            break;
-        case INDEX_op_st8_i64:
-            t0 = tci_read_r8(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            *(uint8_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st16_i64:
-            t0 = tci_read_r16(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            *(uint16_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st32_i64:
-            t0 = tci_read_r32(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            *(uint32_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st_i64:
-            t0 = tci_read_r64(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            assert(t1 != sp_value || (int32_t)t2 < 0);
-            *(uint64_t *)(t1 + t2) = t0;
-            break;
-
-            /* Arithmetic operations (64 bit). */
-
-        case INDEX_op_add_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 + t2);
-            break;
-        case INDEX_op_sub_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 - t2);
-            break;
-        case INDEX_op_mul_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 * t2);
-            break;
+    CASE(mov_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, t1);
+        TCI_NEXT();
+    CASE(movi_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_i64(&tb_ptr);
+        tci_write_reg64(t0, t1);
+        TCI_NEXT();
+
+        /* Load/store operations (64 bit). */
+
+    CASE(ld8u_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        tci_write_reg8(t0, *(uint8_t *)(t1 + t2));
+        TCI_NEXT();
+    CASE(ld8s_i64)
+    CASE(ld16u_i64)
+    CASE(ld16s_i64)
+        TODO();
+        TCI_NEXT();
+    CASE(ld32u_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        tci_write_reg32(t0, *(uint32_t *)(t1 + t2));
+        TCI_NEXT();
+    CASE(ld32s_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        tci_write_reg32s(t0, *(int32_t *)(t1 + t2));
+        TCI_NEXT();
+    CASE(ld_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        tci_write_reg64(t0, *(uint64_t *)(t1 + t2));
+        TCI_NEXT();
+    CASE(st8_i64)
+        t0 = tci_read_r8(&tb_ptr);
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        *(uint8_t *)(t1 + t2) = t0;
+        TCI_NEXT();
+    CASE(st16_i64)
+        t0 = tci_read_r16(&tb_ptr);
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        *(uint16_t *)(t1 + t2) = t0;
+        TCI_NEXT();
+    CASE(st32_i64)
+        t0 = tci_read_r32(&tb_ptr);
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        *(uint32_t *)(t1 + t2) = t0;
+        TCI_NEXT();
+    CASE(st_i64)
+        t0 = tci_read_r64(&tb_ptr);
+        t1 = tci_read_r(&tb_ptr);
+        t2 = tci_read_s32(&tb_ptr);
+        assert(t1 != sp_value || (int32_t)t2 < 0);
+        *(uint64_t *)(t1 + t2) = t0;
+        TCI_NEXT();
+
+        /* Arithmetic operations (64 bit). */
+
+    CASE(add_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, t1 + t2);
+        TCI_NEXT();
+    CASE_TCI(addi_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_i64(&tb_ptr);
+        tci_write_reg64(t0, t1 + t2);
+        TCI_NEXT();
+    CASE(sub_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, t1 - t2);
+        TCI_NEXT();
+    CASE_TCI(subi_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_i64(&tb_ptr);
+        tci_write_reg64(t0, t1 - t2);
+        TCI_NEXT();
+    CASE(mul_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, t1 * t2);
+        TCI_NEXT();
+    CASE_TCI(muli_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_i64(&tb_ptr);
+        tci_write_reg64(t0, t1 * t2);
+        TCI_NEXT();
 #if TCG_TARGET_HAS_div_i64
-        case INDEX_op_div_i64:
-        case INDEX_op_divu_i64:
-        case INDEX_op_rem_i64:
-        case INDEX_op_remu_i64:
-            TODO();
-            break;
+    CASE(div_i64)
+    CASE(divu_i64)
+    CASE(rem_i64)
+    CASE(remu_i64)
+        TODO();
+        TCI_NEXT();
 #elif TCG_TARGET_HAS_div2_i64
-        case INDEX_op_div2_i64:
-        case INDEX_op_divu2_i64:
-            TODO();
-            break;
-#endif
-        case INDEX_op_and_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 & t2);
-            break;
-        case INDEX_op_or_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 | t2);
-            break;
-        case INDEX_op_xor_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 ^ t2);
-            break;
-
-            /* Shift/rotate operations (64 bit). */
-
-        case INDEX_op_shl_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 << (t2 & 63));
-            break;
-        case INDEX_op_shr_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 >> (t2 & 63));
-            break;
-        case INDEX_op_sar_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, ((int64_t)t1 >> (t2 & 63)));
-            break;
+    CASE(div2_i64)
+    CASE(divu2_i64)
+        TODO();
+        TCI_NEXT();
+#endif
+    CASE(and_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, t1 & t2);
+        TCI_NEXT();
+    CASE_TCI(andi_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_i64(&tb_ptr);
+        tci_write_reg64(t0, t1 & t2);
+        TCI_NEXT();
+    CASE(or_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, t1 | t2);
+        TCI_NEXT();
+    CASE_TCI(ori_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_i64(&tb_ptr);
+        tci_write_reg64(t0, t1 | t2);
+        TCI_NEXT();
+    CASE(xor_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, t1 ^ t2);
+        TCI_NEXT();
+    CASE_TCI(xori_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_i64(&tb_ptr);
+        tci_write_reg64(t0, t1 ^ t2);
+        TCI_NEXT();
+
+        /* Shift/rotate operations (64 bit). */
+
+    CASE(shl_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, t1 << (t2 & 63));
+        TCI_NEXT();
+    CASE_TCI(shli_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_i64(&tb_ptr);
+        tci_write_reg64(t0, t1 << t2);
+        TCI_NEXT();
+    CASE(shr_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, t1 >> (t2 & 63));
+        TCI_NEXT();
+    CASE_TCI(shri_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_i64(&tb_ptr);
+        tci_write_reg64(t0, t1 >> t2);
+        TCI_NEXT();
+    CASE(sar_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, ((int64_t)t1 >> (t2 & 63)));
+        TCI_NEXT();
+    CASE_TCI(sari_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_i64(&tb_ptr);
+        tci_write_reg64(t0, ((int64_t)t1 >> t2));
+        TCI_NEXT();
 #if TCG_TARGET_HAS_rot_i64
-        case INDEX_op_rotl_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, rol64(t1, t2 & 63));
-            break;
-        case INDEX_op_rotr_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, ror64(t1, t2 & 63));
-            break;
+    CASE(rotl_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, rol64(t1, t2 & 63));
+        TCI_NEXT();
+    CASE_TCI(rotli_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_i64(&tb_ptr);
+        tci_write_reg64(t0, rol64(t1, t2 & 63));
+        TCI_NEXT();
+    CASE(rotr_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, ror64(t1, t2 & 63));
+        TCI_NEXT();
+    CASE_TCI(rotri_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_i64(&tb_ptr);
+        tci_write_reg64(t0, ror64(t1, t2 & 63));
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_deposit_i64
-        case INDEX_op_deposit_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            t2 = tci_read_r64(&tb_ptr);
-            tmp16 = *tb_ptr++;
-            tmp8 = *tb_ptr++;
-            tmp64 = (((1ULL << tmp8) - 1) << tmp16);
-            tci_write_reg64(t0, (t1 & ~tmp64) | ((t2 << tmp16) & tmp64));
-            break;
-#endif
-        case INDEX_op_brcond_i64:
-            t0 = tci_read_r64(&tb_ptr);
-            t1 = tci_read_ri64(&tb_ptr);
-            condition = *tb_ptr++;
-            label = tci_read_label(&tb_ptr);
-            if (tci_compare64(t0, t1, condition)) {
-                assert(tb_ptr == old_code_ptr + op_size);
-                tb_ptr = (uint8_t *)label;
-                continue;
-            }
-            break;
+    CASE(deposit_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        t2 = tci_read_r64(&tb_ptr);
+        tmp16 = *tb_ptr++;
+        tmp8 = *tb_ptr++;
+        tmp64 = (((1ULL << tmp8) - 1) << tmp16);
+        tci_write_reg64(t0, (t1 & ~tmp64) | ((t2 << tmp16) & tmp64));
+        TCI_NEXT();
+#endif
+    CASE(brcond_i64)
+        t0 = tci_read_r64(&tb_ptr);
+        t1 = tci_read_r64(&tb_ptr);
+        condition = *tb_ptr++;
+        label = tci_read_label(&tb_ptr);
+        if (tci_compare64(t0, t1, condition)) {
+            assert(tb_ptr == old_code_ptr + op_size);
+            tb_ptr = (uint8_t *)label;
+            TCI_DISPATCH();
+        }
+        TCI_NEXT();
+    CASE_TCI(brcondi_i64)
+        t0 = tci_read_r64(&tb_ptr);
+        t1 = tci_read_i64(&tb_ptr);
+        condition = *tb_ptr++;
+        label = tci_read_label(&tb_ptr);
+        if (tci_compare64(t0, t1, condition)) {
+            assert(tb_ptr == old_code_ptr + op_size);
+            tb_ptr = (uint8_t *)label;
+            TCI_DISPATCH();
+        }
+        TCI_NEXT();
 #if TCG_TARGET_HAS_ext8u_i64
-        case INDEX_op_ext8u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r8(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
+    CASE(ext8u_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r8(&tb_ptr);
+        tci_write_reg64(t0, t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext8s_i64
-        case INDEX_op_ext8s_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r8s(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
+    CASE(ext8s_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r8s(&tb_ptr);
+        tci_write_reg64(t0, t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext16s_i64
-        case INDEX_op_ext16s_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16s(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
+    CASE(ext16s_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r16s(&tb_ptr);
+        tci_write_reg64(t0, t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext16u_i64
-        case INDEX_op_ext16u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
+    CASE(ext16u_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r16(&tb_ptr);
+        tci_write_reg64(t0, t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext32s_i64
-        case INDEX_op_ext32s_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32s(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
+    CASE(ext32s_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32s(&tb_ptr);
+        tci_write_reg64(t0, t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext32u_i64
-        case INDEX_op_ext32u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
+    CASE(ext32u_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        tci_write_reg64(t0, t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap16_i64
-        case INDEX_op_bswap16_i64:
-            TODO();
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16(&tb_ptr);
-            tci_write_reg64(t0, bswap16(t1));
-            break;
+    CASE(bswap16_i64)
+        TODO();
+        t0 = *tb_ptr++;
+        t1 = tci_read_r16(&tb_ptr);
+        tci_write_reg64(t0, bswap16(t1));
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap32_i64
-        case INDEX_op_bswap32_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg64(t0, bswap32(t1));
-            break;
+    CASE(bswap32_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r32(&tb_ptr);
+        tci_write_reg64(t0, bswap32(t1));
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap64_i64
-        case INDEX_op_bswap64_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            tci_write_reg64(t0, bswap64(t1));
-            break;
+    CASE(bswap64_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, bswap64(t1));
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_not_i64
-        case INDEX_op_not_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            tci_write_reg64(t0, ~t1);
-            break;
+    CASE(not_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, ~t1);
+        TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_neg_i64
-        case INDEX_op_neg_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            tci_write_reg64(t0, -t1);
-            break;
+    CASE(neg_i64)
+        t0 = *tb_ptr++;
+        t1 = tci_read_r64(&tb_ptr);
+        tci_write_reg64(t0, -t1);
+        TCI_NEXT();
 #endif
 #endif /* TCG_TARGET_REG_BITS == 64 */
 
-            /* QEMU specific operations. */
+        /* QEMU specific operations. */
 
 #if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
-        case INDEX_op_debug_insn_start:
-            TODO();
-            break;
+    CASE(debug_insn_start)
+        TODO();
+        TCI_NEXT();
 #else
-        case INDEX_op_debug_insn_start:
-            TODO();
-            break;
-#endif
-        case INDEX_op_exit_tb:
-            next_tb = *(uint64_t *)tb_ptr;
-            goto exit;
-            break;
-        case INDEX_op_goto_tb:
-            t0 = tci_read_i32(&tb_ptr);
-            assert(tb_ptr == old_code_ptr + op_size);
-            tb_ptr += (int32_t)t0;
-            continue;
-        case INDEX_op_qemu_ld8u:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+    CASE(debug_insn_start)
+        TODO();
+        TCI_NEXT();
+#endif
+    CASE(exit_tb)
+        next_tb = *(uint64_t *)tb_ptr;
+        goto exit;
+    CASE(goto_tb)
+        t0 = tci_read_i32(&tb_ptr);
+        assert(tb_ptr == old_code_ptr + op_size);
+        tb_ptr += (int32_t)t0;
+        TCI_DISPATCH();
+    CASE(qemu_ld8u)
+        t0 = *tb_ptr++;
+        taddr = tci_read_ulong(&tb_ptr);
 #ifdef CONFIG_SOFTMMU
-            tmp8 = helper_ldb_mmu(env, taddr, tci_read_i(&tb_ptr));
+        tmp8 = helper_ldb_mmu(env, taddr, tci_read_i(&tb_ptr));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            tmp8 = *(uint8_t *)(host_addr + GUEST_BASE);
-#endif
-            tci_write_reg8(t0, tmp8);
-            break;
-        case INDEX_op_qemu_ld8s:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+        host_addr = (tcg_target_ulong)taddr;
+        tmp8 = *(uint8_t *)(host_addr + GUEST_BASE);
+#endif
+        tci_write_reg8(t0, tmp8);
+        TCI_NEXT();
+    CASE(qemu_ld8s)
+        t0 = *tb_ptr++;
+        taddr = tci_read_ulong(&tb_ptr);
 #ifdef CONFIG_SOFTMMU
-            tmp8 = helper_ldb_mmu(env, taddr, tci_read_i(&tb_ptr));
+        tmp8 = helper_ldb_mmu(env, taddr, tci_read_i(&tb_ptr));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            tmp8 = *(uint8_t *)(host_addr + GUEST_BASE);
-#endif
-            tci_write_reg8s(t0, tmp8);
-            break;
-        case INDEX_op_qemu_ld16u:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+        host_addr = (tcg_target_ulong)taddr;
+        tmp8 = *(uint8_t *)(host_addr + GUEST_BASE);
+#endif
+        tci_write_reg8s(t0, tmp8);
+        TCI_NEXT();
+    CASE(qemu_ld16u)
+        t0 = *tb_ptr++;
+        taddr = tci_read_ulong(&tb_ptr);
 #ifdef CONFIG_SOFTMMU
-            tmp16 = helper_ldw_mmu(env, taddr, tci_read_i(&tb_ptr));
+        tmp16 = helper_ldw_mmu(env, taddr, tci_read_i(&tb_ptr));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            tmp16 = tswap16(*(uint16_t *)(host_addr + GUEST_BASE));
-#endif
-            tci_write_reg16(t0, tmp16);
-            break;
-        case INDEX_op_qemu_ld16s:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+        host_addr = (tcg_target_ulong)taddr;
+        tmp16 = tswap16(*(uint16_t *)(host_addr + GUEST_BASE));
+#endif
+        tci_write_reg16(t0, tmp16);
+        TCI_NEXT();
+    CASE(qemu_ld16s)
+        t0 = *tb_ptr++;
+        taddr = tci_read_ulong(&tb_ptr);
 #ifdef CONFIG_SOFTMMU
-            tmp16 = helper_ldw_mmu(env, taddr, tci_read_i(&tb_ptr));
+        tmp16 = helper_ldw_mmu(env, taddr, tci_read_i(&tb_ptr));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            tmp16 = tswap16(*(uint16_t *)(host_addr + GUEST_BASE));
+        host_addr = (tcg_target_ulong)taddr;
+        tmp16 = tswap16(*(uint16_t *)(host_addr + GUEST_BASE));
 #endif
-            tci_write_reg16s(t0, tmp16);
-            break;
+        tci_write_reg16s(t0, tmp16);
+        TCI_NEXT();
 #if TCG_TARGET_REG_BITS == 64
-        case INDEX_op_qemu_ld32u:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+    CASE(qemu_ld32u)
+        t0 = *tb_ptr++;
+        taddr = tci_read_ulong(&tb_ptr);
 #ifdef CONFIG_SOFTMMU
-            tmp32 = helper_ldl_mmu(env, taddr, tci_read_i(&tb_ptr));
+        tmp32 = helper_ldl_mmu(env, taddr, tci_read_i(&tb_ptr));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            tmp32 = tswap32(*(uint32_t *)(host_addr + GUEST_BASE));
-#endif
-            tci_write_reg32(t0, tmp32);
-            break;
-        case INDEX_op_qemu_ld32s:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+        host_addr = (tcg_target_ulong)taddr;
+        tmp32 = tswap32(*(uint32_t *)(host_addr + GUEST_BASE));
+#endif
+        tci_write_reg32(t0, tmp32);
+        TCI_NEXT();
+    CASE(qemu_ld32s)
+        t0 = *tb_ptr++;
+        taddr = tci_read_ulong(&tb_ptr);
 #ifdef CONFIG_SOFTMMU
-            tmp32 = helper_ldl_mmu(env, taddr, tci_read_i(&tb_ptr));
+        tmp32 = helper_ldl_mmu(env, taddr, tci_read_i(&tb_ptr));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            tmp32 = tswap32(*(uint32_t *)(host_addr + GUEST_BASE));
+        host_addr = (tcg_target_ulong)taddr;
+        tmp32 = tswap32(*(uint32_t *)(host_addr + GUEST_BASE));
 #endif
-            tci_write_reg32s(t0, tmp32);
-            break;
+        tci_write_reg32s(t0, tmp32);
+        TCI_NEXT();
 #endif /* TCG_TARGET_REG_BITS == 64 */
-        case INDEX_op_qemu_ld32:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
+    CASE(qemu_ld32)
+        t0 = *tb_ptr++;
+        taddr = tci_read_ulong(&tb_ptr);
 #ifdef CONFIG_SOFTMMU
-            tmp32 = helper_ldl_mmu(env, taddr, tci_read_i(&tb_ptr));
+        tmp32 = helper_ldl_mmu(env, taddr, tci_read_i(&tb_ptr));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            tmp32 = tswap32(*(uint32_t *)(host_addr + GUEST_BASE));
+        host_addr = (tcg_target_ulong)taddr;
+        tmp32 = tswap32(*(uint32_t *)(host_addr + GUEST_BASE));
 #endif
-            tci_write_reg32(t0, tmp32);
-            break;
-        case INDEX_op_qemu_ld64:
-            t0 = *tb_ptr++;
+        tci_write_reg32(t0, tmp32);
+        TCI_NEXT();
+    CASE(qemu_ld64)
+        t0 = *tb_ptr++;
 #if TCG_TARGET_REG_BITS == 32
-            t1 = *tb_ptr++;
+        t1 = *tb_ptr++;
 #endif
-            taddr = tci_read_ulong(&tb_ptr);
+        taddr = tci_read_ulong(&tb_ptr);
 #ifdef CONFIG_SOFTMMU
-            tmp64 = helper_ldq_mmu(env, taddr, tci_read_i(&tb_ptr));
+        tmp64 = helper_ldq_mmu(env, taddr, tci_read_i(&tb_ptr));
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            tmp64 = tswap64(*(uint64_t *)(host_addr + GUEST_BASE));
+        host_addr = (tcg_target_ulong)taddr;
+        tmp64 = tswap64(*(uint64_t *)(host_addr + GUEST_BASE));
 #endif
-            tci_write_reg(t0, tmp64);
+        tci_write_reg(t0, tmp64);
 #if TCG_TARGET_REG_BITS == 32
-            tci_write_reg(t1, tmp64 >> 32);
+        tci_write_reg(t1, tmp64 >> 32);
 #endif
-            break;
-        case INDEX_op_qemu_st8:
-            t0 = tci_read_r8(&tb_ptr);
-            taddr = tci_read_ulong(&tb_ptr);
+        TCI_NEXT();
+    CASE(qemu_st8)
+        t0 = tci_read_r8(&tb_ptr);
+        taddr = tci_read_ulong(&tb_ptr);
 #ifdef CONFIG_SOFTMMU
-            t2 = tci_read_i(&tb_ptr);
-            helper_stb_mmu(env, taddr, t0, t2);
+        t2 = tci_read_i(&tb_ptr);
+        helper_stb_mmu(env, taddr, t0, t2);
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            *(uint8_t *)(host_addr + GUEST_BASE) = t0;
+        host_addr = (tcg_target_ulong)taddr;
+        *(uint8_t *)(host_addr + GUEST_BASE) = t0;
 #endif
-            break;
-        case INDEX_op_qemu_st16:
-            t0 = tci_read_r16(&tb_ptr);
-            taddr = tci_read_ulong(&tb_ptr);
+        TCI_NEXT();
+    CASE(qemu_st16)
+        t0 = tci_read_r16(&tb_ptr);
+        taddr = tci_read_ulong(&tb_ptr);
 #ifdef CONFIG_SOFTMMU
-            t2 = tci_read_i(&tb_ptr);
-            helper_stw_mmu(env, taddr, t0, t2);
+        t2 = tci_read_i(&tb_ptr);
+        helper_stw_mmu(env, taddr, t0, t2);
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            *(uint16_t *)(host_addr + GUEST_BASE) = tswap16(t0);
+        host_addr = (tcg_target_ulong)taddr;
+        *(uint16_t *)(host_addr + GUEST_BASE) = tswap16(t0);
 #endif
-            break;
-        case INDEX_op_qemu_st32:
-            t0 = tci_read_r32(&tb_ptr);
-            taddr = tci_read_ulong(&tb_ptr);
+        TCI_NEXT();
+    CASE(qemu_st32)
+        t0 = tci_read_r32(&tb_ptr);
+        taddr = tci_read_ulong(&tb_ptr);
 #ifdef CONFIG_SOFTMMU
-            t2 = tci_read_i(&tb_ptr);
-            helper_stl_mmu(env, taddr, t0, t2);
+        t2 = tci_read_i(&tb_ptr);
+        helper_stl_mmu(env, taddr, t0, t2);
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            *(uint32_t *)(host_addr + GUEST_BASE) = tswap32(t0);
+        host_addr = (tcg_target_ulong)taddr;
+        *(uint32_t *)(host_addr + GUEST_BASE) = tswap32(t0);
 #endif
-            break;
-        case INDEX_op_qemu_st64:
-            tmp64 = tci_read_r64(&tb_ptr);
-            taddr = tci_read_ulong(&tb_ptr);
+        TCI_NEXT();
+    CASE(qemu_st64)
+        tmp64 = tci_read_r64(&tb_ptr);
+        taddr = tci_read_ulong(&tb_ptr);
 #ifdef CONFIG_SOFTMMU
-            t2 = tci_read_i(&tb_ptr);
-            helper_stq_mmu(env, taddr, tmp64, t2);
+        t2 = tci_read_i(&tb_ptr);
+        helper_stq_mmu(env, taddr, tmp64, t2);
 #else
-            host_addr = (tcg_target_ulong)taddr;
-            *(uint64_t *)(host_addr + GUEST_BASE) = tswap64(tmp64);
+        host_addr = (tcg_target_ulong)taddr;
+        *(uint64_t *)(host_addr + GUEST_BASE) = tswap64(tmp64);
 #endif
-            break;
-        default:
-            TODO();
-            break;
-        }
-        assert(tb_ptr == old_code_ptr + op_size);
+        TCI_NEXT();
+    default:
+        TCI_LABEL(illegal)
+        TODO();
+        TCI_NEXT();
     }
 exit:
     return next_tb;
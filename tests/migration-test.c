@@ -0,0 +1,330 @@
+/*
+ * Live migration between two QEMUs on this host
+ *
+ * The guest RAM is dirtied through qtest at a fixed rate while the
+ * migration runs.  The quick test checks that the target ends up with the
+ * last value written to each page.  With -m perf, each feature is timed at
+ * several dirty rates and the query-migrate statistics of every run are
+ * printed as one JSON object per line, for comparing features and builds.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "libqtest.h"
+#include "qemu-common.h"
+#include "qapi/qmp/qjson.h"
+#include "qapi/qmp/qint.h"
+#include "qapi/qmp/qfloat.h"
+#include "qapi/qmp/qstring.h"
+
+#define RAM_MB          128
+#define START_ADDR      (1 << 20)
+#define PAGE_SIZE       4096
+#define NB_PAGES        (((RAM_MB << 20) - START_ADDR) / PAGE_SIZE)
+
+/* Pages dirtied in a loop while migrating: 8MB */
+#define WORKING_SET     2048
+
+/* Seconds before a migration that does not converge is cancelled */
+#define TIMEOUT         30
+
+typedef struct MigrationRun {
+    const char *capability;     /* enabled on both sides, or NULL */
+    int dirty_rate;             /* pages per second */
+    int64_t max_bandwidth;      /* bytes per second */
+    bool check;                 /* compare the target RAM */
+    bool postcopy;              /* switch to post-copy once active */
+} MigrationRun;
+
+static uint8_t expected[NB_PAGES];
+/* Pages written after the source was last seen running */
+static bool unsure[NB_PAGES];
+
+static uint64_t page_addr(int page)
+{
+    return START_ADDR + (uint64_t)page * PAGE_SIZE;
+}
+
+/* Run a QMP command and return its result, skipping events */
+static QDict *qmp_command(QTestState *s, const char *fmt, ...)
+{
+    va_list ap;
+    QDict *resp, *ret;
+
+    va_start(ap, fmt);
+    resp = qtest_qmpv(s, fmt, ap);
+    va_end(ap);
+    while (qdict_haskey(resp, "event")) {
+        QDECREF(resp);
+        resp = qtest_qmp_receive(s);
+    }
+
+    g_assert(!qdict_haskey(resp, "error"));
+    ret = qdict_get_qdict(resp, "return");
+    g_assert(ret);
+    QINCREF(ret);
+    QDECREF(resp);
+    return ret;
+}
+
+static bool vm_running(QTestState *s)
+{
+    QDict *status = qmp_command(s, "{ 'execute': 'query-status' }");
+    bool running = qdict_get_bool(status, "running");
+
+    QDECREF(status);
+    return running;
+}
+
+static void set_capability(QTestState *s, const char *capability)
+{
+    QDECREF(qmp_command(s, "{ 'execute': 'migrate-set-capabilities',"
+                           "  'arguments': { 'capabilities': ["
+                           "    { 'capability': '%s', 'state': true } ] } }",
+                        capability));
+}
+
+static int find_free_port(void)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t len = sizeof(addr);
+    int fd;
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert(fd >= 0);
+    g_assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    g_assert(getsockname(fd, (struct sockaddr *)&addr, &len) == 0);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+/*
+ * Migrate while writing to the pages of the working set at the rate of
+ * @run, and return the last query-migrate result.  A write that lands
+ * after the source stopped for the final stage may or may not reach the
+ * target; since qtest cannot tell, such pages are marked unsure.
+ */
+static QDict *migrate(QTestState *from, const char *uri,
+                      const MigrationRun *run, double *dirty_rate)
+{
+    GTimer *timer = g_timer_new();
+    bool writing = true, postcopy = false;
+    int64_t written = 0;
+    const char *status;
+    QDict *info;
+    int i;
+
+    QDECREF(qmp_command(from, "{ 'execute': 'migrate',"
+                              "  'arguments': { 'uri': '%s' } }", uri));
+
+    for (;;) {
+        double elapsed = g_timer_elapsed(timer, NULL);
+
+        for (; writing && written < elapsed * run->dirty_rate; written++) {
+            i = written % WORKING_SET;
+            expected[i]++;
+            unsure[i] = true;
+            qtest_writeb(from, page_addr(i), expected[i]);
+        }
+        if (writing && vm_running(from)) {
+            memset(unsure, 0, sizeof(unsure));
+        } else {
+            writing = false;
+        }
+
+        info = qmp_command(from, "{ 'execute': 'query-migrate' }");
+        status = qdict_get_str(info, "status");
+        if (strcmp(status, "active") && strcmp(status, "setup")) {
+            break;
+        }
+        if (run->postcopy && !postcopy && !strcmp(status, "active")) {
+            QDECREF(qmp_command(from,
+                                "{ 'execute': 'migrate-start-postcopy' }"));
+            postcopy = true;
+        }
+        if (elapsed > TIMEOUT) {
+            QDECREF(info);
+            QDECREF(qmp_command(from, "{ 'execute': 'migrate_cancel' }"));
+            info = qmp_command(from, "{ 'execute': 'query-migrate' }");
+            qdict_put(info, "status", qstring_from_str("timeout"));
+            break;
+        }
+        QDECREF(info);
+        g_usleep(1000);
+    }
+
+    *dirty_rate = written / g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    return info;
+}
+
+static QDict *migration_run(const MigrationRun *run)
+{
+    QTestState *from, *to;
+    char *uri, *args;
+    double dirty_rate;
+    QDict *info;
+    int i;
+
+    uri = g_strdup_printf("tcp:127.0.0.1:%d", find_free_port());
+    args = g_strdup_printf("-m %d -incoming %s", RAM_MB, uri);
+    to = qtest_init(args);
+    g_free(args);
+    args = g_strdup_printf("-m %d", RAM_MB);
+    from = qtest_init(args);
+    g_free(args);
+
+    if (run->capability) {
+        set_capability(from, run->capability);
+        set_capability(to, run->capability);
+    }
+    QDECREF(qmp_command(from, "{ 'execute': 'migrate_set_speed',"
+                              "  'arguments': { 'value': %" PRId64 " } }",
+                        run->max_bandwidth));
+
+    /* Every page starts out non-zero, so that the first pass sends them */
+    memset(expected, 1, sizeof(expected));
+    memset(unsure, 0, sizeof(unsure));
+    for (i = 0; i < NB_PAGES; i++) {
+        qtest_writeb(from, page_addr(i), expected[i]);
+    }
+
+    info = migrate(from, uri, run, &dirty_rate);
+    qdict_put(info, "capability",
+              qstring_from_str(run->capability ?: "none"));
+    qdict_put(info, "dirty-rate", qint_from_int(run->dirty_rate));
+    qdict_put(info, "achieved-dirty-rate", qfloat_from_double(dirty_rate));
+
+    if (run->check) {
+        g_assert_cmpstr(qdict_get_str(info, "status"), ==, "completed");
+        for (i = 0; i < 10 * 1000 && !vm_running(to); i++) {
+            g_usleep(1000);
+        }
+        g_assert(vm_running(to));
+        for (i = 0; i < NB_PAGES; i++) {
+            if (!unsure[i]) {
+                g_assert_cmphex(qtest_readb(to, page_addr(i)), ==,
+                                expected[i]);
+            }
+        }
+    }
+
+    qtest_quit(from);
+    qtest_quit(to);
+    g_free(uri);
+    return info;
+}
+
+static void test_dirty(void)
+{
+    MigrationRun run = {
+        .dirty_rate = 1000,
+        .max_bandwidth = 1LL << 30,
+        .check = true,
+    };
+
+    QDECREF(migration_run(&run));
+}
+
+static void test_compress(void)
+{
+    MigrationRun run = {
+        .capability = "compress",
+        .dirty_rate = 1000,
+        .max_bandwidth = 1LL << 30,
+        .check = true,
+    };
+
+    QDECREF(migration_run(&run));
+}
+
+static void test_multifd(void)
+{
+    MigrationRun run = {
+        .capability = "multifd",
+        .dirty_rate = 1000,
+        .max_bandwidth = 1LL << 30,
+        .check = true,
+    };
+
+    QDECREF(migration_run(&run));
+}
+
+/* The first pass is slow enough for most pages to come after the switch */
+static void test_postcopy(void)
+{
+    MigrationRun run = {
+        .capability = "postcopy-ram",
+        .dirty_rate = 1000,
+        .max_bandwidth = 32LL << 20,
+        .check = true,
+        .postcopy = true,
+    };
+
+    QDECREF(migration_run(&run));
+}
+
+static bool userfaultfd_available(void)
+{
+#ifdef __NR_userfaultfd
+    int fd = syscall(__NR_userfaultfd, O_CLOEXEC);
+
+    if (fd >= 0) {
+        close(fd);
+        return true;
+    }
+#endif
+    return false;
+}
+
+/* Each feature at each dirty rate, limited to 256MB/s */
+static void perf_migration(void)
+{
+    static const char *capabilities[] = {
+        NULL, "xbzrle", "compress", "multifd",
+    };
+    static const int dirty_rates[] = { 0, 2000, 10000 };
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(capabilities); i++) {
+        for (j = 0; j < ARRAY_SIZE(dirty_rates); j++) {
+            MigrationRun run = {
+                .capability = capabilities[i],
+                .dirty_rate = dirty_rates[j],
+                .max_bandwidth = 256LL << 20,
+            };
+            QDict *info = migration_run(&run);
+            QString *json = qobject_to_json(QOBJECT(info));
+
+            g_test_message("%s", qstring_get_str(json));
+            QDECREF(json);
+            QDECREF(info);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/migration/dirty", test_dirty);
+    qtest_add_func("/migration/compress", test_compress);
+    qtest_add_func("/migration/multifd", test_multifd);
+    if (userfaultfd_available()) {
+        qtest_add_func("/migration/postcopy", test_postcopy);
+    }
+    if (g_test_perf()) {
+        qtest_add_func("/migration/perf", perf_migration);
+    }
+    return g_test_run();
+}
@@ -0,0 +1,104 @@
+#!/bin/bash
+#
+# Migrate a guest to a second QEMU on this host over Soft-RoCE and report
+# the throughput and downtime of the RDMA migration.
+#
+# Needs root, the rdma_rxe module, the "rdma" tool of iproute2 and socat.
+# The guest is a boot sector that writes to every page of its 1GB of RAM,
+# then keeps dirtying the first 64MB.
+#
+# Usage: rxe-loopback.sh [netdev]
+#
+#   QEMU        binary to run (default: ../../x86_64-softmmu/qemu-system-x86_64)
+#   PIN_ALL     "on" to pin all memory up front (default: off)
+#   PINNED_MAX  rdma-pinned-max, in MB (default: 0, no limit)
+#   DOWNTIME    maximum downtime, in seconds (default: 1)
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+
+QEMU=${QEMU:-"../../x86_64-softmmu/qemu-system-x86_64"}
+PIN_ALL=${PIN_ALL:-off}
+PINNED_MAX=${PINNED_MAX:-0}
+DOWNTIME=${DOWNTIME:-1}
+PORT=4444
+
+netdev=${1:-$(ip route show default | sed -n 's/.* dev \([^ ]*\).*/\1/p' | head -1)}
+ip=$(ip -4 -o addr show dev "$netdev" | sed -n 's/.* inet \([0-9.]*\).*/\1/p' | head -1)
+if [ -z "$ip" ]; then
+    echo "no IPv4 address on '$netdev'" >&2
+    exit 1
+fi
+
+dir=$(mktemp -d)
+rxe=
+cleanup() {
+    kill $src_pid $dst_pid 2>/dev/null
+    wait 2>/dev/null
+    [ -n "$rxe" ] && rdma link delete "$rxe"
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+
+modprobe rdma_rxe || exit 1
+if ! rdma link show | grep -q "netdev $netdev\b"; then
+    rxe=rxe_qemu
+    rdma link add $rxe type rxe netdev "$netdev" || exit 1
+fi
+
+# 16-bit boot sector: enter flat protected mode, increment a byte of each
+# page from 1MB to 1008MB, then loop over 1MB to 65MB.
+printf '\xfa\x31\xc0\x8e\xd8\xe4\x92\x0c\x02\xe6\x92\x66\x0f\x01\x16\x70'\
+'\x7c\x0f\x20\xc0\x66\x83\xc8\x01\x0f\x22\xc0\x66\xea\x23\x7c\x00'\
+'\x00\x08\x00\x66\xb8\x10\x00\x8e\xd8\xb8\x00\x00\x10\x00\xfe\x00'\
+'\x05\x00\x10\x00\x00\x3d\x00\x00\x00\x3f\x72\xf2\xb8\x00\x00\x10'\
+'\x00\xfe\x00\x05\x00\x10\x00\x00\x3d\x00\x00\x10\x04\x72\xf2\xeb'\
+'\xeb\x8d\xb4\x26\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00'\
+'\xff\xff\x00\x00\x00\x9a\xcf\x00\xff\xff\x00\x00\x00\x92\xcf\x00'\
+'\x17\x00\x58\x7c\x00\x00' > "$dir/boot.img"
+truncate -s 510 "$dir/boot.img"
+printf '\x55\xaa' >> "$dir/boot.img"
+
+hmp() {
+    echo "$2" | socat - "unix-connect:$dir/$1.mon"
+}
+
+run_qemu() {
+    local name=$1
+    shift
+
+    $QEMU -machine accel=kvm:tcg -m 1024 -display none \
+        -drive file="$dir/boot.img",format=raw,if=ide \
+        -monitor unix:"$dir/$name.mon",server,nowait "$@" \
+        > "$dir/$name.log" 2>&1 &
+}
+
+run_qemu dst -incoming rdma:$ip:$PORT
+dst_pid=$!
+run_qemu src
+src_pid=$!
+sleep 2
+
+hmp src "migrate_set_capability rdma-pin-all $PIN_ALL" > /dev/null
+hmp src "migrate_set_parameter rdma-pinned-max $PINNED_MAX" > /dev/null
+hmp src "migrate_set_downtime $DOWNTIME" > /dev/null
+hmp src "migrate_set_speed 100g" > /dev/null
+hmp src "migrate -d rdma:$ip:$PORT" > /dev/null
+
+for i in $(seq 600); do
+    info=$(hmp src "info migrate")
+    case "$info" in
+    *"status: completed"*|*"status: failed"*|*"status: cancelled"*)
+        break;;
+    esac
+    sleep 0.5
+done
+
+echo "rdma-pin-all $PIN_ALL, rdma-pinned-max $PINNED_MAX MB over $netdev ($ip)"
+echo "$info" | grep -E "status:|total time:|downtime:|transferred ram:|throughput:"
+if ! echo "$info" | grep -q "status: completed" ||
+   ! hmp dst "info status" | grep -q "running"; then
+    echo "migration failed, see the QEMU output:" >&2
+    cat "$dir/src.log" "$dir/dst.log" >&2
+    exit 1
+fi
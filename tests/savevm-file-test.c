@@ -0,0 +1,98 @@
+/*
+ * savevm_file/loadvm_file round trips
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libqtest.h"
+#include "qemu-common.h"
+
+#define START_ADDR      (1 << 20)
+#define PAGE_SIZE       4096
+#define NB_PAGES        256
+
+static uint64_t page_addr(int page)
+{
+    return START_ADDR + (uint64_t)page * PAGE_SIZE;
+}
+
+static void hmp(const char *fmt, const char *arg)
+{
+    char *cmd = g_strdup_printf(fmt, arg);
+    QDict *response;
+
+    response = qmp("{ 'execute': 'human-monitor-command',"
+                   "  'arguments': { 'command-line': '%s' } }", cmd);
+    g_assert(response);
+    g_assert_cmpstr(qdict_get_try_str(response, "return"), ==, "");
+    QDECREF(response);
+    g_free(cmd);
+}
+
+/* Every third page stays zero, so the image has holes */
+static void write_pages(uint8_t *expected, uint8_t seed)
+{
+    int i;
+
+    for (i = 0; i < NB_PAGES; i++) {
+        expected[i] = i % 3 ? seed + i : 0;
+        writeb(page_addr(i), expected[i]);
+        writeb(page_addr(i) + PAGE_SIZE - 1, expected[i]);
+    }
+}
+
+static void check_pages(const uint8_t *expected)
+{
+    int i;
+
+    for (i = 0; i < NB_PAGES; i++) {
+        g_assert_cmphex(readb(page_addr(i)), ==, expected[i]);
+        g_assert_cmphex(readb(page_addr(i) + PAGE_SIZE - 1), ==, expected[i]);
+    }
+}
+
+/*
+ * Save, clobber RAM and restore twice to the same file.  The second save
+ * is done while guest RAM is still mapped from the first image.
+ */
+static void test_round_trip(void)
+{
+    char *filename = g_strdup_printf("/tmp/savevm-file-test-%d",
+                                     (int)getpid());
+    char *ram_filename = g_strdup_printf("%s.ram", filename);
+    uint8_t expected[NB_PAGES];
+    uint8_t clobbered[NB_PAGES];
+
+    qtest_start("-m 16");
+
+    write_pages(expected, 1);
+    hmp("savevm_file %s", filename);
+    write_pages(clobbered, 0x80);
+    hmp("loadvm_file %s", filename);
+    check_pages(expected);
+
+    write_pages(expected, 0x40);
+    hmp("savevm_file %s", filename);
+    check_pages(expected);
+    write_pages(clobbered, 0xc0);
+    hmp("loadvm_file %s", filename);
+    check_pages(expected);
+
+    qtest_end();
+    unlink(filename);
+    unlink(ram_filename);
+    g_free(filename);
+    g_free(ram_filename);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/savevm-file/round-trip", test_round_trip);
+    return g_test_run();
+}
@@ -0,0 +1,2 @@
+/* Stand-in for the per-target config-target.h, so that fpu/softfloat.c can
+ * be built for tests/test-softfloat with the default NaN conventions.  */
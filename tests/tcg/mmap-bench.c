@@ -0,0 +1,92 @@
+/*
+ * Allocator-like mmap/munmap/mprotect workload, to time the page
+ * bookkeeping of linux-user.  Run it natively and under qemu and
+ * compare.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#define LIVE_MAPPINGS 512
+#define MAX_PAGES 64
+
+static void *maps[LIVE_MAPPINGS];
+static size_t sizes[LIVE_MAPPINGS];
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 200000;
+    size_t pagesize = getpagesize();
+    unsigned int seed = 1;
+    int fds[2];
+    char buf[256];
+    double start, elapsed;
+    long i;
+
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    start = now();
+    for (i = 0; i < iterations; i++) {
+        int slot = rand_r(&seed) % LIVE_MAPPINGS;
+        char *p;
+
+        if (maps[slot]) {
+            munmap(maps[slot], sizes[slot]);
+        }
+
+        sizes[slot] = (1 + rand_r(&seed) % MAX_PAGES) * pagesize;
+        p = mmap(NULL, sizes[slot], PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            return 1;
+        }
+        maps[slot] = p;
+        p[0] = 1;
+
+        /* Guard page at the end, as thread stacks and arenas do */
+        if (sizes[slot] > pagesize) {
+            mprotect(p + sizes[slot] - pagesize, pagesize, PROT_NONE);
+        }
+
+        /* System calls check the guest buffers they are given */
+        if (write(fds[1], p, sizeof(buf)) != sizeof(buf) ||
+            read(fds[0], buf, sizeof(buf)) != sizeof(buf)) {
+            perror("pipe I/O");
+            return 1;
+        }
+    }
+    elapsed = now() - start;
+
+    printf("%ld iterations in %.3f s (%.2f us each)\n",
+           iterations, elapsed, elapsed * 1e6 / iterations);
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Branchy integer workload, to time -tb-trace.  The loop body is many
+ * small blocks joined by forward jumps, each setting flags that the next
+ * block mostly overwrites.  Run it under qemu with and without -tb-trace
+ * and compare.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* A small bytecode interpreter: its dispatch and operand checks are the
+   kind of short, always-taken paths that traces straighten out.  */
+static unsigned int run(const unsigned char *code, int len, unsigned int x)
+{
+    unsigned int acc = x, tmp = 0;
+    int pc;
+
+    for (pc = 0; pc < len; pc++) {
+        switch (code[pc] & 7) {
+        case 0:
+            acc += tmp;
+            break;
+        case 1:
+            acc ^= acc >> 3;
+            break;
+        case 2:
+            if (acc & 1) {
+                acc = acc * 3 + 1;
+            } else {
+                acc >>= 1;
+            }
+            break;
+        case 3:
+            tmp = acc < tmp ? tmp - acc : acc - tmp;
+            break;
+        case 4:
+            acc = (acc << 5) | (acc >> 27);
+            break;
+        case 5:
+            if (acc > 0x80000000u) {
+                acc -= 0x12345;
+            }
+            break;
+        case 6:
+            tmp += code[pc];
+            break;
+        default:
+            acc = ~acc;
+            break;
+        }
+    }
+    return acc;
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 200000;
+    unsigned char code[256];
+    unsigned int seed = 1, result = 0;
+    double start, elapsed;
+    long i;
+
+    for (i = 0; i < sizeof(code); i++) {
+        code[i] = rand_r(&seed);
+    }
+
+    start = now();
+    for (i = 0; i < iterations; i++) {
+        result = run(code, sizeof(code), result + i);
+    }
+    elapsed = now() - start;
+
+    printf("%ld iterations in %.3f s (%.2f us each), result %08x\n",
+           iterations, elapsed, elapsed * 1e6 / iterations, result);
+    return 0;
+}
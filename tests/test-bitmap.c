@@ -0,0 +1,121 @@
+/*
+ * Test bitmap routines
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include "qemu/bitmap.h"
+
+#define TEST_BITS 300
+
+static void check_range(unsigned long *map, long start, long nr)
+{
+    long i;
+
+    for (i = 0; i < TEST_BITS; i++) {
+        g_assert_cmpint(test_bit(i, map), ==, i >= start && i < start + nr);
+    }
+}
+
+static void test_set_atomic(void)
+{
+    unsigned long *map = bitmap_new(TEST_BITS);
+    long start, nr;
+
+    for (start = 0; start < 140; start += 7) {
+        for (nr = 1; start + nr <= TEST_BITS; nr += 13) {
+            bitmap_zero(map, TEST_BITS);
+            bitmap_set_atomic(map, start, nr);
+            check_range(map, start, nr);
+        }
+    }
+    g_free(map);
+}
+
+static void test_test_and_clear_atomic(void)
+{
+    unsigned long *map = bitmap_new(TEST_BITS);
+    long start, nr;
+
+    for (start = 0; start < 140; start += 7) {
+        for (nr = 1; start + nr <= TEST_BITS; nr += 13) {
+            /* Only the bits just outside the range are set */
+            bitmap_zero(map, TEST_BITS);
+            if (start > 0) {
+                set_bit(start - 1, map);
+            }
+            if (start + nr < TEST_BITS) {
+                set_bit(start + nr, map);
+            }
+            g_assert(!bitmap_test_and_clear_atomic(map, start, nr));
+
+            /* Everything set: the range is cleared, the rest is kept */
+            bitmap_fill(map, TEST_BITS);
+            g_assert(bitmap_test_and_clear_atomic(map, start, nr));
+            bitmap_complement(map, map, TEST_BITS);
+            check_range(map, start, nr);
+
+            /* Only the last bit of the range set */
+            bitmap_zero(map, TEST_BITS);
+            set_bit(start + nr - 1, map);
+            g_assert(bitmap_test_and_clear_atomic(map, start, nr));
+            g_assert(bitmap_empty(map, TEST_BITS));
+        }
+    }
+    g_free(map);
+}
+
+/* Cost of a dirty bitmap sync with a few dirty pages, by guest RAM size
+ * (4 KiB pages), scanning page by page versus a word at a time.
+ */
+static void perf_test_and_clear(void)
+{
+    long gb, pages, i, found;
+    unsigned long *map;
+    double duration;
+    int word;
+
+    for (gb = 1; gb <= 64; gb *= 4) {
+        pages = gb << (30 - 12);
+        map = bitmap_new(pages);
+
+        for (word = 0; word <= 1; word++) {
+            for (i = 0; i < pages; i += 4099) {
+                set_bit(i, map);
+            }
+            found = 0;
+            g_test_timer_start();
+            if (word) {
+                found = bitmap_test_and_clear_atomic(map, 0, pages);
+            } else {
+                for (i = 0; i < pages; i++) {
+                    if (test_bit(i, map)) {
+                        clear_bit(i, map);
+                        found++;
+                    }
+                }
+            }
+            duration = g_test_timer_elapsed();
+            g_assert(found);
+            g_assert(bitmap_empty(map, pages));
+            g_test_message("%3ld GiB (%s): %.2f ms", gb,
+                           word ? "word" : "page", duration * 1000);
+        }
+        g_free(map);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/bitmap/set_atomic", test_set_atomic);
+    g_test_add_func("/bitmap/test_and_clear_atomic",
+                    test_test_and_clear_atomic);
+    if (g_test_perf()) {
+        g_test_add_func("/bitmap/perf/test_and_clear", perf_test_and_clear);
+    }
+    return g_test_run();
+}
@@ -0,0 +1,216 @@
+/*
+ * Test interval trees
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include "qemu-common.h"
+#include "qemu/interval-tree.h"
+
+#define NR_NODES 1000
+#define MAX_VALUE 10000
+
+static IntervalTreeNode nodes[NR_NODES];
+static bool in_tree[NR_NODES];
+
+/* Check the red-black and augmentation invariants; return the black
+ * height of the subtree.
+ */
+static int check_subtree(IntervalTreeNode *node, IntervalTreeNode *parent)
+{
+    uint64_t max;
+    int left, right;
+
+    if (!node) {
+        return 1;
+    }
+    g_assert(node->parent == parent);
+    if (node->red) {
+        g_assert(!node->left || !node->left->red);
+        g_assert(!node->right || !node->right->red);
+    }
+    if (node->left) {
+        g_assert_cmpint(node->left->start, <=, node->start);
+    }
+    if (node->right) {
+        g_assert_cmpint(node->right->start, >=, node->start);
+    }
+
+    max = node->last;
+    if (node->left && node->left->subtree_last > max) {
+        max = node->left->subtree_last;
+    }
+    if (node->right && node->right->subtree_last > max) {
+        max = node->right->subtree_last;
+    }
+    g_assert_cmpint(node->subtree_last, ==, max);
+
+    left = check_subtree(node->left, node);
+    right = check_subtree(node->right, node);
+    g_assert_cmpint(left, ==, right);
+    return left + !node->red;
+}
+
+static void check_tree(IntervalTreeRoot *root)
+{
+    g_assert(!root->root || !root->root->red);
+    check_subtree(root->root, NULL);
+}
+
+static int cmp_node(const void *a, const void *b)
+{
+    const IntervalTreeNode *na = *(IntervalTreeNode * const *)a;
+    const IntervalTreeNode *nb = *(IntervalTreeNode * const *)b;
+
+    return na->start < nb->start ? -1 : na->start > nb->start;
+}
+
+/* The iteration must return exactly the overlapping nodes, by start */
+static void check_query(IntervalTreeRoot *root, uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *expected[NR_NODES];
+    IntervalTreeNode *node;
+    int i, n = 0, found = 0;
+
+    for (i = 0; i < NR_NODES; i++) {
+        if (in_tree[i] && nodes[i].start <= last && start <= nodes[i].last) {
+            expected[n++] = &nodes[i];
+        }
+    }
+    qsort(expected, n, sizeof(expected[0]), cmp_node);
+
+    for (node = interval_tree_iter_first(root, start, last); node;
+         node = interval_tree_iter_next(node, start, last)) {
+        g_assert_cmpint(found, <, n);
+        g_assert_cmpint(node->start, ==, expected[found]->start);
+        g_assert(node->start <= last && start <= node->last);
+        found++;
+    }
+    g_assert_cmpint(found, ==, n);
+}
+
+static void test_random(void)
+{
+    IntervalTreeRoot root = { NULL };
+    GRand *rand = g_rand_new_with_seed(1);
+    uint64_t start, last;
+    int i, j;
+
+    for (i = 0; i < 20 * NR_NODES; i++) {
+        j = g_rand_int_range(rand, 0, NR_NODES);
+        if (in_tree[j]) {
+            interval_tree_remove(&nodes[j], &root);
+            in_tree[j] = false;
+        } else {
+            nodes[j].start = g_rand_int_range(rand, 0, MAX_VALUE);
+            nodes[j].last = nodes[j].start + g_rand_int_range(rand, 0, 100);
+            interval_tree_insert(&nodes[j], &root);
+            in_tree[j] = true;
+        }
+
+        if (i % 100 == 0) {
+            check_tree(&root);
+            start = g_rand_int_range(rand, 0, MAX_VALUE);
+            last = start + g_rand_int_range(rand, 0, 200);
+            check_query(&root, start, last);
+        }
+    }
+
+    check_tree(&root);
+    check_query(&root, 0, UINT64_MAX);
+    for (j = 0; j < NR_NODES; j++) {
+        if (in_tree[j]) {
+            interval_tree_remove(&nodes[j], &root);
+            in_tree[j] = false;
+        }
+    }
+    g_assert(root.root == NULL);
+    g_rand_free(rand);
+}
+
+static void test_edges(void)
+{
+    IntervalTreeRoot root = { NULL };
+    IntervalTreeNode a = { .start = 0, .last = 9 };
+    IntervalTreeNode b = { .start = 10, .last = UINT64_MAX };
+
+    g_assert(interval_tree_iter_first(&root, 0, UINT64_MAX) == NULL);
+
+    interval_tree_insert(&a, &root);
+    interval_tree_insert(&b, &root);
+    g_assert(interval_tree_iter_first(&root, 9, 9) == &a);
+    g_assert(interval_tree_iter_first(&root, 10, 10) == &b);
+    g_assert(interval_tree_iter_first(&root, UINT64_MAX, UINT64_MAX) == &b);
+    g_assert(interval_tree_iter_first(&root, 5, 15) == &a);
+    g_assert(interval_tree_iter_next(&a, 5, 15) == &b);
+    g_assert(interval_tree_iter_next(&a, 5, 9) == NULL);
+
+    interval_tree_remove(&a, &root);
+    g_assert(interval_tree_iter_first(&root, 0, 9) == NULL);
+    interval_tree_remove(&b, &root);
+    g_assert(root.root == NULL);
+}
+
+/* Lookups in a tree of disjoint page ranges, like the page flags of a
+ * process with many mappings.
+ */
+static void perf_lookup(void)
+{
+    IntervalTreeRoot root = { NULL };
+    IntervalTreeNode *map;
+    GRand *rand = g_rand_new_with_seed(1);
+    double duration;
+    long n, i, found;
+
+    for (n = 1024; n <= 1024 * 1024; n *= 32) {
+        map = g_new(IntervalTreeNode, n);
+        for (i = 0; i < n; i++) {
+            map[i].start = i * 16;
+            map[i].last = i * 16 + 7;
+        }
+
+        g_test_timer_start();
+        for (i = 0; i < n; i++) {
+            interval_tree_insert(&map[i], &root);
+        }
+        duration = g_test_timer_elapsed();
+        g_test_message("%7ld intervals: insert %.1f ns", n,
+                       duration * 1e9 / n);
+
+        found = 0;
+        g_test_timer_start();
+        for (i = 0; i < 1000000; i++) {
+            uint64_t addr = g_rand_int_range(rand, 0, n * 16);
+
+            found += interval_tree_iter_first(&root, addr, addr) != NULL;
+        }
+        duration = g_test_timer_elapsed();
+        g_assert(found);
+        g_test_message("%7ld intervals: lookup %.1f ns", n, duration * 1e3);
+
+        g_test_timer_start();
+        for (i = 0; i < n; i++) {
+            interval_tree_remove(&map[i], &root);
+        }
+        duration = g_test_timer_elapsed();
+        g_test_message("%7ld intervals: remove %.1f ns", n,
+                       duration * 1e9 / n);
+        g_assert(root.root == NULL);
+        g_free(map);
+    }
+    g_rand_free(rand);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-tree/random", test_random);
+    g_test_add_func("/interval-tree/edges", test_edges);
+    if (g_test_perf()) {
+        g_test_add_func("/interval-tree/perf/lookup", perf_lookup);
+    }
+    return g_test_run();
+}
@@ -0,0 +1,134 @@
+/*
+ * RCU tests
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include <glib.h>
+#include "qemu-common.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+
+static void test_nesting(void)
+{
+    rcu_read_lock();
+    rcu_read_lock();
+    rcu_read_unlock();
+    g_assert(rcu_reader.ctr != 0);
+    rcu_read_unlock();
+    g_assert(rcu_reader.ctr == 0);
+
+    /* No reader is active, so this must not block */
+    synchronize_rcu();
+}
+
+static int reader_state;
+
+static void *long_reader(void *opaque)
+{
+    rcu_register_thread();
+    rcu_read_lock();
+    atomic_mb_set(&reader_state, 1);
+    g_usleep(100000);
+    atomic_mb_set(&reader_state, 2);
+    rcu_read_unlock();
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void test_synchronize(void)
+{
+    QemuThread thread;
+
+    reader_state = 0;
+    qemu_thread_create(&thread, "rcu-reader", long_reader, NULL,
+                       QEMU_THREAD_JOINABLE);
+    while (atomic_mb_read(&reader_state) == 0) {
+        g_usleep(1000);
+    }
+
+    /* The reader started before the grace period, wait for it */
+    synchronize_rcu();
+    g_assert_cmpint(atomic_mb_read(&reader_state), ==, 2);
+    qemu_thread_join(&thread);
+}
+
+#define MAGIC 0x12345678
+#define NR_READERS 4
+#define NR_UPDATES 2000
+
+typedef struct {
+    struct rcu_head rcu;
+    int magic;
+} Item;
+
+static Item *current_item;
+static int stop_readers;
+static int nr_freed;
+
+static void free_item(Item *item)
+{
+    item->magic = 0;
+    g_free(item);
+    atomic_fetch_inc(&nr_freed);
+}
+
+static void *item_reader(void *opaque)
+{
+    Item *item;
+
+    rcu_register_thread();
+    while (!atomic_mb_read(&stop_readers)) {
+        rcu_read_lock();
+        item = atomic_rcu_read(&current_item);
+        g_assert_cmpint(item->magic, ==, MAGIC);
+        rcu_read_unlock();
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void test_call_rcu(void)
+{
+    QemuThread threads[NR_READERS];
+    Item *item, *old;
+    int i;
+
+    current_item = g_new0(Item, 1);
+    current_item->magic = MAGIC;
+    stop_readers = 0;
+    nr_freed = 0;
+
+    for (i = 0; i < NR_READERS; i++) {
+        qemu_thread_create(&threads[i], "rcu-reader", item_reader, NULL,
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    for (i = 0; i < NR_UPDATES; i++) {
+        item = g_new0(Item, 1);
+        item->magic = MAGIC;
+        old = current_item;
+        atomic_rcu_set(&current_item, item);
+        call_rcu(old, free_item, rcu);
+    }
+
+    atomic_mb_set(&stop_readers, 1);
+    for (i = 0; i < NR_READERS; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    while (atomic_mb_read(&nr_freed) < NR_UPDATES) {
+        g_usleep(1000);
+    }
+    g_free(current_item);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/rcu/nesting", test_nesting);
+    g_test_add_func("/rcu/synchronize", test_synchronize);
+    g_test_add_func("/rcu/call_rcu", test_call_rcu);
+    return g_test_run();
+}
@@ -0,0 +1,207 @@
+/*
+ * Test the host FPU fast path of softfloat against the integer
+ * implementation
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include "fpu/softfloat.c"
+
+/* The fast path is only taken when the inexact flag is already set, so
+ * running each operation with and without it compares both paths.  */
+
+typedef float32 (*Float32Op)(float32 a, float32 b, float_status *s);
+typedef float64 (*Float64Op)(float64 a, float64 b, float_status *s);
+
+static float32 f32_sqrt(float32 a, float32 b, float_status *s)
+{
+    return float32_sqrt(a, s);
+}
+
+static float64 f64_sqrt(float64 a, float64 b, float_status *s)
+{
+    return float64_sqrt(a, s);
+}
+
+static const struct {
+    const char *name;
+    Float32Op f32;
+    Float64Op f64;
+} ops[] = {
+    { "add", float32_add, float64_add },
+    { "sub", float32_sub, float64_sub },
+    { "mul", float32_mul, float64_mul },
+    { "div", float32_div, float64_div },
+    { "sqrt", f32_sqrt, f64_sqrt },
+};
+
+static const uint32_t f32_edge[] = {
+    0x00000000, 0x80000000,             /* zeroes */
+    0x00000001, 0x007fffff, 0x807fffff, /* denormals */
+    0x00800000, 0x00800001, 0x80800000, /* smallest normals */
+    0x01000000, 0x1f800000, 0x20000000,
+    0x3f7fffff, 0x3f800000, 0x3f800001, 0xbf800000, 0x40000000,
+    0x40490fdb, 0x5f000000, 0x7e800000,
+    0x7f7ffffe, 0x7f7fffff, 0xff7fffff, /* largest normals */
+    0x7f800000, 0xff800000,             /* infinities */
+    0x7fc00000, 0x7f800001, 0xffc00001, /* NaNs */
+};
+
+static const uint64_t f64_edge[] = {
+    0x0000000000000000ULL, 0x8000000000000000ULL,
+    0x0000000000000001ULL, 0x000fffffffffffffULL, 0x800fffffffffffffULL,
+    0x0010000000000000ULL, 0x0010000000000001ULL, 0x8010000000000000ULL,
+    0x0020000000000000ULL, 0x1ff0000000000000ULL, 0x2000000000000000ULL,
+    0x3fefffffffffffffULL, 0x3ff0000000000000ULL, 0x3ff0000000000001ULL,
+    0xbff0000000000000ULL, 0x4000000000000000ULL, 0x400921fb54442d18ULL,
+    0x5fe0000000000000ULL, 0x7fd0000000000000ULL,
+    0x7feffffffffffffeULL, 0x7fefffffffffffffULL, 0xffefffffffffffffULL,
+    0x7ff0000000000000ULL, 0xfff0000000000000ULL,
+    0x7ff8000000000000ULL, 0x7ff0000000000001ULL, 0xfff8000000000001ULL,
+};
+
+#define RANDOM_ITERATIONS 200000
+
+static void check_f32(Float32Op fn, uint32_t a, uint32_t b)
+{
+    float_status soft = { 0 }, fast = { 0 };
+    float32 r_soft, r_fast;
+
+    fast.float_exception_flags = float_flag_inexact;
+    r_soft = fn(make_float32(a), make_float32(b), &soft);
+    r_fast = fn(make_float32(a), make_float32(b), &fast);
+    g_assert_cmphex(float32_val(r_soft), ==, float32_val(r_fast));
+    g_assert_cmphex((uint8_t)(soft.float_exception_flags | float_flag_inexact),
+                    ==, (uint8_t)fast.float_exception_flags);
+}
+
+static void check_f64(Float64Op fn, uint64_t a, uint64_t b)
+{
+    float_status soft = { 0 }, fast = { 0 };
+    float64 r_soft, r_fast;
+
+    fast.float_exception_flags = float_flag_inexact;
+    r_soft = fn(make_float64(a), make_float64(b), &soft);
+    r_fast = fn(make_float64(a), make_float64(b), &fast);
+    g_assert_cmphex(float64_val(r_soft), ==, float64_val(r_fast));
+    g_assert_cmphex((uint8_t)(soft.float_exception_flags | float_flag_inexact),
+                    ==, (uint8_t)fast.float_exception_flags);
+}
+
+/* Random values, half of them with an exponent close to the bias so that
+ * the results are mostly normal and the fast path is exercised.  */
+static uint32_t random_f32(void)
+{
+    uint32_t x = g_test_rand_int();
+
+    if (x & 1) {
+        x = (x & 0x807fffff) | ((uint32_t)g_test_rand_int_range(97, 158) << 23);
+    }
+    return x;
+}
+
+static uint64_t random_f64(void)
+{
+    uint64_t x = ((uint64_t)g_test_rand_int() << 32) | g_test_rand_int();
+
+    if (x & 1) {
+        x = (x & 0x800fffffffffffffULL)
+            | ((uint64_t)g_test_rand_int_range(991, 1056) << 52);
+    }
+    return x;
+}
+
+static void test_f32_edge(void)
+{
+    int i, j, k;
+
+    for (k = 0; k < ARRAY_SIZE(ops); k++) {
+        for (i = 0; i < ARRAY_SIZE(f32_edge); i++) {
+            for (j = 0; j < ARRAY_SIZE(f32_edge); j++) {
+                check_f32(ops[k].f32, f32_edge[i], f32_edge[j]);
+            }
+        }
+    }
+}
+
+static void test_f64_edge(void)
+{
+    int i, j, k;
+
+    for (k = 0; k < ARRAY_SIZE(ops); k++) {
+        for (i = 0; i < ARRAY_SIZE(f64_edge); i++) {
+            for (j = 0; j < ARRAY_SIZE(f64_edge); j++) {
+                check_f64(ops[k].f64, f64_edge[i], f64_edge[j]);
+            }
+        }
+    }
+}
+
+static void test_f32_random(void)
+{
+    int i, k;
+
+    for (k = 0; k < ARRAY_SIZE(ops); k++) {
+        for (i = 0; i < RANDOM_ITERATIONS; i++) {
+            check_f32(ops[k].f32, random_f32(), random_f32());
+        }
+    }
+}
+
+static void test_f64_random(void)
+{
+    int i, k;
+
+    for (k = 0; k < ARRAY_SIZE(ops); k++) {
+        for (i = 0; i < RANDOM_ITERATIONS; i++) {
+            check_f64(ops[k].f64, random_f64(), random_f64());
+        }
+    }
+}
+
+#define PERF_COUNT 1000000
+
+static void perf_f64(void)
+{
+    static uint64_t in[1024];
+    float_status st = { 0 };
+    float64 acc;
+    double duration;
+    int i, k, fast;
+
+    for (i = 0; i < ARRAY_SIZE(in); i++) {
+        in[i] = ((uint64_t)g_test_rand_int_range(1013, 1034) << 52)
+                | (((uint64_t)g_test_rand_int() << 20) & 0x000fffffffffffffULL);
+    }
+    for (k = 0; k < ARRAY_SIZE(ops); k++) {
+        for (fast = 0; fast <= 1; fast++) {
+            acc = make_float64(0);
+            g_test_timer_start();
+            for (i = 0; i < PERF_COUNT; i++) {
+                st.float_exception_flags = fast ? float_flag_inexact : 0;
+                acc = ops[k].f64(make_float64(in[i & 1023]),
+                                 make_float64(in[(i + 1) & 1023]), &st);
+            }
+            duration = g_test_timer_elapsed();
+            g_test_message("float64_%s (%s): %.1f Mops/s (last %016" PRIx64
+                           ")", ops[k].name, fast ? "host" : "softfloat",
+                           PERF_COUNT / duration / 1e6, float64_val(acc));
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/softfloat/float32/edge", test_f32_edge);
+    g_test_add_func("/softfloat/float64/edge", test_f64_edge);
+    g_test_add_func("/softfloat/float32/random", test_f32_random);
+    g_test_add_func("/softfloat/float64/random", test_f64_random);
+    if (g_test_perf()) {
+        g_test_add_func("/softfloat/perf/float64", perf_f64);
+    }
+    return g_test_run();
+}
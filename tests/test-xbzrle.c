@@ -19,6 +19,7 @@
 #include <assert.h>
 #include "qemu-common.h"
 #include "include/migration/migration.h"
+#include "include/migration/page_cache.h"
 
 #define PAGE_SIZE 4096
 
@@ -179,6 +180,199 @@ static void test_encode_decode(void)
     }
 }
 
+/* Byte at a time version of the encoder, which the vector ones must match */
+static int encode_reference(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                            uint8_t *dst, int dlen)
+{
+    int d = 0, i = 0, start;
+
+    while (i < slen) {
+        if (d + 2 > dlen) {
+            return -1;
+        }
+        for (start = i; i < slen && old_buf[i] == new_buf[i]; i++) {
+        }
+        if (i - start == slen) {
+            return 0;
+        }
+        if (i == slen) {
+            return d;
+        }
+        d += uleb128_encode_small(dst + d, i - start);
+        if (d + 2 > dlen) {
+            return -1;
+        }
+        for (start = i; i < slen && old_buf[i] != new_buf[i]; i++) {
+        }
+        d += uleb128_encode_small(dst + d, i - start);
+        if (d + i - start > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + start, i - start);
+        d += i - start;
+    }
+    return d;
+}
+
+/* Change @nr_runs runs of up to @max_len bytes of @page, at random */
+static void dirty_page(uint8_t *page, int nr_runs, int max_len)
+{
+    int i, j;
+
+    for (i = 0; i < nr_runs; i++) {
+        int len = g_test_rand_int_range(1, max_len + 1);
+        int start = g_test_rand_int_range(0, PAGE_SIZE - len + 1);
+
+        for (j = start; j < start + len; j++) {
+            page[j] ^= g_test_rand_int_range(1, 256);
+        }
+    }
+}
+
+static void test_encode_reference(void)
+{
+    uint8_t *old = g_malloc(PAGE_SIZE);
+    uint8_t *new = g_malloc(PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    uint8_t *expected = g_malloc(PAGE_SIZE);
+    int i, j, dlen, elen;
+
+    for (i = 0; i < 2000; i++) {
+        int slen = PAGE_SIZE - 8 * g_test_rand_int_range(0, 4);
+
+        for (j = 0; j < PAGE_SIZE; j++) {
+            old[j] = g_test_rand_int_range(0, 4);
+        }
+        memcpy(new, old, PAGE_SIZE);
+        dirty_page(new, g_test_rand_int_range(0, 64),
+                   g_test_rand_int_range(1, 128));
+
+        /* small dlen too, for the overflow checks */
+        dlen = g_test_rand_int_range(2, PAGE_SIZE / 2) & ~1;
+        if (i % 2) {
+            dlen = PAGE_SIZE;
+        }
+        elen = encode_reference(old, new, slen, expected, dlen);
+        g_assert_cmpint(xbzrle_encode_buffer(old, new, slen, compressed,
+                                             dlen), ==, elen);
+        if (elen > 0) {
+            g_assert(memcmp(compressed, expected, elen) == 0);
+            g_assert_cmpint(xbzrle_decode_buffer(compressed, elen, old,
+                                                 slen), <=, slen);
+            g_assert(memcmp(old, new, slen) == 0);
+        }
+    }
+
+    g_free(old);
+    g_free(new);
+    g_free(compressed);
+    g_free(expected);
+}
+
+static void test_page_cache(void)
+{
+    uint8_t page[PAGE_SIZE];
+    PageCache *cache = cache_init(64, PAGE_SIZE);
+    uint64_t addr;
+    int hits;
+
+    /* a full cache keeps the pages used last */
+    for (addr = 0; addr < 1024 * PAGE_SIZE; addr += PAGE_SIZE) {
+        memset(page, addr / PAGE_SIZE, PAGE_SIZE);
+        g_assert_cmpint(cache_insert(cache, addr, page), ==, 0);
+        g_assert(cache_is_cached(cache, addr));
+        g_assert(get_cached_data(cache, addr)[0] == (uint8_t)(addr /
+                                                              PAGE_SIZE));
+        if (addr >= PAGE_SIZE) {
+            get_cached_data(cache, 0);
+            g_assert(cache_is_cached(cache, 0));
+        }
+    }
+
+    /* which a power-of-two stride doesn't get to evict early */
+    hits = 0;
+    for (addr = 0; addr < 64 * PAGE_SIZE * 16; addr += PAGE_SIZE * 16) {
+        g_assert_cmpint(cache_insert(cache, addr, page), ==, 0);
+    }
+    for (addr = 0; addr < 64 * PAGE_SIZE * 16; addr += PAGE_SIZE * 16) {
+        hits += cache_is_cached(cache, addr);
+    }
+    g_assert_cmpint(hits, >=, 32);
+
+    g_assert_cmpint(cache_resize(cache, 16), ==, 16);
+    g_assert(cache_is_cached(cache, (64 - 1) * PAGE_SIZE * 16));
+    g_assert_cmpint(cache_resize(cache, 256), ==, 256);
+    g_assert(cache_is_cached(cache, (64 - 1) * PAGE_SIZE * 16));
+
+    cache_fini(cache);
+    g_free(cache);
+}
+
+/* Encoder and decoder throughput, for pages dirtied as a guest does */
+#define PERF_PAGES 256
+
+static void perf_encode_decode(void)
+{
+    static const struct {
+        const char *name;
+        int nr_runs, max_len;
+    } loads[] = {
+        { "unchanged", 0, 1 },
+        { "one word", 1, 8 },
+        { "sparse", 16, 8 },
+        { "dense", 64, 32 },
+    };
+    const int nr_pages = PERF_PAGES, iterations = 40;
+    uint8_t *old = g_malloc(nr_pages * PAGE_SIZE);
+    uint8_t *new = g_malloc(nr_pages * PAGE_SIZE);
+    uint8_t *compressed = g_malloc(nr_pages * PAGE_SIZE);
+    int lens[PERF_PAGES];
+    double duration, mbytes;
+    int i, j, k;
+
+    mbytes = (double)nr_pages * PAGE_SIZE * iterations / (1024 * 1024);
+    for (i = 0; i < ARRAY_SIZE(loads); i++) {
+        for (j = 0; j < nr_pages * PAGE_SIZE; j++) {
+            old[j] = g_test_rand_int_range(0, 256);
+        }
+        memcpy(new, old, nr_pages * PAGE_SIZE);
+        for (j = 0; j < nr_pages; j++) {
+            dirty_page(new + j * PAGE_SIZE, loads[i].nr_runs,
+                       loads[i].max_len);
+        }
+
+        g_test_timer_start();
+        for (k = 0; k < iterations; k++) {
+            for (j = 0; j < nr_pages; j++) {
+                lens[j] = xbzrle_encode_buffer(old + j * PAGE_SIZE,
+                                               new + j * PAGE_SIZE, PAGE_SIZE,
+                                               compressed + j * PAGE_SIZE,
+                                               PAGE_SIZE);
+            }
+        }
+        duration = g_test_timer_elapsed();
+        g_test_message("%-10s encode %8.1f MB/s", loads[i].name,
+                       mbytes / duration);
+
+        g_test_timer_start();
+        for (k = 0; k < iterations; k++) {
+            for (j = 0; j < nr_pages; j++) {
+                g_assert(xbzrle_decode_buffer(compressed + j * PAGE_SIZE,
+                                              lens[j], old + j * PAGE_SIZE,
+                                              PAGE_SIZE) >= 0);
+            }
+        }
+        duration = g_test_timer_elapsed();
+        g_test_message("%-10s decode %8.1f MB/s", loads[i].name,
+                       mbytes / duration);
+        g_assert(memcmp(old, new, nr_pages * PAGE_SIZE) == 0);
+    }
+
+    g_free(old);
+    g_free(new);
+    g_free(compressed);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -191,6 +385,11 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_reference", test_encode_reference);
+    g_test_add_func("/xbzrle/page_cache", test_page_cache);
+    if (g_test_perf()) {
+        g_test_add_func("/xbzrle/perf/encode_decode", perf_encode_decode);
+    }
 
     return g_test_run();
 }
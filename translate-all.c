@@ -37,6 +37,7 @@
 #include "tcg.h"
 #if defined(CONFIG_USER_ONLY)
 #include "qemu.h"
+#include "qemu/interval-tree.h"
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
 #include <sys/param.h>
 #if __FreeBSD_version >= 700104
@@ -54,6 +55,7 @@
 #endif
 #else
 #include "exec/address-spaces.h"
+#include "qmp-commands.h"
 #endif
 
 #include "exec/cputlb.h"
@@ -79,9 +81,6 @@ typedef struct PageDesc {
        of lookups we do to a given page to use a bitmap */
     unsigned int code_write_count;
     uint8_t *code_bitmap;
-#if defined(CONFIG_USER_ONLY)
-    unsigned long flags;
-#endif
 } PageDesc;
 
 /* In system mode we want L1_MAP to be based on ram offsets,
@@ -125,6 +124,8 @@ static void *l1_map[V_L1_SIZE];
 /* code generation context */
 TCGContext tcg_ctx;
 
+static FILE *tb_perf_map_file;
+
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2);
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr);
@@ -156,6 +157,7 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
 #endif
     tcg_func_start(s);
 
+    s->tb_exec_count = tb_counts_exec(tb) ? &tb->exec_count : NULL;
     gen_intermediate_code(env, tb);
 
     /* generate machine code */
@@ -213,6 +215,7 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
 #endif
     tcg_func_start(s);
 
+    s->tb_exec_count = tb_counts_exec(tb) ? &tb->exec_count : NULL;
     gen_intermediate_code_pc(env, tb);
 
     if (use_icount) {
@@ -436,6 +439,187 @@ static inline PageDesc *page_find(tb_page_addr_t index)
     return page_find_alloc(index, 0);
 }
 
+/* Return the first page in [*pindex, last] that holds translated code
+   and store its index in *pindex.  Unallocated parts of l1_map are
+   skipped as a whole.  */
+static PageDesc *page_find_code(tb_page_addr_t *pindex, tb_page_addr_t last)
+{
+    tb_page_addr_t index = *pindex;
+
+    while (index <= last) {
+        void **lp = l1_map + ((index >> V_L1_SHIFT) & (V_L1_SIZE - 1));
+        int shift = V_L1_SHIFT;
+        tb_page_addr_t next;
+        int i;
+
+        for (i = V_L1_SHIFT / V_L2_BITS - 1; i > 0 && *lp; i--) {
+            lp = (void **)*lp + ((index >> (i * V_L2_BITS)) & (V_L2_SIZE - 1));
+            shift = i * V_L2_BITS;
+        }
+
+        if (i == 0 && *lp) {
+            PageDesc *pd = *lp;
+
+            for (; index <= last; index++) {
+                if (pd[index & (V_L2_SIZE - 1)].first_tb) {
+                    *pindex = index;
+                    return pd + (index & (V_L2_SIZE - 1));
+                }
+                if ((index & (V_L2_SIZE - 1)) == V_L2_SIZE - 1) {
+                    break;
+                }
+            }
+            shift = V_L2_BITS;
+        }
+
+        /* Nothing in the rest of the table that covers index */
+        next = (index | (((tb_page_addr_t)1 << shift) - 1)) + 1;
+        if (next == 0) {
+            break;
+        }
+        index = next;
+    }
+    return NULL;
+}
+
+#if defined(CONFIG_USER_ONLY)
+/* The protection of the guest address space, as runs of pages with the
+   same flags.  Unmapped pages are not in the tree.  Adjacent runs with
+   equal flags are merged, so a process has about as many runs as it has
+   mappings and the flags of a range are changed or checked in
+   O(log n).  Protected by mmap_lock.  */
+typedef struct PageFlagsNode {
+    IntervalTreeNode itree;
+    int flags;
+    struct PageFlagsNode *next_free;
+} PageFlagsNode;
+
+static IntervalTreeRoot pageflags_root;
+static PageFlagsNode *pageflags_free_list;
+
+#define PAGEFLAGS_CHUNK 4096
+
+static PageFlagsNode *pageflags_alloc(target_ulong start, target_ulong last,
+                                      int flags)
+{
+    PageFlagsNode *p;
+
+    /* Nodes are also allocated in the SEGV handler; see page_find_alloc
+       for why g_malloc is not used.  */
+    if (!pageflags_free_list) {
+        int i, n = PAGEFLAGS_CHUNK / sizeof(PageFlagsNode);
+
+        p = mmap(NULL, PAGEFLAGS_CHUNK, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            abort();
+        }
+        for (i = 0; i < n; i++) {
+            p[i].next_free = pageflags_free_list;
+            pageflags_free_list = &p[i];
+        }
+    }
+    p = pageflags_free_list;
+    pageflags_free_list = p->next_free;
+
+    p->itree.start = start;
+    p->itree.last = last;
+    p->flags = flags;
+    interval_tree_insert(&p->itree, &pageflags_root);
+    return p;
+}
+
+static void pageflags_free(PageFlagsNode *p)
+{
+    interval_tree_remove(&p->itree, &pageflags_root);
+    p->next_free = pageflags_free_list;
+    pageflags_free_list = p;
+}
+
+static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
+{
+    IntervalTreeNode *n;
+
+    n = interval_tree_iter_first(&pageflags_root, start, last);
+    return n ? container_of(n, PageFlagsNode, itree) : NULL;
+}
+
+static PageFlagsNode *pageflags_next(PageFlagsNode *p, target_ulong start,
+                                     target_ulong last)
+{
+    IntervalTreeNode *n;
+
+    n = interval_tree_iter_next(&p->itree, start, last);
+    return n ? container_of(n, PageFlagsNode, itree) : NULL;
+}
+
+/* Set the flags of the pages in [start, last]; 0 unmaps them.  */
+static void pageflags_set(target_ulong start, target_ulong last, int flags)
+{
+    PageFlagsNode *p;
+
+    p = pageflags_find(start, last);
+    if (p && p->flags == flags &&
+        p->itree.start <= start && p->itree.last >= last) {
+        return;
+    }
+
+    /* Cut the range out of the runs that overlap it */
+    while ((p = pageflags_find(start, last)) != NULL) {
+        target_ulong p_start = p->itree.start;
+        target_ulong p_last = p->itree.last;
+        int p_flags = p->flags;
+
+        pageflags_free(p);
+        if (p_start < start) {
+            pageflags_alloc(p_start, start - 1, p_flags);
+        }
+        if (p_last > last) {
+            pageflags_alloc(last + 1, p_last, p_flags);
+        }
+    }
+
+    if (flags) {
+        if (start != 0) {
+            p = pageflags_find(start - 1, start - 1);
+            if (p && p->flags == flags) {
+                start = p->itree.start;
+                pageflags_free(p);
+            }
+        }
+        if (last + 1 != 0) {
+            p = pageflags_find(last + 1, last + 1);
+            if (p && p->flags == flags) {
+                last = p->itree.last;
+                pageflags_free(p);
+            }
+        }
+        pageflags_alloc(start, last, flags);
+    }
+}
+
+/* Set and clear bits in the flags of the mapped pages in [start, last].  */
+static void pageflags_update(target_ulong start, target_ulong last,
+                             int set, int clear)
+{
+    PageFlagsNode *p;
+
+    while ((p = pageflags_find(start, last)) != NULL) {
+        target_ulong seg_start = MAX(start, p->itree.start);
+        target_ulong seg_last = MIN(last, p->itree.last);
+        int flags = (p->flags & ~clear) | set;
+
+        if (flags != p->flags) {
+            pageflags_set(seg_start, seg_last, flags);
+        }
+        if (seg_last >= last) {
+            break;
+        }
+        start = seg_last + 1;
+    }
+}
+#endif
+
 #if !defined(CONFIG_USER_ONLY)
 #define mmap_lock() do { } while (0)
 #define mmap_unlock() do { } while (0)
@@ -721,6 +905,7 @@ static TranslationBlock *tb_alloc(target_ulong pc)
     tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
     tb->pc = pc;
     tb->cflags = 0;
+    tb->exec_count = 0;
     return tb;
 }
 
@@ -1032,6 +1217,37 @@ static void build_page_bitmap(PageDesc *p)
     }
 }
 
+static void tb_perf_map_close(void)
+{
+    fclose(tb_perf_map_file);
+    tb_perf_map_file = NULL;
+}
+
+/* Describe the host code of a new TB to Linux perf.  The file is opened
+   lazily so that it is named after the pid of a daemonized process.  When
+   the translation buffer is flushed, addresses get reused and newer entries
+   shadow the old ones.  */
+static void tb_perf_map_add(TranslationBlock *tb, int code_gen_size)
+{
+    if (!tb_perf_map_file) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "/tmp/perf-%d.map", (int)getpid());
+        tb_perf_map_file = fopen(name, "w");
+        if (!tb_perf_map_file) {
+            fprintf(stderr, "qemu: could not open %s: %s\n",
+                    name, strerror(errno));
+            tb_perf_map = 0;
+            return;
+        }
+        /* perf may read the map while QEMU runs, or after it crashed */
+        setvbuf(tb_perf_map_file, NULL, _IOLBF, 0);
+        atexit(tb_perf_map_close);
+    }
+    fprintf(tb_perf_map_file, "%" PRIxPTR " %x guest_" TARGET_FMT_lx "\n",
+            (uintptr_t)tb->tc_ptr, code_gen_size, tb->pc);
+}
+
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               int flags, int cflags)
@@ -1057,6 +1273,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     cpu_gen_code(env, tb, &code_gen_size);
+    if (tb_perf_map) {
+        tb_perf_map_add(tb, code_gen_size);
+    }
     tcg_ctx.code_gen_ptr = (void *)(((uintptr_t)tcg_ctx.code_gen_ptr +
             code_gen_size + CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
 
@@ -1080,10 +1299,24 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t end,
                               int is_cpu_write_access)
 {
-    while (start < end) {
-        tb_invalidate_phys_page_range(start, end, is_cpu_write_access);
-        start &= TARGET_PAGE_MASK;
-        start += TARGET_PAGE_SIZE;
+    tb_page_addr_t index, last;
+
+    if (start >= end) {
+        return;
+    }
+
+    /* Only visit the pages that hold code */
+    index = start >> TARGET_PAGE_BITS;
+    last = (end - 1) >> TARGET_PAGE_BITS;
+    while (page_find_code(&index, last)) {
+        tb_page_addr_t addr = index << TARGET_PAGE_BITS;
+
+        tb_invalidate_phys_page_range(MAX(start, addr), end,
+                                      is_cpu_write_access);
+        if (index == last) {
+            break;
+        }
+        index++;
     }
 }
 
@@ -1332,25 +1565,21 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 #if defined(TARGET_HAS_SMC) || 1
 
 #if defined(CONFIG_USER_ONLY)
-    if (p->flags & PAGE_WRITE) {
-        target_ulong addr;
-        PageDesc *p2;
+    if (page_get_flags(page_addr) & PAGE_WRITE) {
+        target_ulong last;
+        PageFlagsNode *p2;
         int prot;
 
         /* force the host page as non writable (writes will have a
            page fault + mprotect overhead) */
         page_addr &= qemu_host_page_mask;
+        last = page_addr + qemu_host_page_size - 1;
         prot = 0;
-        for (addr = page_addr; addr < page_addr + qemu_host_page_size;
-            addr += TARGET_PAGE_SIZE) {
-
-            p2 = page_find(addr >> TARGET_PAGE_BITS);
-            if (!p2) {
-                continue;
-            }
+        for (p2 = pageflags_find(page_addr, last); p2;
+             p2 = pageflags_next(p2, page_addr, last)) {
             prot |= p2->flags;
-            p2->flags &= ~PAGE_WRITE;
-          }
+        }
+        pageflags_update(page_addr, last, 0, PAGE_WRITE);
         mprotect(g2h(page_addr), qemu_host_page_size,
                  (prot & PAGE_BITS) & ~PAGE_WRITE);
 #ifdef DEBUG_TB_INVALIDATE
@@ -1555,7 +1784,9 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
         cpu_abort(cpu, "TB too big during recompile");
     }
 
-    cflags = n | CF_LAST_IO;
+    /* A trace must be retranslated as a trace, or the first n
+       instructions would not be the same.  */
+    cflags = n | CF_LAST_IO | (tb->cflags & CF_TRACE);
     pc = tb->pc;
     cs_base = tb->cs_base;
     flags = tb->flags;
@@ -1649,101 +1880,108 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     tcg_dump_info(f, cpu_fprintf);
 }
 
-#else /* CONFIG_USER_ONLY */
-
-void cpu_interrupt(CPUState *cpu, int mask)
+static int tb_exec_count_cmp(const void *a, const void *b)
 {
-    cpu->interrupt_request |= mask;
-    cpu->tcg_exit_req = 1;
-}
+    const TranslationBlock *tb1 = *(TranslationBlock * const *)a;
+    const TranslationBlock *tb2 = *(TranslationBlock * const *)b;
 
-/*
- * Walks guest process memory "regions" one by one
- * and calls callback function 'fn' for each region.
- */
-struct walk_memory_regions_data {
-    walk_memory_regions_fn fn;
-    void *priv;
-    uintptr_t start;
-    int prot;
-};
-
-static int walk_memory_regions_end(struct walk_memory_regions_data *data,
-                                   abi_ulong end, int new_prot)
-{
-    if (data->start != -1ul) {
-        int rc = data->fn(data->priv, data->start, end, data->prot);
-        if (rc != 0) {
-            return rc;
-        }
+    if (tb1->exec_count != tb2->exec_count) {
+        return tb1->exec_count < tb2->exec_count ? 1 : -1;
     }
+    return tb1 < tb2 ? -1 : tb1 > tb2;
+}
 
-    data->start = (new_prot ? end : -1ul);
-    data->prot = new_prot;
+/* TBs are allocated sequentially in the code buffer, so the host code of
+   a TB extends up to the start of the next one.  */
+static size_t tb_host_size(TranslationBlock *tb)
+{
+    TranslationBlock *tbs = tcg_ctx.tb_ctx.tbs;
+    int i = tb - tbs;
 
-    return 0;
+    if (i + 1 < tcg_ctx.tb_ctx.nb_tbs) {
+        return tbs[i + 1].tc_ptr - tb->tc_ptr;
+    }
+    return tcg_ctx.code_gen_ptr - tb->tc_ptr;
 }
 
-static int walk_memory_regions_1(struct walk_memory_regions_data *data,
-                                 abi_ulong base, int level, void **lp)
+TbHotspotList *qmp_query_tb_hotspots(bool has_count, int64_t count,
+                                     Error **errp)
 {
-    abi_ulong pa;
-    int i, rc;
+    TbHotspotList *head = NULL, **next = &head;
+    TranslationBlock **sorted;
+    int i, nb_tbs = tcg_ctx.tb_ctx.nb_tbs;
 
-    if (*lp == NULL) {
-        return walk_memory_regions_end(data, base, 0);
+    if (!tb_profile) {
+        error_setg(errp, "TB execution counting is disabled, "
+                   "use -tb-profile to enable it");
+        return NULL;
+    }
+    if (!has_count) {
+        count = 20;
     }
 
-    if (level == 0) {
-        PageDesc *pd = *lp;
+    sorted = g_new(TranslationBlock *, nb_tbs);
+    for (i = 0; i < nb_tbs; i++) {
+        sorted[i] = &tcg_ctx.tb_ctx.tbs[i];
+    }
+    qsort(sorted, nb_tbs, sizeof(*sorted), tb_exec_count_cmp);
 
-        for (i = 0; i < V_L2_SIZE; ++i) {
-            int prot = pd[i].flags;
+    for (i = 0; i < nb_tbs && i < count && sorted[i]->exec_count; i++) {
+        TranslationBlock *tb = sorted[i];
+        TbHotspotList *entry = g_new0(TbHotspotList, 1);
 
-            pa = base | (i << TARGET_PAGE_BITS);
-            if (prot != data->prot) {
-                rc = walk_memory_regions_end(data, pa, prot);
-                if (rc != 0) {
-                    return rc;
-                }
-            }
-        }
-    } else {
-        void **pp = *lp;
-
-        for (i = 0; i < V_L2_SIZE; ++i) {
-            pa = base | ((abi_ulong)i <<
-                (TARGET_PAGE_BITS + V_L2_BITS * level));
-            rc = walk_memory_regions_1(data, pa, level - 1, pp + i);
-            if (rc != 0) {
-                return rc;
-            }
-        }
+        entry->value = g_new0(TbHotspot, 1);
+        entry->value->pc = tb->pc;
+        entry->value->guest_size = tb->size;
+        entry->value->host_addr = (uintptr_t)tb->tc_ptr;
+        entry->value->host_size = tb_host_size(tb);
+        entry->value->count = tb->exec_count;
+        *next = entry;
+        next = &entry->next;
     }
+    g_free(sorted);
 
-    return 0;
+    return head;
 }
 
-int walk_memory_regions(void *priv, walk_memory_regions_fn fn)
-{
-    struct walk_memory_regions_data data;
-    uintptr_t i;
+#else /* CONFIG_USER_ONLY */
 
-    data.fn = fn;
-    data.priv = priv;
-    data.start = -1ul;
-    data.prot = 0;
+void cpu_interrupt(CPUState *cpu, int mask)
+{
+    cpu->interrupt_request |= mask;
+    cpu->tcg_exit_req = 1;
+}
 
-    for (i = 0; i < V_L1_SIZE; i++) {
-        int rc = walk_memory_regions_1(&data, (abi_ulong)i << V_L1_SHIFT,
-                                       V_L1_SHIFT / V_L2_BITS - 1, l1_map + i);
+/*
+ * Walks guest process memory "regions" one by one
+ * and calls callback function 'fn' for each region.
+ */
+int walk_memory_regions(void *priv, walk_memory_regions_fn fn)
+{
+    PageFlagsNode *p;
+    target_ulong start = 0, end = 0;
+    int prot = 0, rc = 0;
 
-        if (rc != 0) {
-            return rc;
+    mmap_lock();
+    for (p = pageflags_find(0, -1); p; p = pageflags_next(p, 0, -1)) {
+        if (prot && (p->flags != prot || p->itree.start != end)) {
+            rc = fn(priv, start, end, prot);
+            if (rc != 0) {
+                break;
+            }
+            prot = 0;
+        }
+        if (!prot) {
+            start = p->itree.start;
+            prot = p->flags;
         }
+        end = p->itree.last + 1;
     }
-
-    return walk_memory_regions_end(&data, 0, 0);
+    if (prot && rc == 0) {
+        rc = fn(priv, start, end, prot);
+    }
+    mmap_unlock();
+    return rc;
 }
 
 static int dump_region(void *priv, abi_ulong start,
@@ -1772,13 +2010,14 @@ void page_dump(FILE *f)
 
 int page_get_flags(target_ulong address)
 {
-    PageDesc *p;
+    PageFlagsNode *p;
+    int flags;
 
-    p = page_find(address >> TARGET_PAGE_BITS);
-    if (!p) {
-        return 0;
-    }
-    return p->flags;
+    mmap_lock();
+    p = pageflags_find(address, address);
+    flags = p ? p->flags : 0;
+    mmap_unlock();
+    return flags;
 }
 
 /* Modify the flags of a page and invalidate the code if necessary.
@@ -1786,7 +2025,7 @@ int page_get_flags(target_ulong address)
    on PAGE_WRITE.  The mmap_lock should already be held.  */
 void page_set_flags(target_ulong start, target_ulong end, int flags)
 {
-    target_ulong addr, len;
+    target_ulong last;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -1797,33 +2036,36 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
     assert(start < end);
 
     start = start & TARGET_PAGE_MASK;
-    end = TARGET_PAGE_ALIGN(end);
+    last = TARGET_PAGE_ALIGN(end) - 1;
 
     if (flags & PAGE_WRITE) {
-        flags |= PAGE_WRITE_ORG;
-    }
+        tb_page_addr_t index = start >> TARGET_PAGE_BITS;
 
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        PageDesc *p = page_find_alloc(addr >> TARGET_PAGE_BITS, 1);
+        flags |= PAGE_WRITE_ORG;
 
         /* If the write protection bit is set, then we invalidate
            the code inside.  */
-        if (!(p->flags & PAGE_WRITE) &&
-            (flags & PAGE_WRITE) &&
-            p->first_tb) {
-            tb_invalidate_phys_page(addr, 0, NULL, false);
+        while (page_find_code(&index, last >> TARGET_PAGE_BITS)) {
+            target_ulong addr = (target_ulong)index << TARGET_PAGE_BITS;
+
+            if (!(page_get_flags(addr) & PAGE_WRITE)) {
+                tb_invalidate_phys_page(addr, 0, NULL, false);
+            }
+            if (index == last >> TARGET_PAGE_BITS) {
+                break;
+            }
+            index++;
         }
-        p->flags = flags;
     }
+
+    pageflags_set(start, last, flags);
 }
 
 int page_check_range(target_ulong start, target_ulong len, int flags)
 {
-    PageDesc *p;
-    target_ulong end;
-    target_ulong addr;
+    PageFlagsNode *p;
+    target_ulong last;
+    int ret = 0;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -1835,43 +2077,46 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
     if (len == 0) {
         return 0;
     }
-    if (start + len - 1 < start) {
+    last = start + len - 1;
+    if (last < start) {
         /* We've wrapped around.  */
         return -1;
     }
 
-    /* must do before we loose bits in the next step */
-    end = TARGET_PAGE_ALIGN(start + len);
-    start = start & TARGET_PAGE_MASK;
-
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        p = page_find(addr >> TARGET_PAGE_BITS);
-        if (!p) {
-            return -1;
-        }
-        if (!(p->flags & PAGE_VALID)) {
-            return -1;
+    /* The range usually lies in a single mapping */
+    mmap_lock();
+    for (;;) {
+        p = pageflags_find(start, start);
+        if (!p || !(p->flags & PAGE_VALID)) {
+            ret = -1;
+            break;
         }
-
         if ((flags & PAGE_READ) && !(p->flags & PAGE_READ)) {
-            return -1;
+            ret = -1;
+            break;
         }
         if (flags & PAGE_WRITE) {
             if (!(p->flags & PAGE_WRITE_ORG)) {
-                return -1;
+                ret = -1;
+                break;
             }
             /* unprotect the page if it was put read-only because it
                contains translated code */
             if (!(p->flags & PAGE_WRITE)) {
-                if (!page_unprotect(addr, 0, NULL)) {
-                    return -1;
+                if (!page_unprotect(start, 0, NULL)) {
+                    ret = -1;
+                    break;
                 }
+                continue;
             }
         }
+        if (p->itree.last >= last) {
+            break;
+        }
+        start = p->itree.last + 1;
     }
-    return 0;
+    mmap_unlock();
+    return ret;
 }
 
 /* called from signal handler: invalidate the code and unprotect the
@@ -1879,7 +2124,7 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
 int page_unprotect(target_ulong address, uintptr_t pc, void *puc)
 {
     unsigned int prot;
-    PageDesc *p;
+    PageFlagsNode *p;
     target_ulong host_start, host_end, addr;
 
     /* Technically this isn't safe inside a signal handler.  However we
@@ -1887,7 +2132,7 @@ int page_unprotect(target_ulong address, uintptr_t pc, void *puc)
        practice it seems to be ok.  */
     mmap_lock();
 
-    p = page_find(address >> TARGET_PAGE_BITS);
+    p = pageflags_find(address, address);
     if (!p) {
         mmap_unlock();
         return 0;
@@ -1899,12 +2144,18 @@ int page_unprotect(target_ulong address, uintptr_t pc, void *puc)
         host_start = address & qemu_host_page_mask;
         host_end = host_start + qemu_host_page_size;
 
+        pageflags_update(host_start, host_end - 1, PAGE_WRITE, 0);
         prot = 0;
-        for (addr = host_start ; addr < host_end ; addr += TARGET_PAGE_SIZE) {
-            p = page_find(addr >> TARGET_PAGE_BITS);
-            p->flags |= PAGE_WRITE;
+        for (p = pageflags_find(host_start, host_end - 1); p;
+             p = pageflags_next(p, host_start, host_end - 1)) {
             prot |= p->flags;
+        }
 
+        /* Unprotect first: tb_invalidate_phys_page may not return if it
+           invalidates the TB that is writing.  */
+        mprotect((void *)g2h(host_start), qemu_host_page_size,
+                 prot & PAGE_BITS);
+        for (addr = host_start ; addr < host_end ; addr += TARGET_PAGE_SIZE) {
             /* and since the content will be modified, we must invalidate
                the corresponding translated code. */
             tb_invalidate_phys_page(addr, pc, puc, true);
@@ -1912,8 +2163,6 @@ int page_unprotect(target_ulong address, uintptr_t pc, void *puc)
             tb_invalidate_check(addr);
 #endif
         }
-        mprotect((void *)g2h(host_start), qemu_host_page_size,
-                 prot & PAGE_BITS);
 
         mmap_unlock();
         return 1;
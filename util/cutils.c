@@ -166,6 +166,69 @@ int qemu_fdatasync(int fd)
 #endif
 }
 
+/* The part of buffer_find_nonzero_offset() after the first chunks */
+static size_t find_nonzero_chunk(const VECTYPE *p, size_t len)
+{
+    const VECTYPE zero = (VECTYPE){0};
+    size_t i;
+
+    for (i = BUFFER_FIND_NONZERO_OFFSET_UNROLL_FACTOR;
+         i < len / sizeof(VECTYPE);
+         i += BUFFER_FIND_NONZERO_OFFSET_UNROLL_FACTOR) {
+        VECTYPE tmp0 = p[i + 0] | p[i + 1];
+        VECTYPE tmp1 = p[i + 2] | p[i + 3];
+        VECTYPE tmp2 = p[i + 4] | p[i + 5];
+        VECTYPE tmp3 = p[i + 6] | p[i + 7];
+        VECTYPE tmp01 = tmp0 | tmp1;
+        VECTYPE tmp23 = tmp2 | tmp3;
+        if (!ALL_EQ(tmp01 | tmp23, zero)) {
+            break;
+        }
+    }
+    return i;
+}
+
+#if defined(CONFIG_AVX2_OPT) && defined(__SSE2__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/* The same 128-byte steps, in four 32-byte loads */
+static size_t find_nonzero_chunk_avx2(const VECTYPE *p, size_t len)
+{
+    size_t i;
+
+    for (i = BUFFER_FIND_NONZERO_OFFSET_UNROLL_FACTOR;
+         i < len / sizeof(VECTYPE);
+         i += BUFFER_FIND_NONZERO_OFFSET_UNROLL_FACTOR) {
+        const __m256i *q = (const __m256i *)(p + i);
+        __m256i tmp01 = _mm256_or_si256(_mm256_loadu_si256(q + 0),
+                                        _mm256_loadu_si256(q + 1));
+        __m256i tmp23 = _mm256_or_si256(_mm256_loadu_si256(q + 2),
+                                        _mm256_loadu_si256(q + 3));
+        __m256i tmp = _mm256_or_si256(tmp01, tmp23);
+
+        if (!_mm256_testz_si256(tmp, tmp)) {
+            break;
+        }
+    }
+    return i;
+}
+#pragma GCC pop_options
+#endif
+
+static size_t (*find_nonzero)(const VECTYPE *p, size_t len);
+
+static void __attribute__((constructor)) init_find_nonzero(void)
+{
+    find_nonzero = find_nonzero_chunk;
+#if defined(CONFIG_AVX2_OPT) && defined(__SSE2__)
+    if (__builtin_cpu_supports("avx2")) {
+        find_nonzero = find_nonzero_chunk_avx2;
+    }
+#endif
+}
+
 /*
  * Searches for an area with non-zero content in a buffer
  *
@@ -204,21 +267,7 @@ size_t buffer_find_nonzero_offset(const void *buf, size_t len)
         }
     }
 
-    for (i = BUFFER_FIND_NONZERO_OFFSET_UNROLL_FACTOR;
-         i < len / sizeof(VECTYPE);
-         i += BUFFER_FIND_NONZERO_OFFSET_UNROLL_FACTOR) {
-        VECTYPE tmp0 = p[i + 0] | p[i + 1];
-        VECTYPE tmp1 = p[i + 2] | p[i + 3];
-        VECTYPE tmp2 = p[i + 4] | p[i + 5];
-        VECTYPE tmp3 = p[i + 6] | p[i + 7];
-        VECTYPE tmp01 = tmp0 | tmp1;
-        VECTYPE tmp23 = tmp2 | tmp3;
-        if (!ALL_EQ(tmp01 | tmp23, zero)) {
-            break;
-        }
-    }
-
-    return i * sizeof(VECTYPE);
+    return find_nonzero(p, len) * sizeof(VECTYPE);
 }
 
 /*
@@ -0,0 +1,316 @@
+/*
+ * Interval trees
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include <stddef.h>
+#include "qemu/interval-tree.h"
+
+/* Red-black insertion and removal follow Cormen et al., with NULL
+ * children counting as black leaves.  The subtree_last field is kept
+ * up to date along the path that an insertion or removal touches, and by
+ * the rotations.
+ */
+
+static inline bool is_red(IntervalTreeNode *node)
+{
+    return node && node->red;
+}
+
+static uint64_t compute_subtree_last(IntervalTreeNode *node)
+{
+    uint64_t max = node->last;
+
+    if (node->left && node->left->subtree_last > max) {
+        max = node->left->subtree_last;
+    }
+    if (node->right && node->right->subtree_last > max) {
+        max = node->right->subtree_last;
+    }
+    return max;
+}
+
+static void replace_child(IntervalTreeRoot *root, IntervalTreeNode *parent,
+                          IntervalTreeNode *old, IntervalTreeNode *new)
+{
+    if (!parent) {
+        root->root = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+    if (new) {
+        new->parent = parent;
+    }
+}
+
+static void rotate_left(IntervalTreeRoot *root, IntervalTreeNode *x)
+{
+    IntervalTreeNode *y = x->right;
+
+    x->right = y->left;
+    if (y->left) {
+        y->left->parent = x;
+    }
+    replace_child(root, x->parent, x, y);
+    y->left = x;
+    x->parent = y;
+
+    /* y now covers the subtree that x covered */
+    y->subtree_last = x->subtree_last;
+    x->subtree_last = compute_subtree_last(x);
+}
+
+static void rotate_right(IntervalTreeRoot *root, IntervalTreeNode *x)
+{
+    IntervalTreeNode *y = x->left;
+
+    x->left = y->right;
+    if (y->right) {
+        y->right->parent = x;
+    }
+    replace_child(root, x->parent, x, y);
+    y->right = x;
+    x->parent = y;
+
+    y->subtree_last = x->subtree_last;
+    x->subtree_last = compute_subtree_last(x);
+}
+
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    IntervalTreeNode **link = &root->root;
+    IntervalTreeNode *parent = NULL;
+
+    while (*link) {
+        parent = *link;
+        if (parent->subtree_last < node->last) {
+            parent->subtree_last = node->last;
+        }
+        link = node->start < parent->start ? &parent->left : &parent->right;
+    }
+
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->red = true;
+    node->subtree_last = node->last;
+    *link = node;
+
+    while (is_red(node->parent)) {
+        IntervalTreeNode *gparent = node->parent->parent;
+        IntervalTreeNode *uncle;
+
+        if (node->parent == gparent->left) {
+            uncle = gparent->right;
+            if (is_red(uncle)) {
+                node->parent->red = false;
+                uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == node->parent->right) {
+                node = node->parent;
+                rotate_left(root, node);
+            }
+            node->parent->red = false;
+            gparent->red = true;
+            rotate_right(root, gparent);
+        } else {
+            uncle = gparent->left;
+            if (is_red(uncle)) {
+                node->parent->red = false;
+                uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == node->parent->left) {
+                node = node->parent;
+                rotate_right(root, node);
+            }
+            node->parent->red = false;
+            gparent->red = true;
+            rotate_left(root, gparent);
+        }
+    }
+    root->root->red = false;
+}
+
+/* Restore the red-black properties after a black node was removed from
+ * below @parent; @node, possibly NULL, took its place.
+ */
+static void remove_fixup(IntervalTreeRoot *root, IntervalTreeNode *node,
+                         IntervalTreeNode *parent)
+{
+    IntervalTreeNode *sibling;
+
+    while (node != root->root && !is_red(node)) {
+        if (node == parent->left) {
+            sibling = parent->right;
+            if (is_red(sibling)) {
+                sibling->red = false;
+                parent->red = true;
+                rotate_left(root, parent);
+                sibling = parent->right;
+            }
+            if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!is_red(sibling->right)) {
+                sibling->left->red = false;
+                sibling->red = true;
+                rotate_right(root, sibling);
+                sibling = parent->right;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->right->red = false;
+            rotate_left(root, parent);
+        } else {
+            sibling = parent->left;
+            if (is_red(sibling)) {
+                sibling->red = false;
+                parent->red = true;
+                rotate_right(root, parent);
+                sibling = parent->left;
+            }
+            if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!is_red(sibling->left)) {
+                sibling->right->red = false;
+                sibling->red = true;
+                rotate_left(root, sibling);
+                sibling = parent->left;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->left->red = false;
+            rotate_right(root, parent);
+        }
+        node = root->root;
+    }
+    if (node) {
+        node->red = false;
+    }
+}
+
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    IntervalTreeNode *child, *parent, *n;
+    bool removed_red;
+
+    if (!node->left || !node->right) {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        removed_red = node->red;
+        replace_child(root, parent, node, child);
+    } else {
+        /* Move the successor, which has no left child, into the place
+         * of the node.
+         */
+        IntervalTreeNode *succ = node->right;
+
+        while (succ->left) {
+            succ = succ->left;
+        }
+        child = succ->right;
+        removed_red = succ->red;
+        if (succ->parent == node) {
+            parent = succ;
+        } else {
+            parent = succ->parent;
+            replace_child(root, parent, succ, child);
+            succ->right = node->right;
+            succ->right->parent = succ;
+        }
+        replace_child(root, node->parent, node, succ);
+        succ->left = node->left;
+        succ->left->parent = succ;
+        succ->red = node->red;
+    }
+
+    for (n = parent; n; n = n->parent) {
+        n->subtree_last = compute_subtree_last(n);
+    }
+    if (!removed_red) {
+        remove_fixup(root, child, parent);
+    }
+}
+
+/* Leftmost node of the subtree that overlaps [start, last], given that
+ * start <= node->subtree_last.
+ */
+static IntervalTreeNode *subtree_search(IntervalTreeNode *node,
+                                        uint64_t start, uint64_t last)
+{
+    for (;;) {
+        if (node->left && start <= node->left->subtree_last) {
+            /* Some interval on the left ends after start; the leftmost
+             * of them is the only candidate, since everything to its
+             * right starts later.
+             */
+            node = node->left;
+            continue;
+        }
+        if (node->start > last) {
+            return NULL;
+        }
+        if (start <= node->last) {
+            return node;
+        }
+        node = node->right;
+        if (!node || start > node->subtree_last) {
+            return NULL;
+        }
+    }
+}
+
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last)
+{
+    if (!root->root || start > root->root->subtree_last) {
+        return NULL;
+    }
+    return subtree_search(root->root, start, last);
+}
+
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *right = node->right, *prev;
+
+    for (;;) {
+        /* Everything on the right starts at or after node->start */
+        if (right && start <= right->subtree_last) {
+            return subtree_search(right, start, last);
+        }
+
+        /* Climb until we come up from a left child */
+        do {
+            prev = node;
+            node = node->parent;
+            if (!node) {
+                return NULL;
+            }
+            right = node->right;
+        } while (prev == right);
+
+        if (node->start > last) {
+            return NULL;
+        }
+        if (start <= node->last) {
+            return node;
+        }
+    }
+}
@@ -0,0 +1,123 @@
+/*
+ * Read-copy-update for QEMU
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+
+/* Never 0, which marks a reader outside a critical section.  */
+unsigned long rcu_gp_ctr = 1;
+
+__thread struct rcu_reader_data rcu_reader;
+
+/* Protects the registry and serializes grace periods.  */
+static QemuMutex rcu_registry_lock;
+static QLIST_HEAD(, rcu_reader_data) registry = QLIST_HEAD_INITIALIZER(registry);
+
+static QemuMutex rcu_call_lock;
+static QemuCond rcu_call_cond;
+static struct rcu_head *rcu_call_head;
+static struct rcu_head **rcu_call_tail = &rcu_call_head;
+static bool rcu_call_started;
+static QemuThread rcu_call_thread;
+
+void rcu_register_thread(void)
+{
+    assert(rcu_reader.ctr == 0);
+    qemu_mutex_lock(&rcu_registry_lock);
+    QLIST_INSERT_HEAD(&registry, &rcu_reader, node);
+    qemu_mutex_unlock(&rcu_registry_lock);
+}
+
+void rcu_unregister_thread(void)
+{
+    assert(rcu_reader.depth == 0);
+    qemu_mutex_lock(&rcu_registry_lock);
+    QLIST_REMOVE(&rcu_reader, node);
+    qemu_mutex_unlock(&rcu_registry_lock);
+}
+
+void synchronize_rcu(void)
+{
+    struct rcu_reader_data *r;
+    unsigned long gp, ctr;
+
+    assert(rcu_reader.depth == 0);
+    qemu_mutex_lock(&rcu_registry_lock);
+
+    /* Order the writer's updates before the new grace period.  Readers
+     * that start after this point see the updates; wait for the others.
+     */
+    gp = rcu_gp_ctr + 1;
+    if (gp == 0) {
+        gp = 1;
+    }
+    atomic_mb_set(&rcu_gp_ctr, gp);
+
+again:
+    QLIST_FOREACH(r, &registry, node) {
+        ctr = atomic_read(&r->ctr);
+        if (ctr != 0 && ctr != gp) {
+            qemu_mutex_unlock(&rcu_registry_lock);
+            g_usleep(10);
+            qemu_mutex_lock(&rcu_registry_lock);
+            goto again;
+        }
+    }
+
+    smp_mb();
+    qemu_mutex_unlock(&rcu_registry_lock);
+}
+
+static void *call_rcu_thread(void *opaque)
+{
+    struct rcu_head *head, *next;
+
+    for (;;) {
+        qemu_mutex_lock(&rcu_call_lock);
+        while (!rcu_call_head) {
+            qemu_cond_wait(&rcu_call_cond, &rcu_call_lock);
+        }
+        head = rcu_call_head;
+        rcu_call_head = NULL;
+        rcu_call_tail = &rcu_call_head;
+        qemu_mutex_unlock(&rcu_call_lock);
+
+        synchronize_rcu();
+        for (; head; head = next) {
+            next = head->next;
+            head->func(head);
+        }
+    }
+    return NULL;
+}
+
+void call_rcu1(struct rcu_head *head, RCUCBFunc *func)
+{
+    head->func = func;
+    head->next = NULL;
+
+    qemu_mutex_lock(&rcu_call_lock);
+    if (!rcu_call_started) {
+        rcu_call_started = true;
+        qemu_thread_create(&rcu_call_thread, "call_rcu", call_rcu_thread,
+                           NULL, QEMU_THREAD_DETACHED);
+    }
+    *rcu_call_tail = head;
+    rcu_call_tail = &head->next;
+    qemu_cond_signal(&rcu_call_cond);
+    qemu_mutex_unlock(&rcu_call_lock);
+}
+
+static void __attribute__((__constructor__)) rcu_init(void)
+{
+    qemu_mutex_init(&rcu_registry_lock);
+    qemu_mutex_init(&rcu_call_lock);
+    qemu_cond_init(&rcu_call_cond);
+    rcu_register_thread();
+}
@@ -152,6 +152,9 @@ CharDriverState *virtcon_hds[MAX_VIRTIO_CONSOLES];
 CharDriverState *sclp_hds[MAX_SCLP_CONSOLES];
 int win2k_install_hack = 0;
 int singlestep = 0;
+int tb_profile = 0;
+int tb_perf_map = 0;
+unsigned int tb_trace_threshold = 0;
 int smp_cpus = 1;
 int max_cpus = 0;
 int smp_cores = 1;
@@ -196,6 +199,7 @@ static QTAILQ_HEAD(, FWBootEntry) fw_boot_order =
 
 int nb_numa_nodes;
 uint64_t node_mem[MAX_NODES];
+int node_host[MAX_NODES];
 unsigned long *node_cpumask[MAX_NODES];
 
 uint8_t qemu_uuid[16];
@@ -370,6 +374,10 @@ static QemuOptsList qemu_machine_opts = {
             .name = "mem-merge",
             .type = QEMU_OPT_BOOL,
             .help = "enable/disable memory merge support",
+        },{
+            .name = "mem-thp",
+            .type = QEMU_OPT_BOOL,
+            .help = "enable/disable transparent huge pages for guest memory",
         },{
             .name = "usb",
             .type = QEMU_OPT_BOOL,
@@ -1356,6 +1364,16 @@ static void numa_add(const char *optarg)
         if (get_param_value(option, 128, "cpus", optarg) != 0) {
             numa_node_parse_cpus(nodenr, option);
         }
+        if (get_param_value(option, 128, "hostnode", optarg) != 0) {
+            unsigned long long hostnode;
+
+            if (parse_uint_full(option, &hostnode, 10) < 0 ||
+                hostnode >= MAX_NODES) {
+                fprintf(stderr, "qemu: invalid NUMA hostnode: %s\n", option);
+                exit(1);
+            }
+            node_host[nodenr] = hostnode;
+        }
         nb_numa_nodes++;
     } else {
         fprintf(stderr, "Invalid -numa option: %s\n", option);
@@ -2968,6 +2986,8 @@ int main(int argc, char **argv, char **envp)
     int optind;
     const char *optarg;
     const char *loadvm = NULL;
+    const char *loadvm_file = NULL;
+    bool loadvm_template = false;
     MachineClass *machine_class;
     const char *cpu_model;
     const char *vga_model = NULL;
@@ -3045,6 +3065,7 @@ int main(int argc, char **argv, char **envp)
 
     for (i = 0; i < MAX_NODES; i++) {
         node_mem[i] = 0;
+        node_host[i] = -1;
         node_cpumask[i] = bitmap_new(MAX_CPUMASK_BITS);
     }
 
@@ -3405,6 +3426,25 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_singlestep:
                 singlestep = 1;
                 break;
+            case QEMU_OPTION_tb_profile:
+                tb_profile = 1;
+                break;
+            case QEMU_OPTION_perfmap:
+                tb_perf_map = 1;
+                break;
+            case QEMU_OPTION_tb_trace:
+                {
+                    unsigned long long threshold;
+
+                    if (parse_uint_full(optarg, &threshold, 0) < 0 ||
+                        threshold == 0 || threshold > UINT_MAX) {
+                        fprintf(stderr, "qemu: invalid -tb-trace threshold "
+                                "'%s'\n", optarg);
+                        exit(1);
+                    }
+                    tb_trace_threshold = threshold;
+                }
+                break;
             case QEMU_OPTION_S:
                 autostart = 0;
                 break;
@@ -3617,6 +3657,14 @@ int main(int argc, char **argv, char **envp)
 	    case QEMU_OPTION_loadvm:
 		loadvm = optarg;
 		break;
+            case QEMU_OPTION_loadvm_file:
+                loadvm_file = optarg;
+                loadvm_template = false;
+                break;
+            case QEMU_OPTION_loadvm_template:
+                loadvm_file = optarg;
+                loadvm_template = true;
+                break;
             case QEMU_OPTION_full_screen:
                 full_screen = 1;
                 break;
@@ -4540,6 +4588,11 @@ int main(int argc, char **argv, char **envp)
             autostart = 0;
         }
     }
+    if (loadvm_file) {
+        if (load_vmstate_file(loadvm_file, loadvm_template) < 0) {
+            autostart = 0;
+        }
+    }
 
     if (incoming) {
         Error *local_err = NULL;
@@ -12,6 +12,7 @@
  */
 #include "qemu-common.h"
 #include "include/migration/migration.h"
+#include "qemu/host-utils.h"
 
 /*
   page = zrun nzrun
@@ -23,13 +24,147 @@
 
   length = uleb128 encoded integer
  */
+
+/* The encoder spends its time looking for the end of the runs: the first
+ * byte from @i that differs between @a and @b, or the first one that
+ * matches.  Both return @n if there is none.
+ */
+static int find_diff_long(const uint8_t *a, const uint8_t *b, int i, int n)
+{
+    /* not aligned to sizeof(long) */
+    while (i < n && (i % sizeof(long)) && a[i] == b[i]) {
+        i++;
+    }
+    /* word at a time for speed */
+    if (!(i % sizeof(long))) {
+        while (i < n && *(long *)(a + i) == *(long *)(b + i)) {
+            i += sizeof(long);
+        }
+    }
+    while (i < n && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int find_same_long(const uint8_t *a, const uint8_t *b, int i, int n)
+{
+    /* truncation to 32-bit long okay */
+    unsigned long mask = (unsigned long)0x0101010101010101ULL;
+
+    while (i < n && (i % sizeof(long)) && a[i] != b[i]) {
+        i++;
+    }
+    if (!(i % sizeof(long))) {
+        while (i < n) {
+            unsigned long xor = *(unsigned long *)(a + i) ^
+                                *(unsigned long *)(b + i);
+
+            /* a zero byte in xor ends the nzrun within this long */
+            if ((xor - mask) & ~xor & (mask << 7)) {
+                break;
+            }
+            i += sizeof(long);
+        }
+    }
+    while (i < n && a[i] != b[i]) {
+        i++;
+    }
+    return i;
+}
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+static int find_diff_sse2(const uint8_t *a, const uint8_t *b, int i, int n)
+{
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        uint32_t eq = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+
+        if (eq != 0xffff) {
+            return i + ctz32(~eq);
+        }
+    }
+    return find_diff_long(a, b, i, n);
+}
+
+static int find_same_sse2(const uint8_t *a, const uint8_t *b, int i, int n)
+{
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        uint32_t eq = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+
+        if (eq) {
+            return i + ctz32(eq);
+        }
+    }
+    return find_same_long(a, b, i, n);
+}
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static int find_diff_avx2(const uint8_t *a, const uint8_t *b, int i, int n)
+{
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+        if (eq != 0xffffffff) {
+            return i + ctz32(~eq);
+        }
+    }
+    return find_diff_long(a, b, i, n);
+}
+
+static int find_same_avx2(const uint8_t *a, const uint8_t *b, int i, int n)
+{
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+        if (eq) {
+            return i + ctz32(eq);
+        }
+    }
+    return find_same_long(a, b, i, n);
+}
+#pragma GCC pop_options
+#endif
+
+static int (*find_diff)(const uint8_t *a, const uint8_t *b, int i, int n);
+static int (*find_same)(const uint8_t *a, const uint8_t *b, int i, int n);
+
+static void __attribute__((constructor)) init_find_runs(void)
+{
+#if defined(__SSE2__)
+    find_diff = find_diff_sse2;
+    find_same = find_same_sse2;
+#else
+    find_diff = find_diff_long;
+    find_same = find_same_long;
+#endif
+#ifdef CONFIG_AVX2_OPT
+    if (__builtin_cpu_supports("avx2")) {
+        find_diff = find_diff_avx2;
+        find_same = find_same_avx2;
+    }
+#endif
+}
+
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen)
 {
-    uint32_t zrun_len = 0, nzrun_len = 0;
-    int d = 0, i = 0;
-    long res;
-    uint8_t *nzrun_start = NULL;
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, start;
 
     g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
                sizeof(long)));
@@ -40,28 +175,9 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
             return -1;
         }
 
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] == new_buf[i]) {
-            zrun_len++;
-            i++;
-            res--;
-        }
-
-        /* word at a time for speed */
-        if (!res) {
-            while (i < slen &&
-                   (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
-                i += sizeof(long);
-                zrun_len += sizeof(long);
-            }
-
-            /* go over the rest */
-            while (i < slen && old_buf[i] == new_buf[i]) {
-                zrun_len++;
-                i++;
-            }
-        }
+        start = i;
+        i = find_diff(old_buf, new_buf, i, slen);
+        zrun_len = i - start;
 
         /* buffer unchanged */
         if (zrun_len == slen) {
@@ -75,51 +191,22 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
         d += uleb128_encode_small(dst + d, zrun_len);
 
-        zrun_len = 0;
-        nzrun_start = new_buf + i;
-
         /* overflow */
         if (d + 2 > dlen) {
             return -1;
         }
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] != new_buf[i]) {
-            i++;
-            nzrun_len++;
-            res--;
-        }
-
-        /* word at a time for speed, use of 32-bit long okay */
-        if (!res) {
-            /* truncation to 32-bit long okay */
-            unsigned long mask = (unsigned long)0x0101010101010101ULL;
-            while (i < slen) {
-                unsigned long xor;
-                xor = *(unsigned long *)(old_buf + i)
-                    ^ *(unsigned long *)(new_buf + i);
-                if ((xor - mask) & ~xor & (mask << 7)) {
-                    /* found the end of an nzrun within the current long */
-                    while (old_buf[i] != new_buf[i]) {
-                        nzrun_len++;
-                        i++;
-                    }
-                    break;
-                } else {
-                    i += sizeof(long);
-                    nzrun_len += sizeof(long);
-                }
-            }
-        }
+
+        start = i;
+        i = find_same(old_buf, new_buf, i, slen);
+        nzrun_len = i - start;
 
         d += uleb128_encode_small(dst + d, nzrun_len);
         /* overflow */
         if (d + nzrun_len > dlen) {
             return -1;
         }
-        memcpy(dst + d, nzrun_start, nzrun_len);
+        memcpy(dst + d, new_buf + start, nzrun_len);
         d += nzrun_len;
-        nzrun_len = 0;
     }
 
     return d;